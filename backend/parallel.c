@@ -13,6 +13,7 @@
  *
  *   main()         - Send a file to the specified parallel port.
  *   drain_output() - Drain pending print data to the device.
+ *   get_time()     - Get the current time in seconds.
  *   list_devices() - List all parallel devices.
  *   run_loop()     - Read and write print and back-channel data.
  *   side_cb()      - Handle side-channel requests...
@@ -26,18 +27,30 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/socket.h>
 
 
+/*
+ * Constants...
+ */
+
+#define PRINT_BUFFER_SIZE	65536	/* Size of print data buffer */
+
+
 /*
  * Local functions...
  */
 
-static int	drain_output(int print_fd, int device_fd);
+static int	drain_output(int print_fd, int device_fd, char **pending,
+		             ssize_t *pending_bytes);
+static double	get_time(void);
 static void	list_devices(void);
 static ssize_t	run_loop(int print_fd, int device_fd, int use_bc,
 		         int update_state);
-static int	side_cb(int print_fd, int device_fd, int use_bc);
+static int	side_cb(int print_fd, int device_fd, char **print_ptr,
+		        ssize_t *print_bytes, int use_bc);
 
 
 /*
@@ -274,26 +287,31 @@ main(int  argc,				/* I - Number of command-line arguments (6 or 7) */
 
 /*
  * 'drain_output()' - Drain pending print data to the device.
+ *
+ * Any print data already read into the caller's buffer is written first,
+ * so that it is not sent after data that is read here.
  */
 
 static int				/* O - 0 on success, -1 on error */
-drain_output(int print_fd,		/* I - Print file descriptor */
-             int device_fd)		/* I - Device file descriptor */
+drain_output(int     print_fd,		/* I  - Print file descriptor */
+             int     device_fd,		/* I  - Device file descriptor */
+             char    **pending,		/* IO - Buffered print data */
+             ssize_t *pending_bytes)	/* IO - Bytes of buffered print data */
 {
-  int		nfds;			/* Maximum file descriptor value + 1 */
-  fd_set	input;			/* Input set for reading */
+  struct pollfd	pfd;			/* Poll descriptor for print data */
   ssize_t	print_bytes,		/* Print bytes read */
 		bytes;			/* Bytes written */
   char		print_buffer[8192],	/* Print data buffer */
 		*print_ptr;		/* Pointer into print data buffer */
-  struct timeval timeout;		/* Timeout for read... */
 
 
  /*
-  * Figure out the maximum file descriptor value to use with select()...
+  * Take over the print data the caller has already buffered...
   */
 
-  nfds = (print_fd > device_fd ? print_fd : device_fd) + 1;
+  print_ptr      = *pending;
+  print_bytes    = *pending_bytes;
+  *pending_bytes = 0;
 
  /*
   * Now loop until we are out of data from print_fd...
@@ -302,19 +320,44 @@ drain_output(int print_fd,		/* I - Print file descriptor */
   for (;;)
   {
    /*
-    * Use select() to determine whether we have data to copy around...
+    * Write what we have before reading more...
     */
 
-    FD_ZERO(&input);
-    FD_SET(print_fd, &input);
+    while (print_bytes > 0)
+    {
+      if ((bytes = write(device_fd, print_ptr, print_bytes)) < 0)
+      {
+       /*
+        * Write error - bail if we don't see an error we can retry...
+	*/
+
+        if (errno != ENOSPC && errno != ENXIO && errno != EAGAIN &&
+	    errno != EINTR && errno != ENOTTY)
+	{
+	  perror("ERROR: Unable to write print data");
+	  return (-1);
+	}
+      }
+      else
+      {
+        fprintf(stderr, "DEBUG: Wrote %d bytes of print data.\n", (int)bytes);
+
+        print_bytes -= bytes;
+	print_ptr   += bytes;
+      }
+    }
+
+   /*
+    * Use poll() to determine whether we have data to copy around...
+    */
 
-    timeout.tv_sec  = 0;
-    timeout.tv_usec = 0;
+    pfd.fd     = print_fd;
+    pfd.events = POLLIN;
 
-    if (select(nfds, &input, NULL, NULL, &timeout) < 0)
+    if (poll(&pfd, 1, 0) < 0)
       return (-1);
 
-    if (!FD_ISSET(print_fd, &input))
+    if (!pfd.revents)
       return (0);
 
     if ((print_bytes = read(print_fd, print_buffer,
@@ -344,30 +387,24 @@ drain_output(int print_fd,		/* I - Print file descriptor */
     fprintf(stderr, "DEBUG: Read %d bytes of print data.\n",
 	    (int)print_bytes);
 
-    for (print_ptr = print_buffer; print_bytes > 0;)
-    {
-      if ((bytes = write(device_fd, print_ptr, print_bytes)) < 0)
-      {
-       /*
-        * Write error - bail if we don't see an error we can retry...
-	*/
+    print_ptr = print_buffer;
+  }
+}
 
-        if (errno != ENOSPC && errno != ENXIO && errno != EAGAIN &&
-	    errno != EINTR && errno != ENOTTY)
-	{
-	  perror("ERROR: Unable to write print data");
-	  return (-1);
-	}
-      }
-      else
-      {
-        fprintf(stderr, "DEBUG: Wrote %d bytes of print data.\n", (int)bytes);
 
-        print_bytes -= bytes;
-	print_ptr   += bytes;
-      }
-    }
-  }
+/*
+ * 'get_time()' - Get the current time in seconds.
+ */
+
+static double				/* O - Time in seconds */
+get_time(void)
+{
+  struct timespec	ts;		/* Monotonic clock */
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
 }
 
 
@@ -541,19 +578,24 @@ run_loop(int print_fd,			/* I - Print file descriptor */
 	int use_bc,			/* I - Use back-channel? */
 	int update_state)		/* I - Update printer-state-reasons? */
 {
-  int		nfds;			/* Maximum file descriptor value + 1 */
-  fd_set	input,			/* Input set for reading */
-		output;			/* Output set for writing */
+  struct pollfd	pfds[3];		/* Print, device, and side-channel */
   ssize_t	print_bytes,		/* Print bytes read */
 		bc_bytes,		/* Backchannel bytes read */
 		total_bytes,		/* Total bytes written */
 		bytes;			/* Bytes written */
+  int		print_eof,		/* Saw EOF on print file? */
+		print_ready,		/* Print data ready to splice? */
+		use_splice;		/* Splice print data to the device? */
+  double	start_time,		/* Time we started sending */
+		poll_time,		/* Time we started waiting */
+		stall_time,		/* Time spent waiting for the device */
+		elapsed;		/* Time sending took */
   int		paperout;		/* "Paper out" status */
   int		offline;		/* "Off-line" status */
-  char		print_buffer[8192],	/* Print data buffer */
-		*print_ptr,		/* Pointer into print data buffer */
+  static char	print_buffer[PRINT_BUFFER_SIZE];
+					/* Print data buffer */
+  char		*print_ptr,		/* Pointer into print data buffer */
 		bc_buffer[1024];	/* Back-channel data buffer */
-  struct timeval timeout;		/* Timeout for select() */
   int           sc_ok;                  /* Flag a side channel error and
 					   stop using the side channel
 					   in such a case. */
@@ -592,46 +634,64 @@ run_loop(int print_fd,			/* I - Print file descriptor */
     print_fd = 0;
   }
 
- /*
-  * Figure out the maximum file descriptor value to use with select()...
-  */
-
-  nfds = (print_fd > device_fd ? print_fd : device_fd) + 1;
-
-
  /*
   * Side channel is OK...
   */
 
   sc_ok = 1;
 
+#ifdef SPLICE_F_MOVE
+  use_splice = 1;
+#else
+  use_splice = 0;
+#endif /* SPLICE_F_MOVE */
+
+  start_time = get_time();
+  stall_time = 0.0;
+
  /*
-  * Now loop until we are out of data from print_fd...
+  * Now loop until we are out of data from print_fd...  Print data is read
+  * ahead into a large buffer while the device is busy, and when the print
+  * data comes from a pipe and the device supports it, it is spliced to the
+  * device without copying it...
   */
 
-  for (print_bytes = 0, print_ptr = print_buffer, offline = -1,
-           paperout = -1, total_bytes = 0;;)
+  for (print_bytes = 0, print_ptr = print_buffer, print_eof = 0,
+           print_ready = 0, offline = -1, paperout = -1, total_bytes = 0;
+       !print_eof || print_bytes;)
   {
    /*
-    * Use select() to determine whether we have data to copy around...
+    * Use poll() to determine whether we have data to copy around...
     */
 
-    FD_ZERO(&input);
     if (!print_bytes)
-      FD_SET(print_fd, &input);
-    if (use_bc)
-      FD_SET(device_fd, &input);
-    if (!print_bytes && sc_ok)
-      FD_SET(CUPS_SC_FD, &input);
-
-    FD_ZERO(&output);
-    if (print_bytes)
-      FD_SET(device_fd, &output);
-
-    timeout.tv_sec  = 5;
-    timeout.tv_usec = 0;
+      print_ptr = print_buffer;
 
-    if (select(nfds, &input, &output, NULL, &timeout) < 0)
+    pfds[0].fd      = -1;		/* Negative fds are not polled */
+    pfds[0].events  = POLLIN;
+    pfds[0].revents = 0;
+    pfds[1].fd      = -1;
+    pfds[1].events  = use_bc ? POLLIN : 0;
+    pfds[1].revents = 0;
+    pfds[2].fd      = -1;
+    pfds[2].events  = POLLIN;
+    pfds[2].revents = 0;
+
+    if (!print_eof && !print_ready &&
+        (use_splice ? !print_bytes :
+	              print_ptr + print_bytes <
+		          print_buffer + sizeof(print_buffer)))
+      pfds[0].fd = print_fd;
+    if (print_bytes || print_ready)
+      pfds[1].events |= POLLOUT;
+    if (pfds[1].events)
+      pfds[1].fd = device_fd;
+    if (sc_ok)
+      pfds[2].fd = CUPS_SC_FD;
+
+    poll_time = get_time();
+
+    if (poll(pfds, 3, 5000) < 0)
     {
      /*
       * Pause printing to clear any pending errors...
@@ -653,23 +713,28 @@ run_loop(int print_fd,			/* I - Print file descriptor */
       continue;
     }
 
+    if (pfds[1].events & POLLOUT)
+      stall_time += get_time() - poll_time;
+
    /*
     * Check if we have a side-channel request ready...
     */
 
-    if (sc_ok && FD_ISSET(CUPS_SC_FD, &input))
+    if (pfds[2].revents)
     {
      /*
-      * Do the side-channel request, then start back over in the select
-      * loop since it may have read from print_fd...
+      * Do the side-channel request, then start back over in the poll
+      * loop since it may have written the buffered print data and read
+      * from print_fd...
       *
       * If the side channel processing errors, go straight on to avoid
       * blocking of the backend by side channel problems, deactivate the side
       * channel.
       */
 
-      if (side_cb(print_fd, device_fd, use_bc))
+      if (side_cb(print_fd, device_fd, &print_ptr, &print_bytes, use_bc))
 	sc_ok = 0;
+      print_ready = 0;
       continue;
     }
 
@@ -677,7 +742,7 @@ run_loop(int print_fd,			/* I - Print file descriptor */
     * Check if we have back-channel data ready...
     */
 
-    if (FD_ISSET(device_fd, &input))
+    if (use_bc && (pfds[1].revents & (POLLIN | POLLHUP | POLLERR)))
     {
       if ((bc_bytes = read(device_fd, bc_buffer, sizeof(bc_buffer))) > 0)
       {
@@ -698,10 +763,13 @@ run_loop(int print_fd,			/* I - Print file descriptor */
     * Check if we have print data ready...
     */
 
-    if (FD_ISSET(print_fd, &input))
+    if (pfds[0].revents)
     {
-      if ((print_bytes = read(print_fd, print_buffer,
-                              sizeof(print_buffer))) < 0)
+      if (use_splice)
+        print_ready = 1;
+      else if ((bytes = read(print_fd, print_ptr + print_bytes,
+                             print_buffer + sizeof(print_buffer) -
+			         print_ptr - print_bytes)) < 0)
       {
        /*
         * Read error - bail if we don't see EAGAIN or EINTR...
@@ -712,22 +780,17 @@ run_loop(int print_fd,			/* I - Print file descriptor */
 	  perror("ERROR: Unable to read print data");
 	  return (-1);
 	}
-
-        print_bytes = 0;
       }
-      else if (print_bytes == 0)
+      else if (bytes == 0)
       {
        /*
-        * End of file, break out of the loop...
+        * End of file, finish writing what we have...
 	*/
 
-        break;
+        print_eof = 1;
       }
-
-      print_ptr = print_buffer;
-
-      fprintf(stderr, "DEBUG: Read %d bytes of print data.\n",
-              (int)print_bytes);
+      else
+        print_bytes += bytes;
     }
 
    /*
@@ -735,9 +798,33 @@ run_loop(int print_fd,			/* I - Print file descriptor */
     * send...
     */
 
-    if (print_bytes && FD_ISSET(device_fd, &output))
+    if ((print_bytes || print_ready) && (pfds[1].revents & POLLOUT))
     {
-      if ((bytes = write(device_fd, print_ptr, print_bytes)) < 0)
+#ifdef SPLICE_F_MOVE
+      if (print_ready)
+      {
+        print_ready = 0;
+
+        if ((bytes = splice(print_fd, NULL, device_fd, NULL,
+	                    sizeof(print_buffer),
+			    SPLICE_F_MOVE | SPLICE_F_MORE)) == 0)
+	  print_eof = 1;
+	else if (bytes < 0 && (errno == EINVAL || errno == ENOSYS))
+	{
+	 /*
+	  * Not a pipe or the device can't do it, copy the data...
+	  */
+
+	  fputs("DEBUG: Unable to splice print data, copying it.\n", stderr);
+	  use_splice = 0;
+	  continue;
+	}
+      }
+      else
+#endif /* SPLICE_F_MOVE */
+      bytes = write(device_fd, print_ptr, print_bytes);
+
+      if (bytes < 0)
       {
        /*
         * Write error - bail if we don't see an error we can retry...
@@ -779,15 +866,28 @@ run_loop(int print_fd,			/* I - Print file descriptor */
 	  offline = 0;
 	}
 
-        fprintf(stderr, "DEBUG: Wrote %d bytes of print data...\n", (int)bytes);
+        if (print_bytes)
+	{
+          print_bytes -= bytes;
+	  print_ptr   += bytes;
+	}
 
-        print_bytes -= bytes;
-	print_ptr   += bytes;
 	total_bytes += bytes;
       }
     }
   }
 
+ /*
+  * Tell how fast the data went out...
+  */
+
+  elapsed = get_time() - start_time;
+
+  fprintf(stderr,
+          "DEBUG: Sent %ld bytes in %.3f seconds (%.0f bytes/sec), "
+	  "%.3f seconds waiting for the device.\n", (long)total_bytes,
+	  elapsed, elapsed > 0.0 ? total_bytes / elapsed : 0.0, stall_time);
+
  /*
   * Return with success...
   */
@@ -801,9 +901,11 @@ run_loop(int print_fd,			/* I - Print file descriptor */
  */
 
 static int				/* O - 0 on success, -1 on error */
-side_cb(int         print_fd,		/* I - Print file */
-        int         device_fd,		/* I - Device file */
-	int         use_bc)		/* I - Using back-channel? */
+side_cb(int         print_fd,		/* I  - Print file */
+        int         device_fd,		/* I  - Device file */
+        char        **print_ptr,	/* IO - Buffered print data */
+        ssize_t     *print_bytes,	/* IO - Bytes of buffered print data */
+	int         use_bc)		/* I  - Using back-channel? */
 {
   cups_sc_command_t	command;	/* Request command */
   cups_sc_status_t	status;		/* Request/response status */
@@ -819,7 +921,7 @@ side_cb(int         print_fd,		/* I - Print file */
   switch (command)
   {
     case CUPS_SC_CMD_DRAIN_OUTPUT :
-        if (drain_output(print_fd, device_fd))
+        if (drain_output(print_fd, device_fd, print_ptr, print_bytes))
 	  status = CUPS_SC_STATUS_IO_ERROR;
 	else if (tcdrain(device_fd))
 	  status = CUPS_SC_STATUS_IO_ERROR;
@@ -12,6 +12,8 @@
  * Contents:
  *
  *   main()         - Send a file to the printer or server.
+ *   drain_output() - Drain pending print data to the device.
+ *   get_time()     - Get the current time in seconds.
  *   list_devices() - List all serial devices.
  *   side_cb()      - Handle side-channel requests...
  */
@@ -26,7 +28,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <termios.h>
-#include <sys/select.h>
+#include <poll.h>
+#include <time.h>
 #ifdef HAVE_SYS_IOCTL_H
 #  include <sys/ioctl.h>
 #endif /* HAVE_SYS_IOCTL_H */
@@ -52,13 +55,23 @@
 #endif /* __linux && TIOCGSERIAL */
 
 
+/*
+ * Constants...
+ */
+
+#define PRINT_BUFFER_SIZE	65536	/* Size of print data buffer */
+
+
 /*
  * Local functions...
  */
 
-static int	drain_output(int print_fd, int device_fd);
+static int	drain_output(int print_fd, int device_fd, char **pending,
+		             ssize_t *pending_bytes);
+static double	get_time(void);
 static void	list_devices(void);
-static int	side_cb(int print_fd, int device_fd, int use_bc);
+static int	side_cb(int print_fd, int device_fd, char **print_ptr,
+		        ssize_t *print_bytes, int use_bc);
 
 
 /*
@@ -86,17 +99,24 @@ main(int  argc,				/* I - Number of command-line arguments (6 or 7) */
   int		side_eof = 0,		/* Saw EOF on side-channel? */
 		print_fd,		/* Print file */
 		device_fd;		/* Serial device */
-  int		nfds;			/* Maximum file descriptor value + 1 */
-  fd_set	input,			/* Input set for reading */
-		output;			/* Output set for writing */
+  struct pollfd	pfds[3];		/* Print, device, and side-channel */
   ssize_t	print_bytes,		/* Print bytes read */
 		bc_bytes,		/* Backchannel bytes read */
+		copy_bytes,		/* Bytes written for this copy */
 		total_bytes,		/* Total bytes written */
 		bytes;			/* Bytes written */
+  int		print_eof,		/* Saw EOF on print file? */
+		print_ready,		/* Print data ready to splice? */
+		use_splice;		/* Splice print data to the device? */
+  double	start_time,		/* Time the copy started */
+		poll_time,		/* Time we started waiting */
+		stall_time,		/* Time spent waiting for the device */
+		elapsed;		/* Time the copy took */
   int		dtrdsr;			/* Do dtr/dsr flow control? */
   int		print_size;		/* Size of output buffer for writes */
-  char		print_buffer[8192],	/* Print data buffer */
-		*print_ptr,		/* Pointer into print data buffer */
+  static char	print_buffer[PRINT_BUFFER_SIZE];
+					/* Print data buffer */
+  char		*print_ptr,		/* Pointer into print data buffer */
 		bc_buffer[1024];	/* Back-channel data buffer */
   struct termios opts;			/* Serial port options */
   struct termios origopts;		/* Original port options */
@@ -483,22 +503,26 @@ main(int  argc,				/* I - Number of command-line arguments (6 or 7) */
 #endif /* HAVE_SIGSET */
   }
 
- /*
-  * Figure out the maximum file descriptor value to use with select()...
-  */
-
-  nfds = (print_fd > device_fd ? print_fd : device_fd) + 1;
-
  /*
   * Finally, send the print file.  Ordinarily we would just use the
   * backendRunLoop() function, however since we need to use smaller
   * writes and may need to do DSR/DTR flow control, we duplicate much
   * of the code here instead...
+  *
+  * Print data is read ahead into a large buffer while the device is
+  * busy, and when the print data comes from a pipe and the device
+  * supports it, it is spliced to the device without copying it...
   */
 
   if (print_size > sizeof(print_buffer))
     print_size = sizeof(print_buffer);
 
+#ifdef SPLICE_F_MOVE
+  use_splice = 1;
+#else
+  use_splice = 0;
+#endif /* SPLICE_F_MOVE */
+
   total_bytes = 0;
 
   while (copies > 0)
@@ -511,43 +535,67 @@ main(int  argc,				/* I - Number of command-line arguments (6 or 7) */
       lseek(print_fd, 0, SEEK_SET);
     }
 
+    start_time = get_time();
+    stall_time = 0.0;
+    copy_bytes = 0;
+
    /*
     * Now loop until we are out of data from print_fd...
     */
 
-    for (print_bytes = 0, print_ptr = print_buffer;;)
+    for (print_bytes = 0, print_ptr = print_buffer, print_eof = 0,
+             print_ready = 0;
+	 !print_eof || print_bytes;)
     {
      /*
-      * Use select() to determine whether we have data to copy around...
+      * Use poll() to determine whether we have data to copy around...
       */
 
-      FD_ZERO(&input);
       if (!print_bytes)
-	FD_SET(print_fd, &input);
-      FD_SET(device_fd, &input);
-      if (!print_bytes && !side_eof)
-        FD_SET(CUPS_SC_FD, &input);
-
-      FD_ZERO(&output);
-      if (print_bytes)
-	FD_SET(device_fd, &output);
-
-      if (select(nfds, &input, &output, NULL, NULL) < 0)
+        print_ptr = print_buffer;
+
+      pfds[0].fd      = -1;		/* Negative fds are not polled */
+      pfds[0].events  = POLLIN;
+      pfds[0].revents = 0;
+      pfds[1].fd      = device_fd;
+      pfds[1].events  = POLLIN;
+      pfds[2].fd      = -1;
+      pfds[2].events  = POLLIN;
+      pfds[2].revents = 0;
+
+      if (!print_eof && !print_ready &&
+          (use_splice ? !print_bytes :
+	                print_ptr + print_bytes <
+			    print_buffer + sizeof(print_buffer)))
+        pfds[0].fd = print_fd;
+      if (print_bytes || print_ready)
+        pfds[1].events |= POLLOUT;
+      if (!side_eof)
+        pfds[2].fd = CUPS_SC_FD;
+
+      poll_time = get_time();
+
+      if (poll(pfds, 3, -1) < 0)
 	continue;			/* Ignore errors here */
 
+      if (pfds[1].events & POLLOUT)
+        stall_time += get_time() - poll_time;
+
      /*
       * Check if we have a side-channel request ready...
       */
 
-      if (FD_ISSET(CUPS_SC_FD, &input))
+      if (pfds[2].revents & (POLLIN | POLLHUP | POLLNVAL))
       {
        /*
-	* Do the side-channel request, then start back over in the select
-	* loop since it may have read from print_fd...
+	* Do the side-channel request, then start back over in the poll
+	* loop since it may have written the buffered print data and read
+	* from print_fd...
 	*/
 
-        if (side_cb(print_fd, device_fd, 1))
+        if (side_cb(print_fd, device_fd, &print_ptr, &print_bytes, 1))
 	  side_eof = 1;
+	print_ready = 0;
 	continue;
       }
 
@@ -555,7 +603,7 @@ main(int  argc,				/* I - Number of command-line arguments (6 or 7) */
       * Check if we have back-channel data ready...
       */
 
-      if (FD_ISSET(device_fd, &input))
+      if (pfds[1].revents & POLLIN)
       {
 	if ((bc_bytes = read(device_fd, bc_buffer, sizeof(bc_buffer))) > 0)
 	{
@@ -569,9 +617,13 @@ main(int  argc,				/* I - Number of command-line arguments (6 or 7) */
       * Check if we have print data ready...
       */
 
-      if (FD_ISSET(print_fd, &input))
+      if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR))
       {
-	if ((print_bytes = read(print_fd, print_buffer, print_size)) < 0)
+        if (use_splice)
+	  print_ready = 1;
+	else if ((bytes = read(print_fd, print_ptr + print_bytes,
+	                       print_buffer + sizeof(print_buffer) -
+			           print_ptr - print_bytes)) < 0)
 	{
 	 /*
           * Read error - bail if we don't see EAGAIN or EINTR...
@@ -590,19 +642,17 @@ main(int  argc,				/* I - Number of command-line arguments (6 or 7) */
 
 	    return (CUPS_BACKEND_FAILED);
 	  }
-
-          print_bytes = 0;
 	}
-	else if (print_bytes == 0)
+	else if (bytes == 0)
 	{
 	 /*
-          * End of file, break out of the loop...
+          * End of file, finish writing what we have...
 	  */
 
-          break;
+          print_eof = 1;
 	}
-
-	print_ptr = print_buffer;
+	else
+	  print_bytes += bytes;
       }
 
      /*
@@ -610,7 +660,7 @@ main(int  argc,				/* I - Number of command-line arguments (6 or 7) */
       * send...
       */
 
-      if (print_bytes && FD_ISSET(device_fd, &output))
+      if ((print_bytes || print_ready) && (pfds[1].revents & POLLOUT))
       {
 	if (dtrdsr)
 	{
@@ -630,24 +680,62 @@ main(int  argc,				/* I - Number of command-line arguments (6 or 7) */
 
 	      fputs("DEBUG: DSR is low; waiting for device.\n", stderr);
 
+              poll_time = get_time();
+
               do
 	      {
+#ifdef TIOCMIWAIT
+	       /*
+	        * Sleep until the modem lines change, or poll every 100ms
+		* if the driver can't tell us...
+		*/
+
+		if (ioctl(device_fd, TIOCMIWAIT, TIOCM_DSR))
+		  usleep(100000);
+#else
 	       /*
 	        * Poll every 100ms...
 		*/
 
 		usleep(100000);
+#endif /* TIOCMIWAIT */
 
 		if (ioctl(device_fd, TIOCMGET, &status))
 		  break;
 	      }
 	      while (!(status & TIOCM_DSR));
 
+              stall_time += get_time() - poll_time;
+
 	      fputs("DEBUG: DSR is high; writing to device.\n", stderr);
             }
 	}
 
-	if ((bytes = write(device_fd, print_ptr, print_bytes)) < 0)
+#ifdef SPLICE_F_MOVE
+        if (print_ready)
+	{
+	  print_ready = 0;
+
+	  if ((bytes = splice(print_fd, NULL, device_fd, NULL, print_size,
+	                      SPLICE_F_MOVE | SPLICE_F_MORE)) == 0)
+	    print_eof = 1;
+	  else if (bytes < 0 && (errno == EINVAL || errno == ENOSYS))
+	  {
+	   /*
+	    * Not a pipe or the device can't do it, copy the data...
+	    */
+
+	    fputs("DEBUG: Unable to splice print data, copying it.\n", stderr);
+	    use_splice = 0;
+	    continue;
+	  }
+	}
+	else
+#endif /* SPLICE_F_MOVE */
+	bytes = write(device_fd, print_ptr,
+	              print_bytes > print_size ? print_size : print_bytes);
+
+	if (bytes < 0)
 	{
 	 /*
           * Write error - bail if we don't see an error we can retry...
@@ -667,16 +755,28 @@ main(int  argc,				/* I - Number of command-line arguments (6 or 7) */
 	    return (CUPS_BACKEND_FAILED);
 	  }
 	}
-	else
+	else if (print_bytes)
 	{
-          fprintf(stderr, "DEBUG: Wrote %d bytes.\n", (int)bytes);
-
           print_bytes -= bytes;
 	  print_ptr   += bytes;
-	  total_bytes += bytes;
+	  copy_bytes  += bytes;
 	}
+	else
+	  copy_bytes += bytes;
       }
     }
+
+   /*
+    * Tell how fast the data went out...
+    */
+
+    elapsed = get_time() - start_time;
+    total_bytes += copy_bytes;
+
+    fprintf(stderr,
+            "DEBUG: Sent %ld bytes in %.3f seconds (%.0f bytes/sec), "
+	    "%.3f seconds waiting for the device.\n", (long)copy_bytes,
+	    elapsed, elapsed > 0.0 ? copy_bytes / elapsed : 0.0, stall_time);
   }
 
  /*
@@ -696,26 +796,31 @@ main(int  argc,				/* I - Number of command-line arguments (6 or 7) */
 
 /*
  * 'drain_output()' - Drain pending print data to the device.
+ *
+ * Any print data already read into the caller's buffer is written first,
+ * so that it is not sent after data that is read here.
  */
 
 static int				/* O - 0 on success, -1 on error */
-drain_output(int print_fd,		/* I - Print file descriptor */
-             int device_fd)		/* I - Device file descriptor */
+drain_output(int     print_fd,		/* I  - Print file descriptor */
+             int     device_fd,		/* I  - Device file descriptor */
+             char    **pending,		/* IO - Buffered print data */
+             ssize_t *pending_bytes)	/* IO - Bytes of buffered print data */
 {
-  int		nfds;			/* Maximum file descriptor value + 1 */
-  fd_set	input;			/* Input set for reading */
+  struct pollfd	pfd;			/* Poll descriptor for print data */
   ssize_t	print_bytes,		/* Print bytes read */
 		bytes;			/* Bytes written */
   char		print_buffer[8192],	/* Print data buffer */
 		*print_ptr;		/* Pointer into print data buffer */
-  struct timeval timeout;		/* Timeout for read... */
 
 
  /*
-  * Figure out the maximum file descriptor value to use with select()...
+  * Take over the print data the caller has already buffered...
   */
 
-  nfds = (print_fd > device_fd ? print_fd : device_fd) + 1;
+  print_ptr      = *pending;
+  print_bytes    = *pending_bytes;
+  *pending_bytes = 0;
 
  /*
   * Now loop until we are out of data from print_fd...
@@ -724,19 +829,44 @@ drain_output(int print_fd,		/* I - Print file descriptor */
   for (;;)
   {
    /*
-    * Use select() to determine whether we have data to copy around...
+    * Write what we have before reading more...
     */
 
-    FD_ZERO(&input);
-    FD_SET(print_fd, &input);
+    while (print_bytes > 0)
+    {
+      if ((bytes = write(device_fd, print_ptr, print_bytes)) < 0)
+      {
+       /*
+        * Write error - bail if we don't see an error we can retry...
+	*/
 
-    timeout.tv_sec  = 0;
-    timeout.tv_usec = 0;
+        if (errno != ENOSPC && errno != ENXIO && errno != EAGAIN &&
+	    errno != EINTR && errno != ENOTTY)
+	{
+	  perror("ERROR: Unable to write print data");
+	  return (-1);
+	}
+      }
+      else
+      {
+        fprintf(stderr, "DEBUG: Wrote %d bytes of print data.\n", (int)bytes);
+
+        print_bytes -= bytes;
+	print_ptr   += bytes;
+      }
+    }
+
+   /*
+    * Use poll() to determine whether we have data to copy around...
+    */
+
+    pfd.fd     = print_fd;
+    pfd.events = POLLIN;
 
-    if (select(nfds, &input, NULL, NULL, &timeout) < 0)
+    if (poll(&pfd, 1, 0) < 0)
       return (-1);
 
-    if (!FD_ISSET(print_fd, &input))
+    if (!pfd.revents)
       return (0);
 
     if ((print_bytes = read(print_fd, print_buffer,
@@ -766,30 +896,24 @@ drain_output(int print_fd,		/* I - Print file descriptor */
     fprintf(stderr, "DEBUG: Read %d bytes of print data.\n",
 	    (int)print_bytes);
 
-    for (print_ptr = print_buffer; print_bytes > 0;)
-    {
-      if ((bytes = write(device_fd, print_ptr, print_bytes)) < 0)
-      {
-       /*
-        * Write error - bail if we don't see an error we can retry...
-	*/
+    print_ptr = print_buffer;
+  }
+}
 
-        if (errno != ENOSPC && errno != ENXIO && errno != EAGAIN &&
-	    errno != EINTR && errno != ENOTTY)
-	{
-	  perror("ERROR: Unable to write print data");
-	  return (-1);
-	}
-      }
-      else
-      {
-        fprintf(stderr, "DEBUG: Wrote %d bytes of print data.\n", (int)bytes);
 
-        print_bytes -= bytes;
-	print_ptr   += bytes;
-      }
-    }
-  }
+/*
+ * 'get_time()' - Get the current time in seconds.
+ */
+
+static double				/* O - Time in seconds */
+get_time(void)
+{
+  struct timespec	ts;		/* Monotonic clock */
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
 }
 
 
@@ -1184,9 +1308,11 @@ list_devices(void)
  */
 
 static int				/* O - 0 on success, -1 on error */
-side_cb(int print_fd,			/* I - Print file */
-        int device_fd,			/* I - Device file */
-	int use_bc)			/* I - Using back-channel? */
+side_cb(int     print_fd,		/* I  - Print file */
+        int     device_fd,		/* I  - Device file */
+        char    **print_ptr,		/* IO - Buffered print data */
+        ssize_t *print_bytes,		/* IO - Bytes of buffered print data */
+	int     use_bc)			/* I  - Using back-channel? */
 {
   cups_sc_command_t	command;	/* Request command */
   cups_sc_status_t	status;		/* Request/response status */
@@ -1202,7 +1328,7 @@ side_cb(int print_fd,			/* I - Print file */
   switch (command)
   {
     case CUPS_SC_CMD_DRAIN_OUTPUT :
-        if (drain_output(print_fd, device_fd))
+        if (drain_output(print_fd, device_fd, print_ptr, print_bytes))
 	  status = CUPS_SC_STATUS_IO_ERROR;
 	else if (tcdrain(device_fd))
 	  status = CUPS_SC_STATUS_IO_ERROR;
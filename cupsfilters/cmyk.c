@@ -24,6 +24,8 @@
  *                           density.
  *   cupsCMYKSetInkLimit() - Set the limit on the amount of ink.
  *   cupsCMYKSetLtDk()     - Set light/dark ink transforms.
+ *   cups_cmyk_ink_limit() - Get the effective ink limit for a separation.
+ *   cups_cmyk_limit()     - Scale a pixel down to the ink limit.
  */
 
 /*
@@ -36,6 +38,55 @@
 #include <ctype.h>
 
 
+/*
+ * 'cups_cmyk_ink_limit()' - Get the effective ink limit for a separation.
+ *
+ * Returns 0 when the limit can never be reached so that the separation
+ * loops skip the per-pixel ink check entirely.
+ */
+
+static inline int			/* O - Ink limit or 0 for none */
+cups_cmyk_ink_limit(const cups_cmyk_t *cmyk)
+					/* I - Color separation */
+{
+  if (cmyk->ink_limit >= cmyk->num_channels * CUPS_MAX_LUT)
+    return (0);
+  else
+    return (cmyk->ink_limit);
+}
+
+
+/*
+ * 'cups_cmyk_limit()' - Scale a pixel down to the ink limit.
+ *
+ * The channel count is a constant at every call site, so the compiler
+ * unrolls (and where possible vectorizes) both loops; the N divisions of
+ * the old code are replaced by a single 16.16 fixed-point reciprocal.
+ */
+
+static inline void
+cups_cmyk_limit(short *output,		/* IO - Device-N pixel */
+                int   num_channels,	/* I  - Number of channels */
+		int   ink_limit)	/* I  - Ink limit */
+{
+  int	i,				/* Looping var */
+	ink,				/* Amount of ink */
+	scale;				/* Scaling factor (16.16) */
+
+
+  for (i = 0, ink = 0; i < num_channels; i ++)
+    ink += output[i];
+
+  if (ink <= ink_limit)
+    return;
+
+  scale = (ink_limit << 16) / ink;
+
+  for (i = 0; i < num_channels; i ++)
+    output[i] = (output[i] * scale) >> 16;
+}
+
+
 /*
  * 'cupsCMYKDelete()' - Delete a color separation.
  */
@@ -75,8 +126,7 @@ cupsCMYKDoBlack(const cups_cmyk_t   *cmyk,
 {
   int			k;		/* Current black value */
   const short		**channels;	/* Copy of channel LUTs */
-  int			ink,		/* Amount of ink */
-			ink_limit;	/* Ink limit from separation */
+  int			ink_limit;	/* Ink limit from separation */
 
 
  /*
@@ -91,7 +141,7 @@ cupsCMYKDoBlack(const cups_cmyk_t   *cmyk,
   */
 
   channels  = (const short **)cmyk->channels;
-  ink_limit = cmyk->ink_limit;
+  ink_limit = cups_cmyk_ink_limit(cmyk);
 
   switch (cmyk->num_channels)
   {
@@ -123,15 +173,7 @@ cupsCMYKDoBlack(const cups_cmyk_t   *cmyk,
 	  output[1] = channels[1][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 2, ink_limit);
 
           output += 2;
           num_pixels --;
@@ -152,16 +194,7 @@ cupsCMYKDoBlack(const cups_cmyk_t   *cmyk,
 	  output[2] = channels[2][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 3, ink_limit);
 
           output += 3;
           num_pixels --;
@@ -224,15 +257,7 @@ cupsCMYKDoBlack(const cups_cmyk_t   *cmyk,
 	  output[6] = channels[6][k];
 
           if (ink_limit)
-	  {
-	    ink = output[5] + output[6];
-
-	    if (ink > ink_limit)
-	    {
-	      output[5] = ink_limit * output[5] / ink;
-	      output[6] = ink_limit * output[6] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output + 5, 2, ink_limit);
 
           output += 7;
           num_pixels --;
@@ -261,8 +286,7 @@ cupsCMYKDoCMYK(const cups_cmyk_t   *cmyk,
 			y,		/* Current yellow value */
 			k;		/* Current black value */
   const short		**channels;	/* Copy of channel LUTs */
-  int			ink,		/* Amount of ink */
-			ink_limit;	/* Ink limit from separation */
+  int			ink_limit;	/* Ink limit from separation */
 
 
  /*
@@ -277,7 +301,7 @@ cupsCMYKDoCMYK(const cups_cmyk_t   *cmyk,
   */
 
   channels  = (const short **)cmyk->channels;
-  ink_limit = cmyk->ink_limit;
+  ink_limit = cups_cmyk_ink_limit(cmyk);
 
   switch (cmyk->num_channels)
   {
@@ -328,15 +352,7 @@ cupsCMYKDoCMYK(const cups_cmyk_t   *cmyk,
 	  }
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 2, ink_limit);
 
           output += 2;
           num_pixels --;
@@ -375,16 +391,7 @@ cupsCMYKDoCMYK(const cups_cmyk_t   *cmyk,
 	    output[2] = channels[2][255];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 3, ink_limit);
 
           output += 3;
           num_pixels --;
@@ -410,17 +417,7 @@ cupsCMYKDoCMYK(const cups_cmyk_t   *cmyk,
 	  output[3] = channels[3][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2] + output[3];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	      output[3] = ink_limit * output[3] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 4, ink_limit);
 
           output += 4;
           num_pixels --;
@@ -448,20 +445,7 @@ cupsCMYKDoCMYK(const cups_cmyk_t   *cmyk,
 	  output[5] = channels[5][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2] + output[3] +
-	          output[4] + output[5];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	      output[3] = ink_limit * output[3] / ink;
-	      output[4] = ink_limit * output[4] / ink;
-	      output[5] = ink_limit * output[5] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 6, ink_limit);
 
           output += 6;
           num_pixels --;
@@ -490,21 +474,7 @@ cupsCMYKDoCMYK(const cups_cmyk_t   *cmyk,
 	  output[6] = channels[6][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2] + output[3] +
-	          output[4] + output[5] + output[6];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	      output[3] = ink_limit * output[3] / ink;
-	      output[4] = ink_limit * output[4] / ink;
-	      output[5] = ink_limit * output[5] / ink;
-	      output[6] = ink_limit * output[6] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 7, ink_limit);
 
           output += 7;
           num_pixels --;
@@ -531,8 +501,7 @@ cupsCMYKDoGray(const cups_cmyk_t   *cmyk,
   int			k,		/* Current black value */
 			kc;		/* Current black color value */
   const short		**channels;	/* Copy of channel LUTs */
-  int			ink,		/* Amount of ink */
-			ink_limit;	/* Ink limit from separation */
+  int			ink_limit;	/* Ink limit from separation */
 
 
  /*
@@ -547,7 +516,7 @@ cupsCMYKDoGray(const cups_cmyk_t   *cmyk,
   */
 
   channels  = (const short **)cmyk->channels;
-  ink_limit = cmyk->ink_limit;
+  ink_limit = cups_cmyk_ink_limit(cmyk);
 
   switch (cmyk->num_channels)
   {
@@ -579,15 +548,7 @@ cupsCMYKDoGray(const cups_cmyk_t   *cmyk,
 	  output[1] = channels[1][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 2, ink_limit);
 
           output += 2;
           num_pixels --;
@@ -608,16 +569,7 @@ cupsCMYKDoGray(const cups_cmyk_t   *cmyk,
 	  output[2] = channels[2][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 3, ink_limit);
 
           output += 3;
           num_pixels --;
@@ -641,17 +593,7 @@ cupsCMYKDoGray(const cups_cmyk_t   *cmyk,
 	  output[3] = channels[3][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2] + output[3];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	      output[3] = ink_limit * output[3] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 4, ink_limit);
 
           output += 4;
           num_pixels --;
@@ -677,20 +619,7 @@ cupsCMYKDoGray(const cups_cmyk_t   *cmyk,
 	  output[5] = channels[5][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2] + output[3] +
-	          output[4] + output[5];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	      output[3] = ink_limit * output[3] / ink;
-	      output[4] = ink_limit * output[4] / ink;
-	      output[5] = ink_limit * output[5] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 6, ink_limit);
 
           output += 6;
           num_pixels --;
@@ -717,21 +646,7 @@ cupsCMYKDoGray(const cups_cmyk_t   *cmyk,
 	  output[6] = channels[6][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2] + output[3] +
-	          output[4] + output[5] + output[6];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	      output[3] = ink_limit * output[3] / ink;
-	      output[4] = ink_limit * output[4] / ink;
-	      output[5] = ink_limit * output[5] / ink;
-	      output[6] = ink_limit * output[6] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 7, ink_limit);
 
           output += 7;
           num_pixels --;
@@ -762,8 +677,7 @@ cupsCMYKDoRGB(const cups_cmyk_t   *cmyk,
 			kc,		/* Current black color value */
 			km;		/* Maximum black value */
   const short		**channels;	/* Copy of channel LUTs */
-  int			ink,		/* Amount of ink */
-			ink_limit;	/* Ink limit from separation */
+  int			ink_limit;	/* Ink limit from separation */
 
 
  /*
@@ -778,7 +692,7 @@ cupsCMYKDoRGB(const cups_cmyk_t   *cmyk,
   */
 
   channels  = (const short **)cmyk->channels;
-  ink_limit = cmyk->ink_limit;
+  ink_limit = cups_cmyk_ink_limit(cmyk);
 
   switch (cmyk->num_channels)
   {
@@ -818,15 +732,7 @@ cupsCMYKDoRGB(const cups_cmyk_t   *cmyk,
           output[1] = channels[1][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 2, ink_limit);
 
           output += 2;
           num_pixels --;
@@ -850,16 +756,7 @@ cupsCMYKDoRGB(const cups_cmyk_t   *cmyk,
 	  output[2] = channels[2][y];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 3, ink_limit);
 
           output += 3;
           num_pixels --;
@@ -894,17 +791,7 @@ cupsCMYKDoRGB(const cups_cmyk_t   *cmyk,
 	  output[3] = channels[3][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2] + output[3];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	      output[3] = ink_limit * output[3] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 4, ink_limit);
 
           output += 4;
           num_pixels --;
@@ -941,20 +828,7 @@ cupsCMYKDoRGB(const cups_cmyk_t   *cmyk,
 	  output[5] = channels[5][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2] + output[3] +
-	          output[4] + output[5];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	      output[3] = ink_limit * output[3] / ink;
-	      output[4] = ink_limit * output[4] / ink;
-	      output[5] = ink_limit * output[5] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 6, ink_limit);
 
           output += 6;
           num_pixels --;
@@ -992,21 +866,7 @@ cupsCMYKDoRGB(const cups_cmyk_t   *cmyk,
 	  output[6] = channels[6][k];
 
           if (ink_limit)
-	  {
-	    ink = output[0] + output[1] + output[2] + output[3] +
-	          output[4] + output[5] + output[6];
-
-	    if (ink > ink_limit)
-	    {
-	      output[0] = ink_limit * output[0] / ink;
-	      output[1] = ink_limit * output[1] / ink;
-	      output[2] = ink_limit * output[2] / ink;
-	      output[3] = ink_limit * output[3] / ink;
-	      output[4] = ink_limit * output[4] / ink;
-	      output[5] = ink_limit * output[5] / ink;
-	      output[6] = ink_limit * output[6] / ink;
-	    }
-	  }
+	    cups_cmyk_limit(output, 7, ink_limit);
 
           output += 7;
           num_pixels --;
@@ -444,6 +444,94 @@ out:
   return has_inhibitors;
 }
 
+static unsigned long long
+get_device_modified (DBusConnection *con, const char *object_path)
+{
+  const char *interface = "org.freedesktop.ColorManager.Device";
+  const char *property = "Modified";
+  DBusError error;
+  DBusMessageIter args;
+  DBusMessageIter sub;
+  DBusMessage *message = NULL;
+  DBusMessage *reply = NULL;
+  dbus_uint64_t modified = 0;
+
+  message = dbus_message_new_method_call("org.freedesktop.ColorManager",
+                                         object_path,
+                                         "org.freedesktop.DBus.Properties",
+                                         "Get");
+
+  dbus_message_iter_init_append(message, &args);
+  dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &interface);
+  dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &property);
+
+  /* send syncronous */
+  dbus_error_init(&error);
+  fprintf(stderr, "DEBUG: Calling %s.Get(%s)\n", interface, property);
+  reply = dbus_connection_send_with_reply_and_block(con,
+                                                    message,
+                                                    -1,
+                                                    &error);
+  if (reply == NULL) {
+    fprintf(stderr, "DEBUG: Failed to send: %s:%s\n",
+           error.name, error.message);
+    dbus_error_free(&error);
+    goto out;
+  }
+
+  /* get reply data */
+  dbus_message_iter_init(reply, &args);
+  if (dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_VARIANT) {
+    fprintf(stderr, "DEBUG: Incorrect reply type\n");
+    goto out;
+  }
+
+  dbus_message_iter_recurse(&args, &sub);
+  if (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_UINT64) {
+    fprintf(stderr, "DEBUG: Incorrect reply type\n");
+    goto out;
+  }
+  dbus_message_iter_get_basic(&sub, &modified);
+out:
+  if (message != NULL)
+    dbus_message_unref(message);
+  if (reply != NULL)
+    dbus_message_unref(reply);
+  return (unsigned long long)modified;
+}
+
+unsigned long long
+colord_get_modified_for_device_id (const char *device_id)
+{
+  DBusConnection *con = NULL;
+  char *device_path = NULL;
+  unsigned long long modified = 0;
+
+  if (device_id == NULL)
+    goto out;
+
+  /* connect to system bus */
+  con = dbus_bus_get(DBUS_BUS_SYSTEM, NULL);
+  if (con == NULL)
+    goto out;
+
+  /* find the device */
+  device_path = get_device_path_for_device_id (con, device_id);
+  if (device_path == NULL) {
+    fprintf(stderr, "DEBUG: Failed to get find device %s\n", device_id);
+    goto out;
+  }
+
+  /* colord updates this whenever profiles are added to, removed from or
+     made default for the device */
+  modified = get_device_modified(con, device_path);
+out:
+  free(device_path);
+  if (con != NULL)
+    dbus_connection_unref(con);
+  return modified;
+}
+
 #else
 
 char *
@@ -461,4 +549,10 @@ colord_get_inhibit_for_device_id (const char *device_id)
   return 0;
 }
 
+unsigned long long
+colord_get_modified_for_device_id (const char *device_id)
+{
+  return 0;
+}
+
 #endif
@@ -41,6 +41,7 @@ char  **colord_get_qualifier_for_ppd      (ppd_file_t *ppd);
 char   *colord_get_profile_for_device_id  (const char *device_id,
                                            const char **qualifier_tuple);
 int     colord_get_inhibit_for_device_id  (const char *device_id);
+unsigned long long colord_get_modified_for_device_id (const char *device_id);
 
 #  ifdef __cplusplus
 }
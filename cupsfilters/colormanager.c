@@ -29,6 +29,9 @@ MIT Open Source License  -  http://www.opensource.org/
 #include "colormanager.h"
 #include <cupsfilters/colord.h>
 //#include <cupsfilters/kmdevices.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 
 #define CM_MAX_FILE_LENGTH 1024
@@ -42,6 +45,14 @@ static int      _get_colord_profile             (const char *printer_name,
                                                  ppd_file_t *ppd);
 static char    *_get_ppd_icc_fallback           (ppd_file_t *ppd, 
                                                  char **qualifier);
+static char    *_get_colord_cache_file          (const char *name);
+static char    *_get_colord_cache               (const char *name,
+                                                 unsigned long long modified,
+                                                 char *value,
+                                                 int valuesize);
+static void     _set_colord_cache               (const char *name,
+                                                 unsigned long long modified,
+                                                 const char *value);
 
 
 
@@ -236,16 +247,33 @@ _get_colord_profile(const char   *printer_name,     /* Dest name */
     char  **qualifier = NULL;        /* color qualifier strings */
     char  *icc_profile = NULL;       /* icc profile path */
     char  *printer_id = NULL;        /* colord printer id */ 
+    char  cache_name[CM_MAX_FILE_LENGTH];  /* name of cached answer */
+    char  cached[CM_MAX_FILE_LENGTH];      /* cached profile path */
+    unsigned long long modified;     /* last change of the colord device */
 
 
     /* Get color qualifier triple */
     qualifier = colord_get_qualifier_for_ppd(ppd);
 
     if (qualifier != NULL) {
+      snprintf(cache_name, sizeof(cache_name), "%s-%s.%s.%s", printer_name,
+               qualifier[0], qualifier[1], qualifier[2]);
+
+      /* The profile assignment of the device only changes together with
+         its modification time in colord */
       printer_id = _get_colord_printer_id(printer_name);
-      /* Get profile from colord using qualifiers */
-      icc_profile = colord_get_profile_for_device_id ((const char *)printer_id,
-						      (const char **)qualifier);
+      modified = colord_get_modified_for_device_id(printer_id);
+
+      if (_get_colord_cache(cache_name, modified, cached,
+                            sizeof(cached)) != NULL)
+        icc_profile = strdup(cached);
+      else {
+        /* Get profile from colord using qualifiers */
+        icc_profile = colord_get_profile_for_device_id ((const char *)printer_id,
+                                                        (const char **)qualifier);
+        if (icc_profile)
+          _set_colord_cache(cache_name, modified, icc_profile);
+      }
     }
 
     if (icc_profile) 
@@ -280,6 +308,123 @@ _get_colord_profile(const char   *printer_name,     /* Dest name */
 }
 
 
+/* Profiles found by colord are kept in small files in CUPS_CACHEDIR, as
+   filters only live for one job and cannot listen to the change signals of
+   colord. Each answer is stored with the "Modified" time of the colord
+   device, which changes whenever a profile is added to, removed from or
+   made default for the device, and is only used while that time matches. */
+
+char *
+_get_colord_cache_file(const char *name)         /* Name of answer */
+{
+  const char *cachedir = getenv("CUPS_CACHEDIR");
+  char *filename, *ptr;
+
+  if (cachedir == NULL || !*cachedir || name == NULL)
+    return NULL;
+
+  filename = (char*)malloc(CM_MAX_FILE_LENGTH);
+  if (filename == NULL)
+    return NULL;
+
+  if (snprintf(filename, CM_MAX_FILE_LENGTH, "%s/cups-filters/colord-",
+               cachedir) >= CM_MAX_FILE_LENGTH ||
+      strlen(filename) + strlen(name) >= CM_MAX_FILE_LENGTH) {
+    free(filename);
+    return NULL;
+  }
+
+  /* qualifiers come from the PPD file, keep them out of other directories */
+  ptr = filename + strlen(filename);
+  for (; *name; name ++)
+    *ptr++ = (*name == '/' || *name == ' ') ? '_' : *name;
+  *ptr = '\0';
+
+  return filename;
+}
+
+
+char *
+_get_colord_cache(const char         *name,        /* Name of answer */
+                  unsigned long long modified,     /* Device modification time */
+                  char               *value,       /* Buffer for answer */
+                  int                valuesize)    /* Size of buffer */
+{
+  char *filename;
+  FILE *fp;
+  char stamp[32];
+  char *found = NULL;
+
+  /* without the modification time we cannot tell a stale answer */
+  if (modified == 0)
+    return NULL;
+
+  if ((filename = _get_colord_cache_file(name)) == NULL)
+    return NULL;
+
+  if ((fp = fopen(filename, "r")) != NULL) {
+    if (fgets(stamp, sizeof(stamp), fp) != NULL &&
+        strtoull(stamp, NULL, 10) == modified &&
+        fgets(value, valuesize, fp) != NULL) {
+      value[strcspn(value, "\n")] = '\0';
+      /* a profile which went away needs a new answer */
+      if (value[0] == '/' && !access(value, R_OK))
+        found = value;
+    }
+    fclose(fp);
+  }
+
+  free(filename);
+
+  if (found)
+    fprintf(stderr, "DEBUG: Color Manager: Using cached answer of colord "
+            "for %s\n", name);
+
+  return found;
+}
+
+
+void
+_set_colord_cache(const char         *name,        /* Name of answer */
+                  unsigned long long modified,     /* Device modification time */
+                  const char         *value)       /* Answer */
+{
+  char *filename, *ptr;
+  char tempfile[CM_MAX_FILE_LENGTH + 8];
+  int fd, written;
+  FILE *fp;
+
+  if (modified == 0 || (filename = _get_colord_cache_file(name)) == NULL)
+    return;
+
+  /* create the directory if this is the first cached answer */
+  if ((ptr = strrchr(filename, '/')) != NULL) {
+    *ptr = '\0';
+    if (mkdir(filename, 0770) && errno != EEXIST) {
+      free(filename);
+      return;
+    }
+    *ptr = '/';
+  }
+
+  /* write a new file and rename it, other filters may be reading */
+  snprintf(tempfile, sizeof(tempfile), "%s.XXXXXX", filename);
+
+  if ((fd = mkstemp(tempfile)) >= 0) {
+    if ((fp = fdopen(fd, "w")) == NULL) {
+      close(fd);
+      unlink(tempfile);
+    } else {
+      written = fprintf(fp, "%llu\n%s\n", modified, value) >= 0;
+      if (fclose(fp) || !written || rename(tempfile, filename))
+        unlink(tempfile);
+    }
+  }
+
+  free(filename);
+}
+
+
 #ifndef CUPSDATA
 #define CUPSDATA "/usr/share/cups"
 #endif
@@ -55,6 +55,7 @@ extern "C" {
 #define CUPS_MAX_CHAN	15		/* Maximum number of color components */
 #define CUPS_MAX_LUT	4095		/* Maximum LUT value */
 #define CUPS_MAX_RGB	4		/* Maximum number of sRGB components */
+#define CUPS_RGB_CACHE	256		/* Size of RGB separation color cache */
 
 
 /*
@@ -91,6 +92,14 @@ typedef struct cups_rgb_s		/**** Color separation lookup table ****/
   int		cache_init;		/* Are cached values initialized? */
   unsigned char	black[CUPS_MAX_RGB];	/* Cached black (sRGB = 0,0,0) */
   unsigned char	white[CUPS_MAX_RGB];	/* Cached white (sRGB = 255,255,255) */
+  int		lut_size;		/* Size of device LUT (17 or 33) on a side */
+  unsigned char	*lut;			/* Device LUT, lut_size^3 * num_channels */
+  int		lut_index[256];		/* Index into LUT for a given sRGB value */
+  int		lut_frac[256];		/* Fraction (0-256) to next LUT point */
+  int		cache_rgb[CUPS_RGB_CACHE];
+					/* Color cache keys (-1 = unused) */
+  unsigned char	cache_colors[CUPS_RGB_CACHE][CUPS_MAX_RGB];
+					/* Color cache values */
 } cups_rgb_t;
 
 typedef struct cups_cmyk_s		/**** Simple CMYK lookup table ****/
@@ -177,6 +186,20 @@ extern void		cupsPackHorizontalBit(const unsigned char *,
 extern void		cupsPackVertical(const unsigned char *, unsigned char *,
 			                 int, const unsigned char, const int);
 
+/*
+ * Run-length coding functions...
+ */
+
+extern unsigned char	*cupsPackBits(const unsigned char *line, int length,
+			              unsigned char *comp);
+extern unsigned char	*cupsPackPixels(const unsigned char *line, int width,
+			                int bpp, unsigned char *comp);
+extern const unsigned char
+			*cupsUnpackPixels(const unsigned char *comp,
+			                  const unsigned char *comp_end,
+					  unsigned char *line, int width,
+					  int bpp, unsigned char blank);
+
 /*
  * Color separation functions...
  */
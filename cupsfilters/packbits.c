@@ -0,0 +1,351 @@
+/*
+ *   Run-length coding routines for CUPS.
+ *
+ *   TIFF/PCL/PDF pack-bits works on bytes, PWG and URF raster use the same
+ *   idea on whole pixels, with the meaning of the two kinds of codes
+ *   swapped.  Finding where a run starts or ends is the expensive part, so
+ *   it compares 16 bytes at a time with SSE2 where available.
+ *
+ *   Distribution and use rights are outlined in the file "COPYING"
+ *   which should have been included with this file.
+ *
+ * Contents:
+ *
+ *   cupsPackBits()     - Do TIFF pack-bits encoding of a line.
+ *   cupsPackPixels()   - Do PWG pack-bits encoding of a line of pixels.
+ *   cupsUnpackPixels() - Decode a PWG pack-bits encoded line of pixels.
+ *   pack_differ()      - Count bytes which don't start a run of three.
+ *   pack_equal()       - Count bytes which match the byte a pixel later.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "driver.h"
+#include <string.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif /* __SSE2__ */
+
+
+/*
+ * Local functions...
+ */
+
+static int	pack_differ(const unsigned char *bytes, int length);
+static int	pack_equal(const unsigned char *bytes, int length, int step);
+
+
+/*
+ * 'cupsPackBits()' - Do TIFF pack-bits encoding of a line.
+ *
+ * Pairs of equal bytes are left in literal sequences, where they cost
+ * nothing extra, so the buffer needs at most length + length / 128 + 1
+ * bytes.
+ */
+
+unsigned char *				/* O - End of compressed data */
+cupsPackBits(const unsigned char *line,	/* I - Data to compress */
+             int                 length,/* I - Number of bytes */
+	     unsigned char       *comp)	/* I - Compression buffer */
+{
+  const unsigned char	*line_end;	/* End-of-line byte pointer */
+  int			count,		/* Count of bytes for output */
+			max;		/* Maximum count */
+
+
+  line_end = line + length;
+
+  while (line < line_end)
+  {
+    if ((line + 1) >= line_end)
+    {
+     /*
+      * Single byte on the end...
+      */
+
+      *comp++ = 0x00;
+      *comp++ = *line++;
+    }
+    else if (line[0] == line[1])
+    {
+     /*
+      * Repeated sequence...
+      */
+
+      max   = line_end - line - 2;
+      count = 2 + pack_equal(line + 1, max < 125 ? max : 125, 1);
+
+      *comp++ = 257 - count;
+      *comp++ = *line;
+      line    += count;
+    }
+    else
+    {
+     /*
+      * Non-repeated sequence...
+      */
+
+      max   = line_end - line - 3;
+      count = 1 + pack_differ(line + 1, max < 127 ? max : 127);
+
+      if (line_end - line - count < 3 && line_end - line <= 128)
+        count = line_end - line;	/* Take the last bytes along */
+
+      *comp++ = count - 1;
+
+      memcpy(comp, line, count);
+      comp += count;
+      line += count;
+    }
+  }
+
+  return (comp);
+}
+
+
+/*
+ * 'cupsPackPixels()' - Do PWG pack-bits encoding of a line of pixels.
+ *
+ * The buffer must hold at least width * (bpp + 1) bytes.
+ */
+
+unsigned char *				/* O - End of compressed data */
+cupsPackPixels(const unsigned char *line,/* I - Pixels to compress */
+               int                 width,/* I - Number of pixels */
+	       int                 bpp,	/* I - Bytes per pixel */
+	       unsigned char       *comp)/* I - Compression buffer */
+{
+  int		x,			/* Current pixel */
+		count,			/* Count of pixels for output */
+		max;			/* Maximum count */
+
+
+  for (x = 0; x < width; x += count, line += count * bpp)
+  {
+    max = width - x - 1;
+    if (max > 127)
+      max = 127;
+
+    if (max > 0 && !memcmp(line, line + bpp, bpp))
+    {
+     /*
+      * Repeated pixels...
+      */
+
+      count = 2 + pack_equal(line + bpp, (max - 1) * bpp, bpp) / bpp;
+
+      *comp++ = count - 1;
+      memcpy(comp, line, bpp);
+      comp += bpp;
+    }
+    else
+    {
+     /*
+      * Literal pixels, up to the start of the next run...
+      */
+
+      if (bpp == 1)
+      {
+        count = 1 + pack_differ(line + 1, max - 2 > 0 ? max - 2 : 0);
+
+        if (width - x - count < 3 && width - x <= 128)
+	  count = width - x;
+      }
+      else
+        for (count = 1;
+	     count < max &&
+	         memcmp(line + count * bpp, line + (count + 1) * bpp, bpp);
+	     count ++);
+
+      if (count == width - x - 1)
+        count ++;			/* Take the last pixel along */
+
+      *comp++ = count == 1 ? 0 : 257 - count;
+      memcpy(comp, line, count * bpp);
+      comp += count * bpp;
+    }
+  }
+
+  return (comp);
+}
+
+
+/*
+ * 'cupsUnpackPixels()' - Decode a PWG pack-bits encoded line of pixels.
+ *
+ * Returns NULL if the data ends before the line is complete.  Pixels
+ * running past the end of the line are dropped.
+ */
+
+const unsigned char *			/* O - End of used data or NULL */
+cupsUnpackPixels(const unsigned char *comp,
+					/* I - Compressed data */
+                 const unsigned char *comp_end,
+					/* I - End of compressed data */
+		 unsigned char       *line,
+					/* O - Pixels */
+		 int                 width,
+					/* I - Number of pixels */
+		 int                 bpp,
+					/* I - Bytes per pixel */
+		 unsigned char       blank)
+					/* I - Byte value for blank pixels */
+{
+  int		x,			/* Current pixel */
+		count,			/* Count of pixels */
+		bytes;			/* Bytes to copy */
+
+
+  for (x = 0; x < width;)
+  {
+    if (comp >= comp_end)
+      return (NULL);
+
+    if (*comp == 128)
+    {
+     /*
+      * Blank rest of line...
+      */
+
+      comp ++;
+      memset(line + x * bpp, blank, (width - x) * bpp);
+      break;
+    }
+    else if (*comp < 128)
+    {
+     /*
+      * Repeated pixel...
+      */
+
+      count = *comp++ + 1;
+
+      if (comp_end - comp < bpp)
+        return (NULL);
+
+      if (count > width - x)
+        count = width - x;
+
+      if (bpp == 1)
+        memset(line + x, *comp, count);
+      else
+      {
+       /*
+        * Double the copied pixels until the run is filled...
+	*/
+
+        memcpy(line + x * bpp, comp, bpp);
+
+        for (bytes = bpp; bytes < count * bpp; bytes *= 2)
+	  memcpy(line + x * bpp + bytes, line + x * bpp,
+	         bytes < count * bpp - bytes ? bytes : count * bpp - bytes);
+      }
+
+      comp += bpp;
+      x    += count;
+    }
+    else
+    {
+     /*
+      * Literal pixels...
+      */
+
+      count = 257 - *comp++;
+      bytes = count * bpp;
+
+      if (comp_end - comp < bytes)
+        return (NULL);
+
+      if (count > width - x)
+        count = width - x;
+
+      memcpy(line + x * bpp, comp, count * bpp);
+
+      comp += bytes;
+      x    += count;
+    }
+  }
+
+  return (comp);
+}
+
+
+/*
+ * 'pack_differ()' - Count bytes which don't start a run of three.
+ *
+ * A run of two costs as much as leaving the bytes in a literal sequence,
+ * so literal sequences only end where a run of three starts.
+ */
+
+static int				/* O - Number of bytes */
+pack_differ(const unsigned char *bytes,	/* I - Bytes, two more are read */
+            int                 length)	/* I - Maximum count */
+{
+  int		count = 0;		/* Count of bytes */
+#ifdef __SSE2__
+  __m128i	next;			/* Bytes one later */
+  unsigned	mask;			/* Bytes starting a run of three */
+
+
+  for (; count + 16 <= length; count += 16)
+  {
+    next = _mm_loadu_si128((const __m128i *)(bytes + count + 1));
+    mask = _mm_movemask_epi8(
+               _mm_and_si128(
+	           _mm_cmpeq_epi8(
+		       _mm_loadu_si128((const __m128i *)(bytes + count)),
+		       next),
+		   _mm_cmpeq_epi8(
+		       next,
+		       _mm_loadu_si128((const __m128i *)(bytes + count + 2)))));
+
+    if (mask)
+      return (count + __builtin_ctz(mask));
+  }
+#endif /* __SSE2__ */
+
+  while (count < length &&
+         (bytes[count] != bytes[count + 1] ||
+	  bytes[count + 1] != bytes[count + 2]))
+    count ++;
+
+  return (count);
+}
+
+
+/*
+ * 'pack_equal()' - Count bytes which match the byte a pixel later.
+ *
+ * A run of N pixels with "step" bytes each has (N - 1) * step leading
+ * bytes equal to the byte a pixel later, whatever the pixel size.
+ */
+
+static int				/* O - Number of bytes */
+pack_equal(const unsigned char *bytes,	/* I - Bytes, step more are read */
+           int                 length,	/* I - Maximum count */
+	   int                 step)	/* I - Bytes per pixel */
+{
+  int		count = 0;		/* Count of bytes */
+#ifdef __SSE2__
+  unsigned	mask;			/* Bytes which differ */
+
+
+  for (; count + 16 <= length; count += 16)
+  {
+    mask = ~_mm_movemask_epi8(
+                _mm_cmpeq_epi8(
+	            _mm_loadu_si128((const __m128i *)(bytes + count)),
+		    _mm_loadu_si128((const __m128i *)(bytes + count + step)))) &
+	   0xffff;
+
+    if (mask)
+      return (count + __builtin_ctz(mask));
+  }
+#endif /* __SSE2__ */
+
+  while (count < length && bytes[count] == bytes[count + step])
+    count ++;
+
+  return (count);
+}
@@ -0,0 +1,422 @@
+/*
+ *   PPD settings cache functions for CUPS filters.
+ *
+ *   Opening a big PPD file, marking the options, and interpreting them
+ *   into a raster header takes much longer than the actual setup of a
+ *   filter.  The result only depends on the PPD file and the job options,
+ *   so filters can store what they derived from the PPD file in a cache
+ *   file and map it into memory for the next job with the same settings.
+ *
+ *   Distribution and use rights are outlined in the file "COPYING"
+ *   which should have been included with this file.
+ *
+ * Contents:
+ *
+ *   cupsPPDCacheClose()   - Close a PPD settings cache entry.
+ *   cupsPPDCacheGet()     - Get the cached settings.
+ *   cupsPPDCacheGetData() - Get cached data of variable size.
+ *   cupsPPDCacheOpen()    - Find the cache entry for a PPD file and options.
+ *   cupsPPDCachePut()     - Store the settings in the cache.
+ *   ppd_cache_compare()   - Compare two options by name.
+ *   ppd_cache_volatile()  - Is an option specific to a single job?
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include <config.h>
+#include "ppdcache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/*
+ * Constants...
+ */
+
+#define PPD_CACHE_MAGIC		"CFPPDC1"
+					/* Cache file magic, with version */
+#define PPD_CACHE_SLOTS		64	/* Cache files per filter */
+
+
+/*
+ * Types...
+ */
+
+typedef struct ppd_cache_header_s	/**** Cache file header ****/
+{
+  char		magic[8];		/* PPD_CACHE_MAGIC */
+  unsigned	keylen,			/* Length of key */
+		datalen;		/* Length of settings */
+} ppd_cache_header_t;
+
+struct cups_ppd_cache_s			/**** Cached PPD settings ****/
+{
+  char		dirname[1024],		/* Cache directory */
+		filename[1024];		/* Cache file */
+  char		*key;			/* Key of the entry */
+  size_t	keylen;			/* Length of key */
+  void		*map;			/* Mapping of the cache file */
+  size_t	maplength;		/* Length of mapping */
+};
+
+
+/*
+ * Local functions...
+ */
+
+static int	ppd_cache_compare(const void *a, const void *b);
+static int	ppd_cache_volatile(const char *name);
+
+
+/*
+ * 'cupsPPDCacheClose()' - Close a PPD settings cache entry.
+ */
+
+void
+cupsPPDCacheClose(cups_ppd_cache_t *pc)	/* I - Cache entry */
+{
+  if (!pc)
+    return;
+
+  if (pc->map)
+    munmap(pc->map, pc->maplength);
+
+  free(pc->key);
+  free(pc);
+}
+
+
+/*
+ * 'cupsPPDCacheGet()' - Get the cached settings.
+ *
+ * The returned data is mapped from the cache file and stays valid until
+ * the entry is closed.
+ */
+
+const void *				/* O - Settings or NULL if not cached */
+cupsPPDCacheGet(cups_ppd_cache_t *pc,	/* I - Cache entry */
+                size_t           size)	/* I - Size of settings */
+{
+  const void	*data;			/* Cached settings */
+  size_t	datalen;		/* Length of cached settings */
+
+
+  if ((data = cupsPPDCacheGetData(pc, &datalen)) != NULL && datalen != size)
+  {
+    munmap(pc->map, pc->maplength);
+    pc->map = NULL;
+    return (NULL);
+  }
+
+  return (data);
+}
+
+
+/*
+ * 'cupsPPDCacheGetData()' - Get cached data of variable size.
+ *
+ * Like cupsPPDCacheGet(), but for data whose size is only known when it
+ * is stored, like a serialized color transform.
+ */
+
+const void *				/* O - Data or NULL if not cached */
+cupsPPDCacheGetData(cups_ppd_cache_t *pc,/* I - Cache entry */
+                    size_t           *size)
+					/* O - Size of data */
+{
+  int			fd;		/* Cache file */
+  struct stat		fileinfo;	/* Cache file information */
+  size_t		offset;		/* Offset of data */
+  ppd_cache_header_t	*header;	/* Header of cache file */
+
+
+  if (size)
+    *size = 0;
+
+  if (!pc || !size)
+    return (NULL);
+
+  if (pc->map)
+  {
+    munmap(pc->map, pc->maplength);
+    pc->map = NULL;
+  }
+
+  offset = (sizeof(ppd_cache_header_t) + pc->keylen + 7) & ~(size_t)7;
+
+  if ((fd = open(pc->filename, O_RDONLY)) < 0)
+    return (NULL);
+
+  if (fstat(fd, &fileinfo) || fileinfo.st_size < (off_t)offset)
+  {
+    close(fd);
+    return (NULL);
+  }
+
+  pc->maplength = (size_t)fileinfo.st_size;
+  pc->map       = mmap(NULL, pc->maplength, PROT_READ, MAP_SHARED, fd, 0);
+
+  close(fd);
+
+  if (pc->map == MAP_FAILED)
+  {
+    pc->map = NULL;
+    return (NULL);
+  }
+
+ /*
+  * Another job with the same cache slot may have stored different
+  * data, so compare the whole key...
+  */
+
+  header = (ppd_cache_header_t *)pc->map;
+
+  if (memcmp(header->magic, PPD_CACHE_MAGIC, sizeof(header->magic)) ||
+      header->keylen != pc->keylen ||
+      header->datalen != pc->maplength - offset ||
+      memcmp(header + 1, pc->key, pc->keylen))
+  {
+    munmap(pc->map, pc->maplength);
+    pc->map = NULL;
+    return (NULL);
+  }
+
+  *size = header->datalen;
+
+  return ((char *)pc->map + offset);
+}
+
+
+/*
+ * 'cupsPPDCacheOpen()' - Find the cache entry for a PPD file and options.
+ *
+ * The key of the entry consists of the PPD file name, its size and
+ * modification time, the name of the settings (which should include the
+ * filter name and a version number), and the options of the job which
+ * can have an influence on the settings.  The cache is kept in the
+ * "cups-filters" subdirectory of CUPS_CACHEDIR; without CUPS_CACHEDIR
+ * in the environment there is no cache and NULL is returned.
+ *
+ * Nothing here is specific to PPD files, other files which are expensive
+ * to interpret, like ICC profiles, can be used the same way.
+ */
+
+cups_ppd_cache_t *			/* O - Cache entry or NULL */
+cupsPPDCacheOpen(const char    *ppdfile,/* I - PPD file */
+                 const char    *name,	/* I - Name of settings */
+		 int           num_options,
+					/* I - Number of options */
+		 cups_option_t *options)/* I - Options */
+{
+  cups_ppd_cache_t	*pc;		/* Cache entry */
+  const char		*cachedir;	/* CUPS_CACHEDIR environment variable */
+  struct stat		fileinfo;	/* PPD file information */
+  cups_option_t		**sorted;	/* Options sorted by name */
+  size_t		keysize;	/* Size of key buffer */
+  char			*keyptr;	/* Pointer into key */
+  unsigned long long	hash;		/* Hash of key */
+  int			i;		/* Looping var */
+
+
+  if (!ppdfile || !*ppdfile || !name ||
+      (cachedir = getenv("CUPS_CACHEDIR")) == NULL || !*cachedir ||
+      stat(ppdfile, &fileinfo))
+    return (NULL);
+
+  if ((pc = calloc(1, sizeof(cups_ppd_cache_t))) == NULL)
+    return (NULL);
+
+  snprintf(pc->dirname, sizeof(pc->dirname), "%s/cups-filters", cachedir);
+
+ /*
+  * Sort the options, their order does not matter...
+  */
+
+  if ((sorted = calloc(num_options + 1, sizeof(cups_option_t *))) == NULL)
+  {
+    free(pc);
+    return (NULL);
+  }
+
+  keysize = strlen(ppdfile) + strlen(name) + 80;
+
+  for (i = 0; i < num_options; i ++)
+  {
+    sorted[i] = options + i;
+    keysize   += strlen(options[i].name) + strlen(options[i].value) + 2;
+  }
+
+  qsort(sorted, num_options, sizeof(cups_option_t *), ppd_cache_compare);
+
+ /*
+  * Build the key...
+  */
+
+  if ((pc->key = malloc(keysize)) == NULL)
+  {
+    free(sorted);
+    free(pc);
+    return (NULL);
+  }
+
+  keyptr = pc->key;
+  keyptr += snprintf(keyptr, keysize, "%s\n%llu %lld %lld\n%s\n", ppdfile,
+                     (unsigned long long)fileinfo.st_ino,
+		     (long long)fileinfo.st_size,
+		     (long long)fileinfo.st_mtime, name);
+
+  for (i = 0; i < num_options; i ++)
+    if (!ppd_cache_volatile(sorted[i]->name))
+      keyptr += snprintf(keyptr, keysize - (keyptr - pc->key), "%s=%s\n",
+                         sorted[i]->name, sorted[i]->value);
+
+  pc->keylen = keyptr - pc->key;
+
+  free(sorted);
+
+ /*
+  * The file name is the name of the settings plus a slot number from a
+  * FNV-1a hash of the key, so that the cache cannot grow without limits...
+  */
+
+  for (hash = 14695981039346656037ULL, keyptr = pc->key; *keyptr; keyptr ++)
+  {
+    hash ^= (unsigned char)*keyptr;
+    hash *= 1099511628211ULL;
+  }
+
+  if (snprintf(pc->filename, sizeof(pc->filename), "%s/%s-%02u", pc->dirname,
+               name, (unsigned)(hash % PPD_CACHE_SLOTS)) >=
+          (int)sizeof(pc->filename))
+  {
+    cupsPPDCacheClose(pc);
+    return (NULL);
+  }
+
+  return (pc);
+}
+
+
+/*
+ * 'cupsPPDCachePut()' - Store the settings in the cache.
+ */
+
+int					/* O - 0 on success, -1 on error */
+cupsPPDCachePut(cups_ppd_cache_t *pc,	/* I - Cache entry */
+                const void       *data,	/* I - Settings */
+		size_t           size)	/* I - Size of settings */
+{
+  int			fd;		/* Temporary file */
+  char			tempfile[1040],	/* Temporary file name */
+			*buffer,	/* Contents of cache file */
+			*bufptr;	/* Pointer into contents */
+  size_t		offset,		/* Offset of settings */
+			length;		/* Length of cache file */
+  ssize_t		bytes;		/* Bytes written */
+  ppd_cache_header_t	header;		/* Header of cache file */
+
+
+  if (!pc || !data)
+    return (-1);
+
+  if (mkdir(pc->dirname, 0770) && errno != EEXIST)
+    return (-1);
+
+  offset = (sizeof(ppd_cache_header_t) + pc->keylen + 7) & ~(size_t)7;
+  length = offset + size;
+
+  if ((buffer = calloc(1, length)) == NULL)
+    return (-1);
+
+  memcpy(header.magic, PPD_CACHE_MAGIC, sizeof(header.magic));
+  header.keylen  = (unsigned)pc->keylen;
+  header.datalen = (unsigned)size;
+
+  memcpy(buffer, &header, sizeof(header));
+  memcpy(buffer + sizeof(header), pc->key, pc->keylen);
+  memcpy(buffer + offset, data, size);
+
+ /*
+  * Write a new file and rename it, so that other filters reading the
+  * cache at the same time see either the old or the new entry...
+  */
+
+  snprintf(tempfile, sizeof(tempfile), "%s.XXXXXX", pc->filename);
+
+  if ((fd = mkstemp(tempfile)) < 0)
+  {
+    free(buffer);
+    return (-1);
+  }
+
+  for (bufptr = buffer; length > 0; length -= bytes, bufptr += bytes)
+    if ((bytes = write(fd, bufptr, length)) < 0)
+    {
+      if (errno == EINTR)
+      {
+        bytes = 0;
+	continue;
+      }
+
+      break;
+    }
+
+  free(buffer);
+
+  if (close(fd) || length > 0 || rename(tempfile, pc->filename))
+  {
+    unlink(tempfile);
+    return (-1);
+  }
+
+  return (0);
+}
+
+
+/*
+ * 'ppd_cache_compare()' - Compare two options by name.
+ */
+
+static int				/* O - Result of comparison */
+ppd_cache_compare(const void *a,	/* I - First option */
+                  const void *b)	/* I - Second option */
+{
+  return (strcmp((*(cups_option_t * const *)a)->name,
+                 (*(cups_option_t * const *)b)->name));
+}
+
+
+/*
+ * 'ppd_cache_volatile()' - Is an option specific to a single job?
+ *
+ * These options are different for every job but never change how a PPD
+ * file is interpreted, so they are left out of the cache key.
+ */
+
+static int				/* O - 1 if volatile, 0 otherwise */
+ppd_cache_volatile(const char *name)	/* I - Option name */
+{
+  int		i;			/* Looping var */
+  static const char * const prefixes[] =
+  {					/* Prefixes of volatile options */
+    "date-time-at-",
+    "job-originating-",
+    "job-uuid",
+    "time-at-"
+  };
+
+
+  for (i = 0; i < (int)(sizeof(prefixes) / sizeof(prefixes[0])); i ++)
+    if (!strncmp(name, prefixes[i], strlen(prefixes[i])))
+      return (1);
+
+  return (0);
+}
@@ -0,0 +1,53 @@
+/*
+ *   PPD settings cache header file for CUPS filters.
+ *
+ *   Distribution and use rights are outlined in the file "COPYING"
+ *   which should have been included with this file.
+ */
+
+#ifndef _CUPS_FILTERS_PPDCACHE_H_
+#  define _CUPS_FILTERS_PPDCACHE_H_
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif /* __cplusplus */
+
+/*
+ * Include necessary headers...
+ */
+
+#  include <stddef.h>
+#  include <cups/cups.h>
+
+
+/*
+ * Types and structures...
+ */
+
+typedef struct cups_ppd_cache_s cups_ppd_cache_t;
+					/**** Cached PPD settings ****/
+
+
+/*
+ * Prototypes...
+ */
+
+extern void		cupsPPDCacheClose(cups_ppd_cache_t *pc);
+extern const void	*cupsPPDCacheGet(cups_ppd_cache_t *pc, size_t size);
+extern const void	*cupsPPDCacheGetData(cups_ppd_cache_t *pc,
+			                     size_t *size);
+extern cups_ppd_cache_t	*cupsPPDCacheOpen(const char *ppdfile,
+			                  const char *name, int num_options,
+					  cups_option_t *options);
+extern int		cupsPPDCachePut(cups_ppd_cache_t *pc, const void *data,
+			                size_t size);
+
+#  ifdef __cplusplus
+}
+#  endif /* __cplusplus */
+
+#endif /* !_CUPS_FILTERS_PPDCACHE_H_ */
+
+/*
+ * End
+ */
@@ -16,6 +16,7 @@
  *   cupsRGBDoRGB()  - Do a RGB separation...
  *   cupsRGBLoad()   - Load a RGB color profile from a PPD file.
  *   cupsRGBNew()    - Create a new RGB color separation.
+ *   cups_rgb_cube() - Interpolate a color in the sample cube.
  */
 
 /*
@@ -25,6 +26,22 @@
 #include "driver.h"
 
 
+/*
+ * Local functions...
+ */
+
+static void	cups_rgb_cube(cups_rgb_t *rgbptr, int r, int g, int b,
+		              unsigned char *output);
+
+
+/*
+ * Color cache slot for a given RGB color...
+ */
+
+#define cups_rgb_hash(rgb) \
+	((int)(((unsigned)(rgb) * 2654435761U) >> 24) & (CUPS_RGB_CACHE - 1))
+
+
 /*
  * 'cupsRGBDelete()' - Delete a color separation.
  */
@@ -39,6 +56,7 @@ cupsRGBDelete(cups_rgb_t *rgbptr)	/* I - Color separation */
   free(rgbptr->colors[0][0]);
   free(rgbptr->colors[0]);
   free(rgbptr->colors);
+  free(rgbptr->lut);
   free(rgbptr);
 }
 
@@ -173,16 +191,13 @@ cupsRGBDoRGB(cups_rgb_t          *rgbptr,
   int			i;		/* Looping var */
   int			rgb,		/* Current RGB color */
 			lastrgb;	/* Previous RGB color */
-  int			r, ri, rm0, rm1, rs,
-					/* Current red index, multipliexs, and row offset */
-			g, gi, gm0, gm1, gs,
-					/* Current green ... */
-			b, bi, bm0, bm1, bs;
-					/* Current blue ... */
-  const unsigned char	*color;		/* Current color data */
-  int			tempr,		/* Current separation colors */
-			tempg,		/* ... */
-			tempb ;		/* ... */
+  int			r, g, b;	/* Current RGB values */
+  int			rf, gf, bf;	/* Fractions to next LUT point */
+  int			rs, gs, bs;	/* LUT row offsets */
+  int			d1, d2, d3,	/* Offsets of tetrahedron vertices */
+			w0, w1, w2, w3;	/* Vertex weights */
+  const unsigned char	*color;		/* Current LUT data */
+  int			hash;		/* Color cache slot */
   int			rgbsize;	/* Separation data size */
 
 
@@ -199,8 +214,8 @@ cupsRGBDoRGB(cups_rgb_t          *rgbptr,
 
   lastrgb = -1;
   rgbsize = rgbptr->num_channels;
-  rs      = rgbptr->cube_size * rgbptr->cube_size * rgbptr->num_channels;
-  gs      = rgbptr->cube_size * rgbptr->num_channels;
+  rs      = rgbptr->lut_size * rgbptr->lut_size * rgbptr->num_channels;
+  gs      = rgbptr->lut_size * rgbptr->num_channels;
   bs      = rgbptr->num_channels;
 
  /*
@@ -240,6 +255,7 @@ cupsRGBDoRGB(cups_rgb_t          *rgbptr,
       memcpy(output, rgbptr->black, rgbsize);
 
       output += rgbptr->num_channels;
+      lastrgb = rgb;
       continue;
     }
     else if (rgb == 0xffffff && rgbptr->cache_init)
@@ -251,50 +267,85 @@ cupsRGBDoRGB(cups_rgb_t          *rgbptr,
       memcpy(output, rgbptr->white, rgbsize);
 
       output += rgbptr->num_channels;
+      lastrgb = rgb;
       continue;
     }
 
-   /*
-    * Nope, figure this one out on our own...
-    */
+    lastrgb = rgb;
+    hash    = cups_rgb_hash(rgb);
 
-    ri  = rgbptr->cube_index[r];
-    rm0 = rgbptr->cube_mult[r];
-    rm1 = 256 - rm0;
+    if (rgbptr->cache_rgb[hash] == rgb)
+    {
+     /*
+      * Copy recently used color and continue...
+      */
 
-    gi  = rgbptr->cube_index[g];
-    gm0 = rgbptr->cube_mult[g];
-    gm1 = 256 - gm0;
+      memcpy(output, rgbptr->cache_colors[hash], rgbsize);
 
-    bi  = rgbptr->cube_index[b];
-    bm0 = rgbptr->cube_mult[b];
-    bm1 = 256 - bm0;
+      output += rgbptr->num_channels;
+      continue;
+    }
 
-    color = rgbptr->colors[ri][gi][bi];
+   /*
+    * Nope, do a tetrahedral interpolation in the device LUT.  The cube
+    * around the color is split along its gray diagonal into 6 tetrahedra
+    * and the one containing the color is selected by the ordering of the
+    * fractional parts, so only 4 of the 8 corners are needed...
+    */
+
+    color = rgbptr->lut + rgbptr->lut_index[r] * rs +
+            rgbptr->lut_index[g] * gs + rgbptr->lut_index[b] * bs;
+    rf    = rgbptr->lut_frac[r];
+    gf    = rgbptr->lut_frac[g];
+    bf    = rgbptr->lut_frac[b];
 
-    for (i = rgbptr->num_channels; i > 0; i --, color ++)
+    if (rf >= gf)
+    {
+      if (gf >= bf)
+      {
+        d1 = rs; d2 = rs + gs; w0 = 256 - rf; w1 = rf - gf; w2 = gf - bf;
+	w3 = bf;
+      }
+      else if (rf >= bf)
+      {
+        d1 = rs; d2 = rs + bs; w0 = 256 - rf; w1 = rf - bf; w2 = bf - gf;
+	w3 = gf;
+      }
+      else
+      {
+        d1 = bs; d2 = rs + bs; w0 = 256 - bf; w1 = bf - rf; w2 = rf - gf;
+	w3 = gf;
+      }
+    }
+    else
     {
-      tempb = (color[0] * bm0 + color[bs] * bm1) / 256;
-      tempg = tempb  * gm0;
-      tempb = (color[gs] * gm0 + color[gs + bs] * bm1) / 256;
-      tempg = (tempg + tempb  * gm1) / 256;
+      if (bf > gf)
+      {
+        d1 = bs; d2 = gs + bs; w0 = 256 - bf; w1 = bf - gf; w2 = gf - rf;
+	w3 = rf;
+      }
+      else if (bf > rf)
+      {
+        d1 = gs; d2 = gs + bs; w0 = 256 - gf; w1 = gf - bf; w2 = bf - rf;
+	w3 = rf;
+      }
+      else
+      {
+        d1 = gs; d2 = rs + gs; w0 = 256 - gf; w1 = gf - rf; w2 = rf - bf;
+	w3 = bf;
+      }
+    }
 
-      tempr = tempg * rm0;
+    d3 = rs + gs + bs;
 
-      tempb = (color[rs] * bm0 + color[rs + bs] * bm1) / 256;
-      tempg = tempb  * gm0;
-      tempb = (color[rs + gs] * bm0 + color[rs + gs + bs] * bm1) / 256;
-      tempg = (tempg + tempb  * gm1) / 256;
+    for (i = 0; i < rgbptr->num_channels; i ++, color ++)
+      output[i] = (color[0] * w0 + color[d1] * w1 + color[d2] * w2 +
+                   color[d3] * w3 + 128) >> 8;
 
-      tempr = (tempr + tempg * rm1) / 256;
+    rgbptr->cache_rgb[hash] = rgb;
+    memcpy(rgbptr->cache_colors[hash], output, rgbsize);
 
-      if (tempr > 255)
-        *output++ = 255;
-      else if (tempr < 0)
-        *output++ = 0;
-      else
-        *output++ = tempr;
-    }
+    output += rgbptr->num_channels;
   }
 }
 
@@ -428,6 +479,8 @@ cupsRGBNew(int           num_samples,	/* I - Number of samples */
   int			i;		/* Looping var */
   int			r, g, b;	/* Current RGB */
   int			tempsize;	/* Sibe of main arrays */
+  int			lut_size;	/* Size of device LUT on a side */
+  int			pos;		/* Position in device LUT */
   unsigned char		*tempc;		/* Pointer for C arrays */
   unsigned char		**tempb ;	/* Pointer for Z arrays */
   unsigned char		***tempg;	/* Pointer for Y arrays */
@@ -439,7 +492,8 @@ cupsRGBNew(int           num_samples,	/* I - Number of samples */
   * Range-check the input...
   */
 
-  if (!samples || num_samples != (cube_size * cube_size * cube_size) ||
+  if (!samples || cube_size < 2 ||
+      num_samples != (cube_size * cube_size * cube_size) ||
       num_channels <= 0 || num_channels > CUPS_MAX_RGB)
     return (NULL);
 
@@ -456,13 +510,20 @@ cupsRGBNew(int           num_samples,	/* I - Number of samples */
 
   tempsize = cube_size * cube_size * cube_size;	/* FUTURE: num_samples < cs^3 */
 
-  tempc = calloc(tempsize, num_channels);
-  tempb = calloc(tempsize, sizeof(unsigned char *));
-  tempg = calloc(cube_size * cube_size, sizeof(unsigned char **));
-  tempr = calloc(cube_size, sizeof(unsigned char ***));
+  lut_size = (16 % (cube_size - 1)) ? 33 : 17;
 
-  if (tempc == NULL || tempb  == NULL || tempg == NULL || tempr == NULL)
+  tempc       = calloc(tempsize, num_channels);
+  tempb       = calloc(tempsize, sizeof(unsigned char *));
+  tempg       = calloc(cube_size * cube_size, sizeof(unsigned char **));
+  tempr       = calloc(cube_size, sizeof(unsigned char ***));
+  rgbptr->lut = calloc(lut_size * lut_size * lut_size, num_channels);
+
+  if (tempc == NULL || tempb  == NULL || tempg == NULL || tempr == NULL ||
+      rgbptr->lut == NULL)
   {
+    if (rgbptr->lut)
+      free(rgbptr->lut);
+
     free(rgbptr);
 
     if (tempc)
@@ -524,6 +585,41 @@ cupsRGBNew(int           num_samples,	/* I - Number of samples */
       rgbptr->cube_mult[i] = 255 - ((i * (cube_size - 1)) & 255);
   }
 
+ /*
+  * Resample the cube into the device LUT used by cupsRGBDoRGB(); the LUT
+  * has a fixed 17 point grid (33 when the cube points don't fall on it)
+  * so that the per-pixel work is a table index plus a tetrahedral
+  * interpolation...
+  */
+
+  rgbptr->lut_size = lut_size;
+
+  for (i = 0; i < 256; i ++)
+  {
+    pos = i * (lut_size - 1) * 256 / 255;
+
+    if ((pos >> 8) >= (lut_size - 1))
+    {
+      rgbptr->lut_index[i] = lut_size - 2;
+      rgbptr->lut_frac[i]  = 256;
+    }
+    else
+    {
+      rgbptr->lut_index[i] = pos >> 8;
+      rgbptr->lut_frac[i]  = pos & 255;
+    }
+  }
+
+  for (tempc = rgbptr->lut, r = 0; r < lut_size; r ++)
+    for (g = 0; g < lut_size; g ++)
+      for (b = 0; b < lut_size; b ++, tempc += num_channels)
+        cups_rgb_cube(rgbptr, (r * 255 + lut_size / 2) / (lut_size - 1),
+	              (g * 255 + lut_size / 2) / (lut_size - 1),
+	              (b * 255 + lut_size / 2) / (lut_size - 1), tempc);
+
+  for (i = 0; i < CUPS_RGB_CACHE; i ++)
+    rgbptr->cache_rgb[i] = -1;
+
  /*
   * Generate the black and white cache values for the separation...
   */
@@ -549,3 +645,71 @@ cupsRGBNew(int           num_samples,	/* I - Number of samples */
   return (rgbptr);
 }
 
+
+/*
+ * 'cups_rgb_cube()' - Interpolate a color in the sample cube.
+ */
+
+static void
+cups_rgb_cube(cups_rgb_t    *rgbptr,	/* I - Color separation */
+              int           r,		/* I - Red value */
+              int           g,		/* I - Green value */
+	      int           b,		/* I - Blue value */
+	      unsigned char *output)	/* O - Device-N color */
+{
+  int			i;		/* Looping var */
+  int			ri, rm0, rm1, rs,
+					/* Current red index, multipliexs, and row offset */
+			gi, gm0, gm1, gs,
+					/* Current green ... */
+			bi, bm0, bm1, bs;
+					/* Current blue ... */
+  const unsigned char	*color;		/* Current color data */
+  int			tempr,		/* Current separation colors */
+			tempg,		/* ... */
+			tempb ;		/* ... */
+
+
+  rs  = rgbptr->cube_size * rgbptr->cube_size * rgbptr->num_channels;
+  gs  = rgbptr->cube_size * rgbptr->num_channels;
+  bs  = rgbptr->num_channels;
+
+  ri  = rgbptr->cube_index[r];
+  rm0 = rgbptr->cube_mult[r];
+  rm1 = 256 - rm0;
+
+  gi  = rgbptr->cube_index[g];
+  gm0 = rgbptr->cube_mult[g];
+  gm1 = 256 - gm0;
+
+  bi  = rgbptr->cube_index[b];
+  bm0 = rgbptr->cube_mult[b];
+  bm1 = 256 - bm0;
+
+  color = rgbptr->colors[ri][gi][bi];
+
+  for (i = rgbptr->num_channels; i > 0; i --, color ++)
+  {
+    tempb = (color[0] * bm0 + color[bs] * bm1) / 256;
+    tempg = tempb  * gm0;
+    tempb = (color[gs] * bm0 + color[gs + bs] * bm1) / 256;
+    tempg = (tempg + tempb  * gm1) / 256;
+
+    tempr = tempg * rm0;
+
+    tempb = (color[rs] * bm0 + color[rs + bs] * bm1) / 256;
+    tempg = tempb  * gm0;
+    tempb = (color[rs + gs] * bm0 + color[rs + gs + bs] * bm1) / 256;
+    tempg = (tempg + tempb  * gm1) / 256;
+
+    tempr = (tempr + tempg * rm1) / 256;
+
+    if (tempr > 255)
+      *output++ = 255;
+    else if (tempr < 0)
+      *output++ = 0;
+    else
+      *output++ = tempr;
+  }
+}
+
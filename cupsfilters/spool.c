@@ -0,0 +1,274 @@
+/*
+ *   Input spooling functions for CUPS filters.
+ *
+ *   Distribution and use rights are outlined in the file "COPYING"
+ *   which should have been included with this file.
+ *
+ * Contents:
+ *
+ *   cupsSpoolClose()  - Close a spooled input file.
+ *   cupsSpoolFile()   - Get a stdio stream for a spooled input file.
+ *   cupsSpoolOpen()   - Spool the input from a file descriptor.
+ *   cups_spool_copy() - Copy all data from one file descriptor to another.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include <config.h>
+#include "spool.h"
+#include <cups/cups.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/*
+ * Constants...
+ */
+
+#define CUPS_SPOOL_CHUNK	1048576	/* Copy up to 1MB at a time */
+
+
+/*
+ * Local functions...
+ */
+
+static int	cups_spool_copy(int infd, int outfd);
+
+
+/*
+ * 'cupsSpoolClose()' - Close a spooled input file.
+ */
+
+void
+cupsSpoolClose(cups_spool_t *spool)	/* I - Spooled input file */
+{
+  if (!spool)
+    return;
+
+  if (spool->map)
+    munmap(spool->map, spool->maplength);
+
+  if (spool->own_fd && spool->fd >= 0)
+    close(spool->fd);
+
+  free(spool);
+}
+
+
+/*
+ * 'cupsSpoolFile()' - Get a stdio stream for a spooled input file.
+ *
+ * The stream is positioned at the start of the data and has its own
+ * file descriptor, so it can be closed independently of the spool.
+ */
+
+FILE *					/* O - Stream or NULL on error */
+cupsSpoolFile(cups_spool_t *spool)	/* I - Spooled input file */
+{
+  int	fd;				/* Duplicated file descriptor */
+  FILE	*fp;				/* Stream */
+
+
+  if (!spool)
+    return (NULL);
+
+  if ((fd = dup(spool->fd)) < 0)
+    return (NULL);
+
+  if ((fp = fdopen(fd, "rb")) == NULL)
+  {
+    close(fd);
+    return (NULL);
+  }
+
+  if (fseeko(fp, spool->offset, SEEK_SET))
+  {
+    fclose(fp);
+    return (NULL);
+  }
+
+  return (fp);
+}
+
+
+/*
+ * 'cupsSpoolOpen()' - Spool the input from a file descriptor.
+ *
+ * If the descriptor is a regular file it is used in place.  Otherwise
+ * (a pipe from the scheduler) the data is received into an anonymous
+ * memory file, or a deleted temporary file where memfd_create() is not
+ * available.  In both cases the data is mapped into memory so that it
+ * can be parsed without another copy.
+ */
+
+cups_spool_t *				/* O - Spooled input file or NULL */
+cupsSpoolOpen(int fd)			/* I - File descriptor to read */
+{
+  cups_spool_t	*spool;			/* Spooled input file */
+  struct stat	fileinfo;		/* File information */
+  char		tempfile[1024];		/* Temporary file name */
+
+
+  if ((spool = calloc(1, sizeof(cups_spool_t))) == NULL)
+    return (NULL);
+
+  if (!fstat(fd, &fileinfo) && S_ISREG(fileinfo.st_mode))
+  {
+   /*
+    * Already a file, use it directly from the current position...
+    */
+
+    spool->fd     = fd;
+    spool->own_fd = 0;
+
+    if ((spool->offset = lseek(fd, 0, SEEK_CUR)) < 0)
+      spool->offset = 0;
+  }
+  else
+  {
+   /*
+    * Receive the data...
+    */
+
+    spool->fd     = -1;
+    spool->own_fd = 1;
+
+#ifdef HAVE_MEMFD_CREATE
+    spool->fd = memfd_create("cups-filters-spool", MFD_CLOEXEC);
+#endif /* HAVE_MEMFD_CREATE */
+
+    if (spool->fd < 0)
+    {
+      if ((spool->fd = cupsTempFd(tempfile, sizeof(tempfile))) < 0)
+      {
+	fputs("ERROR: Can't create temporary file\n", stderr);
+	free(spool);
+	return (NULL);
+      }
+
+      unlink(tempfile);
+    }
+
+    if (cups_spool_copy(fd, spool->fd))
+    {
+      fprintf(stderr, "ERROR: Can't copy input to temporary file: %s\n",
+              strerror(errno));
+      cupsSpoolClose(spool);
+      return (NULL);
+    }
+
+    if (fstat(spool->fd, &fileinfo))
+    {
+      cupsSpoolClose(spool);
+      return (NULL);
+    }
+  }
+
+  if (fileinfo.st_size > spool->offset)
+    spool->length = (size_t)(fileinfo.st_size - spool->offset);
+
+  lseek(spool->fd, spool->offset, SEEK_SET);
+
+ /*
+  * Map the data; failure here is not fatal, callers then fall back to
+  * reading the file...
+  */
+
+  if (spool->length > 0)
+  {
+    spool->maplength = (size_t)fileinfo.st_size;
+    spool->map       = mmap(NULL, spool->maplength, PROT_READ, MAP_SHARED,
+                            spool->fd, 0);
+
+    if (spool->map == MAP_FAILED)
+    {
+      spool->map       = NULL;
+      spool->maplength = 0;
+    }
+    else
+    {
+      spool->data = (const char *)spool->map + spool->offset;
+
+#ifdef MADV_WILLNEED
+      madvise(spool->map, spool->maplength, MADV_WILLNEED);
+#endif /* MADV_WILLNEED */
+    }
+  }
+
+  return (spool);
+}
+
+
+/*
+ * 'cups_spool_copy()' - Copy all data from one file descriptor to another.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+cups_spool_copy(int infd,		/* I - Input file descriptor */
+                int outfd)		/* I - Output file descriptor */
+{
+  ssize_t	bytes,			/* Bytes read */
+		written;		/* Bytes written */
+  char		*buffer,		/* Copy buffer */
+		*bufptr;		/* Pointer into buffer */
+
+
+#ifdef HAVE_SPLICE
+ /*
+  * Move the data straight from the pipe into the file; this only works
+  * with a pipe on the input side, so fall back to read/write otherwise...
+  */
+
+  for (;;)
+  {
+    if ((bytes = splice(infd, NULL, outfd, NULL, CUPS_SPOOL_CHUNK,
+                        SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+      continue;
+    else if (bytes == 0)
+      return (0);
+    else if (errno != EINTR)
+      break;
+  }
+
+  if (errno != EINVAL && errno != ENOSYS)
+    return (-1);
+#endif /* HAVE_SPLICE */
+
+  if ((buffer = malloc(CUPS_SPOOL_CHUNK)) == NULL)
+    return (-1);
+
+  while ((bytes = read(infd, buffer, CUPS_SPOOL_CHUNK)) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      free(buffer);
+      return (-1);
+    }
+
+    for (bufptr = buffer; bytes > 0; bytes -= written, bufptr += written)
+      if ((written = write(outfd, bufptr, bytes)) < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+	{
+	  written = 0;
+	  continue;
+	}
+
+	free(buffer);
+	return (-1);
+      }
+  }
+
+  free(buffer);
+
+  return (0);
+}
@@ -0,0 +1,56 @@
+/*
+ *   Input spooling header file for CUPS filters.
+ *
+ *   Distribution and use rights are outlined in the file "COPYING"
+ *   which should have been included with this file.
+ */
+
+#ifndef _CUPS_FILTERS_SPOOL_H_
+#  define _CUPS_FILTERS_SPOOL_H_
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif /* __cplusplus */
+
+/*
+ * Include necessary headers...
+ */
+
+#  include <stdio.h>
+#  include <stdlib.h>
+#  include <sys/types.h>
+
+
+/*
+ * Types and structures...
+ */
+
+typedef struct cups_spool_s		/**** Spooled input file ****/
+{
+  int		fd;			/* File holding the data */
+  int		own_fd;			/* Close fd when done? */
+  off_t		offset;			/* Start of the data in the file */
+  size_t	length;			/* Length of the data */
+  void		*map;			/* Memory mapping of the file or NULL */
+  size_t	maplength;		/* Length of the mapping */
+  const char	*data;			/* Data in the mapping or NULL */
+} cups_spool_t;
+
+
+/*
+ * Prototypes...
+ */
+
+extern void		cupsSpoolClose(cups_spool_t *spool);
+extern FILE		*cupsSpoolFile(cups_spool_t *spool);
+extern cups_spool_t	*cupsSpoolOpen(int fd);
+
+#  ifdef __cplusplus
+}
+#  endif /* __cplusplus */
+
+#endif /* !_CUPS_FILTERS_SPOOL_H_ */
+
+/*
+ * End
+ */
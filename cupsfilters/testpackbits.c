@@ -0,0 +1,187 @@
+/*
+ *   Run-length coding test program for CUPS.
+ *
+ *   Distribution and use rights are outlined in the file "COPYING"
+ *   which should have been included with this file.
+ *
+ * Contents:
+ *
+ *   main()        - Encode and decode random lines.
+ *   fill_line()   - Fill a line with random runs of pixels.
+ *   unpack_bits() - Decode TIFF pack-bits data.
+ */
+
+/*
+ * Include necessary headers.
+ */
+
+#include "driver.h"
+#include <config.h>
+#include <string.h>
+
+
+/*
+ * Local functions...
+ */
+
+static void	fill_line(unsigned char *line, int width, int bpp);
+static int	unpack_bits(const unsigned char *comp,
+		            const unsigned char *comp_end,
+			    unsigned char *line);
+
+
+/*
+ * 'main()' - Encode and decode random lines.
+ */
+
+int				/* O - Exit status */
+main(void)
+{
+  int		i,		/* Looping var */
+		width,		/* Width of line */
+		bpp;		/* Bytes per pixel */
+  unsigned char	line[4096],	/* Line to encode */
+		comp[8192],	/* Compressed line */
+		*comp_end,	/* End of compressed line */
+		decoded[4096];	/* Decoded line */
+  static const int bpps[] = { 1, 3, 4 };
+				/* Pixel sizes to test */
+  static const unsigned char blank[] = { 1, 5, 128 };
+				/* Line ending in blank pixels */
+
+
+  srand(1);
+
+  for (i = 0; i < 10000; i ++)
+  {
+    bpp   = bpps[i % 3];
+    width = rand() % (sizeof(line) / bpp);
+
+    fill_line(line, width, bpp);
+
+   /*
+    * TIFF pack-bits...
+    */
+
+    comp_end = cupsPackBits(line, width * bpp, comp);
+
+    if (comp_end - comp > width * bpp + width * bpp / 128 + 1)
+    {
+      printf("cupsPackBits: FAIL (%d bytes for %d)\n", (int)(comp_end - comp),
+             width * bpp);
+      return (1);
+    }
+
+    if (unpack_bits(comp, comp_end, decoded) != width * bpp ||
+        memcmp(line, decoded, width * bpp))
+    {
+      printf("cupsPackBits: FAIL (bad data for %d bytes)\n", width * bpp);
+      return (1);
+    }
+
+   /*
+    * PWG pack-bits...
+    */
+
+    comp_end = cupsPackPixels(line, width, bpp, comp);
+
+    if (comp_end - comp > width * (bpp + 1))
+    {
+      printf("cupsPackPixels: FAIL (%d bytes for %dx%d)\n",
+             (int)(comp_end - comp), width, bpp);
+      return (1);
+    }
+
+    if (cupsUnpackPixels(comp, comp_end, decoded, width, bpp, 255) !=
+            comp_end ||
+        memcmp(line, decoded, width * bpp))
+    {
+      printf("cupsUnpackPixels: FAIL (bad data for %dx%d)\n", width, bpp);
+      return (1);
+    }
+
+    if (width > 0 &&
+        cupsUnpackPixels(comp, comp_end - 1, decoded, width, bpp, 255))
+    {
+      printf("cupsUnpackPixels: FAIL (short data for %dx%d)\n", width, bpp);
+      return (1);
+    }
+  }
+
+  if (cupsUnpackPixels(blank, blank + sizeof(blank), decoded, 10, 1, 255) !=
+          blank + sizeof(blank) ||
+      decoded[1] != 5 || decoded[2] != 255 || decoded[9] != 255)
+  {
+    puts("cupsUnpackPixels: FAIL (blank rest of line)");
+    return (1);
+  }
+
+  puts("cupsPackBits: PASS");
+  puts("cupsPackPixels: PASS");
+  puts("cupsUnpackPixels: PASS");
+
+  return (0);
+}
+
+
+/*
+ * 'fill_line()' - Fill a line with random runs of pixels.
+ */
+
+static void
+fill_line(unsigned char *line,		/* I - Line */
+          int           width,		/* I - Number of pixels */
+	  int           bpp)		/* I - Bytes per pixel */
+{
+  int	x, b,				/* Looping vars */
+	values,				/* Number of different values */
+	runs;				/* Chance of a run */
+
+
+  values = 1 + rand() % 4;
+  runs   = rand() % 4;
+
+  for (x = 0; x < width; x ++, line += bpp)
+    if (x > 0 && rand() % 4 < runs)
+      memcpy(line, line - bpp, bpp);
+    else
+      for (b = 0; b < bpp; b ++)
+        line[b] = rand() % values;
+}
+
+
+/*
+ * 'unpack_bits()' - Decode TIFF pack-bits data.
+ */
+
+static int				/* O - Number of bytes */
+unpack_bits(const unsigned char *comp,	/* I - Compressed data */
+            const unsigned char *comp_end,
+					/* I - End of compressed data */
+	    unsigned char       *line)	/* O - Decoded data */
+{
+  int		count,			/* Count of bytes */
+		length = 0;		/* Number of bytes */
+
+
+  while (comp < comp_end)
+  {
+    if (*comp < 128)
+    {
+      count = *comp++ + 1;
+      memcpy(line + length, comp, count);
+      comp += count;
+    }
+    else if (*comp > 128)
+    {
+      count = 257 - *comp++;
+      memset(line + length, *comp++, count);
+    }
+    else
+      return (-1);
+
+    length += count;
+  }
+
+  return (length);
+}
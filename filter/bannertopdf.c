@@ -37,9 +37,33 @@
 #include <cups/pwg.h>
 #endif /* HAVE_CUPS_1_7 */
 
+#include <cupsfilters/ppdcache.h>
+
 #include "banner.h"
 #include "pdf.h"
 
+#define TEMPLATE_CACHE_MAGIC "CFBANR1"
+
+/*
+ * Template prepared for a media size, as stored in the cache: this
+ * header, the text fields of the form, and the PDF file.
+ */
+typedef struct {
+    char magic[8];
+    float scale;
+    int form;
+    int nfields;
+    size_t pdflen;
+} template_cache_t;
+
+typedef struct {
+    cups_ppd_cache_t *pc;
+    float scale;
+    int form;           /* 1 = fields below, 0 = no form, -1 = look up */
+    int nfields;
+    const pdf_field_t *fields;
+} template_t;
+
 
 static float get_float_option(const char *name,
                               int noptions,
@@ -354,6 +378,91 @@ opt_t *get_known_opts(
     return opt;
 }
 
+/*
+ * Load the template resized to the page size and with the banner font
+ * added.  Banners are printed for every job, so the prepared template
+ * and the slots of its form fields are cached per template file and
+ * page size.
+ */
+static pdf_t *load_template(template_t *tmpl,
+                            const char *filename,
+                            float width,
+                            float length)
+{
+    char name[64];
+    const template_cache_t *cached;
+    template_cache_t *data;
+    pdf_field_t *fields;
+    pdf_t *doc, *copy;
+    char *pdf;
+    size_t size, pdflen;
+    int form, nfields;
+
+    memset(tmpl, 0, sizeof(*tmpl));
+    tmpl->form = -1;
+
+    snprintf(name, sizeof(name), "bannertopdf-%.2fx%.2f", width, length);
+    tmpl->pc = cupsPPDCacheOpen(filename, name, 0, NULL);
+
+    if ((cached = cupsPPDCacheGetData(tmpl->pc, &size)) != NULL &&
+        size >= sizeof(*cached) &&
+        !memcmp(cached->magic, TEMPLATE_CACHE_MAGIC, sizeof(cached->magic)) &&
+        cached->nfields >= 0 &&
+        size == sizeof(*cached) + cached->nfields * sizeof(pdf_field_t) +
+                cached->pdflen) {
+        tmpl->fields = (const pdf_field_t *)(cached + 1);
+        pdf = (char *)(tmpl->fields + cached->nfields);
+        if ((doc = pdf_load_buffer(pdf, cached->pdflen)) != NULL) {
+            fprintf(stderr, "DEBUG: Using cached banner template for %s\n",
+                    name);
+            tmpl->scale = cached->scale;
+            tmpl->form = cached->form;
+            tmpl->nfields = cached->nfields;
+            return doc;
+        }
+        tmpl->fields = NULL;
+    }
+
+    if (!(doc = pdf_load_template(filename)))
+        return NULL;
+
+    pdf_resize_page(doc, 1, width, length, &tmpl->scale);
+
+    pdf_add_type1_font(doc, 1, "Courier");
+
+    if (!tmpl->pc)
+        return doc;
+
+    /*
+     * Objects get renumbered when writing, so find the form fields in
+     * what we store, not in the template...
+     */
+    if ((pdf = pdf_write_buffer(doc, &pdflen)) == NULL)
+        return doc;
+
+    if ((copy = pdf_load_buffer(pdf, pdflen)) != NULL) {
+        if ((form = pdf_form_fields(copy, &fields, &nfields)) >= 0) {
+            size = sizeof(*data) + nfields * sizeof(pdf_field_t) + pdflen;
+            if ((data = calloc(1, size)) != NULL) {
+                memcpy(data->magic, TEMPLATE_CACHE_MAGIC, sizeof(data->magic));
+                data->scale = tmpl->scale;
+                data->form = form;
+                data->nfields = nfields;
+                data->pdflen = pdflen;
+                memcpy(data + 1, fields, nfields * sizeof(pdf_field_t));
+                memcpy((pdf_field_t *)(data + 1) + nfields, pdf, pdflen);
+                cupsPPDCachePut(tmpl->pc, data, size);
+                free(data);
+            }
+            free(fields);
+        }
+        pdf_free(copy);
+    }
+    free(pdf);
+
+    return doc;
+}
+
 static int generate_banner_pdf(banner_t *banner,
                                ppd_file_t *ppd,
                                const char *jobid,
@@ -371,19 +480,21 @@ static int generate_banner_pdf(banner_t *banner,
     float page_scale;
     ppd_attr_t *attr;
     unsigned copies;
+    template_t tmpl;
 #ifndef HAVE_OPEN_MEMSTREAM
     struct stat st;
 #endif
 
-    if (!(doc = pdf_load_template(banner->template_file)))
-        return 1;
-
     get_pagesize(ppd, noptions, options,
                  &page_width, &page_length, media_limits);
 
-    pdf_resize_page (doc, 1, page_width, page_length, &page_scale);
+    if (!(doc = load_template(&tmpl, banner->template_file,
+                              page_width, page_length))) {
+        cupsPPDCacheClose(tmpl.pc);
+        return 1;
+    }
 
-    pdf_add_type1_font(doc, 1, "Courier");
+    page_scale = tmpl.scale;
 
 #ifdef HAVE_OPEN_MEMSTREAM
     s = open_memstream(&buf, &len);
@@ -497,7 +608,13 @@ static int generate_banner_pdf(banner_t *banner,
     /*
      * Try to find a PDF form in PDF template and fill it.
      */
-    int ret = pdf_fill_form(doc, known_opts);
+    int ret;
+    if (tmpl.form < 0)
+        ret = pdf_fill_form(doc, known_opts);
+    else if (tmpl.form)
+        ret = pdf_fill_fields(doc, tmpl.fields, tmpl.nfields, known_opts);
+    else
+        ret = 0;
 
     /*
      * Could we fill a PDF form? If no, just add PDF stream.
@@ -525,6 +642,7 @@ static int generate_banner_pdf(banner_t *banner,
     }
     free(buf);
     pdf_free(doc);
+    cupsPPDCacheClose(tmpl.pc);
     return 0;
 }
 
@@ -80,6 +80,25 @@ char **qualifier = NULL;
 option_t *optionlist = NULL;
 option_t *optionlist_sorted_by_order = NULL;
 
+/* Tail and length of optionlist, so that appending is O(1) */
+static option_t *optionlist_last = NULL;
+static size_t optionlist_count = 0;
+
+/* Hash index over optionlist. Every option is entered under its case-folded
+   name and under its "no"-prefixed alias, which find_option() also accepts.
+   Existing keys are never replaced, so a lookup returns the same option as
+   the first match of a linear scan over optionlist would. */
+typedef struct optindex_s {
+    unsigned hash;
+    int alias;
+    option_t *opt;
+    struct optindex_s *next;
+} optindex_t;
+
+static optindex_t **optindex = NULL;
+static size_t optindex_size = 0;
+static size_t optindex_count = 0;
+
 int optionset_alloc, optionset_count;
 char **optionsets;
 
@@ -205,6 +224,93 @@ int section_from_string(const char *value)
     return 0;
 }
 
+/* FNV-1a over the lower-cased characters of 'str' */
+static unsigned strcasehash(const char *str)
+{
+    unsigned hash = 2166136261u;
+
+    for (; *str; str++)
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*str)) * 16777619u;
+    return hash;
+}
+
+static int optindex_match(optindex_t *entry, const char *name)
+{
+    if (entry->alias)
+        return !prefixcasecmp(name, "no") &&
+               !strcasecmp(entry->opt->name, &name[2]);
+    return !strcasecmp(entry->opt->name, name);
+}
+
+static option_t * optindex_lookup(const char *name, unsigned hash)
+{
+    optindex_t *entry;
+
+    if (!optindex)
+        return NULL;
+
+    for (entry = optindex[hash & (optindex_size - 1)]; entry; entry = entry->next) {
+        if (entry->hash == hash && optindex_match(entry, name))
+            return entry->opt;
+    }
+    return NULL;
+}
+
+static void optindex_grow()
+{
+    optindex_t **table, *entry, *next;
+    size_t i, size = optindex_size ? optindex_size * 2 : 256;
+
+    table = calloc(size, sizeof(optindex_t *));
+    for (i = 0; i < optindex_size; i++) {
+        for (entry = optindex[i]; entry; entry = next) {
+            next = entry->next;
+            entry->next = table[entry->hash & (size - 1)];
+            table[entry->hash & (size - 1)] = entry;
+        }
+    }
+    free(optindex);
+    optindex = table;
+    optindex_size = size;
+}
+
+static void optindex_add(option_t *opt, const char *key, int alias)
+{
+    optindex_t *entry;
+    unsigned hash = strcasehash(key);
+
+    if (optindex_lookup(key, hash))
+        return;
+
+    if (optindex_count >= optindex_size)
+        optindex_grow();
+
+    entry = malloc(sizeof(optindex_t));
+    entry->hash = hash;
+    entry->alias = alias;
+    entry->opt = opt;
+    entry->next = optindex[hash & (optindex_size - 1)];
+    optindex[hash & (optindex_size - 1)] = entry;
+    optindex_count++;
+}
+
+static void optindex_free()
+{
+    optindex_t *entry, *next;
+    size_t i;
+
+    for (i = 0; i < optindex_size; i++) {
+        for (entry = optindex[i]; entry; entry = next) {
+            next = entry->next;
+            free(entry);
+        }
+    }
+    free(optindex);
+    optindex = NULL;
+    optindex_size = 0;
+    optindex_count = 0;
+}
+
 void options_init()
 {
     optionset_alloc = 8;
@@ -265,6 +371,7 @@ static void free_option(option_t *opt)
         opt->choicelist = opt->choicelist->next;
         free(choice);
     }
+    free(opt->choicehash);
     while (opt->paramlist) {
         param = opt->paramlist;
         opt->paramlist = opt->paramlist->next;
@@ -304,11 +411,14 @@ void options_free()
       free(qualifier[i]);
     free(qualifier);
 
+    optindex_free();
     while (optionlist) {
         opt = optionlist;
         optionlist = optionlist->next;
         free_option(opt);
     }
+    optionlist_last = NULL;
+    optionlist_count = 0;
 
     if (postpipe)
         free_dstr(postpipe);
@@ -320,34 +430,22 @@ void options_free()
 
 size_t option_count()
 {
-    option_t *opt;
-    size_t cnt = 0;
-
-    for (opt = optionlist; opt; opt = opt->next)
-        cnt++;
-    return cnt;
+    return optionlist_count;
 }
 
 option_t * find_option(const char *name)
 {
-    option_t *opt;
-
     /* PageRegion and PageSize are the same options, just store one of them */
     if (!strcasecmp(name, "PageRegion"))
         return find_option("PageSize");
 
-    for (opt = optionlist; opt; opt = opt->next) {
-      if ((!strcasecmp(opt->name, name)) ||
-	  ((!strcasecmp(opt->name, &name[2])) &&
-	   (!prefixcasecmp(name, "no"))))
-            return opt;
-    }
-    return NULL;
+    return optindex_lookup(name, strcasehash(name));
 }
 
 option_t * assure_option(const char *name)
 {
-    option_t *opt, *last;
+    option_t *opt;
+    char alias[131];
 
     if ((opt = find_option(name)))
         return opt;
@@ -371,12 +469,16 @@ option_t * assure_option(const char *name)
     opt->type = TYPE_NONE;
 
     /* append opt to optionlist */
-    if (optionlist) {
-        for (last = optionlist; last->next; last = last->next);
-        last->next = opt;
-    }
+    if (optionlist_last)
+        optionlist_last->next = opt;
     else
         optionlist = opt;
+    optionlist_last = opt;
+    optionlist_count++;
+
+    optindex_add(opt, opt->name, 0);
+    snprintf(alias, sizeof(alias), "no%s", opt->name);
+    optindex_add(opt, alias, 1);
 
     /* prepend opt to optionlist_sorted_by_order
        (0 is always at the beginning) */
@@ -482,14 +584,45 @@ static param_t * option_find_param_index(option_t *opt, const char *name, int *i
 static choice_t * option_find_choice(option_t *opt, const char *name)
 {
     choice_t *choice;
+    unsigned hash;
     assert(opt && name);
-    for (choice = opt->choicelist; choice; choice = choice->next) {
-        if (!strcasecmp(choice->value, name))
+
+    if (!opt->choicehash)
+        return NULL;
+
+    hash = strcasehash(name);
+    for (choice = opt->choicehash[hash & (opt->choicehash_size - 1)];
+         choice; choice = choice->hashnext) {
+        if (choice->hash == hash && !strcasecmp(choice->value, name))
             return choice;
     }
     return NULL;
 }
 
+/* Enter 'choice' into the choice lookup table of 'opt' */
+static void option_index_choice(option_t *opt, choice_t *choice)
+{
+    choice_t *c;
+    size_t size;
+
+    if (opt->choice_count >= opt->choicehash_size) {
+        size = opt->choicehash_size ? opt->choicehash_size * 2 : 16;
+        free(opt->choicehash);
+        opt->choicehash = calloc(size, sizeof(choice_t *));
+        opt->choicehash_size = size;
+        /* rehash in list order, the new choice is not in the list yet */
+        for (c = opt->choicelist; c; c = c->next) {
+            c->hashnext = opt->choicehash[c->hash & (size - 1)];
+            opt->choicehash[c->hash & (size - 1)] = c;
+        }
+    }
+
+    choice->hash = strcasehash(choice->value);
+    choice->hashnext = opt->choicehash[choice->hash & (opt->choicehash_size - 1)];
+    opt->choicehash[choice->hash & (opt->choicehash_size - 1)] = choice;
+    opt->choice_count++;
+}
+
 void free_paramvalues(option_t *opt, char **paramvalues)
 {
     int i;
@@ -1124,21 +1257,20 @@ void option_set_from_string(option_t *opt, const char *str)
 
 static choice_t * option_assure_choice(option_t *opt, const char *name)
 {
-    choice_t *choice, *last = NULL;
+    choice_t *choice;
 
-    for (choice = opt->choicelist; choice; choice = choice->next) {
-        if (!strcasecmp(choice->value, name))
-            return choice;
-        last = choice;
-    }
-    if (!choice) {
-        choice = calloc(1, sizeof(choice_t));
-        if (last)
-            last->next = choice;
-        else
-            opt->choicelist = choice;
-        strlcpy(choice->value, name, 128);
-    }
+    if ((choice = option_find_choice(opt, name)))
+        return choice;
+
+    choice = calloc(1, sizeof(choice_t));
+    strlcpy(choice->value, name, 128);
+    option_index_choice(opt, choice);
+
+    if (opt->choicelist_last)
+        opt->choicelist_last->next = choice;
+    else
+        opt->choicelist = choice;
+    opt->choicelist_last = choice;
     return choice;
 }
 
@@ -57,6 +57,9 @@ typedef struct choice_s {
     char text [128];
     char command[65536];
     struct choice_s *next;
+
+    unsigned hash;              /* case-folded hash of 'value' */
+    struct choice_s *hashnext;  /* next choice in the same hash bucket */
 } choice_t;
 
 /* Custom option parameter */
@@ -89,6 +92,12 @@ typedef struct option_s {
     int notfirst;               /* TODO remove */
 
     choice_t *choicelist;
+    choice_t *choicelist_last;  /* tail of choicelist, for appending */
+
+    /* Choice lookup table, indexed by the case-folded choice value */
+    choice_t **choicehash;
+    size_t choicehash_size;
+    size_t choice_count;
 
     /* Foomatic PPD extensions */
     char *proto;                /* *FoomaticRIPOptionPrototype: if this is set
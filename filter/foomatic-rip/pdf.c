@@ -26,6 +26,7 @@
 #include "options.h"
 #include "process.h"
 #include "renderer.h"
+#include "../pdf.h"
 
 #include <stdlib.h>
 #include <ctype.h>
@@ -47,6 +48,12 @@ int pdf_count_pages(const char *filename)
     size_t bytes;
     char *p;
 
+    /* Let QPDF read the page tree, without interpreting any page */
+    if ((pagecount = pdf_pages(filename)) >= 0)
+        return pagecount;
+
+    /* Last resort, Ghostscript */
+    _log("QPDF could not count the pages, trying Ghostscript\n");
     snprintf(gscommand, CMDLINE_MAX, "%s -dNODISPLAY -dNOSAFER -dNOPAUSE -q -c "
 	     "'/pdffile (%s) (r) file runpdfbegin (PageCount: ) print "
 	     "pdfpagecount = quit'",
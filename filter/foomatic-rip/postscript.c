@@ -135,37 +135,204 @@ int line_type(const char *line)
 #define MAX_NON_DSC_LINES_IN_HEADER 1000
 #define MAX_LINES_FOR_PAGE_OPTIONS 200
 
-typedef struct {
-    size_t pos;
+#define STREAM_BUFSIZE 65536
 
+/* The input is read in large blocks, lines are found with memchr() and
+   data which we do not need to examine goes to the renderer directly
+   from the block buffer */
+typedef struct {
     FILE *file;
-    const char *alreadyread;
-    size_t len;
+    char *buf;      /* block buffer, initially holding the already read data */
+    size_t size;    /* allocated size of buf */
+    size_t pos;     /* start of the unconsumed data in buf */
+    size_t len;     /* end of the valid data in buf */
+    int eof;
 } stream_t;
 
 void _print_ps(stream_t *stream);
 
+static void stream_init(stream_t *s, FILE *file, const char *alreadyread, size_t len)
+{
+    s->file = file;
+    s->size = len > STREAM_BUFSIZE ? len : STREAM_BUFSIZE;
+    s->buf = malloc(s->size);
+    if (len)
+        memcpy(s->buf, alreadyread, len);
+    s->pos = 0;
+    s->len = len;
+    s->eof = 0;
+}
+
+static void stream_free(stream_t *s)
+{
+    free(s->buf);
+    s->buf = NULL;
+}
+
+/* Move the unconsumed data to the beginning of the buffer and fill up the
+   rest from the file. Returns the number of bytes read. */
+static size_t stream_fill(stream_t *s)
+{
+    size_t n;
+
+    if (s->pos > 0) {
+        memmove(s->buf, &s->buf[s->pos], s->len - s->pos);
+        s->len -= s->pos;
+        s->pos = 0;
+    }
+
+    if (s->eof || s->len == s->size)
+        return 0;
+
+    n = fread(&s->buf[s->len], 1, s->size - s->len, s->file);
+    if (n == 0)
+        s->eof = 1;
+    s->len += n;
+    return n;
+}
+
 int stream_next_line(dstr_t *line, stream_t *s)
 {
-    int c;
-    size_t cnt = 0;
+    char *nl;
+    size_t n, cnt = 0;
 
     dstrclear(line);
-    while (s->pos < s->len) {
-        c = s->alreadyread[s->pos++];
-        dstrputc(line, c);
-        cnt++;
-        if (c == '\n')
-            return cnt;
+    for (;;) {
+        if (s->pos == s->len && !stream_fill(s))
+            break;
+
+        nl = memchr(&s->buf[s->pos], '\n', s->len - s->pos);
+        n = nl ? (size_t)(nl - &s->buf[s->pos]) + 1 : s->len - s->pos;
+        dstrmemcat(line, &s->buf[s->pos], n);
+        s->pos += n;
+        cnt += n;
+        if (nl)
+            break;
+    }
+    return cnt;
+}
+
+/*
+ * Send all lines up to, but not including, the next line starting with
+ * "%%" directly from the input buffer to 'out'. Returns the number of
+ * lines sent.
+ */
+static int stream_copy_to_dsc(stream_t *s, FILE *out)
+{
+    char *nl;
+    size_t run = s->pos;
+    int lines = 0, linestart = 1;
+
+    for (;;) {
+        if (s->len - s->pos < 2) {
+            /* Refilling moves the buffer contents, send what we have */
+            if (s->pos > run)
+                fwrite_or_die(&s->buf[run], s->pos - run, 1, out);
+            stream_fill(s);
+            run = s->pos;
+            if (s->pos == s->len) {
+                if (!linestart)
+                    lines++;
+                break;
+            }
+        }
+
+        if (linestart && s->len - s->pos >= 2 &&
+            s->buf[s->pos] == '%' && s->buf[s->pos + 1] == '%')
+            break;
+
+        if ((nl = memchr(&s->buf[s->pos], '\n', s->len - s->pos))) {
+            s->pos = nl - s->buf + 1;
+            linestart = 1;
+            lines++;
+        }
+        else {
+            s->pos = s->len;
+            linestart = 0;
+        }
     }
 
-    while ((c = fgetc(s->file)) != EOF) {
-        dstrputc(line, c);
-        cnt++;
-        if (c == '\n')
-            return cnt;
+    if (s->pos > run)
+        fwrite_or_die(&s->buf[run], s->pos - run, 1, out);
+    return lines;
+}
+
+/* Send the rest of the input to 'out' */
+static void stream_copy_rest(stream_t *s, FILE *out)
+{
+    do {
+        if (s->len > s->pos)
+            fwrite_or_die(&s->buf[s->pos], s->len - s->pos, 1, out);
+        s->pos = s->len;
+    } while (stream_fill(s));
+}
+
+/*
+ * Count the pages of a DSC-conforming PostScript file from its comments.
+ * A "%%Pages:" comment in the header is trusted right away, otherwise the
+ * "%%Pages:" comment of the trailer (for "(atend)") or the number of
+ * "%%Page:" comments of the main document is used. Returns -1 if the file
+ * does not tell.
+ */
+static int ps_dsc_pages(const char *filename)
+{
+    FILE *fh;
+    char buf[1024], *p;
+    size_t len;
+    int linestart = 1, nonpslines = 0, dsc = 0, inheader = 1;
+    int nestinglevel = 0, pages = -1, pagecount = 0, n;
+
+    if (!(fh = fopen(filename, "r")))
+        return -1;
+
+    while (fgets(buf, sizeof(buf), fh)) {
+        len = strlen(buf);
+        p = buf;
+
+        if (linestart && !dsc) {
+            /* There can be JCL commands and a Windows control character
+               before "%!" */
+            if (*p == 4)
+                p++;
+            if (startswith(p, "%!PS-Adobe-"))
+                dsc = 1;
+            else if (startswith(p, "%!") || ++nonpslines > 200)
+                break;
+        }
+        else if (linestart) {
+            if (!startswith(p, "%%"))
+                inheader = 0;
+            else if (startswith(p, "%%BeginDocument"))
+                nestinglevel++;
+            else if (startswith(p, "%%EndDocument")) {
+                if (nestinglevel > 0)
+                    nestinglevel--;
+            }
+            else if (nestinglevel == 0 && startswith(p, "%%EndComments"))
+                inheader = 0;
+            else if (nestinglevel == 0 && startswith(p, "%%Pages:")) {
+                /* "(atend)" does not match, the value is in the trailer then */
+                if (sscanf(p + 8, "%d", &n) == 1 && n > 0) {
+                    pages = n;
+                    if (inheader)
+                        break;
+                }
+            }
+            else if (nestinglevel == 0 && startswith(p, "%%Page:"))
+                pagecount++;
+        }
+
+        linestart = (len > 0 && buf[len - 1] == '\n');
     }
-    return cnt;
+    fclose(fh);
+
+    if (!dsc)
+        return -1;
+    if (pages > 0)
+        return pages;
+    if (pagecount > 0)
+        return pagecount;
+    return -1;
 }
 
 int ps_pages(const char *filename)
@@ -174,6 +341,14 @@ int ps_pages(const char *filename)
     char output[31] = "";
     int pagecount;
     size_t bytes;
+
+    if ((pagecount = ps_dsc_pages(filename)) >= 0) {
+        _log("Page count taken from the DSC comments\n");
+        return pagecount;
+    }
+
+    /* Last resort, let Ghostscript interpret the whole file */
+    _log("No DSC page information, counting pages with Ghostscript\n");
     snprintf(gscommand, 65536, "%s -q -dNOPAUSE -dBATCH -sDEVICE=bbox %s 2>&1 | grep -c HiResBoundingBox",
               CUPS_GHOSTSCRIPT, filename);
     FILE *pd = popen(gscommand, "r");
@@ -204,11 +379,9 @@ int print_ps(FILE *file, const char *alreadyread, size_t len, const char *filena
         _log("File contains %d pages.\n", pagecount);
     }
 
-    stream.pos = 0;
-    stream.file = file;
-    stream.alreadyread = alreadyread;
-    stream.len = len;
+    stream_init(&stream, file, alreadyread, len);
     _print_ps(&stream);
+    stream_free(&stream);
     return 1;
 }
 
@@ -1052,17 +1225,13 @@ void _print_ps(stream_t *stream)
                     if (!printprevpage) {
                         fwrite_or_die(line->data, line->len, 1, rendererhandle);
 
-                        while (stream_next_line(line, stream) > 0) {
-                            if (startswith(line->data, "%%")) {
-                                _log("Found: %s", line->data);
-                                _log(" --> Continue DSC parsing now.\n\n");
-                                saved = 1;
-                                break;
-                            }
-                            else {
-                                fwrite_or_die(line->data, line->len, 1, rendererhandle);
-                                linect++;
-                            }
+                        /* Everything up to the next DSC comment goes to
+                           the renderer without being examined */
+                        linect += stream_copy_to_dsc(stream, rendererhandle);
+                        if (stream_next_line(line, stream) > 0) {
+                            _log("Found: %s", line->data);
+                            _log(" --> Continue DSC parsing now.\n\n");
+                            saved = 1;
                         }
                     }
                 }
@@ -1157,10 +1326,8 @@ void _print_ps(stream_t *stream)
         }
 
         /* Print the rest of the input data */
-        if (more_stuff) {
-            while (stream_next_line(tmp, stream))
-                fwrite_or_die(tmp->data, tmp->len, 1, rendererhandle);
-        }
+        if (more_stuff)
+            stream_copy_rest(stream, rendererhandle);
     }
 
     /*  At every "%%Page:..." comment we have saved the PostScript state
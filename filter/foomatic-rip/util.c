@@ -671,6 +671,22 @@ void dstrcpyf(dstr_t *ds, const char *src, ...)
     ds->len = srclen;
 }
 
+void dstrmemcat(dstr_t *ds, const char *src, size_t n)
+{
+    size_t needed = ds->len + n;
+
+    if (needed >= ds->alloc) {
+        do {
+            ds->alloc *= 2;
+        } while (needed >= ds->alloc);
+        ds->data = realloc(ds->data, ds->alloc);
+    }
+
+    memcpy(&ds->data[ds->len], src, n);
+    ds->len = needed;
+    ds->data[ds->len] = '\0';
+}
+
 void dstrputc(dstr_t *ds, int c)
 {
     if (ds->len +1 >= ds->alloc) {
@@ -154,6 +154,7 @@ void dstrassure(dstr_t *ds, size_t alloc);
 void dstrcpy(dstr_t *ds, const char *src);
 void dstrncpy(dstr_t *ds, const char *src, size_t n);
 void dstrncat(dstr_t *ds, const char *src, size_t n);
+void dstrmemcat(dstr_t *ds, const char *src, size_t n); /* like dstrncat, but also copies zero bytes */
 void dstrcpyf(dstr_t *ds, const char *src, ...);
 void dstrcat(dstr_t *ds, const char *src);
 void dstrcatf(dstr_t *ds, const char *src, ...);
@@ -44,11 +44,13 @@ MIT Open Source License  -  http://www.opensource.org/
 #include <cups/raster.h>
 #include <cupsfilters/colormanager.h>
 #include <cupsfilters/raster.h>
+#include <cupsfilters/ppdcache.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <errno.h>
 #include "pdf.h"
+#include "gsworker.h"
 
 #define PDF_MAX_CHECK_COMMENT_LINES	20
 
@@ -70,6 +72,15 @@ typedef cups_page_header2_t gs_page_header;
 typedef cups_page_header_t gs_page_header;
 #endif /* CUPS_RASTER_SYNCv1 */
 
+/* Everything taken from the PPD file, kept in the PPD settings cache so
+   that jobs with the same PPD file and options do not need to open it */
+typedef struct {
+  gs_page_header h;
+  int workers;
+  int pxlcolor;
+  int center_of_pixel;
+} gs_ppd_settings;
+
 static GsDocType
 parse_doc_type(FILE *fp)
 {
@@ -588,7 +599,7 @@ main (int argc, char **argv, char *envp[])
   char *outformat_env = NULL;
   OutFormatType outformat;
   char buf[BUFSIZ];
-  char *filename;
+  char *filename = NULL;
   char *icc_profile = NULL;
   /*char **qualifier = NULL;*/
   char *tmp;
@@ -605,9 +616,16 @@ main (int argc, char **argv, char *envp[])
   int num_options;
   int status = 1;
   ppd_file_t *ppd = NULL;
+  const char *ppdfile = NULL;
+  cups_ppd_cache_t *ppdcache = NULL;
+  gs_ppd_settings settings;
+  const void *cached = NULL;
+  char cachename[64];
   struct sigaction sa;
   cm_calibration_t cm_calibrate;
   int pxlcolor = 1;
+  int workers = 0;
+  char workerdir[1024];
 #ifdef HAVE_CUPS_1_7
   int pwgraster = 0;
   ppd_attr_t *attr;
@@ -646,21 +664,49 @@ main (int argc, char **argv, char *envp[])
   
   num_options = cupsParseOptions(argv[5], 0, &options);
 
-  t = getenv("PPD");
-  if (t && t[0] != '\0')
-    if ((ppd = ppdOpenFile(t)) == NULL) {
-      fprintf(stderr, "ERROR: Failed to open PPD: %s\n", t);
+  memset(&settings, 0, sizeof(settings));
+
+  ppdfile = getenv("PPD");
+  if (ppdfile && ppdfile[0] != '\0') {
+    /* If an earlier job had the same PPD file and options we take the
+       settings from the cache and do not need to open the PPD file */
+    t = getenv("FINAL_CONTENT_TYPE");
+    snprintf(cachename, sizeof(cachename), "gstoraster-%d-%d", outformat,
+	     t && strcasestr(t, "pwg") ? 1 : 0);
+    ppdcache = cupsPPDCacheOpen(ppdfile, cachename, num_options, options);
+    if ((cached = cupsPPDCacheGet(ppdcache, sizeof(settings))) != NULL) {
+      memcpy(&settings, cached, sizeof(settings));
+      fprintf(stderr, "DEBUG: Using cached settings for PPD file %s\n",
+	      ppdfile);
+    } else if ((ppd = ppdOpenFile(ppdfile)) == NULL) {
+      fprintf(stderr, "ERROR: Failed to open PPD: %s\n", ppdfile);
     }
-      
+  }
+
   if (ppd) {
     ppdMarkDefaults (ppd);
     cupsMarkOptions (ppd, num_options, options);
   }
 
+  if (!cached)
+    settings.workers = gs_worker_count(ppd, num_options, options);
+
+  /* Raster jobs can be handed to a persistent Ghostscript worker if the
+     queue asks for it, the input has to be spooled into the worker's
+     directory then */
+  if (argc == 6 && outformat == OUTPUT_FORMAT_RASTER &&
+      (workers = settings.workers) > 0 &&
+      !gs_worker_dir(workerdir, sizeof(workerdir), ppdfile, workers))
+    workers = 0;
+
   if (argc == 6) {
     /* stdin */
 
-    fd = cupsTempFd(buf,BUFSIZ);
+    if (workers) {
+      snprintf(buf, BUFSIZ, "%s/job-XXXXXX", workerdir);
+      fd = mkstemp(buf);
+    } else
+      fd = cupsTempFd(buf,BUFSIZ);
     if (fd < 0) {
       fprintf(stderr, "ERROR: Can't create temporary file\n");
       goto out;
@@ -760,7 +806,7 @@ main (int argc, char **argv, char *envp[])
       goto out;
     }
   }
-  if (argc == 6) {
+  if (argc == 6 && !workers) {
     /* input from stdin */
     /* remove name of temp file*/
     unlink(filename);
@@ -775,8 +821,15 @@ main (int argc, char **argv, char *envp[])
   else 
     cm_disabled = cmIsPrinterCmDisabled(getenv("PRINTER"));
 
-  if (!cm_disabled)
+  if (!cm_disabled) {
+    /* colord looks up the profile by the marked choices of the PPD file,
+       so here we need it even with cached settings */
+    if (cached && (ppd = ppdOpenFile(ppdfile)) != NULL) {
+      ppdMarkDefaults (ppd);
+      cupsMarkOptions (ppd, num_options, options);
+    }
     cmGetPrinterIccProfile(getenv("PRINTER"), &icc_profile, ppd);
+  }
 
   /* Ghostscript parameters */
   gs_args = cupsArrayNew(NULL, NULL);
@@ -862,7 +915,12 @@ main (int argc, char **argv, char *envp[])
   }
 #endif /* HAVE_CUPS_1_7 */
     
-  if (ppd)
+  if (cached)
+  {
+    h = settings.h;
+    pxlcolor = settings.pxlcolor;
+  }
+  else if (ppd)
   {
     cupsRasterInterpretPPD(&h,ppd,num_options,options,0);
 #ifdef HAVE_CUPS_1_7
@@ -911,7 +969,7 @@ main (int argc, char **argv, char *envp[])
 #endif /* HAVE_CUPS_1_7 */
   }
 
-  if ((h.HWResolution[0] == 100) && (h.HWResolution[1] == 100)) {
+  if (!cached && (h.HWResolution[0] == 100) && (h.HWResolution[1] == 100)) {
     /* No "Resolution" option */
     if (ppd && (attr = ppdFindAttr(ppd, "DefaultResolution", 0)) != NULL) {
       /* "*DefaultResolution" keyword in the PPD */
@@ -933,6 +991,18 @@ main (int argc, char **argv, char *envp[])
     h.cupsHeight = h.HWResolution[1] * h.PageSize[1] / 72;
   }
 
+  /* Remember the settings for the next job */
+  if (!cached && ppd) {
+    settings.h = h;
+    settings.pxlcolor = pxlcolor;
+    settings.center_of_pixel =
+      (attr = ppdFindAttr(ppd,"DefaultCenterOfPixel", NULL)) != NULL &&
+      (!strcasecmp(attr->value, "true") ||
+       !strcasecmp(attr->value, "on") ||
+       !strcasecmp(attr->value, "yes"));
+    cupsPPDCachePut(ppdcache, &settings, sizeof(settings));
+  }
+
   /* set PDF-specific options */
   if (doc_type == GS_DOC_TYPE_PDF) {
     parse_pdf_header_options(fp, &h);
@@ -991,10 +1061,7 @@ main (int argc, char **argv, char *envp[])
      https://bugs.linuxfoundation.org/show_bug.cgi?id=1373 */
   if (((t = cupsGetOption("CenterOfPixel", num_options, options)) == NULL &&
        (t = cupsGetOption("center-of-pixel", num_options, options)) == NULL &&
-       ppd && (attr = ppdFindAttr(ppd,"DefaultCenterOfPixel", NULL)) != NULL &&
-       (!strcasecmp(attr->value, "true") ||
-	!strcasecmp(attr->value, "on") ||
-	!strcasecmp(attr->value, "yes"))) ||
+       settings.center_of_pixel) ||
       (t && (!strcasecmp(t, "true") || !strcasecmp(t, "on") ||
 	     !strcasecmp(t, "yes")))) {
     fprintf(stderr, "DEBUG: Ghostscript using Center-of-Pixel method to fill paths.\n");
@@ -1012,11 +1079,20 @@ main (int argc, char **argv, char *envp[])
   /* Execute Ghostscript command line ... */
   snprintf(tmpstr, sizeof(tmpstr), "%s", CUPS_GHOSTSCRIPT);
 
-  /* call Ghostscript */
-  rewind(fp);
-  status = gs_spawn (tmpstr, gs_args, envp, fp);
+  /* call Ghostscript, on the worker if we can */
+  status = -1;
+  if (workers)
+    status = gs_worker_run(workerdir, workers, gs_args, filename);
+  if (status < 0) {
+    rewind(fp);
+    status = gs_spawn (tmpstr, gs_args, envp, fp);
+  }
   if (status != 0) status = 1;
 out:
+  if (workers && filename) {
+    unlink(filename);
+    free(filename);
+  }
   if (fp)
     fclose(fp);
   if (gs_args) {
@@ -1029,5 +1105,6 @@ out:
   free(icc_profile);
   if (ppd)
     ppdClose(ppd);
+  cupsPPDCacheClose(ppdcache);
   return status;
 }
@@ -0,0 +1,1605 @@
+/*
+ *   Persistent Ghostscript worker for the gstoraster filter.
+ *
+ *   Distribution and use rights are outlined in the file "COPYING"
+ *   which should have been included with this file.
+ *
+ *   Starting Ghostscript (font map, ICC profiles, device setup) often
+ *   costs more than rendering a small job.  When a queue asks for
+ *   workers, the first gstoraster process starts a small daemon which
+ *   keeps a pool of Ghostscript instances running in job server mode
+ *   (-dJOBSERVER).  Each job is sent to an idle instance as one
+ *   encapsulated job, so its VM and page device are restored when it
+ *   ends, and the raster data comes back through a named pipe in a
+ *   private directory.  Instances are restarted after a failed job and
+ *   after GSW_MAX_JOBS jobs, and the daemon exits when it has been idle
+ *   for GSW_IDLE_TIMEOUT seconds.  gstoraster runs Ghostscript itself
+ *   whenever the worker cannot take a job.
+ *
+ *   Ghostscript's cups device reads the PPD file named in the daemon's
+ *   environment, so each PPD file (and number of instances) gets its own
+ *   daemon and directory, and a daemon exits when its PPD file changes.
+ *   Each instance may only access a directory of its own, into which
+ *   the daemon moves the input file and output pipe of its current job.
+ *
+ * Contents:
+ *
+ *   gs_worker_count()  - Get the number of workers requested for a queue.
+ *   gs_worker_dir()    - Get the private worker directory, creating it.
+ *   gs_worker_run()    - Run a job on a persistent Ghostscript worker.
+ *   gsw_accept()       - Accept a job and hand it to an idle instance.
+ *   gsw_clean()        - Remove all files from an instance's directory.
+ *   gsw_connect()      - Connect to the worker daemon, starting it if needed.
+ *   gsw_file_param()   - Check whether a parameter names a file.
+ *   gsw_finish()       - Finish the current job of an instance.
+ *   gsw_job()          - Convert a Ghostscript command line into a job.
+ *   gsw_line()         - Process a line of Ghostscript output.
+ *   gsw_mkdir()        - Create a private directory.
+ *   gsw_printf()       - Append formatted text to a buffer.
+ *   gsw_serve()        - Main loop of the worker daemon.
+ *   gsw_start()        - Start a Ghostscript instance.
+ *   gsw_stop()         - Stop a Ghostscript instance.
+ *   gsw_string()       - Append a PostScript string to a buffer.
+ *   gsw_write()        - Write a buffer to a file descriptor.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include <config.h>
+#include "gsworker.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+
+/*
+ * Constants...
+ */
+
+#define GSW_MAX_WORKERS		8	/* Maximum number of instances */
+#define GSW_MAX_JOBS		100	/* Jobs before an instance is recycled */
+#define GSW_MAX_FAILURES	3	/* Failed starts before giving up */
+#define GSW_MAX_REQUEST		65536	/* Maximum size of a job request */
+#define GSW_BUFFER		65536	/* Size of the raster copy buffer */
+#define GSW_IDLE_TIMEOUT	300	/* Seconds without jobs before exiting */
+#define GSW_CHECK_INTERVAL	10	/* Seconds between PPD file checks */
+#define GSW_FAIL_TIMEOUT	600	/* Seconds a failed start disables workers */
+#define GSW_START_TIMEOUT	5000	/* Milliseconds to wait for the daemon */
+
+
+/*
+ * Types...
+ */
+
+typedef struct gsw_buf_s		/**** Text buffer ****/
+{
+  char		*data;			/* Buffer */
+  size_t	size,			/* Size of buffer */
+		used;			/* Bytes used */
+  int		overflow;		/* Did the text not fit? */
+} gsw_buf_t;
+
+typedef struct gsw_instance_s		/**** Ghostscript instance ****/
+{
+  int		pid,			/* Process ID or 0 */
+		infd,			/* Pipe to Ghostscript's stdin */
+		outfd,			/* Pipe from Ghostscript's stdout/stderr */
+		ready,			/* Has it finished starting up? */
+		client,			/* Client of current job or -1 */
+		status,			/* Status of current job */
+		jobs;			/* Number of jobs done */
+  char		line[1024];		/* Partial output line */
+  size_t	linelen;		/* Length of partial line */
+  char		message[256];		/* Last message while starting up */
+  char		dir[1024];		/* Directory of the instance */
+} gsw_instance_t;
+
+
+/*
+ * Local globals...
+ */
+
+static char	gsw_marker[256];	/* End-of-job marker of the daemon */
+static char	gsw_password[33];	/* Job server password of the daemon */
+
+
+/*
+ * Local functions...
+ */
+
+static void	gsw_accept(int listenfd, const char *dir,
+		           gsw_instance_t *workers, int num_workers);
+static void	gsw_clean(const char *dir);
+static int	gsw_connect(const char *dir, int num_workers);
+static int	gsw_file_param(const char *name, size_t namelen);
+static void	gsw_finish(gsw_instance_t *w);
+static int	gsw_job(gsw_buf_t *b, cups_array_t *gs_args);
+static int	gsw_line(gsw_instance_t *w, const char *line);
+static int	gsw_mkdir(const char *dir);
+static void	gsw_printf(gsw_buf_t *b, const char *format, ...)
+#ifdef __GNUC__
+__attribute__ ((__format__ (__printf__, 2, 3)))
+#endif /* __GNUC__ */
+;
+static int	gsw_serve(const char *dir, int num_workers);
+static int	gsw_start(gsw_instance_t *w);
+static void	gsw_stop(gsw_instance_t *w);
+static void	gsw_string(gsw_buf_t *b, const char *s, int output_file);
+static int	gsw_write(int fd, const char *buffer, size_t bytes);
+
+
+/*
+ * 'gs_worker_count()' - Get the number of workers requested for a queue.
+ *
+ * Workers are enabled with the "ghostscript-workers" option, usually set
+ * as a queue default with "lpadmin -o ghostscript-workers-default=N", or
+ * with a "*DefaultGhostscriptWorkers: N" line in the PPD file.
+ */
+
+int					/* O - Number of workers, 0 = off */
+gs_worker_count(ppd_file_t    *ppd,	/* I - PPD file or NULL */
+                int           num_options,
+					/* I - Number of options */
+                cups_option_t *options)	/* I - Options */
+{
+  const char	*val;			/* Option value */
+  ppd_attr_t	*attr;			/* PPD attribute */
+  int		count;			/* Number of workers */
+
+
+  if ((val = cupsGetOption("ghostscript-workers", num_options,
+                           options)) == NULL &&
+      (val = cupsGetOption("GhostscriptWorkers", num_options,
+                           options)) == NULL &&
+      ppd &&
+      (attr = ppdFindAttr(ppd, "DefaultGhostscriptWorkers", NULL)) != NULL)
+    val = attr->value;
+
+  if (!val || (count = atoi(val)) <= 0)
+    return (0);
+  else if (count > GSW_MAX_WORKERS)
+    return (GSW_MAX_WORKERS);
+  else
+    return (count);
+}
+
+
+/*
+ * 'gs_worker_dir()' - Get the private worker directory, creating it.
+ *
+ * The directory holds the daemon's socket and the input and output
+ * files of the jobs, so it must only be accessible by our user.  Its
+ * name is derived from the PPD file's name, inode, and modification
+ * time and the number of instances, as the daemon renders every job
+ * with the PPD file it was started with.
+ */
+
+int					/* O - 1 on success, 0 on error */
+gs_worker_dir(char       *dir,		/* O - Directory name */
+              size_t     dirsize,	/* I - Size of name buffer */
+	      const char *ppdfile,	/* I - PPD file or NULL */
+	      int        num_workers)	/* I - Number of instances */
+{
+  const char		*tmpdir,	/* Temporary directory */
+			*ptr;		/* Pointer into key */
+  struct stat		info;		/* File information */
+  struct sockaddr_un	addr;		/* Socket address */
+  char			key[1280],	/* Key of the daemon */
+			failname[1024],	/* Failure file */
+			line[256];	/* Reason for the failure */
+  unsigned long long	hash;		/* Hash of the key */
+  size_t		len;		/* Length of directory name */
+  FILE			*fp;		/* Failure file */
+
+
+  if (ppdfile && *ppdfile)
+  {
+    if (stat(ppdfile, &info))
+      return (0);
+
+    snprintf(key, sizeof(key), "%s\n%lu\n%ld\n%d", ppdfile,
+             (unsigned long)info.st_ino, (long)info.st_mtime, num_workers);
+  }
+  else
+    snprintf(key, sizeof(key), "\n%d", num_workers);
+
+  for (ptr = key, hash = 14695981039346656037ULL; *ptr; ptr ++)
+    hash = (hash ^ (unsigned char)*ptr) * 1099511628211ULL;
+
+  if ((tmpdir = getenv("TMPDIR")) == NULL || !*tmpdir)
+    tmpdir = "/tmp";
+
+  if ((size_t)snprintf(dir, dirsize, "%s/gstoraster-%d", tmpdir,
+                       (int)getuid()) >= dirsize ||
+      !gsw_mkdir(dir))
+    return (0);
+
+  len = strlen(dir);
+  if ((size_t)snprintf(dir + len, dirsize - len, "/%016llx", hash) >=
+          dirsize - len ||
+      strlen(dir) + 8 > sizeof(addr.sun_path) ||
+      !gsw_mkdir(dir))
+    return (0);
+
+ /*
+  * Don't try again and again if Ghostscript could not be started in
+  * job server mode recently...
+  */
+
+  snprintf(failname, sizeof(failname), "%s/failed", dir);
+  if (!stat(failname, &info))
+  {
+    if (time(NULL) - info.st_mtime < GSW_FAIL_TIMEOUT)
+    {
+      if ((fp = fopen(failname, "r")) != NULL)
+      {
+        if (fgets(line, sizeof(line), fp))
+	  fprintf(stderr, "DEBUG: Ghostscript worker disabled: %s", line);
+	fclose(fp);
+      }
+      return (0);
+    }
+
+    unlink(failname);
+  }
+
+  return (1);
+}
+
+
+/*
+ * 'gs_worker_run()' - Run a job on a persistent Ghostscript worker.
+ *
+ * "filename" must be a "job-" file in the worker directory.  The return value
+ * is -1 when the worker could not take the job and nothing has been
+ * written to stdout yet, so that the caller can run Ghostscript itself.
+ */
+
+int					/* O - Exit status or -1 */
+gs_worker_run(const char   *dir,	/* I - Worker directory */
+              int          num_workers,	/* I - Number of instances */
+              cups_array_t *gs_args,	/* I - Ghostscript command line */
+	      const char   *filename)	/* I - Input file */
+{
+  int		sock = -1,		/* Connection to the daemon */
+		rfd = -1,		/* Read end of output pipe */
+		wfd = -1,		/* Our write end of output pipe */
+		status = -1,		/* Job status */
+		done = 0;		/* Got the job status? */
+  char		output[1024],		/* Output pipe */
+		line[1024],		/* Line from the daemon */
+		*start,			/* Start of current line */
+		*end,			/* End of current line */
+		*buffer = NULL;		/* Copy buffer */
+  size_t	linelen = 0,		/* Bytes in line buffer */
+		total = 0;		/* Raster bytes copied */
+  ssize_t	bytes;			/* Bytes read */
+  gsw_buf_t	request;		/* Job request */
+  struct pollfd	pfds[2];		/* Descriptors to wait for */
+
+
+  memset(&request, 0, sizeof(request));
+
+ /*
+  * Create the named pipe Ghostscript writes the raster data to.  We keep
+  * a write end open ourselves, so that the pipe does not report EOF
+  * before Ghostscript opened it or between pages...
+  */
+
+  snprintf(output, sizeof(output), "%s/out-%d", dir, (int)getpid());
+  unlink(output);
+
+  if (mkfifo(output, 0600))
+  {
+    fprintf(stderr, "DEBUG: Unable to create pipe for Ghostscript worker: "
+            "%s\n", strerror(errno));
+    return (-1);
+  }
+
+  if ((rfd = open(output, O_RDONLY | O_NONBLOCK)) < 0 ||
+      (wfd = open(output, O_WRONLY | O_NONBLOCK)) < 0)
+    goto out;
+
+  fcntl(rfd, F_SETFD, FD_CLOEXEC);
+  fcntl(wfd, F_SETFD, FD_CLOEXEC);
+
+ /*
+  * Build the request...
+  */
+
+  if ((request.data = malloc(GSW_MAX_REQUEST)) == NULL ||
+      (buffer = malloc(GSW_BUFFER)) == NULL)
+    goto out;
+
+  request.size = GSW_MAX_REQUEST;
+
+  gsw_printf(&request, "%s\n%s\n", output, filename);
+  if (gsw_job(&request, gs_args))
+  {
+    fprintf(stderr, "DEBUG: Ghostscript command line not supported by the "
+            "worker.\n");
+    goto out;
+  }
+
+ /*
+  * Send it...
+  */
+
+  if ((sock = gsw_connect(dir, num_workers)) < 0)
+  {
+    fprintf(stderr, "DEBUG: Unable to connect to Ghostscript worker.\n");
+    goto out;
+  }
+
+  if (gsw_write(sock, request.data, request.used) ||
+      shutdown(sock, SHUT_WR))
+    goto out;
+
+  fprintf(stderr, "DEBUG: Rendering job with persistent Ghostscript "
+          "worker.\n");
+
+ /*
+  * Copy the raster data to stdout and Ghostscript's messages to stderr
+  * until the daemon reports the end of the job...
+  */
+
+  while (!done)
+  {
+    pfds[0].fd     = rfd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd     = sock;
+    pfds[1].events = POLLIN;
+
+    if (poll(pfds, 2, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (pfds[0].revents & POLLIN)
+    {
+      if ((bytes = read(rfd, buffer, GSW_BUFFER)) > 0)
+      {
+        if (gsw_write(1, buffer, (size_t)bytes))
+	{
+	  status = 1;
+	  goto out;
+	}
+
+	total += (size_t)bytes;
+      }
+    }
+
+    if (pfds[1].revents)
+    {
+      if ((bytes = read(sock, line + linelen,
+                        sizeof(line) - 1 - linelen)) <= 0)
+      {
+        if (bytes < 0 && errno == EINTR)
+	  continue;
+	break;
+      }
+
+      linelen += (size_t)bytes;
+      line[linelen] = '\0';
+
+      for (start = line; (end = strchr(start, '\n')) != NULL; start = end + 1)
+      {
+        *end = '\0';
+
+	if (*start == 'L')
+	  fprintf(stderr, "%s\n", start + 1);
+	else if (*start == 'S')
+	{
+	  status = atoi(start + 1);
+	  done   = 1;
+	}
+      }
+
+      linelen -= (size_t)(start - line);
+      memmove(line, start, linelen);
+
+      if (linelen == sizeof(line) - 1)
+      {
+        line[linelen] = '\0';
+        fprintf(stderr, "%s\n", line + 1);
+	linelen = 0;
+      }
+    }
+  }
+
+  if (done)
+  {
+   /*
+    * Ghostscript has closed the pipe, copy what is left in it...
+    */
+
+    while ((bytes = read(rfd, buffer, GSW_BUFFER)) > 0 ||
+           (bytes < 0 && errno == EINTR))
+    {
+      if (bytes > 0)
+      {
+        if (gsw_write(1, buffer, (size_t)bytes))
+	{
+	  status = 1;
+	  goto out;
+	}
+
+	total += (size_t)bytes;
+      }
+    }
+  }
+  else
+    status = 1;
+
+  if (status != 0)
+  {
+    if (total == 0)
+    {
+      fprintf(stderr, "DEBUG: Ghostscript worker failed, running Ghostscript "
+              "directly.\n");
+      status = -1;
+    }
+    else
+      status = 1;
+  }
+
+  out:
+
+  if (sock >= 0)
+    close(sock);
+  if (rfd >= 0)
+    close(rfd);
+  if (wfd >= 0)
+    close(wfd);
+
+  unlink(output);
+
+  free(request.data);
+  free(buffer);
+
+  return (status);
+}
+
+
+/*
+ * 'gsw_accept()' - Accept a job and hand it to an idle instance.
+ */
+
+static void
+gsw_accept(int            listenfd,	/* I - Listening socket */
+           const char     *dir,		/* I - Worker directory */
+           gsw_instance_t *workers,	/* I - Instances */
+	   int            num_workers)	/* I - Number of instances */
+{
+  int		fd,			/* Client socket */
+		i;			/* Looping var */
+  gsw_instance_t *w;			/* Instance to use */
+  gsw_buf_t	job;			/* Job for Ghostscript */
+  char		*request,		/* Request from the client */
+		*input,			/* Input file */
+		*ps,			/* PostScript job */
+		inname[1024],		/* Input file of the instance */
+		outname[1024];		/* Output pipe of the instance */
+  size_t	dirlen = strlen(dir),	/* Length of directory name */
+		used = 0;		/* Bytes in request */
+  ssize_t	bytes;			/* Bytes read */
+  struct timeval timeout;		/* Receive timeout */
+
+
+  if ((fd = accept(listenfd, NULL, NULL)) < 0)
+    return;
+
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  for (i = 0, w = NULL; i < num_workers; i ++)
+    if (workers[i].pid > 0 && workers[i].ready && workers[i].client < 0)
+    {
+      w = workers + i;
+      break;
+    }
+
+  memset(&job, 0, sizeof(job));
+
+  if (!w || (request = malloc(GSW_MAX_REQUEST + 1)) == NULL)
+  {
+    close(fd);
+    return;
+  }
+
+ /*
+  * Read the request; the client sends it in one go, so don't let a
+  * stuck client block the other jobs...
+  */
+
+  timeout.tv_sec  = 5;
+  timeout.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  while (used < GSW_MAX_REQUEST &&
+         ((bytes = read(fd, request + used, GSW_MAX_REQUEST - used)) > 0 ||
+	  (bytes < 0 && errno == EINTR)))
+    if (bytes > 0)
+      used += (size_t)bytes;
+
+  request[used] = '\0';
+
+ /*
+  * The first two lines are the output pipe and the input file, both of
+  * which must be directly in our directory...
+  */
+
+  if ((input = strchr(request, '\n')) == NULL ||
+      (ps = strchr(input + 1, '\n')) == NULL)
+    goto error;
+
+  *input++ = '\0';
+  *ps++    = '\0';
+
+  if (strncmp(request, dir, dirlen) || request[dirlen] != '/' ||
+      strncmp(request + dirlen + 1, "out-", 4) ||
+      strchr(request + dirlen + 1, '/') ||
+      strncmp(input, dir, dirlen) || input[dirlen] != '/' ||
+      strncmp(input + dirlen + 1, "job-", 4) ||
+      strchr(input + dirlen + 1, '/'))
+    goto error;
+
+ /*
+  * Move both into the instance's directory, which is the only one its
+  * Ghostscript may access, so that the job cannot get at the files of
+  * other jobs; they get deleted at the end of the job...
+  */
+
+  snprintf(inname, sizeof(inname), "%s/input", w->dir);
+  snprintf(outname, sizeof(outname), "%s/output", w->dir);
+
+  if (rename(request, outname) || rename(input, inname))
+  {
+    gsw_clean(w->dir);
+    goto error;
+  }
+
+ /*
+  * Run it as an encapsulated job, followed by a job which resets the
+  * output file, so that the raster stream is complete, and prints the
+  * end-of-job marker...
+  */
+
+  job.size = used + 6 * 1024;
+  if ((job.data = malloc(job.size)) == NULL)
+  {
+    gsw_clean(w->dir);
+    goto error;
+  }
+
+  gsw_printf(&job, "\004\n/GSWInputFile ");
+  gsw_string(&job, inname, 0);
+  gsw_printf(&job, " def /GSWOutputFile ");
+  gsw_string(&job, outname, 1);
+  gsw_printf(&job, " def\n%s\n\004\n<< /OutputFile (/dev/null) >> "
+             "setpagedevice (%s\\n) print flush\n", ps, gsw_marker);
+
+  w->client = fd;
+  w->status = 0;
+
+  if (job.overflow || gsw_write(w->infd, job.data, job.used))
+  {
+    w->status = 1;
+    gsw_finish(w);
+    gsw_stop(w);
+  }
+
+  free(job.data);
+  free(request);
+  return;
+
+  error:
+
+  free(job.data);
+  free(request);
+  close(fd);
+}
+
+
+/*
+ * 'gsw_clean()' - Remove all files from an instance's directory.
+ *
+ * Besides the files of its job, a job may have created files of its own
+ * there, which must not be seen by the next job.
+ */
+
+static void
+gsw_clean(const char *dir)		/* I - Directory */
+{
+  DIR		*dp;			/* Directory */
+  struct dirent	*dent;			/* Directory entry */
+  char		filename[1024];		/* File to remove */
+
+
+  if ((dp = opendir(dir)) == NULL)
+    return;
+
+  while ((dent = readdir(dp)) != NULL)
+  {
+    if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", dir, dent->d_name);
+    unlink(filename);
+  }
+
+  closedir(dp);
+}
+
+
+/*
+ * 'gsw_connect()' - Connect to the worker daemon, starting it if needed.
+ */
+
+static int				/* O - Socket or -1 on error */
+gsw_connect(const char *dir,		/* I - Worker directory */
+            int        num_workers)	/* I - Number of instances */
+{
+  int			fd,		/* Socket */
+			err,		/* Error from connect() */
+			started = 0,	/* Did we start the daemon? */
+			waited;		/* Milliseconds waited */
+  pid_t			pid;		/* Process ID */
+  struct sockaddr_un	addr;		/* Socket address */
+  char			failname[1024];	/* Failure file */
+
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/socket", dir);
+
+  snprintf(failname, sizeof(failname), "%s/failed", dir);
+
+  for (waited = 0; waited < GSW_START_TIMEOUT; waited += 50)
+  {
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+      return (-1);
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+      return (fd);
+
+    err = errno;
+    close(fd);
+
+    if (err != ENOENT && err != ECONNREFUSED)
+      return (-1);
+
+    if (!started)
+    {
+     /*
+      * Start the daemon, detached from the job so that it survives it...
+      */
+
+      started = 1;
+
+      if ((pid = fork()) == 0)
+      {
+        setsid();
+
+        if (fork() == 0)
+	  _exit(gsw_serve(dir, num_workers));
+
+	_exit(0);
+      }
+      else if (pid < 0)
+        return (-1);
+
+      while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+    }
+    else if (!access(failname, F_OK))
+      return (-1);
+
+    usleep(50000);
+  }
+
+  return (-1);
+}
+
+
+/*
+ * 'gsw_file_param()' - Check whether a parameter names a file.
+ */
+
+static int				/* O - 1 if a file name, 0 otherwise */
+gsw_file_param(const char *name,	/* I - Parameter name */
+               size_t     namelen)	/* I - Length of name */
+{
+  static const char * const words[] =	/* Parts of file parameter names */
+  {
+    "Dir",				/* ICCProfilesDir, GenericResourceDir */
+    "File",				/* OutputFile, ... */
+    "PATH",				/* FONTPATH, ... */
+    "Profile"				/* OutputICCProfile, DefaultRGBProfile */
+  };
+  size_t	i,			/* Looping var */
+		len;			/* Length of word */
+  const char	*ptr;			/* Pointer into name */
+
+
+  for (i = 0; i < sizeof(words) / sizeof(words[0]); i ++)
+  {
+    len = strlen(words[i]);
+
+    for (ptr = name; ptr + len <= name + namelen; ptr ++)
+      if (!strncmp(ptr, words[i], len))
+        return (1);
+  }
+
+  return (0);
+}
+
+
+/*
+ * 'gsw_finish()' - Finish the current job of an instance.
+ */
+
+static void
+gsw_finish(gsw_instance_t *w)		/* I - Instance */
+{
+  char	message[32];			/* Status message */
+
+
+  if (w->client < 0)
+    return;
+
+  snprintf(message, sizeof(message), "S%d\n", w->status);
+  gsw_write(w->client, message, strlen(message));
+  close(w->client);
+
+  gsw_clean(w->dir);
+
+  w->client = -1;
+  w->jobs ++;
+}
+
+
+/*
+ * 'gsw_job()' - Convert a Ghostscript command line into a job.
+ *
+ * Options which are fixed when the worker starts Ghostscript are
+ * skipped, the device parameters become one "setpagedevice" call, and
+ * the "-c" commands run before the input file.  The daemon defines the
+ * names of the input file and output pipe as GSWInputFile and
+ * GSWOutputFile.  Returns -1 for anything we cannot express this way.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+gsw_job(gsw_buf_t    *b,		/* I - Buffer */
+        cups_array_t *gs_args)		/* I - Ghostscript command line */
+{
+  static const char * const fixed[] =	/* Options set up by the worker */
+  {
+    "-dQUIET",
+    "-dSAFER",
+    "-dNOPAUSE",
+    "-dBATCH",
+    "-dNOINTERPOLATE",
+    "-dNOMEDIAATTRS",
+    "-sDEVICE=cups",
+    "-sstdout=%stderr",
+    "-sOutputFile=%stdout",
+    "-f",
+    "-_"
+  };
+  const char	*arg,			/* Current argument */
+		*name,			/* Parameter name */
+		*value,			/* Parameter value */
+		*ptr;			/* Pointer into argument */
+  size_t	i,			/* Looping var */
+		namelen;		/* Length of name */
+  int		commands,		/* In "-c" commands? */
+		width = 0,		/* Page width */
+		height = 0,		/* Page height */
+		xres,			/* Horizontal resolution */
+		yres;			/* Vertical resolution */
+
+
+ /*
+  * Device parameters...
+  */
+
+  gsw_printf(b, "<<");
+
+  cupsArrayFirst(gs_args);		/* Skip the program name */
+
+  for (arg = (const char *)cupsArrayNext(gs_args), commands = 0;
+       arg;
+       arg = (const char *)cupsArrayNext(gs_args))
+  {
+    if (commands)
+    {
+      commands = strcmp(arg, "-f") != 0;
+      continue;
+    }
+    else if (!strcmp(arg, "-c"))
+    {
+      commands = 1;
+      continue;
+    }
+
+    for (i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i ++)
+      if (!strcmp(arg, fixed[i]))
+        break;
+
+    if (i < sizeof(fixed) / sizeof(fixed[0]) || !strncmp(arg, "-I", 2) ||
+        !strcmp(arg, "-dShowAcroForm"))
+      continue;
+
+    if (!strncmp(arg, "-r", 2))
+    {
+      if ((i = (size_t)sscanf(arg + 2, "%dx%d", &xres, &yres)) == 1)
+        yres = xres;
+      else if (i != 2)
+        return (-1);
+
+      gsw_printf(b, " /HWResolution [%d %d]", xres, yres);
+      continue;
+    }
+
+    if (!strncmp(arg, "-dDEVICEWIDTHPOINTS=", 20))
+    {
+      width = atoi(arg + 20);
+      continue;
+    }
+    else if (!strncmp(arg, "-dDEVICEHEIGHTPOINTS=", 21))
+    {
+      height = atoi(arg + 21);
+      continue;
+    }
+
+    if (strncmp(arg, "-d", 2) && strncmp(arg, "-s", 2))
+      return (-1);
+
+    name = arg + 2;
+    if ((value = strchr(name, '=')) != NULL)
+      namelen = (size_t)(value++ - name);
+    else
+      namelen = strlen(name);
+
+    if (namelen == 0)
+      return (-1);
+
+    for (ptr = name; ptr < name + namelen; ptr ++)
+      if (!isalnum(*ptr & 255) && *ptr != '_' && *ptr != '.')
+        return (-1);
+
+   /*
+    * Ghostscript may only read the files of the job, so leave file names
+    * (ICC profiles, resource directories, ...) to a normal run...
+    */
+
+    if (arg[1] == 's' && value &&
+        (strchr(value, '/') || gsw_file_param(name, namelen)))
+      return (-1);
+
+    gsw_printf(b, " /%.*s ", (int)namelen, name);
+
+    if (arg[1] == 's')
+      gsw_string(b, value ? value : "", 0);
+    else if (!value)
+      gsw_printf(b, "true");
+    else
+    {
+     /*
+      * Only pass numbers, booleans, and names...
+      */
+
+      if (!*value)
+        return (-1);
+
+      for (ptr = value; *ptr; ptr ++)
+        if (!isalnum(*ptr & 255) && !strchr("+-./", *ptr))
+	  return (-1);
+
+      gsw_printf(b, "%s", value);
+    }
+  }
+
+  if (width > 0 && height > 0)
+    gsw_printf(b, " /PageSize [%d %d]", width, height);
+
+  gsw_printf(b, " /OutputFile GSWOutputFile >> setpagedevice\n");
+
+ /*
+  * Interpreter parameters and PostScript commands...
+  */
+
+  for (arg = (const char *)cupsArrayFirst(gs_args), commands = 0;
+       arg;
+       arg = (const char *)cupsArrayNext(gs_args))
+  {
+    if (!strcmp(arg, "-c"))
+      commands = 1;
+    else if (!strcmp(arg, "-f"))
+      commands = 0;
+    else if (commands)
+      gsw_printf(b, "%s\n", arg);
+    else if (!strcmp(arg, "-dShowAcroForm"))
+      gsw_printf(b, "/ShowAcroForm true def\n");
+  }
+
+ /*
+  * And the document itself...
+  */
+
+  gsw_printf(b, "GSWInputFile run\n");
+
+  return (b->overflow ? -1 : 0);
+}
+
+
+/*
+ * 'gsw_line()' - Process a line of Ghostscript output.
+ */
+
+static int				/* O - 1 if instance came up, 0 otherwise */
+gsw_line(gsw_instance_t *w,		/* I - Instance */
+         const char     *line)		/* I - Line of output */
+{
+  char	*message;			/* Message for the client */
+  size_t linelen = strlen(line);	/* Length of line */
+
+
+  if (!strcmp(line, gsw_marker))
+  {
+    if (!w->ready)
+    {
+      w->ready = 1;
+      return (1);
+    }
+
+    gsw_finish(w);
+
+    if (w->status || w->jobs >= GSW_MAX_JOBS)
+      gsw_stop(w);
+
+    return (0);
+  }
+
+  if (!w->ready)
+    snprintf(w->message, sizeof(w->message), "%s", line);
+
+  if (w->client < 0)
+    return (0);
+
+  if (!strncmp(line, "Error:", 6) || strstr(line, "%%[ Error:"))
+    w->status = 1;
+
+  if ((message = malloc(linelen + 3)) != NULL)
+  {
+    message[0] = 'L';
+    memcpy(message + 1, line, linelen);
+    message[linelen + 1] = '\n';
+    gsw_write(w->client, message, linelen + 2);
+    free(message);
+  }
+
+  return (0);
+}
+
+
+/*
+ * 'gsw_mkdir()' - Create a private directory.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+gsw_mkdir(const char *dir)		/* I - Directory */
+{
+  struct stat	info;			/* Directory information */
+
+
+  if (mkdir(dir, 0700) && errno != EEXIST)
+    return (0);
+
+  if (lstat(dir, &info) || !S_ISDIR(info.st_mode) ||
+      info.st_uid != getuid() || (info.st_mode & 077))
+  {
+    fprintf(stderr,
+            "DEBUG: Ghostscript worker directory %s is not private, "
+	    "not using it.\n", dir);
+    return (0);
+  }
+
+  return (1);
+}
+
+
+/*
+ * 'gsw_printf()' - Append formatted text to a buffer.
+ */
+
+static void
+gsw_printf(gsw_buf_t  *b,		/* I - Buffer */
+           const char *format,		/* I - printf-style format string */
+	   ...)				/* I - Additional arguments */
+{
+  va_list	ap;			/* Argument pointer */
+  int		bytes;			/* Bytes formatted */
+
+
+  if (b->overflow)
+    return;
+
+  va_start(ap, format);
+  bytes = vsnprintf(b->data + b->used, b->size - b->used, format, ap);
+  va_end(ap);
+
+  if (bytes < 0 || (size_t)bytes >= b->size - b->used)
+    b->overflow = 1;
+  else
+    b->used += (size_t)bytes;
+}
+
+
+/*
+ * 'gsw_serve()' - Main loop of the worker daemon.
+ */
+
+static int				/* O - Exit status */
+gsw_serve(const char *dir,		/* I - Worker directory */
+          int        num_workers)	/* I - Number of instances */
+{
+  int			lockfd,		/* Lock file */
+			listenfd,	/* Listening socket */
+			fd,		/* Current file descriptor */
+			maxfd,		/* Maximum file descriptor */
+			i,		/* Looping var */
+			nfds,		/* Number of descriptors to poll */
+			busy,		/* Number of busy instances */
+			idle,		/* Number of idle instances */
+			alive,		/* Number of running instances */
+			failures = 0,	/* Failed starts in a row */
+			stale = 0,	/* Has the PPD file changed? */
+			timeout;	/* Poll timeout */
+  char			filename[1024],	/* Lock and failure files */
+			*start,		/* Start of current line */
+			*end;		/* End of current line */
+  const char		*ppdfile;	/* PPD file of the jobs */
+  struct stat		ppdinfo,	/* PPD file when we started */
+			info;		/* PPD file now */
+  ssize_t		bytes;		/* Bytes read */
+  time_t		last_job;	/* Time of last job */
+  struct sockaddr_un	addr;		/* Socket address */
+  gsw_instance_t	workers[GSW_MAX_WORKERS],
+					/* Ghostscript instances */
+			*w;		/* Current instance */
+  struct pollfd		pfds[2 * GSW_MAX_WORKERS + 1];
+					/* Descriptors to wait for */
+  gsw_instance_t	*pws[2 * GSW_MAX_WORKERS + 1];
+					/* Instance for each descriptor */
+  unsigned char		seed[16];	/* Random data for password */
+  FILE			*fp;		/* Failure file */
+
+
+ /*
+  * Only run one daemon per directory; a daemon which is just exiting
+  * may still hold the lock for a moment...
+  */
+
+  snprintf(filename, sizeof(filename), "%s/lock", dir);
+  if ((lockfd = open(filename, O_RDWR | O_CREAT, 0600)) < 0)
+    return (1);
+
+  for (i = 0; flock(lockfd, LOCK_EX | LOCK_NB); i ++)
+  {
+    if (i >= 20)
+      return (0);
+
+    usleep(50000);
+  }
+
+ /*
+  * Detach from the job, the scheduler waits for all holders of the
+  * filter's stderr to go away...
+  */
+
+  if ((fd = open("/dev/null", O_RDWR)) >= 0)
+  {
+    dup2(fd, 0);
+    dup2(fd, 1);
+    dup2(fd, 2);
+
+    if (fd > 2)
+      close(fd);
+  }
+
+  if ((maxfd = (int)sysconf(_SC_OPEN_MAX)) < 0 || maxfd > 65536)
+    maxfd = 65536;
+
+  for (fd = 3; fd < maxfd; fd ++)
+    if (fd != lockfd)
+      close(fd);
+
+  fcntl(lockfd, F_SETFD, FD_CLOEXEC);
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGCHLD, SIG_DFL);
+
+ /*
+  * Our Ghostscript instances use the PPD file of the job which started
+  * us, jobs for other PPD files go to other daemons...
+  */
+
+  if ((ppdfile = getenv("PPD")) != NULL &&
+      (!*ppdfile || stat(ppdfile, &ppdinfo)))
+    ppdfile = NULL;
+
+ /*
+  * The job server password keeps jobs from leaving their encapsulation
+  * with "exitserver", and the marker cannot be faked by a job either...
+  */
+
+  if ((fd = open("/dev/urandom", O_RDONLY)) < 0 ||
+      read(fd, seed, sizeof(seed)) != sizeof(seed))
+  {
+    srandom((unsigned)(time(NULL) ^ getpid()));
+    for (i = 0; i < (int)sizeof(seed); i ++)
+      seed[i] = (unsigned char)random();
+  }
+
+  if (fd >= 0)
+    close(fd);
+
+  for (i = 0; i < (int)sizeof(seed); i ++)
+    snprintf(gsw_password + 2 * i, 3, "%02x", seed[i]);
+
+  snprintf(gsw_marker, sizeof(gsw_marker), "%%%%[ gstoraster worker %s ]%%%%",
+           gsw_password);
+
+ /*
+  * Listen for jobs...
+  */
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/socket", dir);
+  unlink(addr.sun_path);
+
+  if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return (1);
+
+  fcntl(listenfd, F_SETFD, FD_CLOEXEC);
+
+  if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(listenfd, 16))
+  {
+    close(listenfd);
+    return (1);
+  }
+
+ /*
+  * Start the instances and serve jobs until we are idle for a while or
+  * Ghostscript cannot be started in this mode...
+  */
+
+  memset(workers, 0, sizeof(workers));
+  for (i = 0; i < num_workers; i ++)
+  {
+    workers[i].client = -1;
+    snprintf(workers[i].dir, sizeof(workers[i].dir), "%s/%d", dir, i);
+    gsw_start(workers + i);
+  }
+
+  last_job = time(NULL);
+
+  for (;;)
+  {
+    nfds  = 0;
+    busy  = 0;
+    idle  = 0;
+    alive = 0;
+
+    for (i = 0, w = workers; i < num_workers; i ++, w ++)
+    {
+      if (w->pid <= 0 && failures < GSW_MAX_FAILURES && !stale)
+        gsw_start(w);
+
+      if (w->pid <= 0)
+        continue;
+
+      alive ++;
+
+      pfds[nfds].fd     = w->outfd;
+      pfds[nfds].events = POLLIN;
+      pws[nfds ++]      = w;
+
+      if (w->client >= 0)
+      {
+        busy ++;
+
+	pfds[nfds].fd     = w->client;
+	pfds[nfds].events = 0;		/* Only watch for a hangup */
+	pws[nfds ++]      = w;
+      }
+      else if (w->ready)
+        idle ++;
+    }
+
+    if (!alive)
+      break;
+
+   /*
+    * Once the PPD file has changed, take no new jobs; new clients use
+    * another directory and the running jobs finish with the old one...
+    */
+
+    if (!stale && ppdfile &&
+        (stat(ppdfile, &info) || info.st_ino != ppdinfo.st_ino ||
+	 info.st_mtime != ppdinfo.st_mtime))
+    {
+      stale = 1;
+
+      close(listenfd);
+      listenfd = -1;
+      unlink(addr.sun_path);
+    }
+
+    if (stale && !busy)
+      break;
+
+    if (idle && !stale)
+    {
+      pfds[nfds].fd     = listenfd;
+      pfds[nfds].events = POLLIN;
+      pws[nfds ++]      = NULL;
+    }
+
+    if (busy)
+      timeout = (ppdfile && !stale) ? GSW_CHECK_INTERVAL * 1000 : -1;
+    else if ((timeout = (int)(last_job + GSW_IDLE_TIMEOUT - time(NULL))) <= 0)
+      break;
+    else if (ppdfile && timeout > GSW_CHECK_INTERVAL)
+      timeout = GSW_CHECK_INTERVAL * 1000;
+    else
+      timeout *= 1000;
+
+    if (poll(pfds, (nfds_t)nfds, timeout) <= 0)
+      continue;
+
+    for (i = 0; i < nfds; i ++)
+    {
+      if (!pfds[i].revents)
+        continue;
+
+      if ((w = pws[i]) != NULL && w->pid <= 0)
+        continue;			/* Stopped in this round */
+      else if (!w)
+      {
+       /*
+        * New job...
+	*/
+
+        gsw_accept(listenfd, dir, workers, num_workers);
+	last_job = time(NULL);
+      }
+      else if (pfds[i].fd == w->client)
+      {
+       /*
+        * The client only closes the connection when the job is canceled;
+	* we cannot stop Ghostscript in the middle of a job, so replace
+	* the instance...
+	*/
+
+        w->status = 1;
+	gsw_finish(w);
+	gsw_stop(w);
+      }
+      else if (pfds[i].fd == w->outfd)
+      {
+       /*
+        * Output from Ghostscript...
+	*/
+
+        if ((bytes = read(w->outfd, w->line + w->linelen,
+	                  sizeof(w->line) - 1 - w->linelen)) <= 0)
+	{
+	  if (bytes < 0 && errno == EINTR)
+	    continue;
+
+         /*
+	  * Ghostscript went away...
+	  */
+
+	  if (!w->ready)
+	  {
+	    failures ++;
+
+	    if (failures >= GSW_MAX_FAILURES)
+	    {
+	      snprintf(filename, sizeof(filename), "%s/failed", dir);
+	      if ((fp = fopen(filename, "w")) != NULL)
+	      {
+	        fprintf(fp, "Unable to start %s in job server mode: %s\n",
+		        CUPS_GHOSTSCRIPT,
+			w->message[0] ? w->message : "exited");
+		fclose(fp);
+	      }
+	    }
+	  }
+
+	  w->status = 1;
+	  gsw_finish(w);
+	  gsw_stop(w);
+	  continue;
+	}
+
+	w->linelen += (size_t)bytes;
+	w->line[w->linelen] = '\0';
+
+	for (start = w->line; (end = strchr(start, '\n')) != NULL;
+	     start = end + 1)
+	{
+	  *end = '\0';
+
+	  if (gsw_line(w, start))
+	    failures = 0;
+
+	  if (w->pid <= 0)
+	    break;
+	}
+
+	if (w->pid <= 0)
+	  continue;
+
+	w->linelen -= (size_t)(start - w->line);
+	memmove(w->line, start, w->linelen);
+
+	if (w->linelen == sizeof(w->line) - 1)
+	{
+	  w->line[w->linelen] = '\0';
+	  gsw_line(w, w->line);
+	  w->linelen = 0;
+	}
+      }
+    }
+  }
+
+ /*
+  * Shut down...
+  */
+
+  if (listenfd >= 0)
+  {
+    close(listenfd);
+    unlink(addr.sun_path);
+  }
+
+  for (i = 0; i < num_workers; i ++)
+  {
+    workers[i].status = 1;
+    gsw_finish(workers + i);
+    gsw_stop(workers + i);
+    gsw_clean(workers[i].dir);
+    rmdir(workers[i].dir);
+  }
+
+ /*
+  * Nobody uses our directory anymore when the PPD file has changed...
+  */
+
+  if (stale)
+  {
+    snprintf(filename, sizeof(filename), "%s/failed", dir);
+    unlink(filename);
+    snprintf(filename, sizeof(filename), "%s/lock", dir);
+    unlink(filename);
+    rmdir(dir);
+  }
+
+  close(lockfd);
+
+  return (0);
+}
+
+
+/*
+ * 'gsw_start()' - Start a Ghostscript instance.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+gsw_start(gsw_instance_t *w)		/* I - Instance */
+{
+  int		infds[2],		/* Pipe to stdin */
+		outfds[2];		/* Pipe from stdout/stderr */
+  const char	*fontpath;		/* CUPS font path */
+  char		fontarg[1024],		/* -I option */
+		permit[1024],		/* --permit-file-all option */
+		setup[256],		/* Startup commands */
+		ready[512];		/* Startup marker job */
+  char		*argv[17];		/* Command line */
+
+
+  if ((fontpath = getenv("CUPS_FONTPATH")) == NULL)
+    fontpath = CUPS_FONTPATH;
+
+  snprintf(fontarg, sizeof(fontarg), "-I%s", fontpath);
+  if (!gsw_mkdir(w->dir))
+    return (-1);
+
+  gsw_clean(w->dir);
+
+  snprintf(permit, sizeof(permit), "--permit-file-all=%s/", w->dir);
+  snprintf(setup, sizeof(setup),
+           "<< /StartJobPassword (%s) /SystemParamsPassword (%s) >> "
+	   "setsystemparams", gsw_password, gsw_password);
+
+  argv[0]  = CUPS_GHOSTSCRIPT;
+  argv[1]  = "-dQUIET";
+  argv[2]  = "-dSAFER";
+  argv[3]  = "-dNOPAUSE";
+  argv[4]  = "-dJOBSERVER";
+  argv[5]  = "-dNOINTERPOLATE";
+  argv[6]  = "-dNOMEDIAATTRS";
+  argv[7]  = "-sDEVICE=cups";
+  argv[8]  = "-sstdout=%stderr";
+  argv[9]  = "-sOutputFile=/dev/null";
+  argv[10] = fontarg;
+  argv[11] = permit;
+  argv[12] = "-c";
+  argv[13] = setup;
+  argv[14] = "-f";
+  argv[15] = "-";
+  argv[16] = NULL;
+
+  if (pipe(infds))
+    return (-1);
+
+  if (pipe(outfds))
+  {
+    close(infds[0]);
+    close(infds[1]);
+    return (-1);
+  }
+
+  fcntl(infds[1], F_SETFD, FD_CLOEXEC);
+  fcntl(outfds[0], F_SETFD, FD_CLOEXEC);
+
+  if ((w->pid = fork()) == 0)
+  {
+    dup2(infds[0], 0);
+    dup2(outfds[1], 1);
+    dup2(outfds[1], 2);
+    close(infds[0]);
+    close(outfds[1]);
+
+    execvp(argv[0], argv);
+    _exit(1);
+  }
+
+  close(infds[0]);
+  close(outfds[1]);
+
+  if (w->pid < 0)
+  {
+    w->pid = 0;
+    close(infds[1]);
+    close(outfds[0]);
+    return (-1);
+  }
+
+  w->infd    = infds[1];
+  w->outfd   = outfds[0];
+  w->ready   = 0;
+  w->client  = -1;
+  w->status  = 0;
+  w->jobs    = 0;
+  w->linelen = 0;
+
+  w->message[0] = '\0';
+
+ /*
+  * Ghostscript is ready when it prints the marker...
+  */
+
+  snprintf(ready, sizeof(ready), "(%s\\n) print flush\n", gsw_marker);
+  gsw_write(w->infd, ready, strlen(ready));
+
+  return (0);
+}
+
+
+/*
+ * 'gsw_stop()' - Stop a Ghostscript instance.
+ */
+
+static void
+gsw_stop(gsw_instance_t *w)		/* I - Instance */
+{
+  if (w->pid <= 0)
+    return;
+
+  close(w->infd);
+  close(w->outfd);
+
+  kill(w->pid, SIGTERM);
+  while (waitpid(w->pid, NULL, 0) < 0 && errno == EINTR);
+
+  w->pid     = 0;
+  w->infd    = -1;
+  w->outfd   = -1;
+  w->ready   = 0;
+  w->linelen = 0;
+}
+
+
+/*
+ * 'gsw_string()' - Append a PostScript string to a buffer.
+ */
+
+static void
+gsw_string(gsw_buf_t  *b,		/* I - Buffer */
+           const char *s,		/* I - String */
+	   int        output_file)	/* I - Escape "%" for OutputFile? */
+{
+  gsw_printf(b, "(");
+
+  for (; *s; s ++)
+  {
+    if (*s == '(' || *s == ')' || *s == '\\')
+      gsw_printf(b, "\\%c", *s);
+    else if (*s == '%' && output_file)
+      gsw_printf(b, "%%%%");
+    else if (*s == '\n')
+      gsw_printf(b, "\\n");
+    else
+      gsw_printf(b, "%c", *s);
+  }
+
+  gsw_printf(b, ")");
+}
+
+
+/*
+ * 'gsw_write()' - Write a buffer to a file descriptor.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+gsw_write(int        fd,		/* I - File descriptor */
+          const char *buffer,		/* I - Buffer */
+	  size_t     bytes)		/* I - Number of bytes */
+{
+  ssize_t	written;		/* Bytes written */
+
+
+  while (bytes > 0)
+  {
+    if ((written = write(fd, buffer, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (-1);
+    }
+
+    buffer += written;
+    bytes  -= (size_t)written;
+  }
+
+  return (0);
+}
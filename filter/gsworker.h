@@ -0,0 +1,35 @@
+/*
+ *   Persistent Ghostscript worker header file for the gstoraster filter.
+ *
+ *   Distribution and use rights are outlined in the file "COPYING"
+ *   which should have been included with this file.
+ */
+
+#ifndef _GSWORKER_H_
+#  define _GSWORKER_H_
+
+/*
+ * Include necessary headers...
+ */
+
+#  include <stddef.h>
+#  include <cups/cups.h>
+#  include <cups/ppd.h>
+
+
+/*
+ * Prototypes...
+ */
+
+extern int	gs_worker_count(ppd_file_t *ppd, int num_options,
+		                cups_option_t *options);
+extern int	gs_worker_dir(char *dir, size_t dirsize, const char *ppdfile,
+		              int num_workers);
+extern int	gs_worker_run(const char *dir, int num_workers,
+		              cups_array_t *gs_args, const char *filename);
+
+#endif /* !_GSWORKER_H_ */
+
+/*
+ * End
+ */
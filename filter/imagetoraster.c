@@ -22,6 +22,7 @@
  *   format_W()      - Convert image data to luminance.
  *   format_YMC()    - Convert image data to YMC.
  *   format_YMCK()   - Convert image data to YMCK.
+ *   format_row()    - Convert a row of image data for the color space.
  *   make_lut()      - Make a lookup table given gamma and brightness values.
  *   raster_cb()     - Validate the page header.
  */
@@ -40,6 +41,14 @@
 #include <string.h>
 
 
+/*
+ * Constants...
+ */
+
+#define MAX_PLANE_BUFFER	(64 * 1024 * 1024)
+					/* Planes kept in memory, else in a file */
+
+
 /*
  * Globals...
  */
@@ -122,6 +131,7 @@ static void	format_RGBA(cups_page_header2_t *header, unsigned char *row, int y,
 static void	format_W(cups_page_header2_t *header, unsigned char *row, int y, int z, int xsize, int ysize, int yerr0, int yerr1, cups_ib_t *r0, cups_ib_t *r1);
 static void	format_YMC(cups_page_header2_t *header, unsigned char *row, int y, int z, int xsize, int ysize, int yerr0, int yerr1, cups_ib_t *r0, cups_ib_t *r1);
 static void	format_YMCK(cups_page_header2_t *header, unsigned char *row, int y, int z, int xsize, int ysize, int yerr0, int yerr1, cups_ib_t *r0, cups_ib_t *r1);
+static void	format_row(cups_page_header2_t *header, unsigned char *row, int y, int z, int xsize, int ysize, int yerr0, int yerr1, cups_ib_t *r0, cups_ib_t *r1);
 static void	make_lut(cups_ib_t *, int, float, float);
 static int	raster_cb(cups_page_header2_t *header, int preferred_bits);
 
@@ -186,7 +196,13 @@ main(int  argc,				/* I - Number of command-line arguments */
 			yerr1;		/* Bottom Y error value */
   cups_ib_t		lut[256];	/* Gamma/brightness LUT */
   int			plane,		/* Current color plane */
+			fplane,		/* Plane being formatted */
 			num_planes;	/* Number of color planes */
+  cups_ib_t		*planebuf;	/* Rows of the other planes */
+  int			planefd;	/* File for the other planes */
+  char			planefile[1024];/* Name of plane file */
+  size_t		planesize,	/* Size of one plane */
+			offset;		/* Offset of row in other planes */
   char			filename[1024];	/* Name of file to print */
   cm_calibration_t      cm_calibrate;   /* Are we color calibrating the device? */
   int                   cm_disabled;    /* Color management disabled? */
@@ -1381,19 +1397,48 @@ main(int  argc,				/* I - Number of command-line arguments */
 
         cupsRasterWriteHeader2(ras, &header);
 
-        for (plane = 0; plane < num_planes; plane ++)
+       /*
+	* Initialize the image "zoom" engine...
+	*/
+
+        if (Flip)
+	  z = _cupsImageZoomNew(img, xc0, yc0, xc1, yc1, -xtemp, ytemp,
+	                        Orientation & 1, zoom_type);
+        else
+	  z = _cupsImageZoomNew(img, xc0, yc0, xc1, yc1, xtemp, ytemp,
+	                        Orientation & 1, zoom_type);
+
+       /*
+	* For planar output every zoomed row is formatted for all planes at
+	* once.  The first plane goes to the driver right away, the others
+	* are kept in memory, or in a temporary file for big pages, until
+	* the first plane is complete...
+	*/
+
+        planebuf  = NULL;
+        planefd   = -1;
+	planesize = (size_t)header.cupsBytesPerLine * z->ysize;
+
+        if (num_planes > 1)
 	{
-	 /*
-	  * Initialize the image "zoom" engine...
-	  */
+	  if (planesize * (num_planes - 1) <= MAX_PLANE_BUFFER)
+	    planebuf = malloc(planesize * (num_planes - 1));
 
-          if (Flip)
-	    z = _cupsImageZoomNew(img, xc0, yc0, xc1, yc1, -xtemp, ytemp,
-	                          Orientation & 1, zoom_type);
-          else
-	    z = _cupsImageZoomNew(img, xc0, yc0, xc1, yc1, xtemp, ytemp,
-	                          Orientation & 1, zoom_type);
+	  if (!planebuf)
+	  {
+	    if ((planefd = cupsTempFd(planefile, sizeof(planefile))) < 0)
+	    {
+	      perror("ERROR: Unable to create temporary file for color planes");
+	      cupsImageClose(img);
+	      exit(1);
+	    }
+
+	    unlink(planefile);
+	  }
+	}
 
+        for (plane = 0; plane < num_planes; plane ++)
+	{
          /*
 	  * Write leading blank space as needed...
 	  */
@@ -1422,11 +1467,37 @@ main(int  argc,				/* I - Number of command-line arguments */
 	  }
 
          /*
-	  * Then write image data...
+	  * Then write image data, for the other planes from what was
+	  * formatted together with the first one...
 	  */
 
+	  for (y = 0; plane > 0 && y < z->ysize; y ++)
+	  {
+	    offset = planesize * (plane - 1) +
+	             (size_t)y * header.cupsBytesPerLine;
+
+            if (planebuf)
+	      memcpy(row, planebuf + offset, header.cupsBytesPerLine);
+	    else if (pread(planefd, row, header.cupsBytesPerLine,
+	                   (off_t)offset) < (ssize_t)header.cupsBytesPerLine)
+	    {
+	      perror("ERROR: Unable to read temporary file for color planes");
+	      cupsImageClose(img);
+	      exit(1);
+	    }
+
+	    if (cupsRasterWritePixels(ras, row, header.cupsBytesPerLine) <
+	                              header.cupsBytesPerLine)
+	    {
+	      fputs("ERROR: Unable to send raster data to the driver.\n",
+	            stderr);
+	      cupsImageClose(img);
+	      exit(1);
+	    }
+	  }
+
 	  for (y = z->ysize, yerr0 = 0, yerr1 = z->ysize, iy = 0, last_iy = -2;
-               y > 0;
+               plane == 0 && y > 0;
                y --)
 	  {
 	    if (iy != last_iy)
@@ -1440,66 +1511,35 @@ main(int  argc,				/* I - Number of command-line arguments */
 	    }
 
            /*
-	    * Format this line of raster data for the printer...
+	    * Format this line of raster data for the printer, last the
+	    * first plane which is written right away...
 	    */
 
-    	    blank_line(&header, row);
-
             r0 = z->rows[z->row];
             r1 = z->rows[1 - z->row];
 
-            switch (header.cupsColorSpace)
+            for (fplane = num_planes - 1; fplane >= 0; fplane --)
 	    {
-	      case CUPS_CSPACE_W :
-	          format_W(&header, row, y, plane, z->xsize, z->ysize,
-		           yerr0, yerr1, r0, r1);
-		  break;
-              default :
-	      case CUPS_CSPACE_RGB :
-	          format_RGB(&header, row, y, plane, z->xsize, z->ysize,
-		             yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_RGBA :
-	      case CUPS_CSPACE_RGBW :
-	          format_RGBA(&header, row, y, plane, z->xsize, z->ysize,
-		              yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_K :
-	      case CUPS_CSPACE_WHITE :
-	      case CUPS_CSPACE_GOLD :
-	      case CUPS_CSPACE_SILVER :
-	          format_K(&header, row, y, plane, z->xsize, z->ysize,
-		           yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_CMY :
-	          format_CMY(&header, row, y, plane, z->xsize, z->ysize,
-		             yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_YMC :
-	          format_YMC(&header, row, y, plane, z->xsize, z->ysize,
-		             yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_CMYK :
-	          format_CMYK(&header, row, y, plane, z->xsize, z->ysize,
-		              yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_YMCK :
-	      case CUPS_CSPACE_GMCK :
-	      case CUPS_CSPACE_GMCS :
-	          format_YMCK(&header, row, y, plane, z->xsize, z->ysize,
-		              yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_KCMYcm :
-	          if (header.cupsBitsPerColor == 1)
-		  {
-	            format_KCMYcm(&header, row, y, plane, z->xsize, z->ysize,
-		                  yerr0, yerr1, r0, r1);
-		    break;
-		  }
-	      case CUPS_CSPACE_KCMY :
-	          format_KCMY(&header, row, y, plane, z->xsize, z->ysize,
-		              yerr0, yerr1, r0, r1);
-		  break;
+    	      blank_line(&header, row);
+
+	      format_row(&header, row, y, fplane, z->xsize, z->ysize,
+	                 yerr0, yerr1, r0, r1);
+
+              if (fplane == 0)
+	        break;
+
+	      offset = planesize * (fplane - 1) +
+	               (size_t)(z->ysize - y) * header.cupsBytesPerLine;
+
+              if (planebuf)
+	        memcpy(planebuf + offset, row, header.cupsBytesPerLine);
+	      else if (pwrite(planefd, row, header.cupsBytesPerLine,
+	                      (off_t)offset) < (ssize_t)header.cupsBytesPerLine)
+	      {
+		perror("ERROR: Unable to write temporary file for color planes");
+		cupsImageClose(img);
+		exit(1);
+	      }
 	    }
 
            /*
@@ -1556,13 +1596,17 @@ main(int  argc,				/* I - Number of command-line arguments */
 	      }
             }
 	  }
+        }
 
-         /*
-	  * Free memory used for the "zoom" engine...
-	  */
+       /*
+	* Free memory used for the "zoom" engine and the planes...
+	*/
 
-          _cupsImageZoomDelete(z);
-        }
+        _cupsImageZoomDelete(z);
+
+        free(planebuf);
+	if (planefd >= 0)
+	  close(planefd);
       }
 
  /*
@@ -4473,6 +4517,68 @@ format_YMCK(cups_page_header2_t *header,/* I - Page header */
 }
 
 
+/*
+ * 'format_row()' - Convert a row of image data for the color space.
+ */
+
+static void
+format_row(cups_page_header2_t *header,	/* I - Page header */
+           unsigned char       *row,	/* IO - Bitmap data for device */
+	   int                 y,	/* I - Current row */
+	   int                 z,	/* I - Current plane */
+	   int                 xsize,	/* I - Width of image data */
+	   int	               ysize,	/* I - Height of image data */
+	   int                 yerr0,	/* I - Top Y error */
+	   int                 yerr1,	/* I - Bottom Y error */
+	   cups_ib_t           *r0,	/* I - Primary image data */
+	   cups_ib_t           *r1)	/* I - Image data for interpolation */
+{
+  switch (header->cupsColorSpace)
+  {
+    case CUPS_CSPACE_W :
+	format_W(header, row, y, z, xsize, ysize, yerr0, yerr1, r0, r1);
+	break;
+    default :
+    case CUPS_CSPACE_RGB :
+	format_RGB(header, row, y, z, xsize, ysize, yerr0, yerr1, r0, r1);
+	break;
+    case CUPS_CSPACE_RGBA :
+    case CUPS_CSPACE_RGBW :
+	format_RGBA(header, row, y, z, xsize, ysize, yerr0, yerr1, r0, r1);
+	break;
+    case CUPS_CSPACE_K :
+    case CUPS_CSPACE_WHITE :
+    case CUPS_CSPACE_GOLD :
+    case CUPS_CSPACE_SILVER :
+	format_K(header, row, y, z, xsize, ysize, yerr0, yerr1, r0, r1);
+	break;
+    case CUPS_CSPACE_CMY :
+	format_CMY(header, row, y, z, xsize, ysize, yerr0, yerr1, r0, r1);
+	break;
+    case CUPS_CSPACE_YMC :
+	format_YMC(header, row, y, z, xsize, ysize, yerr0, yerr1, r0, r1);
+	break;
+    case CUPS_CSPACE_CMYK :
+	format_CMYK(header, row, y, z, xsize, ysize, yerr0, yerr1, r0, r1);
+	break;
+    case CUPS_CSPACE_YMCK :
+    case CUPS_CSPACE_GMCK :
+    case CUPS_CSPACE_GMCS :
+	format_YMCK(header, row, y, z, xsize, ysize, yerr0, yerr1, r0, r1);
+	break;
+    case CUPS_CSPACE_KCMYcm :
+	if (header->cupsBitsPerColor == 1)
+	{
+	  format_KCMYcm(header, row, y, z, xsize, ysize, yerr0, yerr1, r0, r1);
+	  break;
+	}
+    case CUPS_CSPACE_KCMY :
+	format_KCMY(header, row, y, z, xsize, ysize, yerr0, yerr1, r0, r1);
+	break;
+  }
+}
+
+
 /*
  * 'make_lut()' - Make a lookup table given gamma and brightness values.
  */
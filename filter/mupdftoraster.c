@@ -55,6 +55,8 @@ MIT Open Source License  -  http://www.opensource.org/
 #define CUPS_IPTEMPFILE "/tmp/ip-XXXXXX"
 #define CUPS_OPTEMPFILE "/tmp/op-XXXXXX"
 
+#define MUTOOL_MAX_WORKERS 16
+
 #ifdef CUPS_RASTER_SYNCv1
 typedef cups_page_header2_t mupdf_page_header;
 #else
@@ -230,6 +232,250 @@ mutool_spawn (const char *filename,
   return status;
 }
 
+static int
+mutool_workers (ppd_file_t *ppd,
+		int num_options,
+		cups_option_t *options)
+{
+  const char *val = NULL;
+  ppd_attr_t *attr;
+  long cpus;
+  int workers;
+
+  /* Number of mutool processes to render a job with, from the
+     "mutool-workers" option (usually set as a queue default with
+     "lpadmin -o mutool-workers-default=N") or "*DefaultMutoolWorkers: N"
+     in the PPD file; "auto" uses one per CPU */
+  if ((val = cupsGetOption("mutool-workers", num_options, options)) == NULL &&
+      (val = cupsGetOption("MutoolWorkers", num_options, options)) == NULL &&
+      ppd && (attr = ppdFindAttr(ppd, "DefaultMutoolWorkers", NULL)) != NULL)
+    val = attr->value;
+
+  if (!val)
+    return 1;
+
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1)
+    cpus = 1;
+
+  if (!strcasecmp(val, "auto"))
+    workers = cpus;
+  else if ((workers = atoi(val)) < 1)
+    workers = 1;
+
+  /* More processes than CPUs only compete for them */
+  if (workers > cpus)
+    workers = cpus;
+  if (workers > MUTOOL_MAX_WORKERS)
+    workers = MUTOOL_MAX_WORKERS;
+
+  return workers;
+}
+
+static int
+mutool_page_count (const char *filename,
+		   const char *infilename,
+		   char **envp)
+{
+  char buf[256];
+  char *showargv[5];
+  int fds[2];
+  int pid;
+  int wstatus;
+  ssize_t n;
+  size_t bytes = 0;
+
+  /* Ask mutool itself, so that the page count matches the pages it
+     will render */
+  showargv[0] = (char *)filename;
+  showargv[1] = "show";
+  showargv[2] = (char *)infilename;
+  showargv[3] = "trailer/Root/Pages/Count";
+  showargv[4] = NULL;
+
+  if (pipe(fds))
+    return -1;
+
+  if ((pid = fork()) == 0) {
+    dup2(fds[1], 1);
+    close(fds[0]);
+    close(fds[1]);
+    execvpe(filename, showargv, envp);
+    perror(filename);
+    exit(errno);
+  }
+
+  close(fds[1]);
+  if (pid < 0) {
+    close(fds[0]);
+    return -1;
+  }
+
+  while (bytes < sizeof(buf) - 1 &&
+	 ((n = read(fds[0], buf + bytes, sizeof(buf) - 1 - bytes)) > 0 ||
+	  (n < 0 && errno == EINTR)))
+    if (n > 0)
+      bytes += n;
+  buf[bytes] = '\0';
+  close(fds[0]);
+
+  while (waitpid(pid, &wstatus, 0) == -1 && errno == EINTR);
+
+  if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus))
+    return -1;
+
+  return atoi(buf);
+}
+
+static int
+mutool_spawn_parallel (const char *filename,
+		       cups_array_t *mupdf_args,
+		       char **envp,
+		       int num_workers,
+		       int num_pages)
+{
+  char *argument;
+  char **mutoolargv;
+  char buf[65536];
+  char ranges[MUTOOL_MAX_WORKERS][64];
+  char outfiles[MUTOOL_MAX_WORKERS][1024];
+  char outargs[MUTOOL_MAX_WORKERS][1030];
+  int outfds[MUTOOL_MAX_WORKERS];
+  int pids[MUTOOL_MAX_WORKERS];
+  int i, w;
+  int numargs;
+  int wstatus;
+  int status = 0;
+  ssize_t n, bytes, skip;
+
+  /* Each worker renders its own consecutive part of the pages. The first
+     one writes to our output directly, the others into temporary files,
+     which get appended in order without their PWG Raster sync words, so
+     that the result is exactly the stream of a single mutool process */
+  if (num_workers > num_pages)
+    num_workers = num_pages;
+
+  numargs = cupsArrayCount(mupdf_args);
+  mutoolargv = calloc(numargs + 2, sizeof(char *));
+
+  for (w = 0; w < num_workers; w ++) {
+    pids[w] = -1;
+    outfds[w] = -1;
+  }
+
+  fprintf(stderr, "DEBUG: Rendering %d pages with %d mutool processes\n",
+	  num_pages, num_workers);
+
+  for (w = 0; w < num_workers; w ++) {
+    snprintf(ranges[w], sizeof(ranges[w]), "%d-%d",
+	     w * num_pages / num_workers + 1,
+	     (w + 1) * num_pages / num_workers);
+
+    if (w > 0) {
+      if ((outfds[w] = cupsTempFd(outfiles[w], sizeof(outfiles[w]))) < 0) {
+	fprintf(stderr, "ERROR: Can't create temporary file\n");
+	status = 1;
+	break;
+      }
+      snprintf(outargs[w], sizeof(outargs[w]), "-o%s", outfiles[w]);
+    }
+
+    for (argument = (char *)cupsArrayFirst(mupdf_args), i = 0; argument;
+	 argument = (char *)cupsArrayNext(mupdf_args), i++) {
+      if (w > 0 && !strcmp(argument, "-o-"))
+	mutoolargv[i] = outargs[w];
+      else
+	mutoolargv[i] = argument;
+    }
+    mutoolargv[i++] = ranges[w];
+    mutoolargv[i] = NULL;
+
+    fprintf(stderr, "DEBUG: mutool process %d renders pages %s\n", w + 1,
+	    ranges[w]);
+
+    if ((pids[w] = fork()) == 0) {
+      execvpe(filename, mutoolargv, envp);
+      perror(filename);
+      exit(errno);
+    } else if (pids[w] < 0) {
+      perror("mutool");
+      status = 1;
+      break;
+    }
+  }
+
+  for (w = 0; w < num_workers && pids[w] > 0; w ++) {
+    while (waitpid(pids[w], &wstatus, 0) == -1 && errno == EINTR);
+    pids[w] = -1;
+
+    if (w > 0)
+      unlink(outfiles[w]);
+
+    if (status == 0) {
+      if (WIFEXITED(wstatus))
+	status = WEXITSTATUS(wstatus);
+      else if (WIFSIGNALED(wstatus))
+	status = 256 * WTERMSIG(wstatus);
+      fprintf(stderr, "DEBUG: mutool process %d completed, status: %d\n",
+	      w + 1, status);
+    }
+
+    if (status != 0) {
+      /* No use waiting for the rest of the job */
+      for (i = w + 1; i < num_workers; i ++)
+	if (pids[i] > 0)
+	  kill(pids[i], SIGTERM);
+      continue;
+    }
+
+    if (w == 0)
+      continue;
+
+    /* Append this part of the job, without the sync word */
+    for (skip = 4; (n = read(outfds[w], buf, sizeof(buf))) != 0;) {
+      if (n < 0) {
+	if (errno == EINTR)
+	  continue;
+	fprintf(stderr, "ERROR: Can't read temporary file: %s\n",
+		strerror(errno));
+	status = 1;
+	break;
+      }
+      if (skip >= n) {
+	skip -= n;
+	continue;
+      }
+      for (i = skip; i < n; i += bytes)
+	if ((bytes = write(1, buf + i, n - i)) < 0) {
+	  if (errno == EINTR)
+	    bytes = 0;
+	  else
+	    break;
+	}
+      skip = 0;
+      if (i < n) {
+	fprintf(stderr, "ERROR: Can't write output: %s\n", strerror(errno));
+	status = 1;
+	break;
+      }
+    }
+  }
+
+  for (w = 0; w < num_workers; w ++) {
+    if (pids[w] > 0) {
+      kill(pids[w], SIGTERM);
+      while (waitpid(pids[w], &wstatus, 0) == -1 && errno == EINTR);
+      if (w > 0)
+	unlink(outfiles[w]);
+    }
+    if (outfds[w] >= 0)
+      close(outfds[w]);
+  }
+
+  free(mutoolargv);
+  return status;
+}
+
 int
 main (int argc, char **argv, char *envp[])
 {
@@ -246,6 +492,8 @@ main (int argc, char **argv, char *envp[])
   int cm_disabled;
   int n;
   int num_options;
+  int num_workers;
+  int num_pages;
   int empty = 0;
   int status = 1;
   ppd_file_t *ppd = NULL;
@@ -411,8 +659,14 @@ main (int argc, char **argv, char *envp[])
   /* Execute mutool command line ... */
   snprintf(tmpstr, sizeof(tmpstr), "%s", CUPS_MUTOOL);
 		
-  /* call mutool */
-  status = mutool_spawn (tmpstr, mupdf_args, envp);
+  /* call mutool, split up among several processes if requested */
+  num_workers = mutool_workers(ppd, num_options, options);
+  if (num_workers > 1 && !empty &&
+      (num_pages = mutool_page_count(tmpstr, infilename, envp)) > 1)
+    status = mutool_spawn_parallel(tmpstr, mupdf_args, envp, num_workers,
+				   num_pages);
+  else
+    status = mutool_spawn (tmpstr, mupdf_args, envp);
   if (status != 0) status = 1;
 
   if(empty)
@@ -21,9 +21,11 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <cstdlib>
 #include <qpdf/QPDF.hh>
 #include <qpdf/QPDFObjectHandle.hh>
 #include <qpdf/QPDFWriter.hh>
+#include <qpdf/Buffer.hh>
 #include <qpdf/QPDFAcroFormDocumentHelper.hh>
 #include <qpdf/QPDFPageDocumentHelper.hh>
 
@@ -75,6 +77,28 @@ extern "C" pdf_t * pdf_load_template(const char *filename)
 }
 
 
+/**
+ * 'pdf_load_buffer()' - Load a PDF file from memory, for example a template
+ *                       prepared by an earlier job.
+ * I - Buffer with the PDF file, must stay valid until the object is freed
+ * I - Length of the buffer
+ * O - Pointer to the QPDF structure or NULL on error
+ */
+extern "C" pdf_t * pdf_load_buffer(const char *buf, size_t len)
+{
+  QPDF *pdf = new QPDF();
+  try {
+    pdf->processMemoryFile("pdf_load_buffer", buf, len);
+    if ((pdf->getAllPages()).size() == 1)
+      return pdf;
+  } catch (...) {
+  }
+
+  delete pdf;
+  return NULL;
+}
+
+
 /**
  * 'pdf_free()' - Free pointer used by PDF object
  * I - Pointer to PDF object
@@ -354,6 +378,36 @@ extern "C" void pdf_write(pdf_t *pdf, FILE *file)
 
 
 
+/**
+ * 'pdf_write_buffer()' - Write the contents of PDF object to memory.
+ * I - pointer to QPDF structure
+ * O - Length of the data
+ * O - Data, to be freed by the caller, or NULL on error
+ */
+extern "C" char * pdf_write_buffer(pdf_t *pdf, size_t *len)
+{
+  Buffer *buffer;
+  char *data;
+
+  *len = 0;
+  try {
+    QPDFWriter output(*pdf);
+    output.setOutputMemory();
+    output.write();
+    buffer = output.getBuffer();
+  } catch (...) {
+    return NULL;
+  }
+
+  if ((data = (char *)malloc(buffer->getSize())) != NULL) {
+    memcpy(data, buffer->getBuffer(), buffer->getSize());
+    *len = buffer->getSize();
+  }
+  delete buffer;
+  return data;
+}
+
+
 /*
  * 'lookup_opt()' - Get value according to key in the options list.
  * I - pointer to the opt_t type list
@@ -448,3 +502,106 @@ extern "C" int pdf_fill_form(pdf_t *doc, opt_t *opt)
     // identifiable fields in the form
     return 1;
 }
+
+
+/*
+ * 'pdf_form_fields()' - Find the text fields of the form in a PDF template,
+ *                       so that they can be filled with pdf_fill_fields()
+ *                       without looking up the form again.
+ * I - Pointer to the QPDF structure
+ * O - Text fields, to be freed by the caller
+ * O - Number of text fields
+ * O - 1 if the template has a form, 0 if not, -1 if its fields can't be
+ *     addressed by object number
+ */
+extern "C" int pdf_form_fields(pdf_t *doc, pdf_field_t **fields, int *nfields)
+{
+    QPDFAcroFormDocumentHelper afdh(*doc);
+    QPDFPageDocumentHelper pdh(*doc);
+    std::vector<pdf_field_t> found;
+
+    *fields = NULL;
+    *nfields = 0;
+
+    if ( !afdh.hasAcroForm() ) {
+        return 0;
+    }
+
+    std::vector<QPDFPageObjectHelper> pages = pdh.getAllPages();
+    if (pages.empty()) {
+        return -1;
+    }
+
+    std::vector<QPDFAnnotationObjectHelper> annotations =
+                  afdh.getWidgetAnnotationsForPage(pages.front());
+
+    for (std::vector<QPDFAnnotationObjectHelper>::iterator annot_iter =
+                     annotations.begin();
+                 annot_iter != annotations.end(); ++annot_iter) {
+        QPDFFormFieldObjectHelper ffh =
+            afdh.getFieldForAnnotation(*annot_iter);
+        if (ffh.getFieldType() == "/Tx") {
+            QPDFObjectHandle oh = ffh.getObjectHandle();
+            std::string const name = ffh.getFullyQualifiedName();
+            pdf_field_t field;
+
+            if (!oh.isIndirect() || name.size() >= sizeof(field.name)) {
+                return -1;
+            }
+
+            field.objid = oh.getObjectID();
+            field.gen = oh.getGeneration();
+            strcpy(field.name, name.c_str());
+            found.push_back(field);
+        }
+    }
+
+    if (!found.empty()) {
+        *fields = (pdf_field_t *)malloc(found.size() * sizeof(pdf_field_t));
+        if (!*fields) {
+            return -1;
+        }
+        memcpy(*fields, &found[0], found.size() * sizeof(pdf_field_t));
+        *nfields = found.size();
+    }
+
+    return 1;
+}
+
+
+/*
+ * 'pdf_fill_fields()' - Fill the text fields found by pdf_form_fields() with
+ *                       information.
+ * I - Pointer to the QPDF structure
+ * I - Text fields
+ * I - Number of text fields
+ * I - Pointer to the opt_t type list
+ * O - status of form fill - 0 for failure, 1 for success
+ */
+extern "C" int pdf_fill_fields(pdf_t *doc, const pdf_field_t *fields,
+                               int nfields, opt_t *opt)
+{
+    for (int i = 0; i < nfields; i ++) {
+        QPDFObjectHandle oh = doc->getObjectByID(fields[i].objid,
+                                                 fields[i].gen);
+        if (!oh.isDictionary()) {
+            fprintf(stderr, "ERROR: Can't find widget %s in PDF template.\n",
+                    fields[i].name);
+            return 0;
+        }
+
+        QPDFFormFieldObjectHelper ffh(oh);
+        std::string fill_with = lookup_opt(opt, fields[i].name);
+        if (fill_with.empty()) {
+            std::cerr << "DEBUG: Lack information for widget: " << fields[i].name << ".\n";
+            fill_with = "N/A";
+        }
+
+        QPDFObjectHandle fill_with_utf_16 = QPDFObjectHandle::newUnicodeString(fill_with);
+        ffh.setV(fill_with_utf_16);
+        std::cerr << "DEBUG: Fill widget name " << fields[i].name << " with value "
+                  << fill_with_utf_16.getUTF8Value() << ".\n";
+    }
+
+    return 1;
+}
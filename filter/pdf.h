@@ -37,14 +37,28 @@ struct _opt {
     opt_t *next;
 };
 
+/*
+ * Text field of a PDF form, addressed by its object number.
+ */
+typedef struct _pdf_field {
+    int objid;
+    int gen;
+    char name[256];
+} pdf_field_t;
+
 pdf_t * pdf_load_template(const char *filename);
+pdf_t * pdf_load_buffer(const char *buf, size_t len);
 void pdf_free(pdf_t *pdf);
 void pdf_write(pdf_t *doc, FILE *file);
+char * pdf_write_buffer(pdf_t *doc, size_t *len);
 void pdf_prepend_stream(pdf_t *doc, unsigned page, char const *buf, size_t len);
 void pdf_add_type1_font(pdf_t *doc, unsigned page, const char *name);
 void pdf_resize_page(pdf_t *doc, unsigned page, float width, float length, float *scale);
 void pdf_duplicate_page (pdf_t *doc, unsigned page, unsigned count);
 int pdf_fill_form(pdf_t *doc, opt_t *opt);
+int pdf_form_fields(pdf_t *doc, pdf_field_t **fields, int *nfields);
+int pdf_fill_fields(pdf_t *doc, const pdf_field_t *fields, int nfields,
+                    opt_t *opt);
 int pdf_pages(const char *filename);
 
 #ifdef __cplusplus
@@ -24,6 +24,7 @@
 
 #include "pdftopdf_processor.h"
 #include "pdftopdf_jcl.h"
+#include <cupsfilters/spool.h>
 
 #include <stdarg.h>
 static void error(const char *fmt,...) // {{{
@@ -868,45 +869,6 @@ void calculate(ppd_file_t *ppd,ProcessingParameters &param) // {{{
 }
 // }}}
 
-// reads from stdin into temporary file. returns FILE *  or NULL on error
-FILE *copy_stdin_to_temp() // {{{
-{
-  char buf[BUFSIZ];
-  int n;
-
-  // FIXME:  what does >buf mean here?
-  int fd=cupsTempFd(buf,sizeof(buf));
-  if (fd<0) {
-    error("Can't create temporary file");
-    return NULL;
-  }
-  // remove name
-  unlink(buf);
-
-  // copy stdin to the tmp file
-  while ((n=read(0,buf,BUFSIZ)) > 0) {
-    if (write(fd,buf,n) != n) {
-      error("Can't copy stdin to temporary file");
-      close(fd);
-      return NULL;
-    }
-  }
-  if (lseek(fd,0,SEEK_SET) < 0) {
-    error("Can't rewind temporary file");
-    close(fd);
-    return NULL;
-  }
-
-  FILE *f;
-  if ((f=fdopen(fd,"rb")) == 0) {
-    error("Can't fdopen temporary file");
-    close(fd);
-    return NULL;
-  }
-  return f;
-}
-// }}}
-
 // check whether a given file is empty
 bool is_empty(FILE *f) // {{{
 {
@@ -1151,6 +1113,7 @@ int main(int argc,char **argv)
     std::unique_ptr<PDFTOPDF_Processor> proc(PDFTOPDF_Factory::processor());
 
     FILE *tmpfile = NULL;
+    cups_spool_t *spool = NULL;
     if (argc==7) {
       FILE *f = NULL;
       if ((f = fopen(argv[6], "rb")) == NULL) {
@@ -1167,13 +1130,18 @@ int main(int argc,char **argv)
       } else
 	fclose(f);
     } else {
-      tmpfile = copy_stdin_to_temp();
-      if (tmpfile && is_empty(tmpfile)) {
+      // stdin is received into memory (or used in place, if it is a file) and parsed from the mapping
+      if ((spool = cupsSpoolOpen(0)) != NULL) {
+        tmpfile = cupsSpoolFile(spool);
+      }
+      if (tmpfile && spool->length == 0) {
 	fclose(tmpfile);
 	ppdClose(ppd);
 	empty = 1;
       } else if ((!tmpfile)||
-		 (!proc->loadFile(tmpfile,WillStayAlive,qpdf_flatten))) {
+		 (!((spool->data)?
+		    proc->loadBuffer(spool->data,spool->length,qpdf_flatten):
+		    proc->loadFile(tmpfile,WillStayAlive,qpdf_flatten)))) {
         ppdClose(ppd);
 	return 1;
       }
@@ -1311,8 +1279,10 @@ int main(int argc,char **argv)
 
     emitPostamble(ppd,param);
     ppdClose(ppd);
+    proc.reset(); // may still refer to the spooled data
     if (tmpfile)
       fclose(tmpfile);
+    cupsSpoolClose(spool);
   } catch (std::exception &e) {
     // TODO? exception type
     error("Exception: %s",e.what());
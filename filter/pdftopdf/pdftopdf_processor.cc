@@ -149,13 +149,6 @@ bool processPDFTOPDF(PDFTOPDF_Processor &proc,ProcessingParameters &param) // {{
     return false;
   }
 
-  if (param.autoRotate) {
-    const bool dst_lscape =
-      (param.paper_is_landscape ==
-       ((param.orientation == ROT_0) || (param.orientation == ROT_180)));
-    proc.autoRotateAll(dst_lscape,param.normal_landscape);
-  }
-
   std::vector<std::shared_ptr<PDFTOPDF_PageHandle>> pages=proc.get_pages();
   const int numOrigPages=pages.size();
 
@@ -175,6 +168,24 @@ bool processPDFTOPDF(PDFTOPDF_Processor &proc,ProcessingParameters &param) // {{
   }
   const int numPages=std::max(shuffle.size(),pages.size());
 
+  // resolve page-ranges / even-odd selection first (input page iA ends up on output page iA/nup+1),
+  // so that only the input pages actually printed are flattened, cropped, rotated and placed
+  const int nup=param.nup.nupX*param.nup.nupY;
+  std::vector<bool> selected(numOrigPages,false);
+  for (int iA=0;iA<numPages;iA++) {
+    if ((shuffle[iA]<numOrigPages)&&(param.withPage(iA/nup+1))) {
+      selected[shuffle[iA]]=true;
+    }
+  }
+  proc.select_pages(selected);
+
+  if (param.autoRotate) {
+    const bool dst_lscape =
+      (param.paper_is_landscape ==
+       ((param.orientation == ROT_0) || (param.orientation == ROT_180)));
+    proc.autoRotateAll(dst_lscape,param.normal_landscape);
+  }
+
   if(param.autoprint||param.autofit){
     bool margin_defined = true;
     bool document_large = false;
@@ -225,6 +236,8 @@ bool processPDFTOPDF(PDFTOPDF_Processor &proc,ProcessingParameters &param) // {{
     }
     for(int i=0;i<(int)pages.size();i++)
     {
+      if (!selected[i])
+        continue;
       std::shared_ptr<PDFTOPDF_PageHandle> page = pages[i];
       page->crop(param.page,param.orientation,param.xpos,param.ypos,!param.cropfit);
     }
@@ -363,6 +376,9 @@ bool processPDFTOPDF(PDFTOPDF_Processor &proc,ProcessingParameters &param) // {{
       if (shuffle[iA]>=numOrigPages) {
         continue;
       }
+      if (!param.withPage(outputpage)) { // sheet will not be output
+        continue;
+      }
 
       if (param.border!=BorderType::NONE) {
         // TODO FIXME... border gets cutted away, if orignal page had wrong size
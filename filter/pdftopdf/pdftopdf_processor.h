@@ -134,12 +134,16 @@ class PDFTOPDF_Processor { // abstract interface
   // TODO: ... qpdf wants password at load time
   virtual bool loadFile(FILE *f,ArgOwnership take=WillStayAlive,int flatten_forms=1) =0;
   virtual bool loadFilename(const char *name,int flatten_forms=1) =0;
+  virtual bool loadBuffer(const char *buf,size_t len,int flatten_forms=1) =0; // buf must stay alive
 
   // TODO? virtual bool may_modify/may_print/?
   virtual bool check_print_permissions() =0;
 
   virtual std::vector<std::shared_ptr<PDFTOPDF_PageHandle>> get_pages() =0; // shared_ptr because of type erasure (deleter)
 
+  // only the selected (input) pages will be used: form flattening etc. is done lazily, just for them
+  virtual void select_pages(const std::vector<bool> &selected) =0; // one entry per get_pages() element
+
   virtual std::shared_ptr<PDFTOPDF_PageHandle> new_page(float width,float height) =0;
 
   virtual void add_page(std::shared_ptr<PDFTOPDF_PageHandle> page,bool front) =0; // at back/front -- either from get_pages() or new_page()+add_subpage()-calls  (or [also allowed]: empty)
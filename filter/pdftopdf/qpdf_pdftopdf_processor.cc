@@ -446,6 +446,9 @@ void QPDF_PDFTOPDF_PageHandle::debug(const PageRect &rect,float xpos,float ypos)
 void QPDF_PDFTOPDF_Processor::closeFile() // {{{
 {
   pdf.reset();
+  orig_pages.clear();
+  selected.clear();
+  flatten_pending=false;
   hasCM=false;
 }
 // }}}
@@ -519,17 +522,28 @@ bool QPDF_PDFTOPDF_Processor::loadFilename(const char *name,int flatten_forms) /
 }
 // }}}
 
+bool QPDF_PDFTOPDF_Processor::loadBuffer(const char *buf,size_t len,int flatten_forms) // {{{
+{
+  closeFile();
+  try {
+    pdf.reset(new QPDF);
+    pdf->processMemoryFile("temp file",buf,len);
+  } catch (const std::exception &e) {
+    error("loadBuffer failed: %s",e.what());
+    return false;
+  }
+  start(flatten_forms);
+  return true;
+}
+// }}}
+
 void QPDF_PDFTOPDF_Processor::start(int flatten_forms) // {{{
 {
   assert(pdf);
 
-  if (flatten_forms) {
-    QPDFAcroFormDocumentHelper afdh(*pdf);
-    afdh.generateAppearancesIfNeeded();
-
-    QPDFPageDocumentHelper dh(*pdf);
-    dh.flattenAnnotations(an_print);
-  }
+  // form flattening is deferred to select_pages(), so that it is only done for the pages actually printed
+  flatten_pending=(flatten_forms!=0);
+  selected.clear();
 
   pdf->pushInheritedAttributesToPage();
   orig_pages=pdf->getAllPages();
@@ -575,6 +589,40 @@ std::vector<std::shared_ptr<PDFTOPDF_PageHandle>> QPDF_PDFTOPDF_Processor::get_p
 }
 // }}}
 
+void QPDF_PDFTOPDF_Processor::select_pages(const std::vector<bool> &sel) // {{{
+{
+  assert(pdf);
+  assert(sel.size()==orig_pages.size());
+  selected=sel;
+
+  if (!flatten_pending) {
+    return;
+  }
+  flatten_pending=false;
+
+  // the document helpers walk the page tree, which is empty after start():
+  // temporarily put back just the selected pages
+  const int len=orig_pages.size();
+  for (int iA=0;iA<len;iA++) {
+    if (selected[iA]) {
+      pdf->addPage(orig_pages[iA],false);
+    }
+  }
+
+  QPDFAcroFormDocumentHelper afdh(*pdf);
+  afdh.generateAppearancesIfNeeded();
+
+  QPDFPageDocumentHelper dh(*pdf);
+  dh.flattenAnnotations(an_print);
+
+  for (int iA=0;iA<len;iA++) {
+    if (selected[iA]) {
+      pdf->removePage(orig_pages[iA]);
+    }
+  }
+}
+// }}}
+
 std::shared_ptr<PDFTOPDF_PageHandle> QPDF_PDFTOPDF_Processor::new_page(float width,float height) // {{{
 {
   if (!pdf) {
@@ -637,6 +685,10 @@ void QPDF_PDFTOPDF_Processor::autoRotateAll(bool dst_lscape,Rotation normal_land
 
   const int len=orig_pages.size();
   for (int iA=0;iA<len;iA++) {
+    // page 0 is always rotated, the fit and orientation decisions look at it
+    if ((iA>0)&&(!selected.empty())&&(!selected[iA])) {
+      continue;
+    }
     QPDFObjectHandle page=orig_pages[iA];
 
     Rotation src_rot=getRotate(page);
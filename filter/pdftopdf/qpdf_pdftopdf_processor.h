@@ -37,6 +37,7 @@ class QPDF_PDFTOPDF_Processor : public PDFTOPDF_Processor {
  public:
   virtual bool loadFile(FILE *f,ArgOwnership take=WillStayAlive,int flatten_forms=1);
   virtual bool loadFilename(const char *name,int flatten_forms=1);
+  virtual bool loadBuffer(const char *buf,size_t len,int flatten_forms=1);
 
   // TODO: virtual bool may_modify/may_print/?
   virtual bool check_print_permissions();
@@ -44,6 +45,7 @@ class QPDF_PDFTOPDF_Processor : public PDFTOPDF_Processor {
   // virtual bool setProcess(const ProcessingParameters &param) =0;
 
   virtual std::vector<std::shared_ptr<PDFTOPDF_PageHandle>> get_pages();
+  virtual void select_pages(const std::vector<bool> &selected);
   virtual std::shared_ptr<PDFTOPDF_PageHandle> new_page(float width,float height);
 
   virtual void add_page(std::shared_ptr<PDFTOPDF_PageHandle> page,bool front);
@@ -66,6 +68,8 @@ class QPDF_PDFTOPDF_Processor : public PDFTOPDF_Processor {
  private:
   std::unique_ptr<QPDF> pdf;
   std::vector<QPDFObjectHandle> orig_pages;
+  std::vector<bool> selected; // empty: all
+  bool flatten_pending;
 
   bool hasCM;
   std::string extraheader;
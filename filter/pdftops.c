@@ -17,6 +17,10 @@
  *   log_command_line()     - Log the command line of a program which we call
  *   main()                 - Main entry for filter...
  *   cancel_job()           - Flag the job as canceled.
+ *   post_process()         - Fix up the renderer's PostScript for pstops.
+ *   ps_copy_rest()         - Pass the rest of the PostScript on unchanged.
+ *   ps_fill()              - Read the next block of PostScript.
+ *   ps_read_line()         - Read a line of the PostScript header.
  */
 
 /*
@@ -45,11 +49,28 @@
 typedef unsigned renderer_t;
 enum renderer_e {GS = 0, PDFTOPS = 1, ACROREAD = 2, PDFTOCAIRO = 3, MUPDF = 4, HYBRID = 5};
 
+typedef struct ps_reader_s		/**** Renderer output being read ****/
+{
+  int		fd;			/* Pipe from the renderer */
+  char		*ptr,			/* Current position in buffer */
+		*end;			/* End of data in buffer */
+  char		buffer[65536];		/* Read buffer */
+} ps_reader_t;
+
 /*
  * Local functions...
  */
 
 static void		cancel_job(int sig);
+static int		post_process(int infd, int outfd, renderer_t renderer,
+			             ppd_file_t *ppd, const char *user,
+				     const char *title, int num_options,
+				     cups_option_t *options, int xres,
+				     int yres);
+static int		ps_copy_rest(ps_reader_t *reader, FILE *out);
+static int		ps_fill(ps_reader_t *reader);
+static int		ps_read_line(ps_reader_t *reader, char *line,
+			             int linesize);
 
 
 /*
@@ -317,13 +338,11 @@ main(int  argc,				/* I - Number of command-line args */
   ppd_choice_t  *choice;
   ppd_attr_t    *attr;
   cups_page_header2_t header;
-  cups_file_t	*fp;			/* Post-processing input file */
   int		pdf_pid,		/* Process ID for pdftops/gs */
 		pdf_argc = 0,		/* Number of args for pdftops/gs */
 		pstops_pid,		/* Process ID of pstops filter */
 		pstops_pipe[2],		/* Pipe to pstops filter */
 		need_post_proc = 0,     /* Post-processing needed? */
-		post_proc_pid = 0,	/* Process ID of post-processing */
 		post_proc_pipe[2],	/* Pipe to post-processing */
 		wait_children,		/* Number of child processes left */
 		wait_pid,		/* Process ID from wait() */
@@ -338,8 +357,6 @@ main(int  argc,				/* I - Number of command-line args */
 		*ptr;			/* Pointer into value */
   const char	*cups_serverbin;	/* CUPS_SERVERBIN environment
 					   variable */
-  int		duplex, tumble;         /* Duplex settings for PPD-less
-					   printing */
 #if defined(HAVE_SIGACTION) && !defined(HAVE_SIGSET)
   struct sigaction action;		/* Actions for POSIX signals */
 #endif /* HAVE_SIGACTION && !HAVE_SIGSET */
@@ -1138,337 +1155,6 @@ main(int  argc,				/* I - Number of command-line args */
 
   fprintf(stderr, "DEBUG: Started filter %s (PID %d)\n", pdf_argv[0], pdf_pid);
 
-  if (need_post_proc)
-  {
-    if ((post_proc_pid = fork()) == 0)
-    {
-     /*
-      * Child comes here...
-      */
-
-      dup2(post_proc_pipe[0], 0);
-      close(post_proc_pipe[0]);
-      close(post_proc_pipe[1]);
-      dup2(pstops_pipe[1], 1);
-      close(pstops_pipe[0]);
-      close(pstops_pipe[1]);
-
-      fp = cupsFileStdin();
-
-      if (renderer == ACROREAD)
-      {
-       /*
-        * Set %Title and %For from filter arguments since acroread inserts
-        * garbage for these when using -toPostScript
-        */
-
-        while ((bytes = cupsFileGetLine(fp, buffer, sizeof(buffer))) > 0 &&
-               strncmp(buffer, "%%BeginProlog", 13))
-        {
-          if (strncmp(buffer, "%%Title", 7) == 0)
-            printf("%%%%Title: %s\n", argv[3]);
-          else if (strncmp(buffer, "%%For", 5) == 0)
-            printf("%%%%For: %s\n", argv[2]);
-          else
-            printf("%s", buffer);
-        }
-
-       /*
-	* Copy the rest of the file
-	*/
-	while ((bytes = cupsFileRead(fp, buffer, sizeof(buffer))) > 0)
-	  fwrite(buffer, 1, bytes, stdout);
-      }
-      else
-      {
-
-       /*
-	* Copy everything until after initial comments (Prolog section)
-	*/
-	while ((bytes = cupsFileGetLine(fp, buffer, sizeof(buffer))) > 0 &&
-	       strncmp(buffer, "%%BeginProlog", 13) &&
-	       strncmp(buffer, "%%EndProlog", 11) &&
-	       strncmp(buffer, "%%BeginSetup", 12) &&
-	       strncmp(buffer, "%%Page:", 7))
-	  printf("%s", buffer);
-
-	if (bytes > 0)
-	{
-	 /*
-	  * Insert PostScript interpreter bug fix code in the beginning of
-	  * the Prolog section (before the first active PostScript code)
-	  */
-	  if (strncmp(buffer, "%%BeginProlog", 13))
-	  {
-	    /* No Prolog section, create one */
-	    fprintf(stderr, "DEBUG: Adding Prolog section for workaround PostScript code\n");
-	    puts("%%BeginProlog");
-	  }
-	  else
-	    printf("%s", buffer);
-
-	  if (renderer == GS && make_model[0])
-	  {
-
-	   /*
-	    * Kyocera (and Utax) printers have a bug in their PostScript
-	    * interpreter making them crashing on PostScript input data
-	    * generated by Ghostscript's "ps2write" output device.
-	    *
-	    * The problem can be simply worked around by preceding the
-	    * PostScript code with some extra bits.
-	    *
-	    * See https://bugs.launchpad.net/bugs/951627
-	    *
-	    * In addition, at least some of Kyocera's PostScript printers are
-	    * very slow on rendering images which request interpolation. So we
-	    * also add some code to eliminate interpolation requests.
-	    *
-	    * See https://bugs.launchpad.net/bugs/1026974
-	    */
-
-	    if (!strncasecmp(make_model, "Kyocera", 7) ||
-		!strncasecmp(make_model, "Utax", 4))
-	    {
-	      fprintf(stderr, "DEBUG: Inserted workaround PostScript code for Kyocera and Utax printers\n");
-	      puts("% ===== Workaround insertion by pdftops CUPS filter =====");
-	      puts("% Kyocera's/Utax's PostScript interpreter crashes on early name binding,");
-	      puts("% so eliminate all \"bind\"s by redefining \"bind\" to no-op");
-	      puts("/bind {} bind def");
-	      puts("% Some Kyocera and Utax printers have an unacceptably slow implementation");
-	      puts("% of image interpolation.");
-	      puts("/image");
-	      puts("{");
-	      puts("  dup /Interpolate known");
-	      puts("  {");
-	      puts("    dup /Interpolate undef");
-	      puts("  } if");
-	      puts("  systemdict /image get exec");
-	      puts("} def");
-	      puts("% =====");
-	    }
-
-	   /*
-	    * Brother printers have a bug in their PostScript interpreter
-	    * making them printing one blank page if PostScript input data
-	    * generated by Ghostscript's "ps2write" output device is used.
-	    *
-	    * The problem can be simply worked around by preceding the PostScript
-	    * code with some extra bits.
-	    *
-	    * See https://bugs.launchpad.net/bugs/950713
-	    */
-
-	    else if (!strncasecmp(make_model, "Brother", 7))
-	    {
-	      fprintf(stderr, "DEBUG: Inserted workaround PostScript code for Brother printers\n");
-	      puts("% ===== Workaround insertion by pdftops CUPS filter =====");
-	      puts("% Brother's PostScript interpreter spits out the current page");
-	      puts("% and aborts the job on the \"currenthalftone\" operator, so redefine");
-	      puts("% it to null");
-	      puts("/currenthalftone {//null} bind def");
-	      puts("/orig.sethalftone systemdict /sethalftone get def");
-	      puts("/sethalftone {dup //null eq not {//orig.sethalftone}{pop} ifelse} bind def");
-	      puts("% =====");
-	    }
-	  }
-
-	  if (strncmp(buffer, "%%BeginProlog", 13))
-	  {
-	    /* Close newly created Prolog section */
-	    if (strncmp(buffer, "%%EndProlog", 11))
-	      puts("%%EndProlog");
-	    printf("%s", buffer);
-	  }
-
-	  if (!ppd)
-	  {
-	   /*
-	    * Copy everything until the setup section
-	    */
-	    while (bytes > 0 &&
-		   strncmp(buffer, "%%BeginSetup", 12) &&
-		   strncmp(buffer, "%%EndSetup", 10) &&
-		   strncmp(buffer, "%%Page:", 7))
-	    {
-	      bytes = cupsFileGetLine(fp, buffer, sizeof(buffer));
-	      if (strncmp(buffer, "%%Page:", 7) &&
-		  strncmp(buffer, "%%EndSetup", 10))
-		printf("%s", buffer);
-	    }
-	  
-	    if (bytes > 0)
-	    {
-	     /*
-	      * Insert option PostScript code in Setup section
-	      */
-	      if (strncmp(buffer, "%%BeginSetup", 12))
-	      {
-		/* No Setup section, create one */
-		fprintf(stderr, "DEBUG: Adding Setup section for option PostScript code\n");
-		puts("%%BeginSetup");
-	      }
-
-	     /*
-	      * Duplex
-	      */
-	      duplex = 0;
-	      tumble = 0;
-	      if ((val = cupsGetOption("sides", num_options, options)) != NULL ||
-		  (val = cupsGetOption("Duplex", num_options, options)) != NULL)
-	      {
-		if (!strcasecmp(val, "On") ||
-			 !strcasecmp(val, "True") || !strcasecmp(val, "Yes") ||
-			 !strncasecmp(val, "two-sided", 9) ||
-			 !strncasecmp(val, "TwoSided", 8) ||
-			 !strncasecmp(val, "Duplex", 6))
-		{
-		  duplex = 1;
-		  if (!strncasecmp(val, "DuplexTumble", 12))
-		    tumble = 1;
-		}
-	      }
-
-	      if ((val = cupsGetOption("sides", num_options, options)) != NULL ||
-		  (val = cupsGetOption("Tumble", num_options, options)) != NULL)
-	      {
-		if (!strcasecmp(val, "None") || !strcasecmp(val, "Off") ||
-		    !strcasecmp(val, "False") || !strcasecmp(val, "No") ||
-		    !strcasecmp(val, "one-sided") || !strcasecmp(val, "OneSided") ||
-		    !strcasecmp(val, "two-sided-long-edge") ||
-		    !strcasecmp(val, "TwoSidedLongEdge") ||
-		    !strcasecmp(val, "DuplexNoTumble"))
-		  tumble = 0;
-		else if (!strcasecmp(val, "On") ||
-			 !strcasecmp(val, "True") || !strcasecmp(val, "Yes") ||
-			 !strcasecmp(val, "two-sided-short-edge") ||
-			 !strcasecmp(val, "TwoSidedShortEdge") ||
-			 !strcasecmp(val, "DuplexTumble"))
-		  tumble = 1;
-	      }
-
-	      if (duplex)
-	      {
-		if (tumble)
-		  puts("<</Duplex true /Tumble true>> setpagedevice");
-		else
-		  puts("<</Duplex true /Tumble false>> setpagedevice");
-	      }
-	      else
-		puts("<</Duplex false>> setpagedevice");
-
-	     /*
-	      * Resolution
-	      */
-	      if ((xres > 0) && (yres > 0))
-		printf("<</HWResolution[%d %d]>> setpagedevice\n", xres, yres);
-
-	     /*
-	      * InputSlot/MediaSource
-	      */
-	      if ((val = cupsGetOption("media-position", num_options,
-				       options)) != NULL ||
-		  (val = cupsGetOption("MediaPosition", num_options,
-				       options)) != NULL ||
-		  (val = cupsGetOption("media-source", num_options,
-				       options)) != NULL ||
-		  (val = cupsGetOption("MediaSource", num_options,
-				       options)) != NULL ||
-		  (val = cupsGetOption("InputSlot", num_options,
-				       options)) != NULL)
-	      {
-		if (!strncasecmp(val, "Auto", 4) ||
-		    !strncasecmp(val, "Default", 7))
-		  puts("<</ManualFeed false /MediaPosition 7>> setpagedevice");
-		else if (!strcasecmp(val, "Main"))
-		  puts("<</MediaPosition 0 /ManualFeed false>> setpagedevice");
-		else if (!strcasecmp(val, "Alternate"))
-		  puts("<</MediaPosition 1 /ManualFeed false>> setpagedevice");
-		else if (!strcasecmp(val, "Manual"))
-		  puts("<</MediaPosition 3 /ManualFeed true>> setpagedevice");
-		else if (!strcasecmp(val, "Top"))
-		  puts("<</MediaPosition 0 /ManualFeed false>> setpagedevice");
-		else if (!strcasecmp(val, "Bottom"))
-		  puts("<</MediaPosition 1 /ManualFeed false>> setpagedevice");
-		else if (!strcasecmp(val, "ByPassTray"))
-		  puts("<</MediaPosition 3 /ManualFeed false>> setpagedevice");
-		else if (!strcasecmp(val, "Tray1"))
-		  puts("<</MediaPosition 3 /ManualFeed false>> setpagedevice");
-		else if (!strcasecmp(val, "Tray2"))
-		  puts("<</MediaPosition 0 /ManualFeed false>> setpagedevice");
-		else if (!strcasecmp(val, "Tray3"))
-		  puts("<</MediaPosition 1 /ManualFeed false>> setpagedevice");
-	      }
-
-	     /*
-	      * ColorModel
-	      */
-	      if ((val = cupsGetOption("pwg-raster-document-type", num_options,
-				       options)) != NULL ||
-		  (val = cupsGetOption("PwgRasterDocumentType", num_options,
-				       options)) != NULL ||
-		  (val = cupsGetOption("print-color-mode", num_options,
-				       options)) != NULL ||
-		  (val = cupsGetOption("PrintColorMode", num_options,
-				       options)) != NULL ||
-		  (val = cupsGetOption("color-space", num_options,
-				       options)) != NULL ||
-		  (val = cupsGetOption("ColorSpace", num_options,
-				       options)) != NULL ||
-		  (val = cupsGetOption("color-model", num_options,
-				       options)) != NULL ||
-		  (val = cupsGetOption("ColorModel", num_options,
-				       options)) != NULL)
-	      {
-		if (!strncasecmp(val, "Black", 5))
-		  puts("<</ProcessColorModel /DeviceGray>> setpagedevice");
-		else if (!strncasecmp(val, "Cmyk", 4))
-		  puts("<</ProcessColorModel /DeviceCMYK>> setpagedevice");
-		else if (!strncasecmp(val, "Cmy", 3))
-		  puts("<</ProcessColorModel /DeviceCMY>> setpagedevice");
-		else if (!strncasecmp(val, "Rgb", 3))
-		  puts("<</ProcessColorModel /DeviceRGB>> setpagedevice");
-		else if (!strncasecmp(val, "Gray", 4))
-		  puts("<</ProcessColorModel /DeviceGray>> setpagedevice");
-		else if (!strncasecmp(val, "Color", 5))
-		  puts("<</ProcessColorModel /DeviceRGB>> setpagedevice");
-	      }
-
-	      if (strncmp(buffer, "%%BeginSetup", 12))
-	      {
-		/* Close newly created Setup section */
-		if (strncmp(buffer, "%%EndSetup", 10))
-		  puts("%%EndSetup");
-		printf("%s", buffer);
-	      }
-	    }
-	  }
-
-	 /*
-	  * Copy the rest of the file
-	  */
-	  while ((bytes = cupsFileRead(fp, buffer, sizeof(buffer))) > 0)
-	    fwrite(buffer, 1, bytes, stdout);
-	}
-      }
-
-      exit(0);
-    }
-    else if (post_proc_pid < 0)
-    {
-     /*
-      * Unable to fork!
-      */
-
-      perror("DEBUG: Unable to execute post-processing process");
-
-      exit_status = 1;
-      goto error;
-    }
-
-    fprintf(stderr, "DEBUG: Started post-processing (PID %d)\n", post_proc_pid);
-  }
-
   if ((pstops_pid = fork()) == 0)
   {
    /*
@@ -1504,18 +1190,40 @@ main(int  argc,				/* I - Number of command-line args */
   fprintf(stderr, "DEBUG: Started filter pstops (PID %d)\n", pstops_pid);
 
   close(pstops_pipe[0]);
-  close(pstops_pipe[1]);
+
   if (need_post_proc)
   {
-    close(post_proc_pipe[0]);
+   /*
+    * Post-process the PostScript in this process, between the renderer and
+    * pstops...
+    */
+
     close(post_proc_pipe[1]);
+
+    fputs("DEBUG: Post-processing PostScript output\n", stderr);
+
+    if (post_process(post_proc_pipe[0], pstops_pipe[1], renderer, ppd,
+                     argv[2], argv[3], num_options, options, xres, yres))
+      exit_status = 1;
+
+    close(post_proc_pipe[0]);
+
+    if (job_canceled)
+    {
+      kill(pdf_pid, SIGTERM);
+      kill(pstops_pid, SIGTERM);
+
+      job_canceled = 0;
+    }
   }
 
+  close(pstops_pipe[1]);
+
  /*
   * Wait for the child processes to exit...
   */
 
-  wait_children = 2 + need_post_proc;
+  wait_children = 2;
 
   while (wait_children > 0)
   {
@@ -1528,8 +1236,6 @@ main(int  argc,				/* I - Number of command-line args */
       if (job_canceled)
       {
 	kill(pdf_pid, SIGTERM);
-	if (need_post_proc)
-	  kill(post_proc_pid, SIGTERM);
 	kill(pstops_pid, SIGTERM);
 
 	job_canceled = 0;
@@ -1561,8 +1267,7 @@ main(int  argc,				/* I - Number of command-line args */
 		(renderer == MUPDF ? "mutool" :
 		 "Unknown renderer"))))) :
 		(wait_pid == pstops_pid ? "pstops" :
-		(wait_pid == post_proc_pid ? "Post-processing" :
-		 "Unknown process")),
+		 "Unknown process"),
 		exit_status);
       }
       else if (WTERMSIG(wait_status) == SIGTERM)
@@ -1578,8 +1283,7 @@ main(int  argc,				/* I - Number of command-line args */
 		(renderer == MUPDF ? "mutool" :
 		 "Unknown renderer"))))) :
 		(wait_pid == pstops_pid ? "pstops" :
-		(wait_pid == post_proc_pid ? "Post-processing" :
-		 "Unknown process")),
+		 "Unknown process"),
 		exit_status);
       }
       else
@@ -1596,8 +1300,7 @@ main(int  argc,				/* I - Number of command-line args */
 		(renderer == MUPDF ? "mutool" :
 		 "Unknown renderer"))))) :
 		(wait_pid == pstops_pid ? "pstops" :
-		(wait_pid == post_proc_pid ? "Post-processing" :
-		 "Unknown process")),
+		 "Unknown process"),
 		exit_status);
       }
     }
@@ -1613,8 +1316,7 @@ main(int  argc,				/* I - Number of command-line args */
 	      (renderer == MUPDF ? "mutool" :
 	       "Unknown renderer"))))) :
 	      (wait_pid == pstops_pid ? "pstops" :
-	      (wait_pid == post_proc_pid ? "Post-processing" :
-	       "Unknown process")));
+	       "Unknown process"));
     }
   }
 
@@ -1643,3 +1345,474 @@ cancel_job(int sig)			/* I - Signal number (unused) */
   job_canceled = 1;
 }
 
+
+/*
+ * 'post_process()' - Fix up the renderer's PostScript for pstops.
+ *
+ * Only the header up to the Prolog or Setup section is read line by
+ * line, the rest is passed on in large blocks.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+post_process(int           infd,	/* I - Pipe from the renderer */
+             int           outfd,	/* I - Pipe to pstops */
+	     renderer_t    renderer,	/* I - Renderer */
+	     ppd_file_t    *ppd,	/* I - PPD file or NULL */
+	     const char    *user,	/* I - User name */
+	     const char    *title,	/* I - Job title */
+	     int           num_options,	/* I - Number of options */
+	     cups_option_t *options,	/* I - Options */
+	     int           xres,	/* I - Horizontal resolution */
+	     int           yres)	/* I - Vertical resolution */
+{
+  ps_reader_t	*reader;		/* Renderer output */
+  FILE		*out;			/* Output to pstops */
+  char		buffer[8192];		/* Line buffer */
+  int		bytes;			/* Bytes in line */
+  const char	*val;			/* Option value */
+  int		duplex, tumble;         /* Duplex settings for PPD-less
+					   printing */
+  int		status = 0;		/* Return status */
+
+
+  if ((reader = malloc(sizeof(ps_reader_t))) == NULL)
+    return (-1);
+
+  reader->fd  = infd;
+  reader->ptr = reader->end = reader->buffer;
+
+  if ((out = fdopen(dup(outfd), "w")) == NULL)
+  {
+    free(reader);
+    return (-1);
+  }
+
+  if (renderer == ACROREAD)
+  {
+   /*
+    * Set %Title and %For from filter arguments since acroread inserts
+    * garbage for these when using -toPostScript
+    */
+
+    while ((bytes = ps_read_line(reader, buffer, sizeof(buffer))) > 0 &&
+           strncmp(buffer, "%%BeginProlog", 13))
+    {
+      if (strncmp(buffer, "%%Title", 7) == 0)
+        fprintf(out, "%%%%Title: %s\n", title);
+      else if (strncmp(buffer, "%%For", 5) == 0)
+        fprintf(out, "%%%%For: %s\n", user);
+      else
+        fprintf(out, "%s", buffer);
+    }
+
+    if (bytes > 0)
+      fprintf(out, "%s", buffer);
+
+   /*
+    * Copy the rest of the file
+    */
+    status = ps_copy_rest(reader, out);
+  }
+  else
+  {
+
+   /*
+    * Copy everything until after initial comments (Prolog section)
+    */
+    while ((bytes = ps_read_line(reader, buffer, sizeof(buffer))) > 0 &&
+	   strncmp(buffer, "%%BeginProlog", 13) &&
+	   strncmp(buffer, "%%EndProlog", 11) &&
+	   strncmp(buffer, "%%BeginSetup", 12) &&
+	   strncmp(buffer, "%%Page:", 7))
+      fprintf(out, "%s", buffer);
+
+    if (bytes > 0)
+    {
+     /*
+      * Insert PostScript interpreter bug fix code in the beginning of
+      * the Prolog section (before the first active PostScript code)
+      */
+      if (strncmp(buffer, "%%BeginProlog", 13))
+      {
+	/* No Prolog section, create one */
+	fprintf(stderr, "DEBUG: Adding Prolog section for workaround PostScript code\n");
+	fputs("%%BeginProlog\n", out);
+      }
+      else
+	fprintf(out, "%s", buffer);
+
+      if (renderer == GS && make_model[0])
+      {
+
+       /*
+	* Kyocera (and Utax) printers have a bug in their PostScript
+	* interpreter making them crashing on PostScript input data
+	* generated by Ghostscript's "ps2write" output device.
+	*
+	* The problem can be simply worked around by preceding the
+	* PostScript code with some extra bits.
+	*
+	* See https://bugs.launchpad.net/bugs/951627
+	*
+	* In addition, at least some of Kyocera's PostScript printers are
+	* very slow on rendering images which request interpolation. So we
+	* also add some code to eliminate interpolation requests.
+	*
+	* See https://bugs.launchpad.net/bugs/1026974
+	*/
+
+	if (!strncasecmp(make_model, "Kyocera", 7) ||
+	    !strncasecmp(make_model, "Utax", 4))
+	{
+	  fprintf(stderr, "DEBUG: Inserted workaround PostScript code for Kyocera and Utax printers\n");
+	  fputs("% ===== Workaround insertion by pdftops CUPS filter =====\n", out);
+	  fputs("% Kyocera's/Utax's PostScript interpreter crashes on early name binding,\n", out);
+	  fputs("% so eliminate all \"bind\"s by redefining \"bind\" to no-op\n", out);
+	  fputs("/bind {} bind def\n", out);
+	  fputs("% Some Kyocera and Utax printers have an unacceptably slow implementation\n", out);
+	  fputs("% of image interpolation.\n", out);
+	  fputs("/image\n", out);
+	  fputs("{\n", out);
+	  fputs("  dup /Interpolate known\n", out);
+	  fputs("  {\n", out);
+	  fputs("    dup /Interpolate undef\n", out);
+	  fputs("  } if\n", out);
+	  fputs("  systemdict /image get exec\n", out);
+	  fputs("} def\n", out);
+	  fputs("% =====\n", out);
+	}
+
+       /*
+	* Brother printers have a bug in their PostScript interpreter
+	* making them printing one blank page if PostScript input data
+	* generated by Ghostscript's "ps2write" output device is used.
+	*
+	* The problem can be simply worked around by preceding the PostScript
+	* code with some extra bits.
+	*
+	* See https://bugs.launchpad.net/bugs/950713
+	*/
+
+	else if (!strncasecmp(make_model, "Brother", 7))
+	{
+	  fprintf(stderr, "DEBUG: Inserted workaround PostScript code for Brother printers\n");
+	  fputs("% ===== Workaround insertion by pdftops CUPS filter =====\n", out);
+	  fputs("% Brother's PostScript interpreter spits out the current page\n", out);
+	  fputs("% and aborts the job on the \"currenthalftone\" operator, so redefine\n", out);
+	  fputs("% it to null\n", out);
+	  fputs("/currenthalftone {//null} bind def\n", out);
+	  fputs("/orig.sethalftone systemdict /sethalftone get def\n", out);
+	  fputs("/sethalftone {dup //null eq not {//orig.sethalftone}{pop} ifelse} bind def\n", out);
+	  fputs("% =====\n", out);
+	}
+      }
+
+      if (strncmp(buffer, "%%BeginProlog", 13))
+      {
+	/* Close newly created Prolog section */
+	if (strncmp(buffer, "%%EndProlog", 11))
+	  fputs("%%EndProlog\n", out);
+	fprintf(out, "%s", buffer);
+      }
+
+      if (!ppd)
+      {
+       /*
+	* Copy everything until the setup section
+	*/
+	while (bytes > 0 &&
+	       strncmp(buffer, "%%BeginSetup", 12) &&
+	       strncmp(buffer, "%%EndSetup", 10) &&
+	       strncmp(buffer, "%%Page:", 7))
+	{
+	  bytes = ps_read_line(reader, buffer, sizeof(buffer));
+	  if (strncmp(buffer, "%%Page:", 7) &&
+	      strncmp(buffer, "%%EndSetup", 10))
+	    fprintf(out, "%s", buffer);
+	}
+
+	if (bytes > 0)
+	{
+	 /*
+	  * Insert option PostScript code in Setup section
+	  */
+	  if (strncmp(buffer, "%%BeginSetup", 12))
+	  {
+	    /* No Setup section, create one */
+	    fprintf(stderr, "DEBUG: Adding Setup section for option PostScript code\n");
+	    fputs("%%BeginSetup\n", out);
+	  }
+
+	 /*
+	  * Duplex
+	  */
+	  duplex = 0;
+	  tumble = 0;
+	  if ((val = cupsGetOption("sides", num_options, options)) != NULL ||
+	      (val = cupsGetOption("Duplex", num_options, options)) != NULL)
+	  {
+	    if (!strcasecmp(val, "On") ||
+		     !strcasecmp(val, "True") || !strcasecmp(val, "Yes") ||
+		     !strncasecmp(val, "two-sided", 9) ||
+		     !strncasecmp(val, "TwoSided", 8) ||
+		     !strncasecmp(val, "Duplex", 6))
+	    {
+	      duplex = 1;
+	      if (!strncasecmp(val, "DuplexTumble", 12))
+		tumble = 1;
+	    }
+	  }
+
+	  if ((val = cupsGetOption("sides", num_options, options)) != NULL ||
+	      (val = cupsGetOption("Tumble", num_options, options)) != NULL)
+	  {
+	    if (!strcasecmp(val, "None") || !strcasecmp(val, "Off") ||
+		!strcasecmp(val, "False") || !strcasecmp(val, "No") ||
+		!strcasecmp(val, "one-sided") || !strcasecmp(val, "OneSided") ||
+		!strcasecmp(val, "two-sided-long-edge") ||
+		!strcasecmp(val, "TwoSidedLongEdge") ||
+		!strcasecmp(val, "DuplexNoTumble"))
+	      tumble = 0;
+	    else if (!strcasecmp(val, "On") ||
+		     !strcasecmp(val, "True") || !strcasecmp(val, "Yes") ||
+		     !strcasecmp(val, "two-sided-short-edge") ||
+		     !strcasecmp(val, "TwoSidedShortEdge") ||
+		     !strcasecmp(val, "DuplexTumble"))
+	      tumble = 1;
+	  }
+
+	  if (duplex)
+	  {
+	    if (tumble)
+	      fputs("<</Duplex true /Tumble true>> setpagedevice\n", out);
+	    else
+	      fputs("<</Duplex true /Tumble false>> setpagedevice\n", out);
+	  }
+	  else
+	    fputs("<</Duplex false>> setpagedevice\n", out);
+
+	 /*
+	  * Resolution
+	  */
+	  if ((xres > 0) && (yres > 0))
+	    fprintf(out, "<</HWResolution[%d %d]>> setpagedevice\n", xres, yres);
+
+	 /*
+	  * InputSlot/MediaSource
+	  */
+	  if ((val = cupsGetOption("media-position", num_options,
+				   options)) != NULL ||
+	      (val = cupsGetOption("MediaPosition", num_options,
+				   options)) != NULL ||
+	      (val = cupsGetOption("media-source", num_options,
+				   options)) != NULL ||
+	      (val = cupsGetOption("MediaSource", num_options,
+				   options)) != NULL ||
+	      (val = cupsGetOption("InputSlot", num_options,
+				   options)) != NULL)
+	  {
+	    if (!strncasecmp(val, "Auto", 4) ||
+		!strncasecmp(val, "Default", 7))
+	      fputs("<</ManualFeed false /MediaPosition 7>> setpagedevice\n", out);
+	    else if (!strcasecmp(val, "Main"))
+	      fputs("<</MediaPosition 0 /ManualFeed false>> setpagedevice\n", out);
+	    else if (!strcasecmp(val, "Alternate"))
+	      fputs("<</MediaPosition 1 /ManualFeed false>> setpagedevice\n", out);
+	    else if (!strcasecmp(val, "Manual"))
+	      fputs("<</MediaPosition 3 /ManualFeed true>> setpagedevice\n", out);
+	    else if (!strcasecmp(val, "Top"))
+	      fputs("<</MediaPosition 0 /ManualFeed false>> setpagedevice\n", out);
+	    else if (!strcasecmp(val, "Bottom"))
+	      fputs("<</MediaPosition 1 /ManualFeed false>> setpagedevice\n", out);
+	    else if (!strcasecmp(val, "ByPassTray"))
+	      fputs("<</MediaPosition 3 /ManualFeed false>> setpagedevice\n", out);
+	    else if (!strcasecmp(val, "Tray1"))
+	      fputs("<</MediaPosition 3 /ManualFeed false>> setpagedevice\n", out);
+	    else if (!strcasecmp(val, "Tray2"))
+	      fputs("<</MediaPosition 0 /ManualFeed false>> setpagedevice\n", out);
+	    else if (!strcasecmp(val, "Tray3"))
+	      fputs("<</MediaPosition 1 /ManualFeed false>> setpagedevice\n", out);
+	  }
+
+	 /*
+	  * ColorModel
+	  */
+	  if ((val = cupsGetOption("pwg-raster-document-type", num_options,
+				   options)) != NULL ||
+	      (val = cupsGetOption("PwgRasterDocumentType", num_options,
+				   options)) != NULL ||
+	      (val = cupsGetOption("print-color-mode", num_options,
+				   options)) != NULL ||
+	      (val = cupsGetOption("PrintColorMode", num_options,
+				   options)) != NULL ||
+	      (val = cupsGetOption("color-space", num_options,
+				   options)) != NULL ||
+	      (val = cupsGetOption("ColorSpace", num_options,
+				   options)) != NULL ||
+	      (val = cupsGetOption("color-model", num_options,
+				   options)) != NULL ||
+	      (val = cupsGetOption("ColorModel", num_options,
+				   options)) != NULL)
+	  {
+	    if (!strncasecmp(val, "Black", 5))
+	      fputs("<</ProcessColorModel /DeviceGray>> setpagedevice\n", out);
+	    else if (!strncasecmp(val, "Cmyk", 4))
+	      fputs("<</ProcessColorModel /DeviceCMYK>> setpagedevice\n", out);
+	    else if (!strncasecmp(val, "Cmy", 3))
+	      fputs("<</ProcessColorModel /DeviceCMY>> setpagedevice\n", out);
+	    else if (!strncasecmp(val, "Rgb", 3))
+	      fputs("<</ProcessColorModel /DeviceRGB>> setpagedevice\n", out);
+	    else if (!strncasecmp(val, "Gray", 4))
+	      fputs("<</ProcessColorModel /DeviceGray>> setpagedevice\n", out);
+	    else if (!strncasecmp(val, "Color", 5))
+	      fputs("<</ProcessColorModel /DeviceRGB>> setpagedevice\n", out);
+	  }
+
+	  if (strncmp(buffer, "%%BeginSetup", 12))
+	  {
+	    /* Close newly created Setup section */
+	    if (strncmp(buffer, "%%EndSetup", 10))
+	      fputs("%%EndSetup\n", out);
+	    fprintf(out, "%s", buffer);
+	  }
+	}
+      }
+
+     /*
+      * Copy the rest of the file
+      */
+      status = ps_copy_rest(reader, out);
+    }
+  }
+
+  if (fclose(out))
+    status = -1;
+
+  free(reader);
+
+  return (status);
+}
+
+
+/*
+ * 'ps_copy_rest()' - Pass the rest of the PostScript on unchanged.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+ps_copy_rest(ps_reader_t *reader,	/* I - Renderer output */
+             FILE        *out)		/* I - Output to pstops */
+{
+  int		outfd = fileno(out);	/* Pipe to pstops */
+  ssize_t	bytes;			/* Bytes written */
+
+
+ /*
+  * Send the header and what we have read ahead of it...
+  */
+
+  if (fflush(out))
+    return (-1);
+
+  do
+  {
+    while (reader->ptr < reader->end)
+    {
+      if ((bytes = write(outfd, reader->ptr,
+                         (size_t)(reader->end - reader->ptr))) < 0)
+      {
+        if (errno == EINTR && !job_canceled)
+	  continue;
+
+	return (-1);
+      }
+
+      reader->ptr += bytes;
+    }
+
+#ifdef HAVE_SPLICE
+   /*
+    * Move the rest from pipe to pipe without copying it through our
+    * memory...
+    */
+
+    for (;;)
+    {
+      if ((bytes = splice(reader->fd, NULL, outfd, NULL, 1048576,
+                          SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+        continue;
+      else if (bytes == 0)
+        return (0);
+      else if (errno != EINTR || job_canceled)
+        break;
+    }
+
+    if (errno != EINVAL && errno != ENOSYS)
+      return (-1);
+#endif /* HAVE_SPLICE */
+  }
+  while (ps_fill(reader) > 0);
+
+  return (job_canceled ? -1 : 0);
+}
+
+
+/*
+ * 'ps_fill()' - Read the next block of PostScript.
+ */
+
+static int				/* O - Bytes read, 0 on EOF, -1 on error */
+ps_fill(ps_reader_t *reader)		/* I - Renderer output */
+{
+  ssize_t	bytes;			/* Bytes read */
+
+
+  while ((bytes = read(reader->fd, reader->buffer,
+                       sizeof(reader->buffer))) < 0)
+    if (errno != EINTR || job_canceled)
+      return (-1);
+
+  reader->ptr = reader->buffer;
+  reader->end = reader->buffer + bytes;
+
+  return ((int)bytes);
+}
+
+
+/*
+ * 'ps_read_line()' - Read a line of the PostScript header.
+ *
+ * Like cupsFileGetLine() the line ending (CR, LF, or CR LF) is kept,
+ * and an empty string with a length of 0 is returned at the end.
+ */
+
+static int				/* O - Length of line or 0 */
+ps_read_line(ps_reader_t *reader,	/* I - Renderer output */
+             char        *line,		/* I - Line buffer */
+	     int         linesize)	/* I - Size of line buffer */
+{
+  char	*lineptr,			/* Current position in line */
+	*lineend;			/* End of line buffer */
+
+
+  for (lineptr = line, lineend = line + linesize - 1; lineptr < lineend;)
+  {
+    if (reader->ptr >= reader->end && ps_fill(reader) <= 0)
+      break;
+
+    if ((*lineptr++ = *reader->ptr++) == '\n')
+      break;
+    else if (lineptr[-1] == '\r')
+    {
+      if (lineptr < lineend &&
+          (reader->ptr < reader->end || ps_fill(reader) > 0) &&
+	  *reader->ptr == '\n')
+	*lineptr++ = *reader->ptr++;
+
+      break;
+    }
+  }
+
+  *lineptr = '\0';
+
+  return ((int)(lineptr - line));
+}
@@ -38,6 +38,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #ifdef HAVE_CPP_POPPLER_VERSION_H
 #include <poppler/cpp/poppler-version.h>
 #endif
@@ -47,6 +48,8 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <cupsfilters/image.h>
 #include <cupsfilters/raster.h>
 #include <cupsfilters/colormanager.h>
+#include <cupsfilters/ppdcache.h>
+#include <cupsfilters/spool.h>
 #include <strings.h>
 #include <math.h>
 #include <poppler/cpp/poppler-document.h>
@@ -186,6 +189,9 @@ namespace {
   /* for color profiles */
   cmsHPROFILE colorProfile = NULL;
   cmsHPROFILE popplerColorProfile = NULL;
+  /* printer profile from the color manager and its file */
+  cmsHPROFILE fileColorProfile = NULL;
+  char *colorProfileFile = NULL;
   cmsHTRANSFORM colorTransform = NULL;
   cmsCIEXYZ D65WhitePoint;
   int renderingIntent = INTENT_PERCEPTUAL;
@@ -295,6 +301,64 @@ static void lcmsErrorHandler(cmsContext contextId, cmsUInt32Number ErrorCode,
 
 
 
+/*
+ * Linking the printer's ICC profile into a transform is the expensive part
+ * of setting up color conversion.  With lcms2 the result is kept as a
+ * device link in the cache of libcupsfilters, keyed by the profile file,
+ * the rendering intent and the pixel formats, so that the next job for
+ * the printer only has to load the link.
+ */
+static cmsHTRANSFORM createColorTransform(unsigned int inputFormat,
+  unsigned int outputFormat)
+{
+  cmsHTRANSFORM transform;
+#ifndef USE_LCMS1
+  cups_ppd_cache_t *pc = NULL;
+  const void *data;
+  size_t size;
+  char name[256];
+  cmsHPROFILE link;
+  cmsUInt32Number linkSize;
+  void *buffer;
+
+  /* only the input profile is sRGB here, built-in output profiles are
+     cheap to link */
+  if (colorProfileFile != NULL && colorProfile == fileColorProfile) {
+    snprintf(name,sizeof(name),"pdftoraster-srgb-%d-%x-%x",renderingIntent,
+      inputFormat,outputFormat);
+    pc = cupsPPDCacheOpen(colorProfileFile,name,0,NULL);
+    if ((data = cupsPPDCacheGetData(pc,&size)) != NULL
+        && (link = cmsOpenProfileFromMem(data,size)) != NULL) {
+      transform = cmsCreateTransform(link,inputFormat,NULL,outputFormat,
+        renderingIntent,0);
+      cmsCloseProfile(link);
+      if (transform != NULL) {
+        fprintf(stderr, "DEBUG: Using cached color transform for %s\n",
+          colorProfileFile);
+        cupsPPDCacheClose(pc);
+        return transform;
+      }
+    }
+  }
+#endif
+  transform = cmsCreateTransform(popplerColorProfile,inputFormat,
+    colorProfile,outputFormat,renderingIntent,0);
+#ifndef USE_LCMS1
+  if (pc != NULL && transform != NULL
+      && (link = cmsTransform2DeviceLink(transform,4.3,0)) != NULL) {
+    if (cmsSaveProfileToMem(link,NULL,&linkSize)
+        && (buffer = malloc(linkSize)) != NULL) {
+      if (cmsSaveProfileToMem(link,buffer,&linkSize))
+        cupsPPDCachePut(pc,buffer,linkSize);
+      free(buffer);
+    }
+    cmsCloseProfile(link);
+  }
+  cupsPPDCacheClose(pc);
+#endif
+  return transform;
+}
+
 static void  handleRqeuiresPageRegion() {
   ppd_choice_t *mf;
   ppd_choice_t *is;
@@ -436,7 +500,11 @@ static void parseOpts(int argc, char **argv)
 
     if (profile != NULL) {
       colorProfile = cmsOpenProfileFromFile(profile,"r");
-      free(profile);
+      if (colorProfile != NULL) {
+        fileColorProfile = colorProfile;
+        colorProfileFile = profile;
+      } else
+        free(profile);
     }
 
 #ifdef HAVE_CUPS_1_7
@@ -1360,12 +1428,10 @@ static void selectConvertFunc(cups_raster_t *raster)
       popplerColorProfile = cmsCreate_sRGBProfile();
     }
     unsigned int dcst = getCMSColorSpaceType(cmsGetColorSpace(colorProfile));
-    if ((colorTransform = cmsCreateTransform(popplerColorProfile,
+    if ((colorTransform = createColorTransform(
             COLORSPACE_SH(PT_RGB) |CHANNELS_SH(3) | BYTES_SH(1),
-            colorProfile,
             COLORSPACE_SH(dcst) |
-            CHANNELS_SH(header.cupsNumColors) | BYTES_SH(bytes),
-            renderingIntent,0)) == 0) {
+            CHANNELS_SH(header.cupsNumColors) | BYTES_SH(bytes))) == 0) {
       fprintf(stderr, "ERROR: Can't create color transform");
       exit(1);
     }
@@ -1972,6 +2038,7 @@ static void setPopplerColorProfile()
 
 int main(int argc, char *argv[]) {
   poppler::document *doc;
+  cups_spool_t *spool = NULL;
   int i;
   int npages=0;
   cups_raster_t *raster;
@@ -1981,29 +2048,20 @@ int main(int argc, char *argv[]) {
 
   if (argc == 6) {
     /* stdin */
-    int fd;
-    char name[BUFSIZ];
-    char buf[BUFSIZ];
-    int n;
-
-    fd = cupsTempFd(name,sizeof(name));
-    if (fd < 0) {
-      fprintf(stderr, "ERROR: Can't create temporary file\n");
+    char name[64];
+
+    /* receive stdin into memory (or use it in place if it is a file) */
+    if ((spool = cupsSpoolOpen(0)) == NULL)
       exit(1);
-    }
 
-    /* copy stdin to the tmp file */
-    while ((n = read(0,buf,BUFSIZ)) > 0) {
-      if (write(fd,buf,n) != n) {
-        fprintf(stderr, "ERROR: Can't copy stdin to temporary file\n" );
-        close(fd);
-	exit(1);
-      }
+    if (spool->data && spool->length <= INT_MAX)
+      /* the mapping stays valid until the document is deleted */
+      doc=poppler::document::load_from_raw_data(spool->data,
+						(int)spool->length,"","");
+    else {
+      snprintf(name,sizeof(name),"/dev/fd/%d",spool->fd);
+      doc=poppler::document::load_from_file(name,"","");
     }
-    close(fd);
-    doc=poppler::document::load_from_file(name,"","");
-    /* remove name */
-    unlink(name);
   } else {
     /* argc == 7 filenmae is specified */
     FILE *fp;
@@ -2127,6 +2185,7 @@ int main(int argc, char *argv[]) {
   cupsRasterClose(raster);
 
   delete doc;
+  cupsSpoolClose(spool);
   if (ppd != NULL) {
     ppdClose(ppd);
   }
@@ -2139,6 +2198,10 @@ int main(int argc, char *argv[]) {
   if (colorTransform != NULL) {
     cmsDeleteTransform(colorTransform);
   }
+  if (fileColorProfile != NULL && fileColorProfile != colorProfile) {
+    cmsCloseProfile(fileColorProfile);
+  }
+  free(colorProfileFile);
 
   return exitCode;
 }
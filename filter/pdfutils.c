@@ -13,19 +13,72 @@
 #include <memory.h>
 #include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
 #include "pdfutils.h"
 #include "fontembed/embed.h"
 
+void pdfOut_write(pdfOut *pdf,const char *buf,int len) // {{{
+{
+  assert(pdf);
+  assert(len>=0);
+
+  if (pdf->capture) {
+    if (pdf->streamsize+len>pdf->streamalloc) {
+      int alloc=(pdf->streamalloc)?pdf->streamalloc:65536;
+      while (pdf->streamsize+len>alloc) {
+        alloc*=2;
+      }
+      char *tmp=realloc(pdf->stream,alloc);
+      if (!tmp) {
+        perror("Out of memory");
+        assert(0);
+        return;
+      }
+      pdf->stream=tmp;
+      pdf->streamalloc=alloc;
+    }
+    memcpy(pdf->stream+pdf->streamsize,buf,len);
+    pdf->streamsize+=len;
+    return;
+  }
+
+  if (fwrite(buf,1,len,stdout)!=len) {
+    perror("Short write");
+    assert(0);
+    return;
+  }
+  pdf->filepos+=len;
+}
+// }}}
+
 void pdfOut_printf(pdfOut *pdf,const char *fmt,...) // {{{
 {
   assert(pdf);
+  char buf[1024],*big;
   int len;
   va_list ap;
 
   va_start(ap,fmt);
-  len=vprintf(fmt,ap);
+  len=vsnprintf(buf,sizeof(buf),fmt,ap);
   va_end(ap);
-  pdf->filepos+=len;
+  if (len<0) {
+    return;
+  }
+  if (len<sizeof(buf)) {
+    pdfOut_write(pdf,buf,len);
+    return;
+  }
+
+  // does not fit into the buffer on the stack
+  big=malloc(len+1);
+  if (!big) {
+    return;
+  }
+  va_start(ap,fmt);
+  vsnprintf(big,len+1,fmt,ap);
+  va_end(ap);
+  pdfOut_write(pdf,big,len);
+  free(big);
 }
 // }}}
 
@@ -33,46 +86,115 @@ void pdfOut_putString(pdfOut *pdf,const char *str,int len) // {{{ - >len==-1: st
 {
   assert(pdf);
   assert(str);
+  char esc[4];
   if (len==-1) {
     len=strlen(str);
   }
-  putc('(',stdout);
+  pdfOut_write(pdf,"(",1);
   // escape special chars: \0 \\ \( \)  -- don't bother about balanced parens
   int iA=0;
   for (;len>0;iA++,len--) {
     if ( (str[iA]<32)||(str[iA]>126) ) {
-      fwrite(str,1,iA,stdout);
-      fprintf(stdout,"\\%03o",(unsigned char)str[iA]);
-      pdf->filepos+=iA+4;
+      pdfOut_write(pdf,str,iA);
+      esc[0]='\\';
+      esc[1]='0'+(((unsigned char)str[iA]>>6)&7);
+      esc[2]='0'+(((unsigned char)str[iA]>>3)&7);
+      esc[3]='0'+((unsigned char)str[iA]&7);
+      pdfOut_write(pdf,esc,4);
       str+=iA+1;
       iA=-1;
     } else if ( (str[iA]=='(')||(str[iA]==')')||(str[iA]=='\\') ) {
-      fwrite(str,1,iA,stdout);
-      fprintf(stdout,"\\%c",str[iA]);
-      pdf->filepos+=iA+2;
+      pdfOut_write(pdf,str,iA);
+      esc[0]='\\';
+      esc[1]=str[iA];
+      pdfOut_write(pdf,esc,2);
       str+=iA+1;
       iA=-1;
     }
   }
-  pdf->filepos+=iA+2;
-  fwrite(str,1,iA,stdout);
-  putc(')',stdout);
+  pdfOut_write(pdf,str,iA);
+  pdfOut_write(pdf,")",1);
 }
 // }}}
 
 void pdfOut_putHexString(pdfOut *pdf,const char *str,int len) // {{{ - >len==-1: strlen()
 {
+  static const char hex[]="0123456789abcdef";
+  char buf[256];
+  int pos=0;
+
   assert(pdf);
   assert(str);
   if (len==-1) {
     len=strlen(str);
   }
-  pdf->filepos+=2*len+2;
-  putc('<',stdout);
+  buf[pos++]='<';
   for (;len>0;str++,len--) {
-    fprintf(stdout,"%02x",(unsigned char)*str);
+    if (pos+2>sizeof(buf)) {
+      pdfOut_write(pdf,buf,pos);
+      pos=0;
+    }
+    buf[pos++]=hex[((unsigned char)*str)>>4];
+    buf[pos++]=hex[((unsigned char)*str)&0x0f];
+  }
+  if (pos+1>sizeof(buf)) {
+    pdfOut_write(pdf,buf,pos);
+    pos=0;
+  }
+  buf[pos++]='>';
+  pdfOut_write(pdf,buf,pos);
+}
+// }}}
+
+void pdfOut_begin_stream(pdfOut *pdf) // {{{
+{
+  assert(pdf);
+  assert(!pdf->capture);
+
+  pdf->capture=1;
+  pdf->streamsize=0;
+}
+// }}}
+
+int pdfOut_end_stream(pdfOut *pdf,int compress) // {{{ -  returns obj_no, -1 on error
+{
+  assert(pdf);
+  assert(pdf->capture);
+  const char *data=pdf->stream;
+  int len=pdf->streamsize;
+  Bytef *zbuf=NULL;
+
+  pdf->capture=0;
+
+  if ( (compress)&&(len>0) ) {
+    uLongf zlen=compressBound(len);
+    zbuf=malloc(zlen);
+    if ( (zbuf)&&(compress2(zbuf,&zlen,(const Bytef *)data,len,Z_DEFAULT_COMPRESSION)==Z_OK) ) {
+      data=(const char *)zbuf;
+      len=zlen;
+    } else {
+      compress=0;
+    }
+  } else {
+    compress=0;
+  }
+
+  const int obj=pdfOut_add_xref(pdf);
+  if (obj==-1) {
+    free(zbuf);
+    return -1;
   }
-  putc('>',stdout);
+  pdfOut_printf(pdf,"%d 0 obj\n"
+                    "<</Length %d%s\n"
+                    ">>\n"
+                    "stream\n",
+                    obj,len,(compress)?"/Filter/FlateDecode":"");
+  pdfOut_write(pdf,data,len);
+  pdfOut_printf(pdf,"\nendstream\n"
+                    "endobj\n");
+
+  free(zbuf);
+  return obj;
 }
 // }}}
 
@@ -277,6 +399,7 @@ void pdfOut_free(pdfOut *pdf) // {{{
     free(pdf->kv);
     free(pdf->pages);
     free(pdf->xref);
+    free(pdf->stream);
     free(pdf);
   }
 }
@@ -286,12 +409,7 @@ static void pdfOut_outfn(const char *buf,int len,void *context) // {{{
 {
   pdfOut *pdf=(pdfOut *)context;
 
-  if (fwrite(buf,1,len,stdout)!=len) {
-    perror("Short write");
-    assert(0);
-    return;
-  }
-  pdf->filepos+=len;
+  pdfOut_write(pdf,buf,len);
 }
 // }}}
 
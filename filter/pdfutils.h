@@ -24,6 +24,11 @@ typedef struct {
 
   int kvsize,kvalloc;
   struct keyval_t *kv;
+
+  // content stream collected in memory, see pdfOut_begin_stream()
+  int capture;
+  int streamsize,streamalloc;
+  char *stream;
 } pdfOut;
 
 /* allocates a new pdfOut structure
@@ -44,12 +49,27 @@ void pdfOut_finish_pdf(pdfOut *pdf);
 void pdfOut_printf(pdfOut *pdf,const char *fmt,...)
   __attribute__((format(printf, 2, 3)));
 
+/* Write out >len bytes of raw data
+ */
+void pdfOut_write(pdfOut *pdf,const char *buf,int len);
+
 /* write out an escaped pdf string: e.g.  (Text \(Test\)\n)
  * >len==-1: use strlen(str) 
  */
 void pdfOut_putString(pdfOut *pdf,const char *str,int len);
 void pdfOut_putHexString(pdfOut *pdf,const char *str,int len);
 
+/* Collect all following output in memory, until pdfOut_end_stream()
+ * writes it out as a stream object.
+ */
+void pdfOut_begin_stream(pdfOut *pdf);
+
+/* Write the collected data as a new stream object, FlateDecode
+ * compressed if >compress is true. The /Length is written directly.
+ * returns the obj number, -1 on error
+ */
+int pdfOut_end_stream(pdfOut *pdf,int compress);
+
 /* Format the broken up timestamp according to
  * pdf requirements for /CreationDate
  * NOTE: uses statically allocated buffer 
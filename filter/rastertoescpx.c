@@ -1305,10 +1305,8 @@ CompressData(ppd_file_t          *ppd,	/* I - PPD file information */
 {
   register const unsigned char *line_ptr,
 					/* Current byte pointer */
-        	*line_end,		/* End-of-line byte pointer */
-        	*start;			/* Start of compression sequence */
+        	*line_end;		/* End-of-line byte pointer */
   register unsigned char *comp_ptr;	/* Pointer into compression buffer */
-  register int  count;			/* Count of bytes for output */
   register int	bytes;			/* Number of bytes per row */
   static int	ctable[7][7] =		/* Colors */
 		{
@@ -1338,65 +1336,7 @@ CompressData(ppd_file_t          *ppd,	/* I - PPD file information */
         * Do TIFF pack-bits encoding...
         */
 
-	line_ptr = (const unsigned char *)line;
-	line_end = (const unsigned char *)line + length;
-	comp_ptr = CompBuffer;
-
-	while (line_ptr < line_end && (comp_ptr - CompBuffer) < length)
-	{
-	  if ((line_ptr + 1) >= line_end)
-	  {
-	   /*
-	    * Single byte on the end...
-	    */
-
-	    *comp_ptr++ = 0x00;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else if (line_ptr[0] == line_ptr[1])
-	  {
-	   /*
-	    * Repeated sequence...
-	    */
-
-	    line_ptr ++;
-	    count = 2;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] == line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = 257 - count;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else
-	  {
-	   /*
-	    * Non-repeated sequence...
-	    */
-
-	    start    = line_ptr;
-	    line_ptr ++;
-	    count    = 1;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] != line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = count - 1;
-
-	    memcpy(comp_ptr, start, count);
-	    comp_ptr += count;
-	  }
-	}
+	comp_ptr = cupsPackBits(line, length, CompBuffer);
 
         if ((comp_ptr - CompBuffer) < length)
 	{
@@ -16,6 +16,8 @@
  *   EndPage()      - Finish a page of graphics.
  *   Shutdown()     - Shutdown a printer.
  *   CancelJob()    - Cancel the current job...
+ *   MatchSeed()    - Count the bytes of a line matching the seed row.
+ *   DeltaRow()     - Do delta-row encoding of a line.
  *   CompressData() - Compress a line of graphics.
  *   OutputLine()   - Output the specified number of lines of graphics.
  *   ReadLine()     - Read graphics from the page stream.
@@ -67,6 +69,8 @@ int		PrinterPlanes,		/* Number of color planes */
 		DotBufferSizes[6],	/* Size of one row of color dots */
 		DotBufferSize,		/* Size of complete line */
 		OutputFeed,		/* Number of lines to skip */
+		CompMode,		/* Current compression mode */
+		UseYOffset,		/* Skip blank lines with ESC*b#Y? */
 		Page;			/* Current page number */
 pcl_output_t	OutputMode;		/* Output mode - see OUTPUT_ consts */
 const int	ColorOrders[7][7] =	/* Order of color planes */
@@ -94,6 +98,10 @@ void	Shutdown(ppd_file_t *ppd, int job_id, const char *user,
 	         const char *title, int num_options, cups_option_t *options);
 
 void	CancelJob(int sig);
+int	MatchSeed(const unsigned char *line, const unsigned char *seed,
+	          int length);
+unsigned char	*DeltaRow(const unsigned char *line, const unsigned char *seed,
+		          int length, unsigned char *comp_ptr);
 void	CompressData(unsigned char *line, int length, int plane, int pend,
 	             int type);
 void	OutputLine(ppd_file_t *ppd, cups_page_header2_t *header);
@@ -787,8 +795,22 @@ StartPage(ppd_file_t         *ppd,	/* I - PPD file */
   if (header->cupsCompression && header->cupsCompression != 10)
     printf("\033*b%dM", header->cupsCompression);
 
+  CompMode   = header->cupsCompression;
   OutputFeed = 0;
 
+ /*
+  * Modes 3 and up skip blank lines with a Y offset; printers without
+  * delta-row compression get one empty raster line per blank line unless
+  * the PPD file says that they know the Y offset command...
+  */
+
+  if (header->cupsCompression >= 3)
+    UseYOffset = 1;
+  else if (ppd && (attr = ppdFindAttr(ppd, "cupsPCLYOffset", NULL)) != NULL)
+    UseYOffset = attr->value && !strcasecmp(attr->value, "true");
+  else
+    UseYOffset = 0;
+
  /*
   * Allocate memory for the page...
   */
@@ -957,6 +979,150 @@ CancelJob(int sig)			/* I - Signal */
 }
 
 
+/*
+ * 'MatchSeed()' - Count the bytes of a line matching the seed row.
+ *
+ * Most of a line usually matches the line before, so compare a machine
+ * word at a time before looking at single bytes.
+ */
+
+int					/* O - Number of matching bytes */
+MatchSeed(const unsigned char *line,	/* I - Line */
+          const unsigned char *seed,	/* I - Seed row */
+	  int                 length)	/* I - Number of bytes */
+{
+  int		count;			/* Matching bytes */
+  unsigned long	lword,			/* Word from line */
+		sword;			/* Word from seed row */
+
+
+  for (count = 0; count + (int)sizeof(lword) <= length;
+       count += sizeof(lword))
+  {
+    memcpy(&lword, line + count, sizeof(lword));
+    memcpy(&sword, seed + count, sizeof(sword));
+
+    if (lword != sword)
+      break;
+  }
+
+  while (count < length && line[count] == seed[count])
+    count ++;
+
+  return (count);
+}
+
+
+/*
+ * 'DeltaRow()' - Do delta-row encoding of a line.
+ *
+ * Without a valid seed row (NULL) the whole line is sent.
+ */
+
+unsigned char *				/* O - End of compressed data */
+DeltaRow(const unsigned char *line,	/* I - Data to compress */
+         const unsigned char *seed,	/* I - Seed row or NULL */
+         int                 length,	/* I - Number of bytes */
+	 unsigned char       *comp_ptr)	/* I - Compression buffer */
+{
+  const unsigned char	*line_ptr,	/* Current byte pointer */
+			*line_end,	/* End-of-line byte pointer */
+			*start;		/* Start of compression sequence */
+  int			count,		/* Count of bytes for output */
+			offset;		/* Offset of bytes for output */
+
+
+  line_ptr = line;
+  line_end = line + length;
+
+  while (line_ptr < line_end)
+  {
+   /*
+    * Find the next non-matching sequence...
+    */
+
+    start = line_ptr;
+
+    if (!seed)
+    {
+     /*
+      * The seed buffer is invalid, so do the next 8 bytes, max...
+      */
+
+      offset = 0;
+
+      if ((count = line_end - line_ptr) > 8)
+	count = 8;
+
+      line_ptr += count;
+    }
+    else
+    {
+     /*
+      * The seed buffer is valid, so compare against it...
+      */
+
+      offset   = MatchSeed(line_ptr, seed + (line_ptr - line),
+                           line_end - line_ptr);
+      line_ptr += offset;
+
+      if (line_ptr == line_end)
+        break;
+
+     /*
+      * Find up to 8 non-matching bytes...
+      */
+
+      start = line_ptr;
+      count = 0;
+      while (line_ptr < line_end &&
+             *line_ptr != seed[line_ptr - line] &&
+             count < 8)
+      {
+        line_ptr ++;
+        count ++;
+      }
+    }
+
+   /*
+    * Place mode 3 compression data in the buffer; see HP manuals
+    * for details...
+    */
+
+    if (offset >= 31)
+    {
+     /*
+      * Output multi-byte offset...
+      */
+
+      *comp_ptr++ = ((count - 1) << 5) | 31;
+
+      offset -= 31;
+      while (offset >= 255)
+      {
+        *comp_ptr++ = 255;
+        offset    -= 255;
+      }
+
+      *comp_ptr++ = offset;
+    }
+    else
+    {
+     /*
+      * Output single-byte offset...
+      */
+
+      *comp_ptr++ = ((count - 1) << 5) | offset;
+    }
+
+    memcpy(comp_ptr, start, count);
+    comp_ptr += count;
+  }
+
+  return (comp_ptr);
+}
+
+
 /*
  * 'CompressData()' - Compress a line of graphics.
  */
@@ -977,6 +1143,7 @@ CompressData(unsigned char *line,	/* I - Data to compress */
 		offset,			/* Offset of bytes for output */
 		temp;			/* Temporary count */
   int		r, g, b;		/* RGB deltas for mode 10 compression */
+  int		mode;			/* Compression mode of line */
 
 
   switch (type)
@@ -1024,68 +1191,8 @@ CompressData(unsigned char *line,	/* I - Data to compress */
         * Do TIFF pack-bits encoding...
         */
 
-	line_ptr = line;
-	line_end = line + length;
-	comp_ptr = CompBuffer;
-
-	while (line_ptr < line_end)
-	{
-	  if ((line_ptr + 1) >= line_end)
-	  {
-	   /*
-	    * Single byte on the end...
-	    */
-
-	    *comp_ptr++ = 0x00;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else if (line_ptr[0] == line_ptr[1])
-	  {
-	   /*
-	    * Repeated sequence...
-	    */
-
-	    line_ptr ++;
-	    count = 2;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] == line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = 257 - count;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else
-	  {
-	   /*
-	    * Non-repeated sequence...
-	    */
-
-	    start    = line_ptr;
-	    line_ptr ++;
-	    count    = 1;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] != line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = count - 1;
-
-	    memcpy(comp_ptr, start, count);
-	    comp_ptr += count;
-	  }
-	}
-
-        line_ptr = CompBuffer;
-        line_end = comp_ptr;
+	line_ptr = CompBuffer;
+	line_end = cupsPackBits(line, length, CompBuffer);
 	break;
 
     case 3 :
@@ -1093,106 +1200,40 @@ CompressData(unsigned char *line,	/* I - Data to compress */
 	* Do delta-row compression...
 	*/
 
-	line_ptr = line;
-	line_end = line + length;
-
-	comp_ptr = CompBuffer;
 	seed     = SeedBuffer + plane * length;
+	line_ptr = CompBuffer;
+	line_end = DeltaRow(line, SeedInvalid ? NULL : seed, length,
+	                    CompBuffer);
+	mode     = 3;
 
-	while (line_ptr < line_end)
-        {
-         /*
-          * Find the next non-matching sequence...
-          */
+        if (plane == 0 && pend == 'W' && line_end > line_ptr)
+	{
+	 /*
+	  * A line with a single plane can use another compression mode
+	  * without disturbing the other planes, so also try pack-bits and
+	  * use it for lines which differ a lot from the seed row.  The
+	  * printer updates the seed row for every mode...
+	  */
 
-          start = line_ptr;
+	  start    = CompBuffer + 2 * DotBufferSize;
+	  comp_ptr = cupsPackBits(line, length, start);
 
-	  if (SeedInvalid)
+	  if ((comp_ptr - start) + (CompMode != 2 ? 5 : 0) <
+	          (line_end - line_ptr) + (CompMode != 3 ? 5 : 0))
 	  {
-	   /*
-	    * The seed buffer is invalid, so do the next 8 bytes, max...
-	    */
-
-	    offset = 0;
-
-	    if ((count = line_end - line_ptr) > 8)
-	      count = 8;
-
-	    line_ptr += count;
+	    line_ptr = start;
+	    line_end = comp_ptr;
+	    mode     = 2;
 	  }
-	  else
-	  {
-	   /*
-	    * The seed buffer is valid, so compare against it...
-	    */
-
-            while (*line_ptr == *seed &&
-                   line_ptr < line_end)
-            {
-              line_ptr ++;
-              seed ++;
-            }
-
-            if (line_ptr == line_end)
-              break;
-
-            offset = line_ptr - start;
-
-           /*
-            * Find up to 8 non-matching bytes...
-            */
-
-            start = line_ptr;
-            count = 0;
-            while (*line_ptr != *seed &&
-                   line_ptr < line_end &&
-                   count < 8)
-            {
-              line_ptr ++;
-              seed ++;
-              count ++;
-            }
-	  }
-
-         /*
-          * Place mode 3 compression data in the buffer; see HP manuals
-          * for details...
-          */
-
-          if (offset >= 31)
-          {
-           /*
-            * Output multi-byte offset...
-            */
-
-            *comp_ptr++ = ((count - 1) << 5) | 31;
-
-            offset -= 31;
-            while (offset >= 255)
-            {
-              *comp_ptr++ = 255;
-              offset    -= 255;
-            }
-
-            *comp_ptr++ = offset;
-          }
-          else
-          {
-           /*
-            * Output single-byte offset...
-            */
-
-            *comp_ptr++ = ((count - 1) << 5) | offset;
-          }
-
-          memcpy(comp_ptr, start, count);
-          comp_ptr += count;
-        }
+	}
 
-	line_ptr = CompBuffer;
-	line_end = comp_ptr;
+        if (mode != CompMode)
+	{
+	  printf("\033*b%dM", mode);
+	  CompMode = mode;
+	}
 
-        memcpy(SeedBuffer + plane * length, line, length);
+        memcpy(seed, line, length);
 	break;
 
     case 10 :
@@ -1218,13 +1259,10 @@ CompressData(unsigned char *line,	/* I - Data to compress */
             * Find the next non-matching sequence...
             */
 
-            start = line_ptr;
-            while (line_ptr < line_end &&
-	           *line_ptr == *seed)
-            {
-              line_ptr ++;
-              seed ++;
-            }
+            start    = line_ptr;
+	    count    = MatchSeed(line_ptr, seed, line_end - line_ptr);
+	    line_ptr += count;
+	    seed     += count;
 
             if (line_ptr == line_end)
               break;
@@ -1385,7 +1423,11 @@ CompressData(unsigned char *line,	/* I - Data to compress */
             * Find the next non-matching sequence...
             */
 
-            start = line_ptr;
+            start    = line_ptr;
+	    count    = MatchSeed(line_ptr, seed, line_end - line_ptr) / 3 * 3;
+	    line_ptr += count;
+	    seed     += count;
+
             while (line_ptr[0] == seed[0] &&
                    line_ptr[1] == seed[1] &&
                    line_ptr[2] == seed[2] &&
@@ -1576,7 +1618,7 @@ OutputLine(ppd_file_t         *ppd,	/* I - PPD file */
 
   if (OutputFeed > 0)
   {
-    if (header->cupsCompression < 3)
+    if (!UseYOffset)
     {
      /*
       * Send blank raster lines...
@@ -1814,6 +1856,13 @@ main(int  argc,				/* I - Number of command-line arguments */
 
   setbuf(stderr, NULL);
 
+ /*
+  * Raster data is written in many small pieces, so give the output a
+  * bigger buffer...
+  */
+
+  setvbuf(stdout, NULL, _IOFBF, 65536);
+
  /*
   * Check command-line...
   */
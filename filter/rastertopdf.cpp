@@ -34,6 +34,7 @@
 #include <cups/cups.h>
 #include <cups/raster.h>
 #include <cupsfilters/colormanager.h>
+#include <cupsfilters/driver.h>
 #include <cupsfilters/image.h>
 
 #include <arpa/inet.h>   // ntohl
@@ -46,7 +47,6 @@
 #include <qpdf/Pl_Flate.hh>
 #include <qpdf/Pl_Buffer.hh>
 #ifdef QPDF_HAVE_PCLM
-#include <qpdf/Pl_RunLength.hh>
 #include <qpdf/Pl_DCT.hh>
 #endif
 
@@ -684,9 +684,13 @@ makePclmStrips(QPDF &pdf, unsigned num_strips,
       }
       else if (compression == RLE_DECODE)
       {
-        Pl_RunLength prle("prle", &psink, Pl_RunLength::a_encode);
-        prle.write(strip_data[i]->getBuffer(),strip_data[i]->getSize());
-        prle.finish();
+        // RunLengthDecode is TIFF pack-bits ended by a 128 byte
+        size_t size = strip_data[i]->getSize();
+        std::vector<unsigned char> rle(size + size / 128 + 2);
+        unsigned char *rle_end = cupsPackBits(strip_data[i]->getBuffer(), size, &rle[0]);
+        *rle_end++ = 128;
+        psink.write(&rle[0], rle_end - &rle[0]);
+        psink.finish();
         ret[i].replaceStreamData(PointerHolder<Buffer>(psink.getBuffer()),
                               QPDFObjectHandle::newName("/RunLengthDecode"),QPDFObjectHandle::newNull());
       }
@@ -14,10 +14,12 @@
  *   main()           - Main entry for filter...
  *   cancel_job()     - Flag the job as canceled.
  *   filter_present() - Is the requested filter actually installed?
+ *   input_is_gzip()  - Check whether the input file is gzip-compressed
  *   compare_pids()   - Compare process IDs for sorting PID list
  *   exec_filter()    - Execute a filter process
  *   exec_filters()   - Execute a filter chain
  *   open_pipe()      - Create a pipe to transfer data from filter to filter
+ *   relay_data()     - Pass the data between the filters and count it
  *   get_option_in_str() - Get an option value from a string like argv[5]
  *   set_option_in_str() - Set an option value in a string like argv[5]
  */
@@ -32,6 +34,9 @@
 #include <cups/file.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <poll.h>
 #include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -41,6 +46,7 @@
 #include <cupsfilters/image-private.h>
 
 #define MAX_CHECK_COMMENT_LINES	20
+#define FILTER_PIPE_SIZE	1048576	/* Pipe buffer size between filters */
 
 /*
  * Type definitions
@@ -48,10 +54,20 @@
 
 typedef unsigned output_format_t;
 enum output_format_e {PDF = 0, POSTSCRIPT = 1, PWGRASTER = 2, PCLXL = 3, PCL = 4};
+typedef struct filter_link_s            /* Data link between two filters */
+{
+  char          *name;                  /* Filter writing into the link */
+  int           infd,                   /* Output pipe of that filter */
+                outfd;                  /* Input pipe of the next filter */
+  int           want_out;               /* Waiting for room in outfd? */
+  long long     bytes;                  /* Bytes passed on */
+} filter_link_t;
 typedef struct filter_pid_s             /* Filter in filter chain */
 {
   char          *name;                  /* Filter executable name */
   int           pid;                    /* PID of filter process */
+  struct timeval start;                 /* Time the filter was started */
+  filter_link_t *link;                  /* Link the filter writes into */
 } filter_pid_t;
 
 /*
@@ -65,6 +81,11 @@ static int		exec_filter(const char *filter, char **argv,
 			            int infd, int outfd);
 static int		exec_filters(cups_array_t *filters, char **argv);
 static int		open_pipe(int *fds);
+#ifdef HAVE_SPLICE
+static void		relay_data(filter_link_t *links, int num_links,
+			           cups_array_t *pids);
+#endif /* HAVE_SPLICE */
+static int		input_is_gzip(const char *filename);
 static char*		get_option_in_str(char *buf, const char *option,
 					  int return_value);
 static void		set_option_in_str(char *buf, int buflen,
@@ -222,10 +243,11 @@ main(int  argc,				/* I - Number of command-line args */
   filter_chain = cupsArrayNew(NULL, NULL);
 
  /*
-  * Add the gziptoany filter if installed
+  * Add the gziptoany filter if installed and the input is compressed,
+  * otherwise it would only copy the data to the next filter
   */
 
-  if (filter_present("gziptoany"))
+  if (filter_present("gziptoany") && input_is_gzip(filename))
     cupsArrayAdd(filter_chain, "gziptoany");
 
  /*
@@ -505,6 +527,28 @@ filter_present(const char *filter)      /* I - Filter name */
 }
 
 
+/*
+ * 'input_is_gzip()' - Check whether the input file is gzip-compressed.
+ */
+
+static int				/* O - 1 if compressed, 0 otherwise */
+input_is_gzip(const char *filename)	/* I - Input file */
+{
+  int		fd;			/* Input file descriptor */
+  unsigned char	magic[2];		/* First bytes of the file */
+  ssize_t	bytes;			/* Bytes read */
+
+
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return (1);
+
+  bytes = read(fd, magic, sizeof(magic));
+  close(fd);
+
+  return (bytes == 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+}
+
+
 /*
  * 'compare_pids()' - Compare two filter PIDs...
  */
@@ -620,15 +664,22 @@ exec_filters(cups_array_t  *filters,	/* I - Array of filters to run */
   char		program[1024];		/* Program to run */
   char		*filter,		/* Current filter */
 		*next;			/* Next filter */
-  int		current,		/* Current filter */
-		filterfds[2][2],	/* Pipes for filters */
+  int		infd,			/* Input of current filter */
+		outfds[2],		/* Output pipe of current filter */
 		pid,			/* Process ID of filter */
 		status,			/* Exit status */
 		retval;			/* Return value */
   cups_array_t	*pids;			/* Executed filters array */
   filter_pid_t	*pid_entry,		/* Entry in executed filters array */
 		key;			/* Search key for filters */
+  filter_link_t	*links;			/* Links between the filters */
+  struct rusage	usage;			/* Resource usage of filter */
+  struct timeval end;			/* Time the filter exited */
   const char	*cups_serverbin;	/* CUPS_SERVERBIN environment variable */
+#ifdef HAVE_SPLICE
+  int		linkfds[2];		/* Input pipe of next filter */
+  int		num_links = 0;		/* Number of links */
+#endif /* HAVE_SPLICE */
 
  /*
   * Remove NULL ("-") filters...
@@ -647,16 +698,14 @@ exec_filters(cups_array_t  *filters,	/* I - Array of filters to run */
   * Execute all of the filters...
   */
 
-  pids            = cupsArrayNew((cups_array_func_t)compare_pids, NULL);
-  current         = 0;
-  filterfds[0][0] = 0;
-  filterfds[0][1] = -1;
-  filterfds[1][0] = -1;
-  filterfds[1][1] = -1;
+  pids      = cupsArrayNew((cups_array_func_t)compare_pids, NULL);
+  links     = calloc(cupsArrayCount(filters) + 1, sizeof(filter_link_t));
+  infd      = 0;
+  retval    = 0;
 
   for (filter = (char *)cupsArrayFirst(filters);
        filter;
-       filter = next, current = 1 - current)
+       filter = next)
   {
     next = (char *)cupsArrayNext(filters);
 
@@ -673,63 +722,84 @@ exec_filters(cups_array_t  *filters,	/* I - Array of filters to run */
 	       filter);
     }
 
-    if (filterfds[!current][1] > 1)
+    if (!next)
+      outfds[0] = outfds[1] = -1;
+    else if (open_pipe(outfds))
     {
-      close(filterfds[1 - current][0]);
-      close(filterfds[1 - current][1]);
-
-      filterfds[1 - current][0] = -1;
-      filterfds[1 - current][0] = -1;
+      fprintf(stderr, "ERROR: Unable to create pipe for %s: %s\n", filter,
+              strerror(errno));
+      retval = 1;
+      break;
     }
 
-    if (next)
-      open_pipe(filterfds[1 - current]);
-    else
-      filterfds[1 - current][1] = 1;
+    pid = exec_filter(program, argv, infd, next ? outfds[1] : 1);
+
+    if (infd > 0)
+      close(infd);
+    if (outfds[1] >= 0)
+      close(outfds[1]);
 
-    pid = exec_filter(program, argv,
-                      filterfds[current][0], filterfds[1 - current][1]);
+    infd = -1;
 
     if (pid > 0)
     {
       fprintf(stderr, "INFO: %s (PID %d) started.\n", filter, pid);
 
-      pid_entry = malloc(sizeof(filter_pid_t));
+      pid_entry = calloc(1, sizeof(filter_pid_t));
       pid_entry->pid = pid;
       pid_entry->name = filter;
+      gettimeofday(&pid_entry->start, NULL);
       cupsArrayAdd(pids, pid_entry);
     }
     else
+    {
+      if (outfds[0] >= 0)
+        close(outfds[0]);
+      retval = 1;
       break;
+    }
 
+    infd    = outfds[0];
     argv[6] = NULL;
+
+#ifdef HAVE_SPLICE
+   /*
+    * Pass the data on to the next filter ourselves, so that we can tell
+    * how much each filter produced...
+    */
+
+    if (next && !open_pipe(linkfds))
+    {
+      links[num_links].name  = filter;
+      links[num_links].infd  = infd;
+      links[num_links].outfd = linkfds[1];
+      pid_entry->link        = links + num_links;
+      num_links ++;
+
+      infd = linkfds[0];
+    }
+#endif /* HAVE_SPLICE */
   }
 
+  if (infd > 0)
+    close(infd);
+
  /*
-  * Close remaining pipes...
+  * Move the data between the filters until they are done...
   */
 
-  if (filterfds[0][1] > 1)
-  {
-    close(filterfds[0][0]);
-    close(filterfds[0][1]);
-  }
-
-  if (filterfds[1][1] > 1)
-  {
-    close(filterfds[1][0]);
-    close(filterfds[1][1]);
-  }
+#ifdef HAVE_SPLICE
+  if (num_links > 0)
+    relay_data(links, num_links, pids);
+#endif /* HAVE_SPLICE */
 
  /*
   * Wait for the children to exit...
   */
 
-  retval = 0;
-
   while (cupsArrayCount(pids) > 0)
   {
-    if ((pid = wait(&status)) < 0)
+    if ((pid = wait4(-1, &status, 0, &usage)) < 0)
     {
       if (errno == EINTR && job_canceled)
       {
@@ -740,8 +810,9 @@ exec_filters(cups_array_t  *filters,	/* I - Array of filters to run */
 	  kill(pid_entry->pid, SIGTERM);
 	job_canceled = 0;
       }
-      else
-	continue;
+      else if (errno == ECHILD)
+        break;
+      continue;
     }
 
     key.pid = pid;
@@ -749,6 +820,26 @@ exec_filters(cups_array_t  *filters,	/* I - Array of filters to run */
     {
       cupsArrayRemove(pids, pid_entry);
 
+      gettimeofday(&end, NULL);
+
+      if (pid_entry->link)
+        fprintf(stderr,
+	        "DEBUG: %s (PID %d) ran %.3fs (%.3fs user, %.3fs system), "
+		"%lld bytes output\n", pid_entry->name, pid,
+		end.tv_sec - pid_entry->start.tv_sec +
+		0.000001 * (end.tv_usec - pid_entry->start.tv_usec),
+		usage.ru_utime.tv_sec + 0.000001 * usage.ru_utime.tv_usec,
+		usage.ru_stime.tv_sec + 0.000001 * usage.ru_stime.tv_usec,
+		pid_entry->link->bytes);
+      else
+        fprintf(stderr,
+	        "DEBUG: %s (PID %d) ran %.3fs (%.3fs user, %.3fs system)\n",
+		pid_entry->name, pid,
+		end.tv_sec - pid_entry->start.tv_sec +
+		0.000001 * (end.tv_usec - pid_entry->start.tv_usec),
+		usage.ru_utime.tv_sec + 0.000001 * usage.ru_utime.tv_usec,
+		usage.ru_stime.tv_sec + 0.000001 * usage.ru_stime.tv_usec);
+
       if (status)
       {
 	if (WIFEXITED(status))
@@ -769,6 +860,7 @@ exec_filters(cups_array_t  *filters,	/* I - Array of filters to run */
   }
 
   cupsArrayDelete(pids);
+  free(links);
 
   return (retval);
 }
@@ -819,6 +911,15 @@ open_pipe(int *fds)			/* O - Pipe file descriptors (2) */
     return (-1);
   }
 
+#ifdef F_SETPIPE_SZ
+ /*
+  * Use a larger pipe buffer so that the filters do not have to take turns
+  * for every 64k of data; this is only a hint, so ignore errors...
+  */
+
+  fcntl(fds[1], F_SETPIPE_SZ, FILTER_PIPE_SIZE);
+#endif /* F_SETPIPE_SZ */
+
  /*
   * Return 0 indicating success...
   */
@@ -827,6 +928,128 @@ open_pipe(int *fds)			/* O - Pipe file descriptors (2) */
 }
 
 
+#ifdef HAVE_SPLICE
+/*
+ * 'relay_data()' - Pass the data between the filters and count it.
+ *
+ * The data is moved from pipe to pipe with splice(), so it is not copied.
+ * Each link waits either for data from the filter before it or for room
+ * in the pipe of the filter after it, depending on why the last splice()
+ * call came short.
+ */
+
+static void
+relay_data(filter_link_t *links,	/* I - Links between the filters */
+	   int           num_links,	/* I - Number of links */
+	   cups_array_t  *pids)		/* I - Running filters */
+{
+  int		i, j;			/* Looping vars */
+  struct pollfd	*pfds;			/* Poll entries */
+  ssize_t	bytes;			/* Bytes moved */
+  filter_link_t	*link;			/* Current link */
+  filter_pid_t	*pid_entry;		/* Current filter */
+
+
+  if ((pfds = calloc(num_links, sizeof(struct pollfd))) == NULL)
+    return;
+
+  for (;;)
+  {
+    for (i = 0, j = 0, link = links; i < num_links; i ++, link ++)
+    {
+      if (link->infd < 0)
+        continue;
+
+      pfds[j].fd     = link->want_out ? link->outfd : link->infd;
+      pfds[j].events = link->want_out ? POLLOUT : POLLIN;
+      j ++;
+    }
+
+    if (j == 0)
+      break;
+
+    if (poll(pfds, j, -1) < 0)
+    {
+      if (errno == EINTR && job_canceled)
+      {
+	fprintf(stderr, "DEBUG: Job canceled, killing filters ...\n");
+	for (pid_entry = (filter_pid_t *)cupsArrayFirst(pids);
+	     pid_entry;
+	     pid_entry = (filter_pid_t *)cupsArrayNext(pids))
+	  kill(pid_entry->pid, SIGTERM);
+	job_canceled = 0;
+      }
+      else if (errno != EINTR && errno != EAGAIN)
+        break;
+
+      continue;
+    }
+
+    for (i = 0, j = 0, link = links; i < num_links; i ++, link ++)
+    {
+      if (link->infd < 0)
+        continue;
+
+      if (!pfds[j ++].revents)
+        continue;
+
+      bytes = splice(link->infd, NULL, link->outfd, NULL, FILTER_PIPE_SIZE,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+      if (bytes > 0)
+      {
+        link->bytes    += bytes;
+	link->want_out = 0;
+	continue;
+      }
+      else if (bytes < 0 && errno == EAGAIN)
+      {
+       /*
+        * Whichever side we were not waiting for is the one that is not
+	* ready...
+	*/
+
+        link->want_out = !link->want_out;
+	continue;
+      }
+      else if (bytes < 0 && errno == EINTR)
+        continue;
+
+     /*
+      * End of data or the next filter went away...
+      */
+
+      if (bytes < 0)
+        fprintf(stderr, "DEBUG: Unable to pass data from %s on: %s\n",
+	        link->name, strerror(errno));
+
+      close(link->infd);
+      close(link->outfd);
+
+      link->infd  = -1;
+      link->outfd = -1;
+    }
+  }
+
+ /*
+  * Don't leave a filter blocked on a link we gave up on...
+  */
+
+  for (i = 0, link = links; i < num_links; i ++, link ++)
+    if (link->infd >= 0)
+    {
+      close(link->infd);
+      close(link->outfd);
+
+      link->infd  = -1;
+      link->outfd = -1;
+    }
+
+  free(pfds);
+}
+#endif /* HAVE_SPLICE */
+
+
 /*
  * Get option value in a string of options
  */
@@ -11,9 +11,15 @@
  *
  * Contents:
  *
+ *   ClearPage()        - Clear all lines of the page.
  *   TextMain()         - Standard main entry for text filters.
  *   compare_keywords() - Compare two C/C++ keywords.
+ *   fill_input()       - Refill the input buffer and get the next byte.
  *   getutf8()          - Get a UTF-8 encoded wide character...
+ *   next_line()        - Advance to the next line, column or page.
+ *   page_span()        - Get a run of cells on a line of the page.
+ *   put_text()         - Put a run of plain ASCII text on the page.
+ *   text_run()         - Count plain ASCII text bytes.
  */
 
 /*
@@ -22,6 +28,16 @@
 
 #include "textcommon.h"
 #include <limits.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif /* __SSE2__ */
+
+
+/*
+ * Constants...
+ */
+
+#define INPUT_SIZE	65536		/* Size of input buffer */
 
 
 /*
@@ -36,7 +52,7 @@ int	WrapLines = 1,		/* Wrap text in lines */
 	ColumnWidth = 80,	/* Width of each column */
 	PrettyPrint = 0,	/* Do pretty code formatting */
 	Copies = 1;		/* Number of copies */
-lchar_t	**Page = NULL;		/* Page characters */
+lline_t	*Page = NULL;		/* Page lines */
 int	NumPages = 0;		/* Number of pages in document */
 float	CharsPerInch = 10;	/* Number of character columns per inch */
 float	LinesPerInch = 6;	/* Number of lines per inch */
@@ -461,12 +477,50 @@ static char *code_keywords[] =	/* List of known C/C++ keywords... */
 	};
 
 
+static unsigned char Input[INPUT_SIZE],
+				/* Input buffer */
+		*InputPtr = Input,
+				/* Next byte in input buffer */
+		*InputEnd = Input;
+				/* End of input buffer */
+
+
 /*
  * Local functions...
  */
 
 static int	compare_keywords(const void *, const void *);
+static int	fill_input(FILE *fp);
 static int	getutf8(FILE *fp);
+static void	next_line(int *line, int *page_column);
+static lchar_t	*page_span(int line, int column, int length);
+static void	put_text(const unsigned char *text, int length, int *line,
+		         int *column, int *page_column, int attr);
+static int	text_run(const unsigned char *bytes, int length);
+
+
+/*
+ * Macro to get the next byte from the input buffer...
+ */
+
+#define getbyte(fp) (InputPtr < InputEnd ? *InputPtr++ : fill_input(fp))
+
+
+/*
+ * 'ClearPage()' - Clear all lines of the page.
+ *
+ * The spans keep their memory for the next page.
+ */
+
+void
+ClearPage(void)
+{
+  int	line;				/* Current line */
+
+
+  for (line = 0; line < SizeLines; line ++)
+    Page[line].num_spans = 0;
+}
 
 
 /*
@@ -480,7 +534,7 @@ TextMain(const char *name,	/* I - Name of filter */
 {
   FILE		*fp;		/* Print file */
   ppd_file_t	*ppd;		/* PPD file */
-  int		i,		/* Looping var */
+  int		i, j,		/* Looping vars */
 		empty,		/* Is the input empty? */
 		ch,		/* Current char from file */
 		lastch,		/* Previous char from file */
@@ -488,6 +542,8 @@ TextMain(const char *name,	/* I - Name of filter */
 		line,		/* Current line */
   		column,		/* Current column */
   		page_column;	/* Current page column */
+  int		count;		/* Bytes of plain text */
+  lchar_t	*cell;		/* Current cell */
   int		num_options;	/* Number of print options */
   cups_option_t	*options;	/* Print options */
   const char	*val;		/* Option value */
@@ -658,30 +714,24 @@ TextMain(const char *name,	/* I - Name of filter */
   if (SizeLines < 1)
     SizeLines = 1;
 
-  if (SizeLines >= INT_MAX / SizeColumns / sizeof(lchar_t))
+  if (SizeLines >= INT_MAX / sizeof(lline_t))
   {
     fprintf(stderr, "ERROR: bad page size\n");
     exit(1);
   }
 
-  Page    = calloc(sizeof(lchar_t *), SizeLines);
-  if (!Page)
-  {
-    fprintf(stderr, "ERROR: cannot allocate memory for page\n");
-    exit(1);
-  }
+ /*
+  * Lines start out without any spans, they only get memory for the text
+  * actually put on them...
+  */
 
-  Page[0] = calloc(sizeof(lchar_t), SizeColumns * SizeLines);
-  if (!Page[0])
+  Page = calloc(sizeof(lline_t), SizeLines);
+  if (!Page)
   {
-    free(Page);
     fprintf(stderr, "ERROR: cannot allocate memory for page\n");
     exit(1);
   }
 
-  for (i = 1; i < SizeLines; i ++)
-    Page[i] = Page[0] + i * SizeColumns;
-
   Copies = atoi(argv[4]);
 
  /*
@@ -699,8 +749,26 @@ TextMain(const char *name,	/* I - Name of filter */
   cmntState     = NoCmnt;
   strState      = NoStr;
 
-  while ((ch = getutf8(fp)) >= 0)
+  for (;;)
   {
+   /*
+    * Without pretty printing, runs of plain ASCII text need none of the
+    * per-character state below, so put them on the page in one go...
+    */
+
+    if (!empty && !PrettyPrint &&
+        (count = text_run(InputPtr, InputEnd - InputPtr)) > 0)
+    {
+      put_text(InputPtr, count, &line, &column, &page_column, attr);
+
+      InputPtr += count;
+      lastch   = InputPtr[-1];
+      continue;
+    }
+
+    if ((ch = getutf8(fp)) < 0)
+      break;
+
     if (empty)
     {
       /* Found the first valid character, write file header */
@@ -750,7 +818,8 @@ TextMain(const char *name,	/* I - Name of filter */
 
 	      while (keycol < column)
 	      {
-	        Page[line][keycol + i].attr |= ATTR_BOLD;
+	        if ((cell = page_span(line, keycol + i, 1)) != NULL)
+		  cell->attr |= ATTR_BOLD;
 		keycol ++;
 	      }
 	    }
@@ -798,8 +867,11 @@ TextMain(const char *name,	/* I - Name of filter */
 
           {
 	    int nextch;
-            if ((nextch = getc(fp)) != 0x0a)
-	      ungetc(nextch, fp);
+            if ((nextch = getbyte(fp)) != 0x0a)
+	    {
+	      if (nextch != EOF)
+	        InputPtr --;
+	    }
 	    else
 	      ch = nextch;
 	  }
@@ -822,7 +894,8 @@ TextMain(const char *name,	/* I - Name of filter */
 
 	      while (keycol < column)
 	      {
-	        Page[line][keycol + i].attr |= ATTR_BOLD;
+	        if ((cell = page_span(line, keycol + i, 1)) != NULL)
+		  cell->attr |= ATTR_BOLD;
 		keycol ++;
 	      }
 	    }
@@ -882,7 +955,8 @@ TextMain(const char *name,	/* I - Name of filter */
 
 	      while (keycol < column)
 	      {
-	        Page[line][keycol + i].attr |= ATTR_BOLD;
+	        if ((cell = page_span(line, keycol + i, 1)) != NULL)
+		  cell->attr |= ATTR_BOLD;
 		keycol ++;
 	      }
 	    }
@@ -990,7 +1064,8 @@ TextMain(const char *name,	/* I - Name of filter */
 
 		while (keycol < column)
 		{
-	          Page[line][keycol + i].attr |= ATTR_BOLD;
+	          if ((cell = page_span(line, keycol + i, 1)) != NULL)
+		    cell->attr |= ATTR_BOLD;
 		  keycol ++;
 		}
 	      }
@@ -1087,28 +1162,30 @@ TextMain(const char *name,	/* I - Name of filter */
 
           if (column < ColumnWidth)
 	  {
-	    i = column + page_column * (ColumnWidth + ColumnGutter);
+	    cell = page_span(line,
+	                     column + page_column * (ColumnWidth + ColumnGutter),
+			     1);
 
             if (PrettyPrint)
-              Page[line][i].attr = attr;
-
-	    if (ch == ' ' && Page[line][i].ch)
-	      ch = Page[line][i].ch;
-            else if (ch == Page[line][i].ch)
-              Page[line][i].attr |= ATTR_BOLD;
-            else if (Page[line][i].ch == '_')
-              Page[line][i].attr |= ATTR_UNDERLINE;
+              cell->attr = attr;
+
+	    if (ch == ' ' && cell->ch)
+	      ch = cell->ch;
+            else if (ch == cell->ch)
+              cell->attr |= ATTR_BOLD;
+            else if (cell->ch == '_')
+              cell->attr |= ATTR_UNDERLINE;
             else if (ch == '_')
 	    {
-              Page[line][i].attr |= ATTR_UNDERLINE;
+              cell->attr |= ATTR_UNDERLINE;
 
-              if (Page[line][i].ch)
-	        ch = Page[line][i].ch;
+              if (cell->ch)
+	        ch = cell->ch;
 	    }
 	    else
-              Page[line][i].attr = attr;
+              cell->attr = attr;
 
-            Page[line][i].ch = ch;
+            cell->ch = ch;
 	  }
 
           if (PrettyPrint)
@@ -1120,7 +1197,8 @@ TextMain(const char *name,	/* I - Name of filter */
 	      * Highlight curley braces...
 	      */
 
-	      Page[line][column].attr |= ATTR_BOLD;
+	      if ((cell = page_span(line, column, 1)) != NULL)
+	        cell->attr |= ATTR_BOLD;
 	    }
 	    else if ((ch == '/' || ch == '*') && lastch == '/' &&
 	             column < ColumnWidth && PrettyPrint != PRETTY_SHELL)
@@ -1129,7 +1207,8 @@ TextMain(const char *name,	/* I - Name of filter */
 	      * Highlight first comment character...
 	      */
 
-	      Page[line][column - 1].attr = attr;
+	      if ((cell = page_span(line, column - 1, 1)) != NULL)
+	        cell->attr = attr;
 	    }
 	    else if (ch == '\"' && lastch != '\\' && !cmntState && strState == StrEnd)
 	    {
@@ -1193,7 +1272,14 @@ TextMain(const char *name,	/* I - Name of filter */
   if (ppd != NULL)
     ppdClose(ppd);
 
-  free(Page[0]);
+  for (i = 0; i < SizeLines; i ++)
+  {
+    for (j = 0; j < Page[i].alloc_spans; j ++)
+      free(Page[i].spans[j].chars);
+
+    free(Page[i].spans);
+  }
+
   free(Page);
   return (0);
 }
@@ -1211,6 +1297,26 @@ compare_keywords(const void *k1,	/* I - First keyword */
 }
 
 
+/*
+ * 'fill_input()' - Refill the input buffer and get the next byte.
+ */
+
+static int		/* O - Next byte or EOF */
+fill_input(FILE *fp)	/* I - File to read from */
+{
+  size_t	bytes;	/* Bytes read */
+
+
+  if ((bytes = fread(Input, 1, sizeof(Input), fp)) == 0)
+    return (EOF);
+
+  InputPtr = Input;
+  InputEnd = Input + bytes;
+
+  return (*InputPtr++);
+}
+
+
 /*
  * 'getutf8()' - Get a UTF-8 encoded wide character...
  */
@@ -1243,7 +1349,7 @@ getutf8(FILE *fp)	/* I - File to read from */
   * 16-bit characters...
   */
 
-  if ((ch = getc(fp)) == EOF)
+  if ((ch = getbyte(fp)) == EOF)
     return (EOF);
 
   if (ch < 0xc0)			/* One byte character? */
@@ -1254,7 +1360,7 @@ getutf8(FILE *fp)	/* I - File to read from */
     * Two byte character...
     */
 
-    if ((next = getc(fp)) == EOF)
+    if ((next = getbyte(fp)) == EOF)
       return (EOF);
     else
       return (((ch & 0x1f) << 6) | (next & 0x3f));
@@ -1265,12 +1371,12 @@ getutf8(FILE *fp)	/* I - File to read from */
     * Three byte character...
     */
 
-    if ((next = getc(fp)) == EOF)
+    if ((next = getbyte(fp)) == EOF)
       return (EOF);
 
     ch = ((ch & 0x0f) << 6) | (next & 0x3f);
 
-    if ((next = getc(fp)) == EOF)
+    if ((next = getbyte(fp)) == EOF)
       return (EOF);
     else
       return ((ch << 6) | (next & 0x3f));
@@ -1285,3 +1391,338 @@ getutf8(FILE *fp)	/* I - File to read from */
   }
 }
 
+
+
+/*
+ * 'next_line()' - Advance to the next line, column or page.
+ */
+
+static void
+next_line(int *line,		/* IO - Current line */
+          int *page_column)	/* IO - Current page column */
+{
+  (*line) ++;
+
+  if (*line >= SizeLines)
+  {
+    (*page_column) ++;
+    *line = 0;
+
+    if (*page_column >= PageColumns)
+    {
+      WritePage();
+      *page_column = 0;
+    }
+  }
+}
+
+
+/*
+ * 'page_span()' - Get a run of cells on a line of the page.
+ *
+ * Spans touching the run are joined with it into one, cells which were
+ * not used before are blank.  Returns NULL if the run doesn't fit on the
+ * line.
+ */
+
+static lchar_t *			/* O - First cell or NULL */
+page_span(int line,			/* I - Line */
+          int column,			/* I - First column */
+	  int length)			/* I - Number of cells */
+{
+  lline_t	*l;			/* Line */
+  lspan_t	*span,			/* Span holding the run */
+		temp;			/* Span being moved */
+  int		lo, hi,			/* Spans touching the run */
+		start, end,		/* Columns of joined span */
+		alloc;			/* Allocated characters */
+  lchar_t	*chars;			/* New characters */
+
+
+  if (line < 0 || line >= SizeLines || column < 0 || length < 1 ||
+      column + length > SizeColumns)
+    return (NULL);
+
+  l = Page + line;
+
+ /*
+  * Most text is added to the end of the last span...
+  */
+
+  if (l->num_spans > 0)
+  {
+    span = l->spans + l->num_spans - 1;
+
+    if (column >= span->column && column + length <= span->column + span->alloc)
+    {
+      if (column + length > span->column + span->length)
+      {
+        memset(span->chars + span->length, 0,
+	       (column + length - span->column - span->length) *
+	           sizeof(lchar_t));
+        span->length = column + length - span->column;
+      }
+
+      return (span->chars + column - span->column);
+    }
+  }
+
+ /*
+  * Find the spans touching the run...
+  */
+
+  for (lo = 0;
+       lo < l->num_spans &&
+           l->spans[lo].column + l->spans[lo].length < column;
+       lo ++);
+
+  for (hi = lo;
+       hi < l->num_spans && l->spans[hi].column <= column + length;
+       hi ++);
+
+  if (lo == hi)
+  {
+   /*
+    * Insert a new span, reusing the memory of an unused one...
+    */
+
+    if (l->num_spans >= l->alloc_spans)
+    {
+      if ((span = realloc(l->spans, (l->alloc_spans + 8) *
+                                    sizeof(lspan_t))) == NULL)
+      {
+	fprintf(stderr, "ERROR: cannot allocate memory for page\n");
+	exit(1);
+      }
+
+      memset(span + l->alloc_spans, 0, 8 * sizeof(lspan_t));
+
+      l->spans       = span;
+      l->alloc_spans += 8;
+    }
+
+    temp = l->spans[l->num_spans];
+    memmove(l->spans + lo + 1, l->spans + lo,
+            (l->num_spans - lo) * sizeof(lspan_t));
+
+    span         = l->spans + lo;
+    *span        = temp;
+    span->column = column;
+    span->length = 0;
+
+    l->num_spans ++;
+
+    start = column;
+    end   = column + length;
+  }
+  else
+  {
+    span  = l->spans + lo;
+    start = span->column < column ? span->column : column;
+    end   = l->spans[hi - 1].column + l->spans[hi - 1].length;
+
+    if (end < column + length)
+      end = column + length;
+  }
+
+ /*
+  * Make room for the joined span...
+  */
+
+  if (end - start > span->alloc)
+  {
+    for (alloc = span->alloc ? span->alloc : 16; alloc < end - start;
+         alloc *= 2);
+
+    if (alloc > SizeColumns)
+      alloc = SizeColumns;
+
+    if ((chars = realloc(span->chars, alloc * sizeof(lchar_t))) == NULL)
+    {
+      fprintf(stderr, "ERROR: cannot allocate memory for page\n");
+      exit(1);
+    }
+
+    span->chars = chars;
+    span->alloc = alloc;
+  }
+
+  if (start < span->column)
+  {
+    memmove(span->chars + span->column - start, span->chars,
+            span->length * sizeof(lchar_t));
+    memset(span->chars, 0, (span->column - start) * sizeof(lchar_t));
+
+    span->length += span->column - start;
+    span->column = start;
+  }
+
+  memset(span->chars + span->length, 0,
+         (end - start - span->length) * sizeof(lchar_t));
+  span->length = end - start;
+
+ /*
+  * Copy the other spans into it, and move them after the used ones...
+  */
+
+  for (hi --; hi > lo; hi --)
+  {
+    temp = l->spans[lo + 1];
+
+    memcpy(span->chars + temp.column - start, temp.chars,
+           temp.length * sizeof(lchar_t));
+    memmove(l->spans + lo + 1, l->spans + lo + 2,
+            (l->num_spans - lo - 2) * sizeof(lspan_t));
+
+    l->num_spans --;
+    l->spans[l->num_spans] = temp;
+  }
+
+  return (span->chars + column - start);
+}
+
+
+/*
+ * 'put_text()' - Put a run of plain ASCII text on the page.
+ *
+ * The text holds only tabs and printable characters, as counted by
+ * text_run().  Characters are placed the same way as in TextMain() without
+ * pretty printing, one line span at a time.
+ */
+
+static void
+put_text(const unsigned char *text,	/* I  - Text */
+         int                 length,	/* I  - Number of bytes */
+	 int                 *line,	/* IO - Current line */
+	 int                 *column,	/* IO - Current column */
+	 int                 *page_column,
+					/* IO - Current page column */
+	 int                 attr)	/* I  - Current attribute */
+{
+  const unsigned char	*end;		/* End of text */
+  lchar_t		*cell;		/* Current cell */
+  int			ch,		/* Current character */
+			count;		/* Characters on this line */
+
+
+  for (end = text + length; text < end;)
+  {
+    if (*text == 0x09)
+    {
+     /*
+      * Tab to next 8th column...
+      */
+
+      text ++;
+      *column = (*column + 8) & ~7;
+
+      if (*column >= ColumnWidth && WrapLines)
+      {
+        next_line(line, page_column);
+	*column = 0;
+      }
+      continue;
+    }
+
+    if (*column >= ColumnWidth && WrapLines)
+    {
+      next_line(line, page_column);
+      *column = 0;
+    }
+
+   /*
+    * Find the span of characters up to the next tab...
+    */
+
+    for (count = 0; text + count < end && text[count] != 0x09; count ++);
+
+    if (*column >= ColumnWidth)
+    {
+     /*
+      * Past the right margin without wrapping, drop the span...
+      */
+
+      text    += count;
+      *column += count;
+      continue;
+    }
+
+    if (count > ColumnWidth - *column)
+      count = ColumnWidth - *column;
+
+    cell    = page_span(*line,
+                        *column + *page_column * (ColumnWidth + ColumnGutter),
+			count);
+    *column += count;
+
+    for (; count > 0; count --, cell ++)
+    {
+      ch = *text++;
+
+      if (!cell->ch && ch != '_')
+      {
+        cell->ch   = ch;
+	cell->attr = attr;
+      }
+      else if (ch == ' ')
+        continue;
+      else if (ch == cell->ch)
+        cell->attr |= ATTR_BOLD;
+      else if (cell->ch == '_')
+      {
+        cell->attr |= ATTR_UNDERLINE;
+	cell->ch   = ch;
+      }
+      else if (ch == '_')
+      {
+        cell->attr |= ATTR_UNDERLINE;
+
+	if (!cell->ch)
+	  cell->ch = ch;
+      }
+      else
+      {
+        cell->ch   = ch;
+	cell->attr = attr;
+      }
+    }
+  }
+}
+
+
+/*
+ * 'text_run()' - Count plain ASCII text bytes.
+ *
+ * Plain text is tabs and everything from space up to DEL, which TextMain()
+ * puts on the page as-is.  Anything else needs the per-character path.
+ */
+
+static int				/* O - Number of bytes */
+text_run(const unsigned char *bytes,	/* I - Bytes to check */
+         int                 length)	/* I - Number of bytes */
+{
+  int		count = 0;		/* Count of bytes */
+#ifdef __SSE2__
+  __m128i	chunk;			/* 16 bytes of text */
+  unsigned	mask;			/* Bytes which aren't plain text */
+
+
+  for (; count + 16 <= length; count += 16)
+  {
+    chunk = _mm_loadu_si128((const __m128i *)(bytes + count));
+    mask  = ~_mm_movemask_epi8(
+                 _mm_or_si128(
+		     _mm_cmpgt_epi8(chunk, _mm_set1_epi8(0x1f)),
+		     _mm_cmpeq_epi8(chunk, _mm_set1_epi8(0x09)))) & 0xffff;
+
+    if (mask)
+      return (count + __builtin_ctz(mask));
+  }
+#endif /* __SSE2__ */
+
+  while (count < length &&
+         ((bytes[count] >= ' ' && bytes[count] < 0x80) || bytes[count] == 0x09))
+    count ++;
+
+  return (count);
+}
@@ -61,6 +61,21 @@ typedef struct			/**** Character/attribute structure... ****/
 		attr;		/* Any attributes */
 } lchar_t;
 
+typedef struct			/**** Run of characters on a line... ****/
+{
+  int		column,		/* First column */
+		length,		/* Number of characters */
+		alloc;		/* Allocated characters */
+  lchar_t	*chars;		/* Characters */
+} lspan_t;
+
+typedef struct			/**** Line of a page... ****/
+{
+  int		num_spans,	/* Number of spans */
+		alloc_spans;	/* Allocated spans */
+  lspan_t	*spans;		/* Spans, sorted by column */
+} lline_t;
+
 
 /*
  * Globals...
@@ -74,7 +89,7 @@ extern int	WrapLines,	/* Wrap text in lines */
 		ColumnWidth,	/* Width of each column */
 		PrettyPrint,	/* Do pretty code formatting? */
 		Copies;		/* Number of copies to produce */
-extern lchar_t	**Page;		/* Page characters */
+extern lline_t	*Page;		/* Page lines */
 extern int	NumPages;	/* Number of pages in document */
 extern float	CharsPerInch,	/* Number of character columns per inch */
 		LinesPerInch;	/* Number of lines per inch */
@@ -83,6 +98,13 @@ extern int	UTF8,		/* Use UTF-8 encoding? */
 extern char	**Keywords;	/* List of known keywords... */
 
 
+/*
+ * Functions...
+ */
+
+extern void	ClearPage(void);
+
+
 /*
  * Required functions...
  */
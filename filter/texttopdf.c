@@ -12,6 +12,8 @@
  *
  * Contents:
  *
+ *   font_load()     - Find a font with fontconfig and load it.
+ *   fontcache_*()   - Persistent cache of fontconfig font resolutions.
  *   main()          - Main entry for text to PDF filter.
  *   WriteEpilogue() - Write the PDF file epilogue.
  *   WritePage()     - Write a page of text.
@@ -30,6 +32,10 @@
 #include <assert.h>
 #include "fontembed/sfnt.h"
 #include <fontconfig/fontconfig.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /*
  * Globals...
@@ -41,6 +47,284 @@ int     UTF8 = 1;               /* Use UTF-8 encoding? */
 
 EMB_PARAMS *font_load(const char *font, int fontwidth);
 
+/*
+ * Font resolution cache...
+ *
+ * Initializing fontconfig and sorting the whole font set is the most
+ * expensive part of the startup of this filter, so the result of the
+ * search for each (font pattern, width) is kept in
+ * $CUPS_CACHEDIR/texttopdf-fonts.cache.  The file is a header followed by
+ * fixed-size entries, so it can be used directly through mmap().  It is
+ * invalid as soon as one of the fontconfig cache directories changed, an
+ * entry is ignored when its font file changed.
+ */
+
+#define FONTCACHE_MAGIC		"CFTFC001"
+#define FONTCACHE_MAX_DIRS	8
+
+typedef struct
+{
+  char		path[512];		/* fontconfig cache directory */
+  long long	mtime;			/* Its modification time, -1 if missing */
+} fontcache_dir_t;
+
+typedef struct
+{
+  char		magic[8];		/* FONTCACHE_MAGIC */
+  int		num_dirs,		/* Number of cache directories */
+		num_fonts;		/* Number of font entries */
+  fontcache_dir_t dirs[FONTCACHE_MAX_DIRS];
+} fontcache_header_t;
+
+typedef struct
+{
+  char		pattern[256];		/* Font pattern from the charset file */
+  int		fontwidth;		/* 1 = single, 2 = double width */
+  char		fontname[1024];		/* Font name for otf_load() */
+  char		file[1024];		/* Font file */
+  long long	mtime,			/* Modification time of the font file */
+		size;			/* Size of the font file */
+} fontcache_entry_t;
+
+
+/*
+ * 'fontcache_filename()' - Get the name of the cache file.
+ */
+
+static int				/* O - 1 on success, 0 if no cache */
+fontcache_filename(char   *filename,	/* I - Buffer */
+                   size_t len)		/* I - Size of buffer */
+{
+  const char *cachedir = getenv("CUPS_CACHEDIR");
+
+  if (!cachedir || !*cachedir)
+    return (0);
+
+  snprintf(filename, len, "%s/texttopdf-fonts.cache", cachedir);
+  return (1);
+}
+
+
+/*
+ * 'fontcache_mtime()' - Get the modification time of a file, -1 if missing.
+ */
+
+static long long
+fontcache_mtime(const char *path,	/* I - File or directory */
+                long long  *size)	/* O - Size or NULL */
+{
+  struct stat st;
+
+  if (stat(path, &st))
+    return (-1);
+
+  if (size)
+    *size = st.st_size;
+  return ((long long)st.st_mtime);
+}
+
+
+/*
+ * 'fontcache_map()' - Map the cache file, if it is still valid.
+ */
+
+static fontcache_header_t *		/* O - Mapped cache or NULL */
+fontcache_map(size_t *maplen)		/* O - Length of the mapping */
+{
+  char			filename[1024];
+  int			fd, i;
+  struct stat		st;
+  fontcache_header_t	*hdr;
+
+  if (!fontcache_filename(filename, sizeof(filename)) ||
+      (fd = open(filename, O_RDONLY)) < 0)
+    return (NULL);
+
+  if (fstat(fd, &st) || st.st_size < sizeof(fontcache_header_t))
+  {
+    close(fd);
+    return (NULL);
+  }
+
+  hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (hdr == MAP_FAILED)
+    return (NULL);
+
+  *maplen = st.st_size;
+
+  if (memcmp(hdr->magic, FONTCACHE_MAGIC, 8) ||
+      hdr->num_dirs < 0 || hdr->num_dirs > FONTCACHE_MAX_DIRS ||
+      hdr->num_fonts < 0 ||
+      *maplen < sizeof(fontcache_header_t) +
+                hdr->num_fonts * sizeof(fontcache_entry_t))
+  {
+    munmap(hdr, *maplen);
+    return (NULL);
+  }
+
+  for (i = 0; i < hdr->num_dirs; i ++)
+    if (memchr(hdr->dirs[i].path, 0, sizeof(hdr->dirs[i].path)) == NULL ||
+        fontcache_mtime(hdr->dirs[i].path, NULL) != hdr->dirs[i].mtime)
+    {
+      munmap(hdr, *maplen);
+      return (NULL);
+    }
+
+  return (hdr);
+}
+
+
+/*
+ * 'fontcache_lookup()' - Look up the font name for a pattern in the cache.
+ */
+
+static char *				/* O - Font name (to be freed) or NULL */
+fontcache_lookup(const char *font,	/* I - Font pattern */
+                 int        fontwidth)	/* I - Font width */
+{
+  fontcache_header_t	*hdr;
+  fontcache_entry_t	*entry;
+  size_t		maplen;
+  long long		size;
+  char			*fontname = NULL;
+  int			i;
+
+  if ((hdr = fontcache_map(&maplen)) == NULL)
+    return (NULL);
+
+  entry = (fontcache_entry_t *)(hdr + 1);
+  for (i = 0; i < hdr->num_fonts; i ++, entry ++)
+  {
+    if (entry->fontwidth != fontwidth ||
+        strncmp(entry->pattern, font, sizeof(entry->pattern)) ||
+        !memchr(entry->fontname, 0, sizeof(entry->fontname)) ||
+	!memchr(entry->file, 0, sizeof(entry->file)))
+      continue;
+
+    if (fontcache_mtime(entry->file, &size) == entry->mtime &&
+        size == entry->size)
+      fontname = strdup(entry->fontname);
+    break;
+  }
+
+  munmap(hdr, maplen);
+  return (fontname);
+}
+
+
+/*
+ * 'fontcache_store()' - Add a font resolution to the cache.
+ *
+ * fontconfig must be initialized.  The cache is rewritten to a temporary
+ * file which then replaces the old one, so readers always see a complete
+ * file.
+ */
+
+static void
+fontcache_store(const char    *font,	/* I - Font pattern */
+                int           fontwidth,/* I - Font width */
+                const char    *fontname,/* I - Font name for otf_load() */
+		const FcChar8 *file)	/* I - Font file */
+{
+  char			filename[1024],	/* Cache file */
+			tempname[1040];	/* Temporary file */
+  fontcache_header_t	header,		/* New header */
+			*old;		/* Old cache */
+  fontcache_entry_t	entry,		/* New entry */
+			*oldentry;	/* Entry of old cache */
+  size_t		maplen;
+  FcStrList		*dirs;
+  FcChar8		*dir;
+  FILE			*fp;
+  int			fd, i;
+
+  if (strlen(font) >= sizeof(entry.pattern) ||
+      strlen(fontname) >= sizeof(entry.fontname) ||
+      strlen((const char *)file) >= sizeof(entry.file) ||
+      !fontcache_filename(filename, sizeof(filename)))
+    return;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FONTCACHE_MAGIC, 8);
+  if ((dirs = FcConfigGetCacheDirs(NULL)) != NULL)
+  {
+    while ((dir = FcStrListNext(dirs)) != NULL &&
+           header.num_dirs < FONTCACHE_MAX_DIRS)
+    {
+      if (strlen((const char *)dir) >= sizeof(header.dirs[0].path))
+        continue;
+      strcpy(header.dirs[header.num_dirs].path, (const char *)dir);
+      header.dirs[header.num_dirs].mtime = fontcache_mtime((const char *)dir,
+                                                           NULL);
+      header.num_dirs ++;
+    }
+    FcStrListDone(dirs);
+  }
+
+  memset(&entry, 0, sizeof(entry));
+  strcpy(entry.pattern, font);
+  entry.fontwidth = fontwidth;
+  strcpy(entry.fontname, fontname);
+  strcpy(entry.file, (const char *)file);
+  if ((entry.mtime = fontcache_mtime(entry.file, &entry.size)) < 0)
+    return;
+
+  snprintf(tempname, sizeof(tempname), "%s.XXXXXX", filename);
+  if ((fd = mkstemp(tempname)) < 0)
+    return;
+  if ((fp = fdopen(fd, "w")) == NULL)
+  {
+    close(fd);
+    unlink(tempname);
+    return;
+  }
+
+ /*
+  * Keep the other entries of a still valid cache...
+  */
+
+  if ((old = fontcache_map(&maplen)) != NULL &&
+      (old->num_dirs != header.num_dirs ||
+       memcmp(old->dirs, header.dirs, sizeof(header.dirs))))
+  {
+    munmap(old, maplen);
+    old = NULL;
+  }
+
+  if (old)
+  {
+    for (i = 0, oldentry = (fontcache_entry_t *)(old + 1);
+         i < old->num_fonts; i ++, oldentry ++)
+      if (oldentry->fontwidth != fontwidth ||
+          strncmp(oldentry->pattern, font, sizeof(oldentry->pattern)))
+        header.num_fonts ++;
+  }
+
+  header.num_fonts ++;
+  fwrite(&header, sizeof(header), 1, fp);
+
+  if (old)
+  {
+    for (i = 0, oldentry = (fontcache_entry_t *)(old + 1);
+         i < old->num_fonts; i ++, oldentry ++)
+      if (oldentry->fontwidth != fontwidth ||
+          strncmp(oldentry->pattern, font, sizeof(oldentry->pattern)))
+        fwrite(oldentry, sizeof(fontcache_entry_t), 1, fp);
+    munmap(old, maplen);
+  }
+
+  fwrite(&entry, sizeof(entry), 1, fp);
+
+  if (fclose(fp) || rename(tempname, filename))
+    unlink(tempname);
+}
+
+
+/*
+ * 'font_load()' - Find a font with fontconfig and load it.
+ */
+
 EMB_PARAMS *font_load(const char *font, int fontwidth)
 {
   OTF_FILE *otf;
@@ -48,12 +332,15 @@ EMB_PARAMS *font_load(const char *font, int fontwidth)
   FcPattern *pattern;
   FcFontSet *candidates;
   FcChar8   *fontname = NULL;
+  FcChar8   *fontfile = NULL;
   FcResult   result;
   int i;
 
   if ( (font[0]=='/')||(font[0]=='.') ) {
     candidates = NULL;
     fontname=(FcChar8 *)strdup(font);
+  } else if ((fontname = (FcChar8 *)fontcache_lookup(font, fontwidth)) != NULL) {
+    candidates = NULL;
   } else {
     FcInit ();
     pattern = FcNameParse ((const FcChar8 *)font);
@@ -84,6 +371,9 @@ EMB_PARAMS *font_load(const char *font, int fontwidth)
 	  }
 	}
       }
+      if (fontname &&
+          FcPatternGetString (candidates->fonts[i], FC_FILE, 0, &fontfile) == FcResultMatch)
+        fontcache_store(font, fontwidth, (const char *)fontname, fontfile);
       FcFontSetDestroy (candidates);
     }
   }
@@ -141,7 +431,7 @@ lchar_t *Title,*Date;   /* The title and date strings */
  * Local functions...
  */
 
-static void	write_line(int row, lchar_t *line);
+static void	write_line(int row, lline_t *text);
 static void	write_string(int col, int row, int len, lchar_t *s);
 static lchar_t *make_wide(const char *buf);
 static void     write_font_str(float x,float y,int fontid, lchar_t *str, int len);
@@ -222,33 +512,20 @@ WritePage(void)
 {
   int	line;			/* Current line */
 
-  int content=pdfOut_add_xref(pdf);
-  pdfOut_printf(pdf,"%d 0 obj\n"
-                    "<</Length %d 0 R\n"
-                    ">>\n"
-                    "stream\n"
-                    "q\n"
-                    ,content,content+1);
-  long size=-(pdf->filepos-2);
+  // collect the page content in memory, to write it compressed
+  pdfOut_begin_stream(pdf);
+  pdfOut_printf(pdf,"q\n");
 
   NumPages ++;
   if (PrettyPrint)
     write_pretty_header(pdf);
 
   for (line = 0; line < SizeLines; line ++)
-    write_line(line, Page[line]);
+    write_line(line, Page + line);
 
-  size+=pdf->filepos+2;
-  pdfOut_printf(pdf,"Q\n"
-                    "endstream\n"
-                    "endobj\n");
-  
-  int len_obj=pdfOut_add_xref(pdf);
-  assert(len_obj==content+1);
-  pdfOut_printf(pdf,"%d 0 obj\n"
-                    "%ld\n"
-                    "endobj\n",
-                    len_obj,size);
+  pdfOut_printf(pdf,"Q\n");
+  int content=pdfOut_end_stream(pdf,1);
+  assert(content!=-1);
 
   int obj=pdfOut_add_xref(pdf);
   pdfOut_printf(pdf,"%d 0 obj\n"
@@ -262,7 +539,7 @@ WritePage(void)
                     obj,PageWidth,PageLength,content,FontResource);
   pdfOut_add_page(pdf,obj);
 
-  memset(Page[0], 0, sizeof(lchar_t) * SizeColumns * SizeLines);
+  ClearPage();
 }
 // }}}
 
@@ -841,120 +1118,137 @@ WriteProlog(const char *title,		/* I - Title of job */
 
 static void
 write_line(int     row,		/* I - Row number (0 to N) */
-           lchar_t *line)	/* I - Line to print */
+           lline_t *text)	/* I - Line to print */
 {
   int		i;		/* Looping var */
   int		col,xcol,xwid;		/* Current column */
+  int		end;		/* Column after current span */
   int		attr;		/* Current attribute */
   int		font,		/* Font to use */
 		lastfont,	/* Last font */
 		mono;		/* Monospaced? */
-  lchar_t	*start;		/* First character in sequence */
+  lspan_t	*span;		/* Current span */
+  lchar_t	*line,		/* Current character */
+		*start;		/* First character in sequence */
+
 
+ /*
+  * Only the spans of the line hold any text, the columns between them are
+  * blank...
+  */
 
   xcol=0;
-  for (col = 0, start = line; col < SizeColumns;)
+  for (span = text->spans, col = 0; span < text->spans + text->num_spans;
+       span ++)
   {
-    while (col < SizeColumns && (line->ch == ' ' || line->ch == 0))
-    {
-      col ++;
-      xcol ++;
-      line ++;
-    }
-
-    if (col >= SizeColumns)
-      break;
+    xcol += span->column - col;
+    col   = span->column;
+    end   = span->column + span->length;
+    line  = span->chars;
 
-    if (NumFonts == 1)
+    while (col < end)
     {
-     /*
-      * All characters in a single font - assume monospaced and single width...
-      */
-
-      attr  = line->attr;
-      start = line;
-
-      while (col < SizeColumns && line->ch != 0 && attr == line->attr)
+      while (col < end && (line->ch == ' ' || line->ch == 0))
       {
 	col ++;
+	xcol ++;
 	line ++;
       }
 
-      write_string(col - (line - start), row, line - start, start);
-    }
-    else
-    {
-     /*
-      * Multiple fonts; break up based on the font...
-      */
+      if (col >= end)
+	break;
 
-      attr     = line->attr;
-      start    = line;
-      xwid     = 0;
-      if (UTF8) {
-        lastfont = Codes[line->ch];
-      } else {
-        lastfont = Codes[Chars[line->ch]];
-      }
-//      mono     = strncmp(Fonts[lastfont][0], "Courier", 7) == 0;
-mono=1; // TODO
+      if (NumFonts == 1)
+      {
+       /*
+	* All characters in a single font - assume monospaced and single width...
+	*/
 
-      col ++;
-      xwid += Widths[lastfont];
-      line ++;
+	attr  = line->attr;
+	start = line;
 
-      if (mono)
-      {
-	while (col < SizeColumns && line->ch != 0 && attr == line->attr)
+	while (col < end && line->ch != 0 && attr == line->attr)
 	{
-          if (UTF8) {
-            font = Codes[line->ch];
-          } else {
-            font = Codes[Chars[line->ch]];
-          }
-          if (/*strncmp(Fonts[font][0], "Courier", 7) != 0 ||*/ // TODO
-	      font != lastfont)
-	    break;
-
 	  col ++;
-          xwid += Widths[lastfont];
 	  line ++;
 	}
-      }
 
-      if (Directions[lastfont] > 0) {
-        write_string(xcol, row, line - start, start);
-        xcol += xwid;
+	write_string(col - (line - start), row, line - start, start);
       }
       else
       {
        /*
-        * Do right-to-left text... ; assume no font change without direction change
+	* Multiple fonts; break up based on the font...
 	*/
 
-	while (col < SizeColumns && line->ch != 0 && attr == line->attr)
+	attr     = line->attr;
+	start    = line;
+	xwid     = 0;
+	if (UTF8) {
+	  lastfont = Codes[line->ch];
+	} else {
+	  lastfont = Codes[Chars[line->ch]];
+	}
+//      mono     = strncmp(Fonts[lastfont][0], "Courier", 7) == 0;
+mono=1; // TODO
+
+	col ++;
+	xwid += Widths[lastfont];
+	line ++;
+
+	if (mono)
 	{
-          if (UTF8) {
-            font = Codes[line->ch];
-          } else {
-            font = Codes[Chars[line->ch]];
-          }
-          if (Directions[font] > 0 &&
-	      !ispunct(line->ch & 255) && !isspace(line->ch & 255))
-	    break;
+	  while (col < end && line->ch != 0 && attr == line->attr)
+	  {
+	    if (UTF8) {
+	      font = Codes[line->ch];
+	    } else {
+	      font = Codes[Chars[line->ch]];
+	    }
+	    if (/*strncmp(Fonts[font][0], "Courier", 7) != 0 ||*/ // TODO
+		font != lastfont)
+	      break;
+
+	    col ++;
+	    xwid += Widths[lastfont];
+	    line ++;
+	  }
+	}
 
-	  col ++;
-          xwid += Widths[lastfont];
-	  line ++;
+	if (Directions[lastfont] > 0) {
+	  write_string(xcol, row, line - start, start);
+	  xcol += xwid;
 	}
+	else
+	{
+	 /*
+	  * Do right-to-left text... ; assume no font change without direction change
+	  */
 
-        for (i = 1; start < line; i ++, start ++)
-	  if (!isspace(start->ch & 255)) {
-            xwid-=Widths[lastfont];
-	    write_string(xcol + xwid, row, 1, start);
-          } else {
-            xwid--;
-          }
+	  while (col < end && line->ch != 0 && attr == line->attr)
+	  {
+	    if (UTF8) {
+	      font = Codes[line->ch];
+	    } else {
+	      font = Codes[Chars[line->ch]];
+	    }
+	    if (Directions[font] > 0 &&
+		!ispunct(line->ch & 255) && !isspace(line->ch & 255))
+	      break;
+
+	    col ++;
+	    xwid += Widths[lastfont];
+	    line ++;
+	  }
+
+	  for (i = 1; start < line; i ++, start ++)
+	    if (!isspace(start->ch & 255)) {
+	      xwid-=Widths[lastfont];
+	      write_string(xcol + xwid, row, 1, start);
+	    } else {
+	      xwid--;
+	    }
+	}
       }
     }
   }
@@ -1079,6 +1373,9 @@ static void write_font_str(float x,float y,int fontid, lchar_t *str, int len)
   unsigned short		ch;		/* Current character */
   static char	*names[] =	/* Font names */
 		{ "FN","FB","FI","FBI" };
+  static const char hex[] = "0123456789abcdef";
+  char		buf[256];	/* Hex string being built */
+  int		pos;		/* Position in buf */
 
   if (len==-1) {
     for (len=0;str[len].ch;len++);
@@ -1123,6 +1420,7 @@ static void write_font_str(float x,float y,int fontid, lchar_t *str, int len)
     pdfOut_printf(pdf,"  /%s%02x %.3f Tf <",
                       names[fontid],lastfont,FontScaleY);
 
+    pos = 0;
     while (len > 0)
     {
       if (UTF8) {
@@ -1135,16 +1433,25 @@ static void write_font_str(float x,float y,int fontid, lchar_t *str, int len)
       if (lastfont != font) { // only possible, when not used via write_string (e.g. utf-8filename.txt in prettyprint)
         break;
       }
+      if (pos + 4 > sizeof(buf)) {
+        pdfOut_write(pdf,buf,pos);
+        pos = 0;
+      }
       if (otf) { // TODO 
         const unsigned short gid=emb_get(emb,ch);
-        pdfOut_printf(pdf,"%04x", gid);
+        buf[pos++] = hex[(gid >> 12) & 15];
+        buf[pos++] = hex[(gid >> 8) & 15];
+        buf[pos++] = hex[(gid >> 4) & 15];
+        buf[pos++] = hex[gid & 15];
       } else { // std 14 font with 7-bit us-ascii uses single byte encoding, TODO
-        pdfOut_printf(pdf,"%02x",ch);
+        buf[pos++] = hex[(ch >> 4) & 15];
+        buf[pos++] = hex[ch & 15];
       }
 
       len --;
       str ++;
     }
+    pdfOut_write(pdf,buf,pos);
 
     pdfOut_printf(pdf,"> Tj\n");
   }
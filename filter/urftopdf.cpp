@@ -39,6 +39,8 @@
 #include <qpdf/Pl_Flate.hh>
 #include <qpdf/Pl_Buffer.hh>
 
+#include <cupsfilters/driver.h>
+
 #include "unirast.h"
 
 #define DEFAULT_PDF_UNIT 72   // 1/72 inch
@@ -275,131 +277,124 @@ struct urf_page_header {
     uint32_t unknown3;
 } __attribute__((__packed__));
 
-int decode_raster(int fd, unsigned width, unsigned height, int bpp, struct pdf_info * info)
+// Buffered input, the raster data is decoded straight from the buffer
+struct urf_input {
+    urf_input(int fd)
+      : fd(fd), pos(0), len(0), eof(false), data(65536)
+    {
+    }
+
+    int fd;
+    size_t pos;
+    size_t len;
+    bool eof;
+    std::vector<uint8_t> data;
+};
+
+// Make at least "want" bytes available unless the file ends first
+size_t urf_fill(struct urf_input * in, size_t want)
+{
+    ssize_t bytes;
+
+    if (in->len - in->pos >= want || in->eof)
+        return in->len - in->pos;
+
+    if (in->pos > 0)
+    {
+        memmove(&in->data[0], &in->data[in->pos], in->len - in->pos);
+        in->len -= in->pos;
+        in->pos = 0;
+    }
+
+    if (want > in->data.size())
+        in->data.resize(want);
+
+    while (in->len < want)
+    {
+        if ((bytes = read(in->fd, &in->data[in->len], in->data.size() - in->len)) < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return (size_t)-1;
+        }
+        else if (bytes == 0)
+        {
+            in->eof = true;
+            break;
+        }
+
+        in->len += bytes;
+    }
+
+    return in->len;
+}
+
+ssize_t urf_read(struct urf_input * in, void * buf, size_t size)
+{
+    size_t avail = urf_fill(in, size);
+
+    if (avail == (size_t)-1)
+        return -1;
+    if (avail > size)
+        avail = size;
+
+    memcpy(buf, &in->data[in->pos], avail);
+    in->pos += avail;
+
+    return avail;
+}
+
+int decode_raster(struct urf_input * in, unsigned width, unsigned height, int bpp, struct pdf_info * info)
 {
     // We should be at raster start
-    int i, j;
+    int i;
     unsigned cur_line = 0;
-    unsigned pos = 0;
-    uint8_t line_repeat_byte = 0;
     unsigned line_repeat = 0;
-    int8_t packbit_code = 0;
     int pixel_size = (bpp/8);
-    std::vector<uint8_t> pixel_container;
+    size_t max_size;
+    const uint8_t *start, *end;
     std::vector<uint8_t> line_container;
 
-    if (width > (std::numeric_limits<unsigned>::max() / pixel_size)) {
+    if (width > (std::numeric_limits<unsigned>::max() / (pixel_size + 1)) - 128) {
         die("Line too big");
     }
     try {
-        pixel_container.resize(pixel_size);
         line_container.resize(pixel_size*width);
     } catch (...) {
         die("Unable to allocate temporary storage");
     }
 
+    // Longest possible line: a code for every pixel, the last one
+    // copying 128 pixels of which all but one are dropped
+    max_size = 1 + (size_t)width * (pixel_size + 1) + 128 * pixel_size;
+
     do
     {
-        if(read(fd, &line_repeat_byte, 1) < 1)
+        if (urf_fill(in, max_size) == (size_t)-1 || in->pos == in->len)
         {
-            dprintf("l%06d : line_repeat EOF at %lu\n", cur_line, lseek(fd, 0, SEEK_CUR));
+            dprintf("l%06d : line_repeat EOF\n", cur_line);
             return 1;
         }
 
-        line_repeat = (unsigned)line_repeat_byte + 1;
+        line_repeat = (unsigned)in->data[in->pos++] + 1;
 
         dprintf("l%06d : next actions for %d lines\n", cur_line, line_repeat);
 
-        // Start of line
-        pos = 0;
-
-        do
+        start = &in->data[in->pos];
+        if ((end = cupsUnpackPixels(start, &in->data[0] + in->len,
+                                    &line_container[0], width, pixel_size,
+                                    0xFF)) == NULL)
         {
-            if(read(fd, &packbit_code, 1) < 1)
-            {
-                dprintf("p%06dl%06d : packbit_code EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
-                return 1;
-            }
-
-            dprintf("p%06dl%06d: Raster code %02X='%d'.\n", pos, cur_line, (uint8_t)packbit_code, packbit_code);
-
-            if(packbit_code == -128)
-            {
-                dprintf("\tp%06dl%06d : blank rest of line.\n", pos, cur_line);
-                memset((&line_container[pos*pixel_size]), 0xFF, (pixel_size*(width-pos)));
-                pos = width;
-                break;
-            }
-            else if(packbit_code >= 0 && packbit_code <= 127)
-            {
-                int n = (packbit_code+1);
-
-                //Read pixel
-                if(read(fd, &pixel_container[0], pixel_size) < pixel_size)
-                {
-                    dprintf("p%06dl%06d : pixel repeat EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
-                    return 1;
-                }
-
-                dprintf("\tp%06dl%06d : Repeat pixel '", pos, cur_line);
-                for(j = 0 ; j < pixel_size ; ++j)
-                    dprintf("%02X ", pixel_container[j]);
-                dprintf("' for %d times.\n", n);
-
-                for(i = 0 ; i < n ; ++i)
-                {
-                    //for(j = pixel_size-1 ; j >= 0 ; --j)
-                    for(j = 0 ; j < pixel_size ; ++j)
-                        line_container[pixel_size*pos + j] = pixel_container[j];
-                    ++pos;
-                    if(pos >= width)
-                        break;
-                }
-
-                if(i < n && pos >= width)
-                {
-                    dprintf("\tp%06dl%06d : Forced end of line for pixel repeat.\n", pos, cur_line);
-                }
-                
-                if(pos >= width)
-                    break;
-            }
-            else if(packbit_code > -128 && packbit_code < 0)
-            {
-                int n = (-(int)packbit_code)+1;
-
-                dprintf("\tp%06dl%06d : Copy %d verbatim pixels.\n", pos, cur_line, n);
-
-                for(i = 0 ; i < n ; ++i)
-                {
-                    if(read(fd, &pixel_container[0], pixel_size) < pixel_size)
-                    {
-                        dprintf("p%06dl%06d : literal_pixel EOF at %lu\n", pos, cur_line, lseek(fd, 0, SEEK_CUR));
-                        return 1;
-                    }
-                    //Invert pixels, should be programmable
-                    for(j = 0 ; j < pixel_size ; ++j)
-                        line_container[pixel_size*pos + j] = pixel_container[j];
-                    ++pos;
-                    if(pos >= width)
-                        break;
-                }
-
-                if(i < n && pos >= width)
-                {
-                    dprintf("\tp%06dl%06d : Forced end of line for pixel copy.\n", pos, cur_line);
-                }
-                
-                if(pos >= width)
-                    break;
-            }
+            dprintf("l%06d : line data EOF\n", cur_line);
+            return 1;
         }
-        while(pos < width);
+
+        in->pos += end - start;
 
         dprintf("\tl%06d : End Of line, drawing %d times.\n", cur_line, line_repeat);
 
         // write lines
-        for(i = 0 ; i < (int)line_repeat ; ++i)
+        for(i = 0 ; i < (int)line_repeat && cur_line < height ; ++i)
         {
             pdf_set_line(info, cur_line, &line_container[0]);
             ++cur_line;
@@ -435,8 +430,9 @@ int main(int argc, char **argv)
 
     // Get fd from file
     fd = fileno(input);
+    urf_input in(fd);
 
-    if(read(fd, &head_orig, sizeof(head)) == -1) die("Unable to read file header");
+    if(urf_read(&in, &head_orig, sizeof(head)) == -1) die("Unable to read file header");
 
     //Transform
     memcpy(head.unirast, head_orig.unirast, sizeof(head.unirast));
@@ -453,7 +449,7 @@ int main(int argc, char **argv)
 
     for(page = 0 ; page < (int)head.page_count ; ++page)
     {
-        if(read(fd, &page_header_orig, sizeof(page_header_orig)) == -1) die("Unable to read page header");
+        if(urf_read(&in, &page_header_orig, sizeof(page_header_orig)) == -1) die("Unable to read page header");
 
         //Transform
         page_header.bpp = page_header_orig.bpp;
@@ -488,7 +484,7 @@ int main(int argc, char **argv)
 
         if(add_pdf_page(&pdf, page, page_header.width, page_header.height, page_header.bpp, page_header.dot_per_inch) != 0) die("Unable to create PDF file");
 
-        if(decode_raster(fd, page_header.width, page_header.height, page_header.bpp, &pdf) != 0)
+        if(decode_raster(&in, page_header.width, page_header.height, page_header.bpp, &pdf) != 0)
             die("Failed to decode Page");
     }
 
@@ -33,6 +33,8 @@
 #include <ifaddrs.h>
 #include <resolv.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <time.h>
@@ -154,6 +156,11 @@ static int  ldap_rebind_proc(LDAP *RebindLDAPHandle,
 #define SAVE_OPTIONS_FILE "/cups-browsed-options-%s"
 #define DEBUG_LOG_FILE "/cups-browsed_log"
 #define DEBUG_LOG_FILE_2 "/cups-browsed_previous_logs"
+/* Messages for the debug log file are queued in a ring buffer of this size
+   and written by a separate thread, so that logging does not hold up the
+   main loop */
+#define DEBUG_LOG_BUFFER_SIZE (1024 * 1024)
+#define DEBUG_LOG_LINE_SIZE 1024
 
 /* Status of remote printer */
 typedef enum printer_status_e {
@@ -172,6 +179,24 @@ typedef struct ipp_discovery_s {
   int family;
 } ipp_discovery_t;
 
+#ifdef HAVE_AVAHI
+/* Data structure for a DNS-SD browser event which is not yet acted
+   upon, one per instance (service name, domain, type, interface,
+   protocol) of a discovered service */
+typedef struct dnssd_event_s {
+  char *name;
+  char *type;
+  char *domain;
+  char ifname[IF_NAMESIZE];
+  AvahiIfIndex interface;
+  AvahiProtocol protocol;
+  AvahiClient *client;
+  AvahiServiceResolver *resolver; /* Running resolver, NULL if none */
+  int remove;                     /* REMOVE pending, not NEW */
+  time_t timeout;                 /* When to apply a pending REMOVE */
+} dnssd_event_t;
+#endif /* HAVE_AVAHI */
+
 /* Data structure for remote printers */
 typedef struct remote_printer_s {
   char *queue_name;
@@ -360,6 +385,36 @@ typedef struct media_col_s{
   char *media_source,*media_type;
 }media_col_t;
 
+/* Ways how the values of an attribute of the printers in a cluster get
+   merged */
+typedef enum cluster_merge_e {
+  CLUSTER_BOOLEAN,		/* True if true for any printer */
+  CLUSTER_STRINGS,		/* Set of strings */
+  CLUSTER_INTEGERS,		/* Set of integers or enums */
+  CLUSTER_RESOLUTIONS,		/* Set of resolutions */
+  CLUSTER_MEDIA_SIZES,		/* Set of media sizes and size ranges */
+  CLUSTER_MEDIA_COLS,		/* Set of media-col-database entries */
+  CLUSTER_PRESETS		/* First job preset of each name */
+} cluster_merge_t;
+
+typedef struct cluster_attr_s{
+  const char *name;		/* Attribute name */
+  ipp_tag_t find_tag;		/* Value tag to look for, or IPP_TAG_ZERO */
+  ipp_tag_t value_tag;		/* Value tag of merged attribute */
+  cluster_merge_t merge;	/* How to merge the values */
+}cluster_attr_t;
+
+typedef struct cluster_set_s{
+  int boolean;			/* Merged boolean */
+  cups_array_t *values;		/* Strings, resolutions, sizes, media-cols
+				   or preset names */
+  cups_array_t *ranges;		/* Media size ranges */
+  cups_array_t *presets;	/* Job presets, in order */
+  int *ints;			/* Integers */
+  int num_ints;			/* Number of integers */
+  int alloc_ints;		/* Allocated integers */
+}cluster_set_t;
+
 typedef struct default_str_attribute_s{
   char* value;
   int count;
@@ -408,6 +463,12 @@ static AvahiGLibPoll *glib_poll = NULL;
 static AvahiClient *client = NULL;
 static AvahiServiceBrowser *sb1 = NULL, *sb2 = NULL;
 static int avahi_present = 0;
+static cups_array_t *dnssd_events = NULL;
+static cups_array_t *dnssd_resolving = NULL;
+static guint dnssd_events_sourceid = 0;
+static time_t dnssd_events_due = 0;
+static int dnssd_max_resolves = 10;
+static int dnssd_remove_delay = 5;
 #endif /* HAVE_AVAHI */
 #ifdef HAVE_LDAP
 static const char * const ldap_attrs[] =/* CUPS LDAP attributes */
@@ -493,7 +554,16 @@ static const char *default_printer = NULL;
 
 static int debug_stderr = 0;
 static int debug_logfile = 0;
-static FILE *lfp = NULL;
+static int debug_log_fd = -1;
+static long int debug_log_size = 0;
+static char *debug_log_buffer = NULL;
+static size_t debug_log_head = 0, /* Bytes ever queued */
+  debug_log_tail = 0;             /* Bytes ever written */
+static unsigned int debug_log_dropped = 0;
+static int debug_log_thread_running = 0, debug_log_thread_stop = 0;
+static pthread_t debug_log_thread;
+static pthread_mutex_t debug_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t debug_log_cond = PTHREAD_COND_INITIALIZER;
 
 static char cachedir[1024];
 static char logdir[1024];
@@ -528,6 +598,10 @@ static char* ppd_keywords[] =
 static int timeout_reached = 0;
 
 static void recheck_timer (void);
+#ifdef HAVE_AVAHI
+static void dnssd_resolve_done (AvahiServiceResolver *r);
+#endif /* HAVE_AVAHI */
+void stop_debug_logging (void);
 static void browse_poll_create_subscription (browsepoll_t *context,
 					     http_t *conn);
 static gboolean browse_poll_get_notifications (browsepoll_t *context,
@@ -687,110 +761,258 @@ httpAddrPort(http_addr_t *addr)         /* I - Address */
 #endif
 
 
+/* Write data to the debug log file. When the file would get bigger than
+   DebugLogFileSize kB it becomes the previous logs file and a new one is
+   started, without splitting lines. Called by the log thread, or with
+   debug_log_mutex held when there is no log thread. */
+static void
+debug_log_write(const char *data, size_t len)
+{
+  long int limit = (long int)DebugLogFileSize * 1024;
+  size_t part;
+  ssize_t bytes;
+  const char *nl;
+
+  while (len > 0 && debug_log_fd >= 0) {
+    part = len;
+    if (limit > 0 && debug_log_size + (long int)len > limit) {
+      if ((nl = memrchr(data, '\n', debug_log_size < limit ?
+			 MIN(len, (size_t)(limit - debug_log_size)) : 0))
+	  != NULL)
+	part = nl - data + 1;
+      else if (debug_log_size > 0) {
+	/* Rename instead of copying the whole file */
+	rename(debug_log_file, debug_log_file_bckp);
+	close(debug_log_fd);
+	debug_log_fd = open(debug_log_file,
+			    O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+	debug_log_size = 0;
+	continue;
+      } else if ((nl = memchr(data, '\n', len)) != NULL)
+	part = nl - data + 1;
+    }
+
+    while (part > 0) {
+      if ((bytes = write(debug_log_fd, data, part)) < 0) {
+	if (errno == EINTR)
+	  continue;
+	return;
+      }
+      data += bytes;
+      part -= bytes;
+      len -= bytes;
+      debug_log_size += bytes;
+    }
+  }
+}
+
+static void *
+debug_log_writer(void *arg)
+{
+  size_t start, len;
+  unsigned int dropped;
+  char note[128];
+
+  pthread_mutex_lock(&debug_log_mutex);
+  for (;;) {
+    while (debug_log_head == debug_log_tail && !debug_log_thread_stop)
+      pthread_cond_wait(&debug_log_cond, &debug_log_mutex);
+    if (debug_log_head == debug_log_tail)
+      break;
+
+    /* Producers never touch the queued data, so write it unlocked */
+    start = debug_log_tail % DEBUG_LOG_BUFFER_SIZE;
+    len = debug_log_head - debug_log_tail;
+    if (start + len > DEBUG_LOG_BUFFER_SIZE)
+      len = DEBUG_LOG_BUFFER_SIZE - start;
+    dropped = debug_log_dropped;
+    debug_log_dropped = 0;
+    pthread_mutex_unlock(&debug_log_mutex);
+
+    if (dropped) {
+      snprintf(note, sizeof(note),
+	       "*** %u debug messages dropped, log buffer full ***\n", dropped);
+      debug_log_write(note, strlen(note));
+    }
+    debug_log_write(debug_log_buffer + start, len);
+
+    pthread_mutex_lock(&debug_log_mutex);
+    debug_log_tail += len;
+  }
+  pthread_mutex_unlock(&debug_log_mutex);
+
+  return (NULL);
+}
+
+/* Queue a complete log line for the log file; if the buffer is full the
+   message is dropped rather than making the caller wait */
+static void
+debug_log_queue(const char *data, size_t len)
+{
+  size_t start, part;
+
+  pthread_mutex_lock(&debug_log_mutex);
+  if (!debug_log_thread_running)
+    debug_log_write(data, len);
+  else if (len > DEBUG_LOG_BUFFER_SIZE - (debug_log_head - debug_log_tail))
+    debug_log_dropped ++;
+  else {
+    start = debug_log_head % DEBUG_LOG_BUFFER_SIZE;
+    part = DEBUG_LOG_BUFFER_SIZE - start;
+    if (part > len)
+      part = len;
+    memcpy(debug_log_buffer + start, data, part);
+    memcpy(debug_log_buffer, data + part, len - part);
+    debug_log_head += len;
+    pthread_cond_signal(&debug_log_cond);
+  }
+  pthread_mutex_unlock(&debug_log_mutex);
+}
+
+/* ctime_r() is slow, so format the time stamp once per second */
+static void
+debug_timestamp(char *buf, size_t bufsize)
+{
+  static time_t last_time = 0;
+  static char last_buf[64];
+  time_t curtime = time(NULL);
+
+  pthread_mutex_lock(&debug_log_mutex);
+  if (curtime != last_time) {
+    ctime_r(&curtime, last_buf);
+    while (last_buf[0] && isspace(last_buf[strlen(last_buf) - 1]))
+      last_buf[strlen(last_buf) - 1] = '\0';
+    last_time = curtime;
+  }
+  snprintf(buf, bufsize, "%s", last_buf);
+  pthread_mutex_unlock(&debug_log_mutex);
+}
+
 void
 start_debug_logging()
 {
-  if (debug_log_file[0] == '\0')
+  struct stat st;
+
+  if (debug_log_file[0] == '\0' || debug_log_fd >= 0)
     return;
-  if (lfp == NULL)
-    lfp = fopen(debug_log_file, "a+");
-  if (lfp == NULL) {
+  debug_log_fd = open(debug_log_file, O_WRONLY | O_CREAT | O_APPEND, 0666);
+  if (debug_log_fd < 0) {
     fprintf(stderr, "cups-browsed: ERROR: Failed creating debug log file %s\n",
       debug_log_file);
     exit(1);
   }
+  /* From here on the size is counted while writing */
+  if (fstat(debug_log_fd, &st) == 0)
+    debug_log_size = st.st_size;
+}
+
+/* Hand the writing of the log file over to a separate thread. This is
+   done only once the log file is finally set up, as debug_log_size and
+   debug_log_fd belong to the thread from then on. */
+static void
+start_debug_log_thread(void)
+{
+  static int atexit_registered = 0;
+
+  if (debug_log_fd >= 0 && !debug_log_thread_running &&
+      (debug_log_buffer = malloc(DEBUG_LOG_BUFFER_SIZE)) != NULL) {
+    debug_log_thread_stop = 0;
+    if (pthread_create(&debug_log_thread, NULL, debug_log_writer, NULL) == 0) {
+      /* Do not lose queued messages when exiting on an error */
+      if (!atexit_registered) {
+	atexit(stop_debug_logging);
+	atexit_registered = 1;
+      }
+      debug_log_thread_running = 1;
+    } else {
+      free(debug_log_buffer);
+      debug_log_buffer = NULL;
+    }
+  }
 }
 
 void
-stop_debug_logging()
+stop_debug_logging(void)
 {
   debug_logfile = 0;
-  if (lfp)
-    fclose(lfp);
-  lfp = NULL;
-}
-
-// returns the size of debug log file
-long int findLogFileSize() 
-{ 
-    FILE* fp = fopen(debug_log_file, "r"); 
-    if (fp == NULL) { 
-        return -1; 
-    } 
-    fseek(fp, 0L, SEEK_END); 
-    long int res = ftell(fp); 
-    fclose(fp); 
-    return res; 
-}
-
-void copyToFile(FILE **fp1, FILE **fp2){
-  int buffer_size = 2048;
-  char *buf = (char*) malloc(sizeof(char)*buffer_size);
-  if(!buf){
-    fprintf(stderr,"Error creating buffer for debug logging\n");
-    return;
+
+  /* Let the log thread write what is still queued */
+  if (debug_log_thread_running) {
+    pthread_mutex_lock(&debug_log_mutex);
+    debug_log_thread_stop = 1;
+    pthread_cond_signal(&debug_log_cond);
+    pthread_mutex_unlock(&debug_log_mutex);
+    pthread_join(debug_log_thread, NULL);
+    debug_log_thread_running = 0;
+    free(debug_log_buffer);
+    debug_log_buffer = NULL;
   }
-  fseek(*fp1, 0, SEEK_SET);
-  size_t r;
-  do {
-    r = fread(buf, sizeof(char), buffer_size, *fp1);
-    fwrite(buf, sizeof(char), r, *fp2);
-  } while(r==buffer_size);
 
+  if (debug_log_fd >= 0)
+    close(debug_log_fd);
+  debug_log_fd = -1;
 }
 
 void
 debug_printf(const char *format, ...) {
   if (debug_stderr || debug_logfile) {
-    time_t curtime = time(NULL);
-    char buf[64];
-    ctime_r(&curtime, buf);
-    while(isspace(buf[strlen(buf)-1])) buf[strlen(buf)-1] = '\0';
+    char line[DEBUG_LOG_LINE_SIZE], *msg = line;
+    int tslen, len;
     va_list arglist;
-    if (debug_stderr) {
-      va_start(arglist, format);
-      fprintf(stderr, "%s ", buf);
-      vfprintf(stderr, format, arglist);
-      fflush(stderr);
-      va_end(arglist);
-    }
-    if (debug_logfile && lfp) {
+
+    debug_timestamp(line, sizeof(line) - 1);
+    tslen = strlen(line);
+    line[tslen ++] = ' ';
+
+    /* Format the message only once, for both stderr and the log file */
+    va_start(arglist, format);
+    len = vsnprintf(line + tslen, sizeof(line) - tslen, format, arglist);
+    va_end(arglist);
+    if (len < 0)
+      return;
+    if (len >= (int)sizeof(line) - tslen &&
+	(msg = malloc(tslen + len + 1)) != NULL) {
+      memcpy(msg, line, tslen);
       va_start(arglist, format);
-      fprintf(lfp, "%s ", buf);
-      vfprintf(lfp, format, arglist);
-      fflush(lfp);
+      vsnprintf(msg + tslen, len + 1, format, arglist);
       va_end(arglist);
+    } else if (msg == NULL) {
+      msg = line;
+      len = sizeof(line) - tslen - 1;
     }
+    len += tslen;
 
-    long int log_file_size = findLogFileSize(); 
-    if(DebugLogFileSize>0 && log_file_size>(long int)DebugLogFileSize*1024){
-      fclose(lfp);
-      FILE *fp1 = fopen(debug_log_file, "r");
-      FILE *fp2 = fopen(debug_log_file_bckp, "w");
-      copyToFile(&fp1,&fp2);
-      fclose(fp1);
-      fclose(fp2);
-      lfp = fopen(debug_log_file, "w");
-    }
-}
+    if (debug_stderr)
+      fputs(msg, stderr);
+    if (debug_logfile && debug_log_fd >= 0)
+      debug_log_queue(msg, len);
+
+    if (msg != line)
+      free(msg);
+  }
 }
 
 void
 debug_log_out(char *log) {
   if (debug_stderr || debug_logfile) {
-    time_t curtime = time(NULL);
     char buf[64];
     char *ptr1, *ptr2;
-    ctime_r(&curtime, buf);
-    while(isspace(buf[strlen(buf)-1])) buf[strlen(buf)-1] = '\0';
+    char *line;
+    size_t len;
+    debug_timestamp(buf, sizeof(buf));
     ptr1 = log;
     while(ptr1) {
       ptr2 = strchr(ptr1, '\n');
       if (ptr2) *ptr2 = '\0';
-      if (debug_stderr)
-	fprintf(stderr, "%s %s\n", buf, ptr1);
-      if (debug_logfile && lfp)
-	fprintf(lfp, "%s %s\n", buf, ptr1);
+      len = strlen(buf) + strlen(ptr1) + 2;
+      if ((line = malloc(len + 1)) != NULL) {
+	snprintf(line, len + 1, "%s %s\n", buf, ptr1);
+	if (debug_stderr)
+	  fputs(line, stderr);
+	if (debug_logfile && debug_log_fd >= 0)
+	  debug_log_queue(line, len);
+	free(line);
+      }
       if (ptr2) *ptr2 = '\n';
       ptr1 = ptr2 ? (ptr2 + 1) : NULL;
     }
@@ -1372,690 +1594,358 @@ pwg_ppdize_name(const char *ipp,  /* I - IPP keyword */
   *ptr = '\0';
 }
 
-void add_mimetype_attributes(char* cluster_name, ipp_t **merged_attributes)
-{
-  int                  count, i;
-  remote_printer_t     *p;
-  const char           *str;
-  char                 *q;
-  cups_array_t         *list;
-  ipp_attribute_t      *attr;
-  int                  num_value, attr_no;
-  char* attributes[] = {
-    "document-format-supported"
-  };
+/* Attributes merged for a cluster, sorted by name for bsearch() */
+static const cluster_attr_t cluster_attrs[] = {
+  { "color-supported", IPP_TAG_BOOLEAN, IPP_TAG_BOOLEAN, CLUSTER_BOOLEAN },
+  { "document-format-supported", IPP_TAG_MIMETYPE, IPP_TAG_MIMETYPE,
+    CLUSTER_STRINGS },
+  { "finishing-template", IPP_TAG_ENUM, IPP_TAG_ENUM, CLUSTER_INTEGERS },
+  { "finishings-col-database", IPP_TAG_ENUM, IPP_TAG_ENUM, CLUSTER_INTEGERS },
+  { "finishings-supported", IPP_TAG_ENUM, IPP_TAG_ENUM, CLUSTER_INTEGERS },
+  { "job-presets-supported", IPP_TAG_BEGIN_COLLECTION,
+    IPP_TAG_BEGIN_COLLECTION, CLUSTER_PRESETS },
+  { "media-bottom-margin-supported", IPP_TAG_INTEGER, IPP_TAG_INTEGER,
+    CLUSTER_INTEGERS },
+  { "media-col-database", IPP_TAG_BEGIN_COLLECTION, IPP_TAG_BEGIN_COLLECTION,
+    CLUSTER_MEDIA_COLS },
+  { "media-left-margin-supported", IPP_TAG_INTEGER, IPP_TAG_INTEGER,
+    CLUSTER_INTEGERS },
+  { "media-right-margin-supported", IPP_TAG_INTEGER, IPP_TAG_INTEGER,
+    CLUSTER_INTEGERS },
+  { "media-size-supported", IPP_TAG_BEGIN_COLLECTION,
+    IPP_TAG_BEGIN_COLLECTION, CLUSTER_MEDIA_SIZES },
+  { "media-source-supported", IPP_TAG_KEYWORD, IPP_TAG_KEYWORD,
+    CLUSTER_STRINGS },
+  { "media-supported", IPP_TAG_ZERO, IPP_TAG_KEYWORD, CLUSTER_STRINGS },
+  { "media-top-margin-supported", IPP_TAG_INTEGER, IPP_TAG_INTEGER,
+    CLUSTER_INTEGERS },
+  { "media-type-supported", IPP_TAG_KEYWORD, IPP_TAG_KEYWORD,
+    CLUSTER_STRINGS },
+  { "output-bin-supported", IPP_TAG_ZERO, IPP_TAG_KEYWORD, CLUSTER_STRINGS },
+  { "output-mode-supported", IPP_TAG_KEYWORD, IPP_TAG_KEYWORD,
+    CLUSTER_STRINGS },
+  { "pclm-source-resolution-supported", IPP_TAG_RESOLUTION,
+    IPP_TAG_RESOLUTION, CLUSTER_RESOLUTIONS },
+  { "print-color-mode-supported", IPP_TAG_KEYWORD, IPP_TAG_KEYWORD,
+    CLUSTER_STRINGS },
+  { "print-content-optimize-supported", IPP_TAG_ZERO, IPP_TAG_KEYWORD,
+    CLUSTER_STRINGS },
+  { "print-quality-supported", IPP_TAG_ENUM, IPP_TAG_ENUM, CLUSTER_INTEGERS },
+  { "print-rendering-intent-supported", IPP_TAG_ZERO, IPP_TAG_KEYWORD,
+    CLUSTER_STRINGS },
+  { "print-scaling-supported", IPP_TAG_ZERO, IPP_TAG_KEYWORD,
+    CLUSTER_STRINGS },
+  { "printer-resolution-supported", IPP_TAG_RESOLUTION, IPP_TAG_RESOLUTION,
+    CLUSTER_RESOLUTIONS },
+  { "pwg-raster-document-resolution-supported", IPP_TAG_RESOLUTION,
+    IPP_TAG_RESOLUTION, CLUSTER_RESOLUTIONS },
+  { "pwg-raster-document-type-supported", IPP_TAG_KEYWORD, IPP_TAG_KEYWORD,
+    CLUSTER_STRINGS },
+  { "sides-supported", IPP_TAG_KEYWORD, IPP_TAG_KEYWORD, CLUSTER_STRINGS },
+  { "urf-supported", IPP_TAG_KEYWORD, IPP_TAG_KEYWORD, CLUSTER_STRINGS }
+};
+
+#define NUM_CLUSTER_ATTRS (int)(sizeof(cluster_attrs) / sizeof(cluster_attrs[0]))
 
-  for (attr_no = 0; attr_no < 1; attr_no++) {
-    if ((list = cupsArrayNew3((cups_array_func_t)strcasecmp, NULL, NULL, 0,
-			      (cups_acopy_func_t)strdup,
-			      (cups_afree_func_t)free)) == NULL)
-      return ;
-
-    num_value = 0;
-    for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
-	 p; p = (remote_printer_t *)cupsArrayNext(remote_printers)) {
-      if (strcmp(cluster_name,p->queue_name))
-        continue;
-      if(p->status == STATUS_DISAPPEARED || p->status == STATUS_UNCONFIRMED ||
-	 p->status ==  STATUS_TO_BE_RELEASED )
-        continue;
-      if ((attr = ippFindAttribute(p->prattrs,attributes[attr_no],
-				   IPP_TAG_MIMETYPE)) != NULL) {
-	count = ippGetCount(attr);
-	for (i = 0; i < count; i ++) { 
-	  str = ippGetString(attr, i, NULL);
-	  if (!cupsArrayFind(list, (void *)str)){
-	    cupsArrayAdd(list, (void *)str);
-	    num_value++;
-	  }
-	}
-      }
-    }
-    if (num_value != 0) {
-      char    *values[num_value];
-      for (q = (char *)cupsArrayFirst(list),i=0;
-	   q;
-	   q = (char *)cupsArrayNext(list),i++) {
-        values[i]=malloc(sizeof(char) * (strlen(q) + 1));
-        snprintf(values[i], strlen(q) + 1, "%s", q);
-      }
-      ippAddStrings(*merged_attributes, IPP_TAG_PRINTER,IPP_TAG_MIMETYPE,
-		    attributes[attr_no], num_value, NULL,
-		    (const char * const *)values);
+void
+free_media(void *media, void *user_data)
+{
+  media_col_t *data = (media_col_t *)media;
 
-      for (int k = 0; k < i; k++) {
-        free(values[k]);
-        values[k] = NULL;
-      }
-    }
-    cupsArrayDelete(list);
-    list = NULL;
+  if (data) {
+    free(data->media_source);
+    free(data->media_type);
+    free(data);
   }
 }
 
-/*add_tagzero_attributes - Adds attribute to the merged_attribute variable for
-                           the cluster. This function adds attribute with value
-                           tag IPP_TAG_ZERO */
-void add_tagzero_attributes(char* cluster_name, ipp_t **merged_attributes)
+int
+compare_cluster_attr(const void *name, const void *cluster_attr)
 {
-  int                  count, i;
-  remote_printer_t     *p;
-  const char           *str;
-  char                 *q;
-  cups_array_t         *list;
-  ipp_attribute_t      *attr;
-  int                  num_value, attr_no;
-  char* attributes[] = {
-    "media-supported",
-    "output-bin-supported",
-    "print-content-optimize-supported",
-    "print-rendering-intent-supported",
-    "print-scaling-supported"
-  };
-
-  for (attr_no = 0; attr_no < 5; attr_no++) {
-    /* Cups Array to store the values for the attribute*/
-    if ((list = cupsArrayNew3((cups_array_func_t)strcasecmp, NULL, NULL, 0,
-			      (cups_acopy_func_t)strdup,
-			      (cups_afree_func_t)free)) == NULL)
-      return ;
-
-    num_value = 0;
-    /* Iterating over all the printers in the cluster*/
-    for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
-	 p; p = (remote_printer_t *)cupsArrayNext(remote_printers)) {
-      if (strcmp(cluster_name, p->queue_name))
-	continue;
-      if(p->status == STATUS_DISAPPEARED || p->status == STATUS_UNCONFIRMED ||
-	 p->status ==  STATUS_TO_BE_RELEASED )
-	continue;
-      if ((attr = ippFindAttribute(p->prattrs, attributes[attr_no],
-				   IPP_TAG_ZERO)) != NULL) {
-	count = ippGetCount(attr);
-	for(i = 0; i < count; i ++) {
-	  /* Pick next format from attribute */
-	  str = ippGetString(attr, i, NULL);
-	  /* Add format to list, skip duplicates */
-	  if (!cupsArrayFind(list, (void *)str)){
-	    cupsArrayAdd(list, (void *)str);
-	    num_value ++;
-	  }
-	}
-      }
-    }
-    if (num_value != 0) {
-      char    *values[num_value];
-      /* Transferring attributes value from cups Array to char* array*/
-      for (q = (char *)cupsArrayFirst(list), i = 0; q;
-           q = (char *)cupsArrayNext(list), i ++) {
-        values[i] = malloc(sizeof(char) * (strlen(q) + 1));
-        snprintf(values[i], strlen(q) + 1, "%s", q);
-      }
-      ippAddStrings(*merged_attributes, IPP_TAG_PRINTER,
-                    IPP_TAG_KEYWORD, attributes[attr_no],
-                    num_value, NULL,
-                    (const char * const *)values);
+  return (strcasecmp((const char *)name,
+		     ((const cluster_attr_t *)cluster_attr)->name));
+}
 
-      for (int k = 0; k < i; k++) {
-        free(values[k]);
-        values[k] = NULL;
-      }
-    }
-    cupsArrayDelete(list);
-    list = NULL;
-  }
+int
+compare_ints(const void *int_a, const void *int_b)
+{
+  return (compare_int(*(const int *)int_a, *(const int *)int_b));
 }
 
-/*add_keyword_attributes - Adds attributes to the merged_attribute variable for
-                           the cluster. This function adds attributes with
-                           value tag IPP_TAG_KEYWORD*/
-void add_keyword_attributes(char* cluster_name, ipp_t **merged_attributes)
+/*merge_cluster_attribute - Adds the values of an attribute of one printer of
+                            the cluster to the set of values for the
+                            cluster. Strings and preset collections are not
+                            copied, they stay valid as long as the printer's
+                            attributes do */
+static void
+merge_cluster_attribute(const cluster_attr_t *ca, cluster_set_t *set,
+			ipp_attribute_t *attr)
 {
-  int                  count, i;
-  remote_printer_t     *p;
+  int                  count, i, *ints;
   const char           *str;
-  char                 *q;
-  cups_array_t         *list;
-  ipp_attribute_t      *attr;
-  int                  num_value, attr_no;
-  char* attributes[] = {
-    "output-mode-supported",
-    "urf-supported",
-    "pwg-raster-document-type-supported",
-    "media-source-supported",
-    "media-type-supported",
-    "print-color-mode-supported",
-    "sides-supported"
-  };
+  res_t                *res;
+  ipp_t                *media_size, *media_col, *preset;
+  ipp_attribute_t      *x_dim, *y_dim, *media_attr;
+  media_size_t         size;
+  pagesize_range_t     range;
+  media_col_t          media;
+  char                 media_source[32], media_type[32];
+
+  count = ippGetCount(attr);
 
-  for (attr_no = 0; attr_no < 7; attr_no ++) {
-    if ((list = cupsArrayNew3((cups_array_func_t)strcasecmp, NULL, NULL, 0,
-			      (cups_acopy_func_t)strdup,
-			      (cups_afree_func_t)free)) == NULL)
+  switch (ca->merge) {
+  case CLUSTER_BOOLEAN :
+    if (ippGetBoolean(attr, 0))
+      set->boolean = 1;
+    break;
+
+  case CLUSTER_STRINGS :
+    if (!set->values &&
+	(set->values = cupsArrayNew((cups_array_func_t)strcasecmp,
+				    NULL)) == NULL)
       return;
+    for (i = 0; i < count; i ++)
+      if ((str = ippGetString(attr, i, NULL)) != NULL &&
+	  !cupsArrayFind(set->values, (void *)str))
+	cupsArrayAdd(set->values, (void *)str);
+    break;
 
-    num_value = 0;
-    for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
-         p; p = (remote_printer_t *)cupsArrayNext(remote_printers)) {
-      if (strcmp(cluster_name, p->queue_name))
-        continue;
-      if(p->status == STATUS_DISAPPEARED || p->status == STATUS_UNCONFIRMED ||
-	 p->status == STATUS_TO_BE_RELEASED )
-        continue;
-      if ((attr = ippFindAttribute(p->prattrs, attributes[attr_no],
-				   IPP_TAG_KEYWORD)) != NULL) {
-        count = ippGetCount(attr);
-        for (i = 0; i < count; i++) {
-          str = ippGetString(attr, i, NULL);
-          if (!cupsArrayFind(list, (void *)str)){
-            cupsArrayAdd(list, (void *)str);
-            num_value ++;
-          }
-        }
-      }
+  case CLUSTER_INTEGERS :
+    if (set->num_ints + count > set->alloc_ints) {
+      if ((ints = realloc(set->ints, (set->num_ints + count + 16) *
+			  sizeof(int))) == NULL)
+	return;
+      set->ints = ints;
+      set->alloc_ints = set->num_ints + count + 16;
     }
-    if (num_value != 0) {
-      char    *values[num_value];
-      for (q = (char *)cupsArrayFirst(list), i=0;
-	   q;
-	   q = (char *)cupsArrayNext(list), i ++) {
-        values[i] = malloc(sizeof(char) * (strlen(q) + 1));
-        snprintf(values[i], strlen(q) + 1, "%s", q);
-      }
-      ippAddStrings(*merged_attributes, IPP_TAG_PRINTER, IPP_TAG_KEYWORD,
-		    attributes[attr_no], num_value, NULL,
-		    (const char * const *)values);
+    for (i = 0; i < count; i ++)
+      set->ints[set->num_ints ++] = ippGetInteger(attr, i);
+    break;
 
-      for (int k = 0; k < i; k++) {
-        free(values[k]);
-        values[k] = NULL;
+  case CLUSTER_RESOLUTIONS :
+    if (!set->values && (set->values = resolutionArrayNew()) == NULL)
+      return;
+    for (i = 0; i < count; i ++)
+      if ((res = ippResolutionToRes(attr, i)) != NULL) {
+	if (!cupsArrayFind(set->values, res))
+	  cupsArrayAdd(set->values, res);
+	free_resolution(res, NULL);
       }
-    }
-    cupsArrayDelete(list);
-    list = NULL;
-  }
-}
+    break;
 
-/*add_enum_attributes - Adds attributes to the merged_attribute variable for
-                        the cluster. This function adds attributes with value
-                        tag IPP_TAG_BEGIN_ENUM*/
-void add_enum_attributes(char* cluster_name, ipp_t **merged_attributes)
-{
-  int                  count, i, value;
-  remote_printer_t     *p;
-  char                 *str = NULL;
-  char                 *q;
-  cups_array_t         *list;
-  ipp_attribute_t      *attr;
-  int                  num_value, attr_no;
-  char* attributes[] = {
-                         "finishings-supported",
-                         "print-quality-supported",
-                         "finishing-template",
-                         "finishings-col-database"
-                       };
-
-  for (attr_no = 0; attr_no < 4; attr_no ++) {
-    if ((list = cupsArrayNew3((cups_array_func_t)strcasecmp, NULL, NULL, 0,
-			      (cups_acopy_func_t)strdup,
-			      (cups_afree_func_t)free)) == NULL)
-      return ;
-    str = malloc(sizeof(char) * 10);
-    num_value = 0;
-    for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
-         p; p = (remote_printer_t *)cupsArrayNext(remote_printers)) {
-      if (strcmp(cluster_name,p->queue_name))
-        continue;
-      if(p->status == STATUS_DISAPPEARED || p->status == STATUS_UNCONFIRMED ||
-        p->status ==  STATUS_TO_BE_RELEASED )
-        continue;
-      if ((attr = ippFindAttribute(p->prattrs,attributes[attr_no],  IPP_TAG_ENUM)) != NULL) {
-        count = ippGetCount(attr);
-        for (i = 0; i < count; i ++) {
-          value = ippGetInteger(attr, i);
-          sprintf(str,"%d",value);
-          if (!cupsArrayFind(list, (void *)str)){
-            cupsArrayAdd(list, (void *)str);
-            num_value++;
-          }
-        }
+  case CLUSTER_MEDIA_SIZES :
+    if (!set->values &&
+	(set->values =
+	 cupsArrayNew3((cups_array_func_t)compare_mediasize, NULL, NULL, 0,
+		       (cups_acopy_func_t)copy_media_size,
+		       (cups_afree_func_t)free)) == NULL)
+      return;
+    if (!set->ranges &&
+	(set->ranges =
+	 cupsArrayNew3((cups_array_func_t)compare_rangesize, NULL, NULL, 0,
+		       (cups_acopy_func_t)copy_range_size,
+		       (cups_afree_func_t)free)) == NULL)
+      return;
+    for (i = 0; i < count; i ++) {
+      media_size = ippGetCollection(attr, i);
+      x_dim = ippFindAttribute(media_size, "x-dimension", IPP_TAG_ZERO);
+      y_dim = ippFindAttribute(media_size, "y-dimension", IPP_TAG_ZERO);
+      if (ippGetValueTag(x_dim) == IPP_TAG_RANGE ||
+	  ippGetValueTag(y_dim) == IPP_TAG_RANGE) {
+	if (ippGetValueTag(x_dim) == IPP_TAG_RANGE)
+	  range.x_dim_min = ippGetRange(x_dim, 0, &range.x_dim_max);
+	else
+	  range.x_dim_min = range.x_dim_max = ippGetInteger(x_dim, 0);
+	if (ippGetValueTag(y_dim) == IPP_TAG_RANGE)
+	  range.y_dim_min = ippGetRange(y_dim, 0, &range.y_dim_max);
+	else
+	  range.y_dim_min = range.y_dim_max = ippGetInteger(y_dim, 0);
+	if (!cupsArrayFind(set->ranges, &range))
+	  cupsArrayAdd(set->ranges, &range);
+      } else {
+	size.x = ippGetInteger(x_dim, 0);
+	size.y = ippGetInteger(y_dim, 0);
+	if (!cupsArrayFind(set->values, &size))
+	  cupsArrayAdd(set->values, &size);
       }
     }
+    break;
 
-    if (num_value != 0){
-      int   values[num_value];
-      for (q = (char *)cupsArrayFirst(list), i = 0;q;
-           q = (char *)cupsArrayNext(list), i++) {
-        values[i] = atoi(q);
-      }
-      ippAddIntegers(*merged_attributes, IPP_TAG_PRINTER,IPP_TAG_ENUM,
-		     attributes[attr_no], num_value,values);
+  case CLUSTER_MEDIA_COLS :
+    if (!set->values &&
+	(set->values =
+	 cupsArrayNew3((cups_array_func_t)compare_media, NULL, NULL, 0,
+		       (cups_acopy_func_t)copy_media,
+		       (cups_afree_func_t)free_media)) == NULL)
+      return;
+    for (i = 0; i < count; i ++) {
+      media_col = ippGetCollection(attr, i);
+      media_size =
+	ippGetCollection(ippFindAttribute(media_col, "media-size",
+					  IPP_TAG_BEGIN_COLLECTION), 0);
+      media.x = ippGetInteger(ippFindAttribute(media_size, "x-dimension",
+					       IPP_TAG_ZERO), 0);
+      media.y = ippGetInteger(ippFindAttribute(media_size, "y-dimension",
+					       IPP_TAG_ZERO), 0);
+      media.top_margin =
+	ippGetInteger(ippFindAttribute(media_col, "media-top-margin",
+				       IPP_TAG_INTEGER), 0);
+      media.bottom_margin =
+	ippGetInteger(ippFindAttribute(media_col, "media-bottom-margin",
+				       IPP_TAG_INTEGER), 0);
+      media.left_margin =
+	ippGetInteger(ippFindAttribute(media_col, "media-left-margin",
+				       IPP_TAG_INTEGER), 0);
+      media.right_margin =
+	ippGetInteger(ippFindAttribute(media_col, "media-right-margin",
+				       IPP_TAG_INTEGER), 0);
+      media_type[0] = '\0';
+      media_source[0] = '\0';
+      if ((media_attr = ippFindAttribute(media_col, "media-type",
+					 IPP_TAG_KEYWORD)) != NULL)
+	pwg_ppdize_name(ippGetString(media_attr, 0, NULL), media_type,
+			sizeof(media_type));
+      if ((media_attr = ippFindAttribute(media_col, "media-source",
+					 IPP_TAG_KEYWORD)) != NULL)
+	pwg_ppdize_name(ippGetString(media_attr, 0, NULL), media_source,
+			sizeof(media_source));
+      media.media_type = strlen(media_type) > 1 ? media_type : NULL;
+      media.media_source = strlen(media_source) > 1 ? media_source : NULL;
+      if (!cupsArrayFind(set->values, &media))
+	cupsArrayAdd(set->values, &media);
     }
+    break;
 
-    if (str != NULL) {
-      free(str);
-      str = NULL;
+  case CLUSTER_PRESETS :
+    if (!set->values &&
+	(set->values = cupsArrayNew((cups_array_func_t)strcasecmp,
+				    NULL)) == NULL)
+      return;
+    if (!set->presets && (set->presets = cupsArrayNew(NULL, NULL)) == NULL)
+      return;
+    for (i = 0; i < count; i ++) {
+      preset = ippGetCollection(attr, i);
+      if ((str = ippGetString(ippFindAttribute(preset, "preset-name",
+					       IPP_TAG_ZERO), 0, NULL)) != NULL &&
+	  !cupsArrayFind(set->values, (void *)str)) {
+	cupsArrayAdd(set->values, (void *)str);
+	cupsArrayAdd(set->presets, preset);
+      }
     }
-    cupsArrayDelete(list);
-    list = NULL;
+    break;
   }
 }
 
-/*add_margin_attribute - Adds margin attributes to the merged_attribute variable for the cluster.*/
-void add_margin_attributes(char* cluster_name, ipp_t **merged_attributes)
-{
-  int                  count, i, value;
-  remote_printer_t     *p;
-  char                 *str;
-  char                 *q;
-  cups_array_t         *list;
+/*add_cluster_attribute - Adds the merged values of an attribute to the
+                          merged_attribute variable for the cluster, and
+                          frees the set of values*/
+static void
+add_cluster_attribute(const cluster_attr_t *ca, cluster_set_t *set,
+		      ipp_t *merged_attributes)
+{
+  int                  count, i, j;
+  void                 *value;
+  res_t                *res;
+  media_size_t         *size;
+  pagesize_range_t     *range;
+  media_col_t          *media;
+  ipp_t                *col;
   ipp_attribute_t      *attr;
-  int                  num_value, attr_no;
-  char* attributes[] = {
-    "media-bottom-margin-supported",
-    "media-left-margin-supported",
-    "media-top-margin-supported",
-    "media-right-margin-supported"
-  };
 
-  for (attr_no = 0; attr_no < 4; attr_no++) {
-    if ((list = cupsArrayNew3((cups_array_func_t)strcasecmp, NULL, NULL, 0,
-			      (cups_acopy_func_t)strdup,
-			      (cups_afree_func_t)free)) == NULL)
-      return ;
-    str = malloc(sizeof(char)*10);
-    num_value = 0;
-    for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
-         p; p = (remote_printer_t *)cupsArrayNext(remote_printers)) {
-      if (strcmp(cluster_name,p->queue_name))
-        continue;
-      if(p->status == STATUS_DISAPPEARED || p->status == STATUS_UNCONFIRMED ||
-      p->status ==  STATUS_TO_BE_RELEASED )
-        continue;
-      if ((attr = ippFindAttribute(p->prattrs,attributes[attr_no],  IPP_TAG_INTEGER)) != NULL) {
-        count = ippGetCount(attr);
-        for (i = 0; i < count; i++) {
-          value = ippGetInteger(attr, i);
-          sprintf(str,"%d",value);
-          if (!cupsArrayFind(list, (void *)str)){
-            cupsArrayAdd(list, (void *)str);
-            num_value++;
-          }
-        }
-      }
-    }
+  switch (ca->merge) {
+  case CLUSTER_BOOLEAN :
+    ippAddBoolean(merged_attributes, IPP_TAG_PRINTER, ca->name,
+		  set->boolean);
+    break;
 
-    if (num_value != 0){
-      int   values[num_value];
-      for (q = (char *)cupsArrayFirst(list),i=0;q;
-           q = (char *)cupsArrayNext(list),i++) {
-        values[i] = atoi(q);
-      }
-      ippAddIntegers(*merged_attributes, IPP_TAG_PRINTER,IPP_TAG_INTEGER,
-		     attributes[attr_no], num_value,values);
+  case CLUSTER_STRINGS :
+    if ((count = cupsArrayCount(set->values)) > 0) {
+      const char *values[count];
+      for (i = 0, value = cupsArrayFirst(set->values); value;
+	   i ++, value = cupsArrayNext(set->values))
+	values[i] = (const char *)value;
+      ippAddStrings(merged_attributes, IPP_TAG_PRINTER, ca->value_tag,
+		    ca->name, count, NULL, values);
     }
+    break;
 
-    if (str != NULL) {
-      free(str);
-      str = NULL;
+  case CLUSTER_INTEGERS :
+    if (set->num_ints > 0) {
+      qsort(set->ints, set->num_ints, sizeof(int), compare_ints);
+      for (i = 1, j = 1; i < set->num_ints; i ++)
+	if (set->ints[i] != set->ints[j - 1])
+	  set->ints[j ++] = set->ints[i];
+      ippAddIntegers(merged_attributes, IPP_TAG_PRINTER, ca->value_tag,
+		     ca->name, j, set->ints);
     }
-    cupsArrayDelete(list);
-    list = NULL;
-  }
-}
+    break;
 
-/*add_resolution_attributes - Adds resolution attributes to the merged_attribute
-                              for the cluster*/
-void add_resolution_attributes(char* cluster_name, ipp_t **merged_attributes)
-{
-  int                  count, i;
-  remote_printer_t     *p;
-  ipp_attribute_t      *attr;
-  int                  num_resolution, attr_no;
-  cups_array_t         *res_array;
-  res_t                *res, *resolution;
-  char* attributes[] = {
-                         "printer-resolution-supported",
-                         "pwg-raster-document-resolution-supported",
-                         "pclm-source-resolution-supported"
-                       };
-
-  for (attr_no = 0; attr_no < 3; attr_no ++) {
-    res_array = NULL;
-    res_array = resolutionArrayNew();
-    num_resolution = 0;
-    for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
-	 p; p = (remote_printer_t *)cupsArrayNext(remote_printers)) {
-      if (strcmp(cluster_name, p->queue_name))
-	continue;
-      if(p->status == STATUS_DISAPPEARED || p->status == STATUS_UNCONFIRMED ||
-	 p->status == STATUS_TO_BE_RELEASED )
-	continue;
-      if ((attr = ippFindAttribute(p->prattrs, attributes[attr_no],
-				   IPP_TAG_RESOLUTION)) != NULL) {
-        for (i = 0, count = ippGetCount(attr); i < count; i ++) {
-          if ((res = ippResolutionToRes(attr, i)) != NULL) {
-	          if (cupsArrayFind(res_array, res) == NULL) {
-	            cupsArrayAdd(res_array, res);
-	            num_resolution ++;
-	          }
-	          free_resolution(res, NULL);
-	        }
-	      }
+  case CLUSTER_RESOLUTIONS :
+    if ((count = cupsArrayCount(set->values)) > 0) {
+      int xres[count], yres[count];
+      for (i = 0, res = cupsArrayFirst(set->values); res;
+	   i ++, res = cupsArrayNext(set->values)) {
+	xres[i] = res->x;
+	yres[i] = res->y;
       }
-    }
-    if (num_resolution) {
-      int xres[num_resolution], yres[num_resolution];
-      for (i = 0, resolution=cupsArrayFirst(res_array); resolution;
-	   i ++, resolution = cupsArrayNext(res_array)) {
-	xres[i] = resolution->x;
-	yres[i] = resolution->y;
-      }
-      ippAddResolutions(*merged_attributes, IPP_TAG_PRINTER,
-			attributes[attr_no], num_resolution,
+      ippAddResolutions(merged_attributes, IPP_TAG_PRINTER, ca->name, count,
 			IPP_RES_PER_INCH, xres, yres);
     }
-    cupsArrayDelete(res_array);
-    res_array = NULL;
-  }
-}
-
-/*add_mediasize_attribute - Adds media sizes to the merged_attribute for the
-                            printer*/
-void add_mediasize_attributes(char* cluster_name, ipp_t **merged_attributes)
-{
-  int                  count, i = 0;
-  remote_printer_t     *p;
-  ipp_attribute_t      *attr, *media_size_supported, *x_dim, *y_dim;
-  int                  num_sizes, attr_no,num_ranges;
-  ipp_t                *media_size;
-  cups_array_t         *sizes, *size_ranges;
-  media_size_t         *temp, *media_s;
-  pagesize_range_t     *temp_range = NULL, *range = NULL;
-  char* attributes[] = {
-                         "media-size-supported",
-                       };
-
-  sizes = cupsArrayNew3((cups_array_func_t)compare_mediasize, NULL, NULL, 0,
-			(cups_acopy_func_t)copy_media_size,
-			(cups_afree_func_t)free);
-  size_ranges = cupsArrayNew3((cups_array_func_t)compare_rangesize, NULL, NULL,
-			      0,
-			      (cups_acopy_func_t)copy_range_size,
-			      (cups_afree_func_t)free);
-  temp = (media_size_t *)malloc(sizeof(media_size_t));
-  temp_range = (pagesize_range_t *)malloc(sizeof(pagesize_range_t));
-  for (attr_no = 0; attr_no < 1; attr_no ++) {
-    num_sizes = 0;
-    num_ranges = 0;
-    for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
-	 p; p = (remote_printer_t *)cupsArrayNext(remote_printers)) {
-      if (strcmp(cluster_name,p->queue_name))
-        continue;
-      if(p->status == STATUS_DISAPPEARED || p->status == STATUS_UNCONFIRMED ||
-	 p->status ==  STATUS_TO_BE_RELEASED )
-        continue;
-      if ((attr = ippFindAttribute(p->prattrs, attributes[attr_no],
-				   IPP_TAG_BEGIN_COLLECTION)) != NULL) {
-        for (i = 0, count = ippGetCount(attr); i < count; i ++) {
-          media_size  = ippGetCollection(attr, i);
-          x_dim = ippFindAttribute(media_size, "x-dimension", IPP_TAG_ZERO);
-          y_dim = ippFindAttribute(media_size, "y-dimension", IPP_TAG_ZERO);
-          if (ippGetValueTag(x_dim) == IPP_TAG_RANGE ||
-	      ippGetValueTag(y_dim) == IPP_TAG_RANGE) {
-            if (ippGetValueTag(x_dim) == IPP_TAG_RANGE)
-              temp_range->x_dim_min = ippGetRange(x_dim, 0,
-						  &temp_range->x_dim_max);
-            else
-              temp_range->x_dim_min = temp_range->x_dim_max =
-		ippGetInteger(x_dim, 0);
-
-            if (ippGetValueTag(y_dim) == IPP_TAG_RANGE)
-              temp_range->y_dim_min = ippGetRange(y_dim, 0,
-						  &temp_range->y_dim_max);
-            else
-              temp_range->y_dim_min = temp_range->y_dim_max =
-		ippGetInteger(y_dim, 0);
-            if (!cupsArrayFind(size_ranges,temp_range)) {
-              cupsArrayAdd(size_ranges, temp_range);
-              num_ranges++;
-            }
-          } else {
-            temp->x = ippGetInteger(x_dim,0);
-            temp->y = ippGetInteger(y_dim,0);
-            if (!cupsArrayFind(sizes, temp)){
-              cupsArrayAdd(sizes, temp);
-              num_sizes++;
-            }
-          }
-        }
-      }
-    }
-    media_size_supported =
-      ippAddCollections(*merged_attributes,
-			IPP_TAG_PRINTER, attributes[attr_no],
-			num_sizes+num_ranges, NULL);
-    if (num_sizes) {
-      for (i = 0, media_s = cupsArrayFirst(sizes);
-	   media_s; i ++, media_s = cupsArrayNext(sizes)) {
-        ipp_t *size = create_media_size(media_s->x, media_s->y);
-        ippSetCollection(*merged_attributes, &media_size_supported, i, size);
-        ippDelete(size);
-      }
-    }
-    if (num_ranges) {
-      for (range = cupsArrayFirst(size_ranges); range;
-	   i++, range = cupsArrayNext(size_ranges)) {
-        ipp_t *size_range = create_media_range(range->x_dim_min,
-					       range->x_dim_max,
-					       range->y_dim_min,
-					       range->y_dim_max);
-        ippSetCollection(*merged_attributes, &media_size_supported, i,
-			 size_range);
-        ippDelete(size_range);
-      }
-    }
-  }
-
-  free(temp);
-  free(temp_range);
-  cupsArrayDelete(sizes);
-  cupsArrayDelete(size_ranges);
-}
-
-/*add_mediadatabase_attribute - Adds media-col-database attributes for the
-                                cluster*/
-void
-add_mediadatabase_attributes(char* cluster_name, ipp_t **merged_attributes)
-{
-  int                  count, i;
-  remote_printer_t     *p;
-  ipp_attribute_t      *attr, *media_attr;
-  int                  num_database, attr_no;
-  cups_array_t         *media_database;
-  media_col_t          *temp, *media_data;
-  ipp_t                *media_col,
-                       *media_size, *current_media;
-  ipp_attribute_t      *media_col_database;
-  char                 media_source[32], media_type[32];
-  char* attributes[] = {
-                         "media-col-database",
-                       };
-  temp = (media_col_t *)malloc(sizeof(media_col_t));
-  media_database = cupsArrayNew3((cups_array_func_t)compare_media,
-				 NULL, NULL, 0,
-				 (cups_acopy_func_t)copy_media,
-				 (cups_afree_func_t)free);
-  for (attr_no = 0; attr_no < 1; attr_no ++) {
-    num_database = 0;
-    for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
-         p; p = (remote_printer_t *)cupsArrayNext(remote_printers)) {
-      if (strcmp(cluster_name, p->queue_name))
-        continue;
-      if(p->status == STATUS_DISAPPEARED || p->status == STATUS_UNCONFIRMED ||
-	 p->status == STATUS_TO_BE_RELEASED )
-        continue;
-      if ((attr = ippFindAttribute(p->prattrs, attributes[attr_no],
-				   IPP_TAG_BEGIN_COLLECTION)) != NULL){
-        for (i = 0, count = ippGetCount(attr); i < count; i ++) {
-          media_col = ippGetCollection(attr, i);
-          media_size =
-	    ippGetCollection(ippFindAttribute(media_col,
-					      "media-size",
-					      IPP_TAG_BEGIN_COLLECTION), 0);
-          temp->x = ippGetInteger(ippFindAttribute(media_size, "x-dimension",
-						   IPP_TAG_ZERO),0);
-          temp->y = ippGetInteger(ippFindAttribute(media_size, "y-dimension",
-						   IPP_TAG_ZERO),0);
-          temp->top_margin =
-	    ippGetInteger(ippFindAttribute(media_col,
-					   "media-top-margin",
-					   IPP_TAG_INTEGER),
-			  0);
-          temp->bottom_margin =
-	    ippGetInteger(ippFindAttribute(media_col,
-					   "media-bottom-margin",
-					   IPP_TAG_INTEGER),
-			  0);
-          temp->left_margin =
-	    ippGetInteger(ippFindAttribute(media_col,
-					   "media-left-margin",
-					   IPP_TAG_INTEGER),
-			  0);
-          temp->right_margin =
-	    ippGetInteger(ippFindAttribute(media_col,
-					   "media-right-margin",
-					   IPP_TAG_INTEGER),
-			  0);
-          media_type[0] = '\0';
-          media_source[0] = '\0';
-          temp->media_source = NULL;
-          temp->media_type = NULL;          
-          if ((media_attr = ippFindAttribute(media_col,
-					     "media-type",
-					     IPP_TAG_KEYWORD)) != NULL)
-            pwg_ppdize_name(ippGetString(media_attr, 0, NULL), media_type,
-			    sizeof(media_type));
-          if (strlen(media_type) > 1) {
-            temp->media_type = (char*)malloc(sizeof(char) * 32);
-            strcpy(temp->media_type, media_type);
-          }
-          if ((media_attr = ippFindAttribute(media_col, "media-source",
-					     IPP_TAG_KEYWORD)) != NULL) {
-            pwg_ppdize_name(ippGetString(media_attr, 0, NULL), media_source,
-			    sizeof(media_source));
-          }
-          if(strlen(media_source) > 1) {
-            temp->media_source = (char*)malloc(sizeof(char) * 32);
-            strcpy(temp->media_source, media_source);
-          }
-
-          if (!cupsArrayFind(media_database, temp)) {
-            cupsArrayAdd(media_database, temp);
-            num_database ++;
-          }
-        }
-      }
-    }
+    break;
 
-    if (num_database != 0) {
-      media_col_database = ippAddCollections(*merged_attributes,
-					     IPP_TAG_PRINTER,
-					     attributes[attr_no],
-					     num_database, NULL);
-      for (i = 0, media_data = cupsArrayFirst(media_database); media_data;
-           i ++, media_data = cupsArrayNext(media_database)) {
-        current_media = create_media_col(media_data->x, media_data->y,
-					 media_data->left_margin,
-					 media_data->right_margin,
-					 media_data->top_margin,
-					 media_data->bottom_margin,
-					 media_data->media_source,
-					 media_data->media_type);
-        ippSetCollection(*merged_attributes, &media_col_database, i,
-			 current_media);
-        ippDelete(current_media);
+  case CLUSTER_MEDIA_SIZES :
+    if ((count = cupsArrayCount(set->values) +
+	 cupsArrayCount(set->ranges)) > 0) {
+      attr = ippAddCollections(merged_attributes, IPP_TAG_PRINTER, ca->name,
+			       count, NULL);
+      i = 0;
+      for (size = cupsArrayFirst(set->values); size;
+	   i ++, size = cupsArrayNext(set->values)) {
+	col = create_media_size(size->x, size->y);
+	ippSetCollection(merged_attributes, &attr, i, col);
+	ippDelete(col);
+      }
+      for (range = cupsArrayFirst(set->ranges); range;
+	   i ++, range = cupsArrayNext(set->ranges)) {
+	col = create_media_range(range->x_dim_min, range->x_dim_max,
+				 range->y_dim_min, range->y_dim_max);
+	ippSetCollection(merged_attributes, &attr, i, col);
+	ippDelete(col);
       }
     }
-  }
-
-  free(temp);
-  cupsArrayDelete(media_database);
-}
-
-/*add_jobpresets_attribute - Adds presets attributes for the cluster*/
-void add_jobpresets_attribute(char* cluster_name, ipp_t ** merged_attributes)
-{
-  int                  count, i, num_preset = 0, preset_no = 0;
-  remote_printer_t     *p;
-  cups_array_t         *list, *added_presets;
-  ipp_t                *preset;
-  ipp_attribute_t      *attr;
-  const char           *preset_name;
-  ipp_attribute_t      *preset_attribute;
-
-  if ((list = cupsArrayNew3((cups_array_func_t)strcasecmp, NULL, NULL, 0,
-			    (cups_acopy_func_t)strdup,
-			    (cups_afree_func_t)free)) == NULL)
-    return;
-
-  if ((added_presets = cupsArrayNew3((cups_array_func_t)strcasecmp,
-				     NULL, NULL, 0,
-				     (cups_acopy_func_t)strdup,
-				     (cups_afree_func_t)free)) == NULL)
-    return;
+    break;
 
-  for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
-       p; p = (remote_printer_t *)cupsArrayNext(remote_printers)) {
-    if (strcmp(cluster_name, p->queue_name))
-      continue;
-    if(p->status == STATUS_DISAPPEARED || p->status == STATUS_UNCONFIRMED ||
-       p->status == STATUS_TO_BE_RELEASED )
-      continue;
-    if ((attr = ippFindAttribute(p->prattrs, "job-presets-supported",
-				 IPP_TAG_BEGIN_COLLECTION)) != NULL) {
-      for (i = 0, count = ippGetCount(attr); i < count; i ++) {
-        preset = ippGetCollection(attr, i);
-        preset_name = ippGetString(ippFindAttribute(preset, "preset-name",
-						    IPP_TAG_ZERO), 0, NULL);
-        if (!cupsArrayFind(list, (void *)preset_name)) {
-          cupsArrayAdd(list, (void *)preset_name);
-          num_preset++;
-        }
+  case CLUSTER_MEDIA_COLS :
+    if ((count = cupsArrayCount(set->values)) > 0) {
+      attr = ippAddCollections(merged_attributes, IPP_TAG_PRINTER, ca->name,
+			       count, NULL);
+      for (i = 0, media = cupsArrayFirst(set->values); media;
+	   i ++, media = cupsArrayNext(set->values)) {
+	col = create_media_col(media->x, media->y,
+			       media->left_margin, media->right_margin,
+			       media->top_margin, media->bottom_margin,
+			       media->media_source, media->media_type);
+	ippSetCollection(merged_attributes, &attr, i, col);
+	ippDelete(col);
       }
     }
-  }
-
-  if (num_preset == 0) {
-    cupsArrayDelete(list);
-    cupsArrayDelete(added_presets);
-    return;
-  }
-
-  preset_attribute = ippAddCollections(*merged_attributes, IPP_TAG_PRINTER,
-				       "job-presets-supported", num_preset,
-				       NULL);
+    break;
 
-  for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
-       p; p = (remote_printer_t *)cupsArrayNext(remote_printers)) {
-    if ((attr = ippFindAttribute(p->prattrs, "job-presets-supported",
-				 IPP_TAG_BEGIN_COLLECTION)) != NULL) {
-      for (i = 0, count = ippGetCount(attr); i < count; i ++) {
-        preset = ippGetCollection(attr, i);
-        preset_name = ippGetString(ippFindAttribute(preset, "preset-name",
-						    IPP_TAG_ZERO), 0, NULL);
-        if (!cupsArrayFind(added_presets, (void *)preset_name)) {
-          cupsArrayAdd(added_presets, (void *)preset_name);
-          ippSetCollection(*merged_attributes, &preset_attribute, i, preset);
-          preset_no++;
-        } else
-          continue;
-      }
+  case CLUSTER_PRESETS :
+    if ((count = cupsArrayCount(set->presets)) > 0) {
+      attr = ippAddCollections(merged_attributes, IPP_TAG_PRINTER, ca->name,
+			       count, NULL);
+      for (i = 0, col = cupsArrayFirst(set->presets); col;
+	   i ++, col = cupsArrayNext(set->presets))
+	ippSetCollection(merged_attributes, &attr, i, col);
     }
+    break;
   }
 
-  cupsArrayDelete(list);
-  cupsArrayDelete(added_presets);
+  cupsArrayDelete(set->values);
+  cupsArrayDelete(set->ranges);
+  cupsArrayDelete(set->presets);
+  free(set->ints);
 }
 
 /* get_pagesize: Function returns the standard/custom page size using
@@ -2867,9 +2757,16 @@ ipp_t* get_cluster_attributes(char* cluster_name)
   ipp_t                *merged_attributes = NULL;
   char                 printer_make_and_model[256];
   ipp_attribute_t      *attr;
-  int                  color_supported = 0, make_model_done = 0, i;
+  const cluster_attr_t *ca;
+  cluster_set_t        sets[NUM_CLUSTER_ATTRS];
+  char                 found[NUM_CLUSTER_ATTRS];
+  const char           *name;
+  int                  make_model_done = 0, i;
   char                 valuebuffer[65536];
   merged_attributes = ippNew();
+  memset(sets, 0, sizeof(sets));
+  /* Walk through the attributes of each printer only once, collecting the
+     values of the attributes we merge in one set per attribute */
   for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
        p; p = (remote_printer_t *)cupsArrayNext(remote_printers)) {
     if (strcmp(cluster_name, p->queue_name))
@@ -2882,27 +2779,30 @@ ipp_t* get_cluster_attributes(char* cluster_name)
       strcat(printer_make_and_model, cluster_name);
       make_model_done = 1;
     }
-    if (((attr = ippFindAttribute(p->prattrs, "color-supported",
-				  IPP_TAG_BOOLEAN)) != NULL &&
-	 ippGetBoolean(attr, 0)))
-      color_supported = 1;
+    /* Like ippFindAttribute() only the first attribute of a name with the
+       right value tag counts */
+    memset(found, 0, sizeof(found));
+    for (attr = ippFirstAttribute(p->prattrs); attr;
+	 attr = ippNextAttribute(p->prattrs)) {
+      if ((name = ippGetName(attr)) == NULL ||
+	  (ca = bsearch(name, cluster_attrs, NUM_CLUSTER_ATTRS,
+			sizeof(cluster_attr_t), compare_cluster_attr)) == NULL)
+	continue;
+      i = ca - cluster_attrs;
+      if (found[i] ||
+	  (ca->find_tag != IPP_TAG_ZERO && ippGetValueTag(attr) != ca->find_tag))
+	continue;
+      found[i] = 1;
+      merge_cluster_attribute(ca, sets + i, attr);
+    }
   }
 
   ippAddString(merged_attributes, IPP_TAG_PRINTER, IPP_TAG_TEXT,
 	       "printer-make-and-model",
                NULL, printer_make_and_model);
-  ippAddBoolean(merged_attributes, IPP_TAG_PRINTER, "color-supported",
-                color_supported);
-
-  add_keyword_attributes(cluster_name, &merged_attributes);
-  add_mimetype_attributes(cluster_name, &merged_attributes);
-  add_tagzero_attributes(cluster_name, &merged_attributes);
-  add_enum_attributes(cluster_name, &merged_attributes);
-  add_resolution_attributes(cluster_name, &merged_attributes);
-  add_margin_attributes(cluster_name, &merged_attributes);
-  add_mediasize_attributes(cluster_name, &merged_attributes);
-  add_mediadatabase_attributes(cluster_name, &merged_attributes);
-  add_jobpresets_attribute(cluster_name, &merged_attributes);
+  for (i = 0; i < NUM_CLUSTER_ATTRS; i ++)
+    add_cluster_attribute(cluster_attrs + i, sets + i, merged_attributes);
+
   attr = ippFirstAttribute(merged_attributes);
   /* Printing merged attributes*/
   debug_printf("Merged attributes for the cluster %s : \n", cluster_name);
@@ -10094,8 +9994,10 @@ static void resolve_callback(AvahiServiceResolver *r,
 
   debug_printf("resolve_callback() in THREAD %ld\n", pthread_self());
 
-  if (r == NULL || name == NULL || type == NULL || domain == NULL)
+  if (r == NULL)
     return;
+  if (name == NULL || type == NULL || domain == NULL)
+    goto ignore;
 
   /* Get the interface name */
   if (!if_indextoname(interface, ifname)) {
@@ -10337,12 +10239,294 @@ static void resolve_callback(AvahiServiceResolver *r,
   }
 
  ignore:
+  dnssd_resolve_done(r);
   avahi_service_resolver_free(r);
 
   if (in_shutdown == 0)
     recheck_timer ();
 }
 
+/*dnssd_event_cmp - Sort DNS-SD events by service name and domain
+  first so that all instances of a service are neighbours*/
+static int
+dnssd_event_cmp(void *va, void *vb, void *data) {
+  dnssd_event_t *a = (dnssd_event_t *)va, *b = (dnssd_event_t *)vb;
+  int result;
+
+  if ((result = strcasecmp(a->name, b->name)) != 0 ||
+      (result = strcasecmp(a->domain, b->domain)) != 0 ||
+      (result = strcasecmp(a->type, b->type)) != 0)
+    return result;
+  if (a->interface != b->interface)
+    return (a->interface < b->interface ? -1 : 1);
+  return (a->protocol < b->protocol ? -1 :
+	  (a->protocol > b->protocol ? 1 : 0));
+}
+
+static void
+dnssd_event_free(dnssd_event_t *e) {
+  free(e->name);
+  free(e->type);
+  free(e->domain);
+  free(e);
+}
+
+/*dnssd_remove_instance - Forget a disappeared instance of a service,
+  remove the printer when it was its last one*/
+static int
+dnssd_remove_instance(dnssd_event_t *e) {
+  remote_printer_t *p;
+  ipp_discovery_t *ippdis;
+  int family;
+
+  /* Check whether we have listed this printer */
+  for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
+       p; p = (remote_printer_t *)cupsArrayNext(remote_printers))
+    if (p->status != STATUS_DISAPPEARED &&
+	p->status != STATUS_TO_BE_RELEASED &&
+	!strcasecmp(p->service_name, e->name) &&
+	!strcasecmp(p->domain, e->domain))
+      break;
+  if (!p)
+    return 0;
+
+  family = (e->protocol == AVAHI_PROTO_INET ? AF_INET :
+	    (e->protocol == AVAHI_PROTO_INET6 ? AF_INET6 : 0));
+  if (p->ipp_discoveries) {
+    for (ippdis = cupsArrayFirst(p->ipp_discoveries); ippdis;
+	 ippdis = cupsArrayNext(p->ipp_discoveries))
+      if (!strcasecmp(ippdis->interface, e->ifname) &&
+	  !strcasecmp(ippdis->type, e->type) &&
+	  ippdis->family == family) {
+	debug_printf("Discovered instance for printer with Service name \"%s\", Domain \"%s\" unregistered: Interface \"%s\", Service type: \"%s\", Protocol: \"%s\"\n",
+		     p->service_name, p->domain,
+		     ippdis->interface, ippdis->type,
+		     (ippdis->family == AF_INET ? "IPv4" :
+		      (ippdis->family == AF_INET6 ? "IPv6" : "Unknown")));
+	cupsArrayRemove(p->ipp_discoveries, (void *)ippdis);
+	ipp_discoveries_list(p->ipp_discoveries);
+	break;
+      }
+    /* Remove the entry if no discovered instances are left */
+    if (cupsArrayCount(p->ipp_discoveries) == 0) {
+      debug_printf("Removing printer with Service name \"%s\", Domain \"%s\", all discovered instances disappeared.\n",
+		   p->service_name, p->domain);
+      remove_printer_entry(p);
+    }
+  }
+
+  return 1;
+}
+
+static gboolean dnssd_process_events(gpointer data);
+
+/*dnssd_schedule - Make sure that the pending DNS-SD events get
+  handled at the given time, or as soon as possible if it is 0*/
+static void
+dnssd_schedule(time_t when) {
+  time_t now = time(NULL);
+
+  if (when && when <= now)
+    when = 0;
+  if (dnssd_events_sourceid) {
+    if (dnssd_events_due <= when)
+      return;
+    g_source_remove(dnssd_events_sourceid);
+  }
+  dnssd_events_due = when;
+  if (when)
+    dnssd_events_sourceid =
+      g_timeout_add_seconds(when - now, dnssd_process_events, NULL);
+  else
+    dnssd_events_sourceid = g_idle_add(dnssd_process_events, NULL);
+}
+
+/*dnssd_process_events - Start resolving newly appeared services and
+  apply the REMOVE events whose delay is over.
+
+  Each burst of browser events gets handled in one go, with at most
+  DNSSDMaxResolves resolvers running and at most one per service name
+  so that a service seen on many interfaces or via both IPv4 and IPv6
+  does not hold up the others. The further instances of a service get
+  resolved when the resolve of the previous one is done.*/
+static gboolean
+dnssd_process_events(gpointer data) {
+  dnssd_event_t *e, *r;
+  time_t now = time(NULL), next = 0;
+  int changed = 0;
+
+  dnssd_events_sourceid = 0;
+
+  if (terminating)
+    return FALSE;
+
+  for (e = (dnssd_event_t *)cupsArrayFirst(dnssd_events);
+       e; e = (dnssd_event_t *)cupsArrayNext(dnssd_events)) {
+    /* REMOVE events which arrive during a resolve are handled when it
+       is done */
+    if (e->resolver)
+      continue;
+
+    if (e->remove) {
+      if (e->timeout > now) {
+	if (next == 0 || e->timeout < next)
+	  next = e->timeout;
+	continue;
+      }
+      changed |= dnssd_remove_instance(e);
+      cupsArrayRemove(dnssd_events, e);
+      dnssd_event_free(e);
+      continue;
+    }
+
+    if (dnssd_max_resolves > 0 &&
+	cupsArrayCount(dnssd_resolving) >= dnssd_max_resolves)
+      continue;
+    for (r = (dnssd_event_t *)cupsArrayFirst(dnssd_resolving);
+	 r; r = (dnssd_event_t *)cupsArrayNext(dnssd_resolving))
+      if (!strcasecmp(r->name, e->name) && !strcasecmp(r->domain, e->domain))
+	break;
+    if (r)
+      continue;
+
+    /* The resolver gets freed in its callback function, or by
+       dnssd_events_clear() if the browsers get shut down before. */
+    if ((e->resolver =
+	 avahi_service_resolver_new(e->client, e->interface, e->protocol,
+				    e->name, e->type, e->domain,
+				    AVAHI_PROTO_UNSPEC, 0, resolve_callback,
+				    e->client)) != NULL)
+      cupsArrayAdd(dnssd_resolving, e);
+    else {
+      debug_printf("Failed to resolve service '%s': %s\n",
+		   e->name, avahi_strerror(avahi_client_errno(e->client)));
+      cupsArrayRemove(dnssd_events, e);
+      dnssd_event_free(e);
+    }
+  }
+
+  if (changed && in_shutdown == 0)
+    recheck_timer();
+
+  if (next)
+    dnssd_schedule(next);
+
+  /* Don't run this callback again */
+  return FALSE;
+}
+
+/*dnssd_resolve_done - Let the next instances get resolved, and apply
+  a REMOVE which came in while resolving*/
+static void
+dnssd_resolve_done(AvahiServiceResolver *r) {
+  dnssd_event_t *e;
+
+  for (e = (dnssd_event_t *)cupsArrayFirst(dnssd_resolving);
+       e; e = (dnssd_event_t *)cupsArrayNext(dnssd_resolving))
+    if (e->resolver == r)
+      break;
+  if (!e)
+    return;
+
+  cupsArrayRemove(dnssd_resolving, e);
+  e->resolver = NULL;
+  if (!e->remove) {
+    cupsArrayRemove(dnssd_events, e);
+    dnssd_event_free(e);
+  }
+  dnssd_schedule(0);
+}
+
+/*dnssd_event_add - Queue a NEW or REMOVE event of the DNS-SD browser.
+
+  Repeated events for the same instance are dropped. A REMOVE gets
+  applied only after DNSSDRemoveDelay seconds; if the instance comes
+  back before, the two events cancel each other out and the CUPS queue
+  stays untouched. The same happens to a NEW which gets removed before
+  its resolve started.*/
+static void
+dnssd_event_add(AvahiClient *c,
+		AvahiIfIndex interface,
+		AvahiProtocol protocol,
+		const char *name,
+		const char *type,
+		const char *domain,
+		const char *ifname,
+		int remove) {
+  dnssd_event_t key, *e;
+
+  if (!dnssd_events) {
+    dnssd_events = cupsArrayNew(dnssd_event_cmp, NULL);
+    dnssd_resolving = cupsArrayNew(NULL, NULL);
+  }
+
+  key.name = (char *)name;
+  key.type = (char *)type;
+  key.domain = (char *)domain;
+  key.interface = interface;
+  key.protocol = protocol;
+  if ((e = (dnssd_event_t *)cupsArrayFind(dnssd_events, &key)) != NULL) {
+    if (e->remove == remove)
+      debug_printf("Avahi Browser: Same event already pending, ignored.\n");
+    else if (e->resolver) {
+      /* Resolve running, a REMOVE waits for it, a NEW cancels the
+	 REMOVE */
+      e->remove = remove;
+      e->timeout = time(NULL) + dnssd_remove_delay;
+    } else {
+      debug_printf("Avahi Browser: Service '%s' of type '%s' in domain '%s' on interface '%s' %s, ignoring both events.\n",
+		   name, type, domain, ifname,
+		   remove ? "disappeared before getting resolved" :
+		   "re-appeared");
+      cupsArrayRemove(dnssd_events, e);
+      dnssd_event_free(e);
+    }
+    return;
+  }
+
+  if ((e = (dnssd_event_t *)calloc(1, sizeof(dnssd_event_t))) == NULL ||
+      (e->name = strdup(name)) == NULL ||
+      (e->type = strdup(type)) == NULL ||
+      (e->domain = strdup(domain)) == NULL) {
+    debug_printf("ERROR: Unable to allocate memory.\n");
+    if (e)
+      dnssd_event_free(e);
+    return;
+  }
+  strncpy(e->ifname, ifname, sizeof(e->ifname) - 1);
+  e->interface = interface;
+  e->protocol = protocol;
+  e->client = c;
+  e->remove = remove;
+  if (remove)
+    e->timeout = time(NULL) + dnssd_remove_delay;
+  cupsArrayAdd(dnssd_events, e);
+
+  dnssd_schedule(remove ? e->timeout : 0);
+}
+
+/*dnssd_events_clear - Drop all pending DNS-SD events and running
+  resolvers*/
+static void
+dnssd_events_clear(void) {
+  dnssd_event_t *e;
+
+  if (dnssd_events_sourceid) {
+    g_source_remove(dnssd_events_sourceid);
+    dnssd_events_sourceid = 0;
+  }
+  for (e = (dnssd_event_t *)cupsArrayFirst(dnssd_events);
+       e; e = (dnssd_event_t *)cupsArrayNext(dnssd_events)) {
+    if (e->resolver)
+      avahi_service_resolver_free(e->resolver);
+    dnssd_event_free(e);
+  }
+  cupsArrayDelete(dnssd_events);
+  cupsArrayDelete(dnssd_resolving);
+  dnssd_events = NULL;
+  dnssd_resolving = NULL;
+}
+
 static void browse_callback(AvahiServiceBrowser *b,
 			    AvahiIfIndex interface,
 			    AvahiProtocol protocol,
@@ -10399,19 +10583,11 @@ static void browse_callback(AvahiServiceBrowser *b,
       break;
     }
 
-    /* We ignore the returned resolver object. In the callback
-       function we free it. If the server is terminated before
-       the callback function is called the server will free
-       the resolver for us. */
-
-    if (!(avahi_service_resolver_new(c, interface, protocol, name, type, domain, AVAHI_PROTO_UNSPEC, 0, resolve_callback, c)))
-      debug_printf("Failed to resolve service '%s': %s\n",
-		   name, avahi_strerror(avahi_client_errno(c)));
+    dnssd_event_add(c, interface, protocol, name, type, domain, ifname, 0);
     break;
 
   /* A service (remote printer) has disappeared */
-  case AVAHI_BROWSER_REMOVE: {
-    remote_printer_t *p;
+  case AVAHI_BROWSER_REMOVE:
 
     if (name == NULL || type == NULL || domain == NULL)
       return;
@@ -10434,47 +10610,8 @@ static void browse_callback(AvahiServiceBrowser *b,
       break;
     }
 
-    /* Check whether we have listed this printer */
-    for (p = (remote_printer_t *)cupsArrayFirst(remote_printers);
-	 p; p = (remote_printer_t *)cupsArrayNext(remote_printers))
-      if (p->status != STATUS_DISAPPEARED &&
-	  p->status != STATUS_TO_BE_RELEASED &&
-	  !strcasecmp(p->service_name, name) &&
-	  !strcasecmp(p->domain, domain))
-	break;
-    if (p) {
-      int family =
-	(protocol == AVAHI_PROTO_INET ? AF_INET :
-	 (protocol == AVAHI_PROTO_INET6 ? AF_INET6 : 0));
-      if (p->ipp_discoveries) {
-	ipp_discovery_t *ippdis;
-	for (ippdis = cupsArrayFirst(p->ipp_discoveries); ippdis;
-	     ippdis = cupsArrayNext(p->ipp_discoveries))
-	  if (!strcasecmp(ippdis->interface, ifname) &&
-	      !strcasecmp(ippdis->type, type) &&
-	      ippdis->family == family) {
-	    debug_printf("Discovered instance for printer with Service name \"%s\", Domain \"%s\" unregistered: Interface \"%s\", Service type: \"%s\", Protocol: \"%s\"\n",
-			 p->service_name, p->domain,
-			 ippdis->interface, ippdis->type,
-			 (ippdis->family == AF_INET ? "IPv4" :
-			  (ippdis->family == AF_INET6 ? "IPv6" : "Unknown")));
-	    cupsArrayRemove(p->ipp_discoveries, (void *)ippdis);
-	    ipp_discoveries_list(p->ipp_discoveries);
-	    break;
-	  }
-	/* Remove the entry if no discovered instances are left */
-	if (cupsArrayCount(p->ipp_discoveries) == 0) {
-	  debug_printf("Removing printer with Service name \"%s\", Domain \"%s\", all discovered instances disappeared.\n",
-		       p->service_name, p->domain);
-	  remove_printer_entry(p);
-	}
-      }
-
-      if (in_shutdown == 0)
-	recheck_timer ();
-    }
+    dnssd_event_add(c, interface, protocol, name, type, domain, ifname, 1);
     break;
-  }
 
   /* All cached Avahi events are treated now */
   case AVAHI_BROWSER_ALL_FOR_NOW:
@@ -10517,6 +10654,7 @@ void avahi_browser_shutdown() {
   }
 
   /* Free the data structures for DNS-SD browsing */
+  dnssd_events_clear();
   if (sb1) {
     avahi_service_browser_free(sb1);
     sb1 = NULL;
@@ -12120,6 +12258,30 @@ read_configuration (const char *filename)
 	debug_printf("Invalid value for pause between calls of update_cups_queues(): %d\n",
 		     t);
     }
+#ifdef HAVE_AVAHI
+    else if (!strcasecmp(line, "DNSSDMaxResolves") && value) {
+      int n = atoi(value);
+      if (n >= 0) {
+	dnssd_max_resolves = n;
+	if (n > 0)
+	  debug_printf("Set maximum of simultaneous DNS-SD service resolves to %d.\n",
+		       n);
+	else
+	  debug_printf("Do not limit the number of simultaneous DNS-SD service resolves.\n");
+      } else
+	debug_printf("Invalid value for maximum number of simultaneous DNS-SD service resolves: %d\n",
+		     n);
+    } else if (!strcasecmp(line, "DNSSDRemoveDelay") && value) {
+      int t = atoi(value);
+      if (t >= 0) {
+	dnssd_remove_delay = t;
+	debug_printf("Set delay for acting on disappeared DNS-SD services to %d sec.\n",
+		     t);
+      } else
+	debug_printf("Invalid value for delay for acting on disappeared DNS-SD services: %d\n",
+		     t);
+    }
+#endif /* HAVE_AVAHI */
 #ifdef HAVE_LDAP
     else if (!strcasecmp(line, "BrowseLDAPBindDN") && value) {
       if (value[0] != '\0')
@@ -12441,8 +12603,10 @@ int main(int argc, char*argv[]) {
 	  DEBUG_LOG_FILE_2,
 	  sizeof(debug_log_file_bckp) - strlen(logdir) - 1);
   
-  if (debug_logfile == 1)
+  if (debug_logfile == 1) {
     start_debug_logging();
+    start_debug_log_thread();
+  }
 
   debug_printf("main() in THREAD %ld\n", pthread_self());
 